@@ -0,0 +1,403 @@
+#include "load_generator.h"
+#include "cortexstream/engine.h"
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+
+namespace cortexstream {
+namespace bench {
+
+namespace {
+
+constexpr int kSyntheticVocab = 32000;
+constexpr size_t kBytesPerToken = 4;
+
+// ---- Minimal JSON-lines reader: one flat object per line ----
+
+struct JsonValue {
+    enum class Kind { None, String, Number, NumberArray } kind = Kind::None;
+    std::string text;
+    double number = 0.0;
+    std::vector<int> numbers;
+};
+
+class LineParser {
+public:
+    explicit LineParser(const std::string& line) : s_(line) {}
+
+    // Calls field(key, value) for every top-level key
+    template <typename Field>
+    bool parseObject(Field&& field) {
+        skipSpace();
+        if (!consume('{')) return false;
+        skipSpace();
+        if (consume('}')) return true;
+        while (true) {
+            std::string key;
+            skipSpace();
+            if (!parseString(key)) return false;
+            skipSpace();
+            if (!consume(':')) return false;
+            JsonValue value;
+            if (!parseValue(value)) return false;
+            field(key, value);
+            skipSpace();
+            if (consume(',')) continue;
+            return consume('}');
+        }
+    }
+
+private:
+    const std::string& s_;
+    size_t pos_ = 0;
+
+    void skipSpace() {
+        while (pos_ < s_.size() && std::isspace(static_cast<unsigned char>(s_[pos_]))) pos_++;
+    }
+
+    bool consume(char c) {
+        if (pos_ < s_.size() && s_[pos_] == c) {
+            pos_++;
+            return true;
+        }
+        return false;
+    }
+
+    bool parseString(std::string& out) {
+        if (!consume('"')) return false;
+        while (pos_ < s_.size()) {
+            char c = s_[pos_++];
+            if (c == '"') return true;
+            if (c != '\\') {
+                out += c;
+                continue;
+            }
+            if (pos_ >= s_.size()) return false;
+            char e = s_[pos_++];
+            switch (e) {
+                case 'n': out += '\n'; break;
+                case 't': out += '\t'; break;
+                case 'r': out += '\r'; break;
+                case 'b': out += '\b'; break;
+                case 'f': out += '\f'; break;
+                case 'u':
+                    // Length is all that matters here; keep a placeholder byte
+                    if (pos_ + 4 > s_.size()) return false;
+                    pos_ += 4;
+                    out += '?';
+                    break;
+                default: out += e; break;
+            }
+        }
+        return false;
+    }
+
+    bool parseNumber(double& out) {
+        size_t end = pos_;
+        while (end < s_.size() && (std::isdigit(static_cast<unsigned char>(s_[end])) ||
+                                   s_[end] == '-' || s_[end] == '+' || s_[end] == '.' ||
+                                   s_[end] == 'e' || s_[end] == 'E')) {
+            end++;
+        }
+        if (end == pos_) return false;
+        out = std::strtod(s_.substr(pos_, end - pos_).c_str(), nullptr);
+        pos_ = end;
+        return true;
+    }
+
+    // Nested objects/arrays, booleans and null are skipped
+    bool skipValue() {
+        skipSpace();
+        if (pos_ >= s_.size()) return false;
+        char c = s_[pos_];
+        if (c == '"') {
+            std::string ignored;
+            return parseString(ignored);
+        }
+        if (c == '{' || c == '[') {
+            char close = c == '{' ? '}' : ']';
+            pos_++;
+            skipSpace();
+            if (consume(close)) return true;
+            while (true) {
+                if (c == '{') {
+                    std::string key;
+                    skipSpace();
+                    if (!parseString(key)) return false;
+                    skipSpace();
+                    if (!consume(':')) return false;
+                }
+                if (!skipValue()) return false;
+                skipSpace();
+                if (consume(',')) continue;
+                return consume(close);
+            }
+        }
+        for (const char* word : {"true", "false", "null"}) {
+            if (s_.compare(pos_, std::char_traits<char>::length(word), word) == 0) {
+                pos_ += std::char_traits<char>::length(word);
+                return true;
+            }
+        }
+        double ignored;
+        return parseNumber(ignored);
+    }
+
+    bool parseValue(JsonValue& value) {
+        skipSpace();
+        if (pos_ >= s_.size()) return false;
+        char c = s_[pos_];
+        if (c == '"') {
+            value.kind = JsonValue::Kind::String;
+            return parseString(value.text);
+        }
+        if (c == '-' || std::isdigit(static_cast<unsigned char>(c))) {
+            value.kind = JsonValue::Kind::Number;
+            return parseNumber(value.number);
+        }
+        if (c == '[') {
+            // Arrays of numbers are kept (token ids); anything else is skipped
+            size_t start = pos_;
+            pos_++;
+            skipSpace();
+            value.kind = JsonValue::Kind::NumberArray;
+            if (consume(']')) return true;
+            while (true) {
+                skipSpace();
+                double number;
+                if (!parseNumber(number)) {
+                    pos_ = start;
+                    value = JsonValue();
+                    return skipValue();
+                }
+                value.numbers.push_back(static_cast<int>(number));
+                skipSpace();
+                if (consume(',')) continue;
+                return consume(']');
+            }
+        }
+        return skipValue();
+    }
+};
+
+// Deterministic ids for prompt text: equal prefixes give equal tokens, so
+// replayed traces exercise the prefix cache the way real prompts would
+std::vector<int> tokensForText(const std::string& text) {
+    std::vector<int> tokens;
+    tokens.reserve(text.size() / kBytesPerToken + 1);
+    for (size_t i = 0; i < text.size(); i += kBytesPerToken) {
+        uint32_t hash = 2166136261u;
+        for (size_t j = i; j < std::min(text.size(), i + kBytesPerToken); ++j) {
+            hash = (hash ^ static_cast<unsigned char>(text[j])) * 16777619u;
+        }
+        tokens.push_back(3 + static_cast<int>(hash % (kSyntheticVocab - 3)));
+    }
+    if (tokens.empty()) {
+        tokens.push_back(3);
+    }
+    return tokens;
+}
+
+double toMs(uint64_t ns) {
+    return static_cast<double>(ns) / 1e6;
+}
+
+}  // namespace
+
+bool loadTrace(const std::string& path, int defaultMaxTokens, std::vector<TraceEntry>& entries) {
+    std::ifstream in(path);
+    if (!in) {
+        std::cerr << "[LoadGenerator] Cannot open trace: " << path << std::endl;
+        return false;
+    }
+    std::string line;
+    size_t lineNumber = 0;
+    while (std::getline(in, line)) {
+        lineNumber++;
+        if (line.find_first_not_of(" \t\r") == std::string::npos) {
+            continue;
+        }
+        TraceEntry entry;
+        entry.maxTokens = defaultMaxTokens;
+        LineParser parser(line);
+        bool ok = parser.parseObject([&entry](const std::string& key, const JsonValue& value) {
+            using Kind = JsonValue::Kind;
+            if ((key == "request_id" || key == "id") && value.kind == Kind::String) {
+                entry.id = value.text;
+            } else if (key == "prompt_tokens" && value.kind == Kind::Number) {
+                entry.promptTokens.assign(std::max(1, static_cast<int>(value.number)), 0);
+            } else if (key == "prompt_tokens" && value.kind == Kind::NumberArray) {
+                entry.promptTokens = value.numbers;
+            } else if ((key == "prompt" || key == "text" || key == "body") &&
+                       value.kind == Kind::String && entry.promptTokens.empty()) {
+                entry.promptTokens = tokensForText(value.text);
+            } else if ((key == "max_tokens" || key == "output_tokens") && value.kind == Kind::Number) {
+                entry.maxTokens = std::max(1, static_cast<int>(value.number));
+            }
+        });
+        if (!ok) {
+            std::cerr << "[LoadGenerator] Malformed JSON at " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+        if (entry.promptTokens.empty()) {
+            std::cerr << "[LoadGenerator] No prompt at " << path << ":" << lineNumber << std::endl;
+            return false;
+        }
+        // Length-only prompts get distinct ids so they do not all share a prefix
+        if (std::all_of(entry.promptTokens.begin(), entry.promptTokens.end(), [](int t) { return t == 0; })) {
+            std::mt19937 rng(static_cast<uint32_t>(lineNumber));
+            std::uniform_int_distribution<int> token(3, kSyntheticVocab - 1);
+            for (int& t : entry.promptTokens) t = token(rng);
+        }
+        if (entry.id.empty()) {
+            entry.id = "trace-" + std::to_string(lineNumber);
+        }
+        entries.push_back(std::move(entry));
+    }
+    return true;
+}
+
+std::vector<TraceEntry> syntheticTrace(int count, int promptLen, int maxTokens, uint64_t seed) {
+    std::mt19937_64 rng(seed);
+    std::uniform_int_distribution<int> token(3, kSyntheticVocab - 1);
+    std::vector<TraceEntry> entries(std::max(count, 0));
+    for (size_t i = 0; i < entries.size(); ++i) {
+        entries[i].id = "synthetic-" + std::to_string(i);
+        entries[i].promptTokens.resize(std::max(promptLen, 1));
+        for (int& t : entries[i].promptTokens) t = token(rng);
+        entries[i].maxTokens = std::max(maxTokens, 1);
+    }
+    return entries;
+}
+
+bool runLoad(const LoadOptions& options, const std::vector<TraceEntry>& entries, LoadReport& report) {
+    auto backend = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+    if (!backend->loadModel(options.modelPath)) {
+        return false;
+    }
+    auto scheduler = std::make_shared<Scheduler>(options.maxBatchSize, options.tokensPerStep);
+    scheduler->setPrefillChunkSize(options.prefillChunk);
+    auto cache = std::make_shared<KVCache>(1, 1, 4, options.kvTokens, 16);
+    InferenceEngine engine(backend, scheduler, cache);
+    if (!engine.initialize()) {
+        return false;
+    }
+    engine.setPipelining(options.pipelined);
+    engine.run();
+
+    // Poisson process: exponential gaps with mean 1 / qps
+    std::mt19937_64 rng(options.seed);
+    std::exponential_distribution<double> gap(options.qps > 0 ? options.qps : 1.0);
+    LatencyHistogram endToEnd;
+
+    auto begin = std::chrono::steady_clock::now();
+    auto due = begin;
+    std::vector<std::shared_ptr<Request>> requests;
+    requests.reserve(entries.size());
+    for (const auto& entry : entries) {
+        if (options.qps > 0) {
+            due += std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                std::chrono::duration<double>(gap(rng)));
+            std::this_thread::sleep_until(due);
+        }
+        // Constructed at submission: arrival-based TTFT starts here
+        auto req = std::make_shared<Request>(entry.id, entry.promptTokens, entry.maxTokens);
+        const uint64_t arrival = req->getArrivalTimestampNs();
+        req->setTokenCallback([&endToEnd, arrival](int, bool finished) {
+            if (finished) {
+                uint64_t now = metricsClockNs();
+                endToEnd.record(now > arrival ? now - arrival : 0);
+            }
+        });
+        scheduler->submitRequest(req);
+        requests.push_back(std::move(req));
+    }
+    const double submitSeconds = std::chrono::duration<double>(
+        std::chrono::steady_clock::now() - begin).count();
+
+    bool idle = engine.waitUntilIdle(std::chrono::minutes(30));
+    report.wallSeconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    engine.shutdown();
+    if (!idle) {
+        std::cerr << "[LoadGenerator] Timed out waiting for the workload" << std::endl;
+    }
+
+    EngineMetrics metrics = engine.getMetrics();
+    report.requestsSubmitted = requests.size();
+    report.requestsCompleted = metrics.stats.requestsCompleted;
+    report.requestsFailed = metrics.stats.requestsFailed;
+    report.tokensGenerated = metrics.stats.tokensProcessed;
+    report.offeredQps = submitSeconds > 0 ? requests.size() / submitSeconds : 0.0;
+    report.timeToFirstToken = metrics.timeToFirstToken;
+    report.interTokenLatency = metrics.interTokenLatency;
+    report.queueWait = metrics.queueWait;
+    report.endToEnd = endToEnd.snapshot();
+    return idle;
+}
+
+void printReport(const LoadReport& report) {
+    std::printf("\nRequests: %zu submitted, %zu completed, %zu failed (offered %.2f req/s)\n",
+                report.requestsSubmitted, report.requestsCompleted, report.requestsFailed,
+                report.offeredQps);
+    std::printf("Wall time: %.3f s\n", report.wallSeconds);
+    std::printf("Throughput: %.1f tok/s, %.2f req/s\n\n",
+                report.tokensPerSecond(), report.requestsPerSecond());
+
+    std::printf("%-22s %10s %10s %10s %10s %10s\n", "latency (ms)", "count", "mean", "p50", "p99", "max");
+    auto row = [](const char* name, const HistogramSnapshot& h) {
+        std::printf("%-22s %10llu %10.3f %10.3f %10.3f %10.3f\n", name,
+                    static_cast<unsigned long long>(h.count), h.mean() / 1e6,
+                    toMs(h.quantile(0.50)), toMs(h.quantile(0.99)), toMs(h.max));
+    };
+    row("time to first token", report.timeToFirstToken);
+    row("inter-token latency", report.interTokenLatency);
+    row("queue wait", report.queueWait);
+    row("end to end", report.endToEnd);
+}
+
+bool writeReportJson(const LoadReport& report, const std::string& path) {
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "[LoadGenerator] Cannot write " << path << std::endl;
+        return false;
+    }
+    auto latency = [&out](const char* name, const HistogramSnapshot& h, bool last) {
+        char line[256];
+        std::snprintf(line, sizeof(line),
+                      "  \"%s\": {\"count\": %llu, \"mean_ms\": %.4f, \"p50_ms\": %.4f, "
+                      "\"p99_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+                      name, static_cast<unsigned long long>(h.count), h.mean() / 1e6,
+                      toMs(h.quantile(0.50)), toMs(h.quantile(0.99)), toMs(h.max), last ? "" : ",");
+        out << line;
+    };
+    out << "{\n"
+        << "  \"requests_submitted\": " << report.requestsSubmitted << ",\n"
+        << "  \"requests_completed\": " << report.requestsCompleted << ",\n"
+        << "  \"requests_failed\": " << report.requestsFailed << ",\n"
+        << "  \"tokens_generated\": " << report.tokensGenerated << ",\n"
+        << "  \"wall_seconds\": " << report.wallSeconds << ",\n"
+        << "  \"offered_qps\": " << report.offeredQps << ",\n"
+        << "  \"tokens_per_second\": " << report.tokensPerSecond() << ",\n"
+        << "  \"requests_per_second\": " << report.requestsPerSecond() << ",\n";
+    latency("ttft", report.timeToFirstToken, false);
+    latency("itl", report.interTokenLatency, false);
+    latency("queue_wait", report.queueWait, false);
+    latency("end_to_end", report.endToEnd, true);
+    out << "}\n";
+    out.flush();
+    if (!out) {
+        std::cerr << "[LoadGenerator] Failed writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace bench
+}  // namespace cortexstream
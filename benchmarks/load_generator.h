@@ -0,0 +1,84 @@
+#ifndef CORTEXSTREAM_BENCH_LOAD_GENERATOR_H
+#define CORTEXSTREAM_BENCH_LOAD_GENERATOR_H
+
+#include "cortexstream/metrics.h"
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// End-to-End Load Generator
+// ============================================================================
+//
+// Replays a JSON-lines trace against a live InferenceEngine with Poisson
+// arrivals at a target rate and reports throughput plus TTFT / ITL
+// percentiles taken from the engine's own latency histograms.
+//
+// Trace lines are flat JSON objects; recognized keys:
+//   "request_id" / "id"                  Request name
+//   "prompt_tokens"                      Prompt length, or an array of ids
+//   "prompt" / "text" / "body"           Prompt text (~4 bytes per token)
+//   "max_tokens" / "output_tokens"       Generation budget
+// Unknown keys are ignored, so request logs can be replayed as they are.
+//
+// ============================================================================
+
+namespace cortexstream {
+namespace bench {
+
+struct TraceEntry {
+    std::string id;
+    std::vector<int> promptTokens;
+    int maxTokens = 0;
+};
+
+struct LoadOptions {
+    std::string tracePath;              // Empty: synthetic requests
+    std::string modelPath = "bench-model";  // Missing path: stub backend
+    double qps = 8.0;                   // Mean arrival rate; <= 0 submits all at once
+    int requests = 128;                 // Synthetic count, or cap on trace lines (0 = all)
+    int promptLen = 256;                // Synthetic prompt length
+    int maxTokens = 64;                 // Default when a trace line has none
+    int maxBatchSize = 32;
+    int tokensPerStep = 2048;
+    int prefillChunk = 256;
+    size_t kvTokens = size_t(1) << 16;
+    uint64_t seed = 42;
+    bool pipelined = false;
+    std::string jsonPath;               // Also write the report as JSON
+};
+
+struct LoadReport {
+    size_t requestsSubmitted = 0;
+    size_t requestsCompleted = 0;
+    size_t requestsFailed = 0;
+    size_t tokensGenerated = 0;
+    double wallSeconds = 0.0;
+    double offeredQps = 0.0;            // Achieved submission rate
+
+    // Nanoseconds
+    HistogramSnapshot timeToFirstToken;
+    HistogramSnapshot interTokenLatency;
+    HistogramSnapshot queueWait;
+    HistogramSnapshot endToEnd;
+
+    double tokensPerSecond() const { return wallSeconds > 0 ? tokensGenerated / wallSeconds : 0.0; }
+    double requestsPerSecond() const { return wallSeconds > 0 ? requestsCompleted / wallSeconds : 0.0; }
+};
+
+// Parse a JSON-lines trace; false (logged) on I/O or syntax errors
+bool loadTrace(const std::string& path, int defaultMaxTokens, std::vector<TraceEntry>& entries);
+
+// Prompts of `promptLen` random tokens
+std::vector<TraceEntry> syntheticTrace(int count, int promptLen, int maxTokens, uint64_t seed);
+
+// Run the workload to completion; false if the engine failed to start or drain
+bool runLoad(const LoadOptions& options, const std::vector<TraceEntry>& entries, LoadReport& report);
+
+void printReport(const LoadReport& report);
+bool writeReportJson(const LoadReport& report, const std::string& path);
+
+}  // namespace bench
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_BENCH_LOAD_GENERATOR_H
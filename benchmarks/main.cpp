@@ -0,0 +1,118 @@
+// cortexstream_bench: Google Benchmark microbenchmarks, or `load` for the
+// end-to-end load generator
+#include "load_generator.h"
+#include <benchmark/benchmark.h>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+
+using namespace cortexstream;
+using namespace cortexstream::bench;
+
+namespace {
+
+void printLoadUsage(const char* program) {
+    std::cerr << "Usage: " << program << " load [options]\n"
+              << "\n"
+              << "  --trace PATH          JSON-lines trace to replay (default: synthetic)\n"
+              << "  --qps X               Mean Poisson arrival rate, 0 = all at once (default: 8)\n"
+              << "  --requests N          Synthetic requests, or cap on trace lines (default: 128)\n"
+              << "  --prompt-len N        Synthetic prompt length (default: 256)\n"
+              << "  --max-tokens N        Tokens per request when the trace has none (default: 64)\n"
+              << "  --model PATH          Model to load (default: stub backend)\n"
+              << "  --batch N             Max decode batch (default: 32)\n"
+              << "  --step-tokens N       Token budget per step (default: 2048)\n"
+              << "  --chunk N             Prefill chunk size, 0 = off (default: 256)\n"
+              << "  --kv-tokens N         KV cache capacity in tokens (default: 65536)\n"
+              << "  --seed N              Arrival and synthetic prompt seed (default: 42)\n"
+              << "  --pipelined           Overlap host work with the next decode\n"
+              << "  --json PATH           Also write the report as JSON\n"
+              << "\n"
+              << "Without `load`, runs the microbenchmarks; see --help for Google Benchmark flags.\n";
+}
+
+bool parseLoadArgs(int argc, char** argv, LoadOptions& options) {
+    for (int i = 2; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--trace" && hasValue) {
+            options.tracePath = argv[++i];
+        } else if (arg == "--qps" && hasValue) {
+            options.qps = std::atof(argv[++i]);
+        } else if (arg == "--requests" && hasValue) {
+            options.requests = std::atoi(argv[++i]);
+        } else if (arg == "--prompt-len" && hasValue) {
+            options.promptLen = std::atoi(argv[++i]);
+        } else if (arg == "--max-tokens" && hasValue) {
+            options.maxTokens = std::atoi(argv[++i]);
+        } else if (arg == "--model" && hasValue) {
+            options.modelPath = argv[++i];
+        } else if (arg == "--batch" && hasValue) {
+            options.maxBatchSize = std::atoi(argv[++i]);
+        } else if (arg == "--step-tokens" && hasValue) {
+            options.tokensPerStep = std::atoi(argv[++i]);
+        } else if (arg == "--chunk" && hasValue) {
+            options.prefillChunk = std::atoi(argv[++i]);
+        } else if (arg == "--kv-tokens" && hasValue) {
+            options.kvTokens = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--seed" && hasValue) {
+            options.seed = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--pipelined") {
+            options.pipelined = true;
+        } else if (arg == "--json" && hasValue) {
+            options.jsonPath = argv[++i];
+        } else {
+            return false;
+        }
+    }
+    return options.requests >= 0 && options.promptLen > 0 && options.maxTokens > 0 &&
+           options.maxBatchSize > 0;
+}
+
+int runLoadCommand(int argc, char** argv) {
+    LoadOptions options;
+    if (!parseLoadArgs(argc, argv, options)) {
+        printLoadUsage(argv[0]);
+        return 1;
+    }
+
+    std::vector<TraceEntry> entries;
+    if (options.tracePath.empty()) {
+        entries = syntheticTrace(options.requests, options.promptLen, options.maxTokens, options.seed);
+    } else {
+        if (!loadTrace(options.tracePath, options.maxTokens, entries)) {
+            return 1;
+        }
+        if (options.requests > 0 && entries.size() > static_cast<size_t>(options.requests)) {
+            entries.resize(options.requests);
+        }
+    }
+    if (entries.empty()) {
+        std::cerr << "No requests to replay" << std::endl;
+        return 1;
+    }
+
+    LoadReport report;
+    bool ok = runLoad(options, entries, report);
+    printReport(report);
+    if (!options.jsonPath.empty() && !writeReportJson(report, options.jsonPath)) {
+        return 1;
+    }
+    return ok && report.requestsFailed == 0 ? 0 : 1;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    if (argc > 1 && std::strcmp(argv[1], "load") == 0) {
+        return runLoadCommand(argc, argv);
+    }
+    benchmark::Initialize(&argc, argv);
+    if (benchmark::ReportUnrecognizedArguments(argc, argv)) {
+        return 1;
+    }
+    benchmark::RunSpecifiedBenchmarks();
+    benchmark::Shutdown();
+    return 0;
+}
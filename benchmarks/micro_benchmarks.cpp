@@ -0,0 +1,174 @@
+// Microbenchmarks for the engine's per-step hot paths
+#include "cortexstream/kv_cache.h"
+#include "cortexstream/sampler.h"
+#include "cortexstream/scheduler.h"
+#include <benchmark/benchmark.h>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+// ============================================================================
+// KVBlockAllocator: alloc/free churn against a half-full pool
+// ============================================================================
+
+constexpr size_t kPoolBlocks = 8192;
+
+// Contiguous buddy allocations of range(0) blocks; one live handle is
+// replaced per iteration, so splits and merges both stay on the path
+void BM_KVBlockAllocatorChurn(benchmark::State& state) {
+    const int blocks = static_cast<int>(state.range(0));
+    KVBlockAllocator allocator(kPoolBlocks);
+    std::mt19937 rng(7);
+    std::vector<KVHandle> live;
+    while (allocator.freeBlocks() > kPoolBlocks / 2) {
+        live.push_back(allocator.allocate(blocks));
+    }
+    std::uniform_int_distribution<size_t> pick(0, live.size() - 1);
+    for (auto _ : state) {
+        KVHandle& slot = live[pick(rng)];
+        allocator.free(slot);
+        slot = allocator.allocate(blocks);
+        benchmark::DoNotOptimize(slot);
+    }
+    state.SetItemsProcessed(state.iterations());
+    state.counters["fragmentation"] = allocator.fragmentation();
+}
+BENCHMARK(BM_KVBlockAllocatorChurn)->Arg(1)->Arg(4)->Arg(16)->Arg(64);
+
+// Paged fast path: single blocks through the lock-free magazine
+void BM_KVBlockAllocatorPages(benchmark::State& state) {
+    const int count = static_cast<int>(state.range(0));
+    KVBlockAllocator allocator(kPoolBlocks);
+    std::vector<int> held;
+    allocator.allocatePages(static_cast<int>(kPoolBlocks / 2), held);
+    std::vector<int> pages;
+    pages.reserve(count);
+    for (auto _ : state) {
+        pages.clear();
+        allocator.allocatePages(count, pages);
+        allocator.freePages(pages);
+    }
+    state.SetItemsProcessed(state.iterations() * count);
+}
+BENCHMARK(BM_KVBlockAllocatorPages)->Arg(1)->Arg(16)->Arg(128);
+
+// ============================================================================
+// Sampler: top-k / top-p over realistic vocabularies
+// ============================================================================
+
+Tensor randomLogits(int rows, int vocab) {
+    Tensor logits;
+    logits.shape = {rows, vocab};
+    logits.data.resize(static_cast<size_t>(rows) * vocab);
+    std::mt19937 rng(11);
+    std::normal_distribution<float> dist(0.0f, 2.0f);
+    for (float& v : logits.data) v = dist(rng);
+    return logits;
+}
+
+void runSampler(benchmark::State& state, const SamplingParams& params) {
+    const int vocab = static_cast<int>(state.range(0));
+    const int rows = static_cast<int>(state.range(1));
+    Tensor logits = randomLogits(rows, vocab);
+    Sampler sampler;
+    sampler.setParams(params);
+    sampler.setSeed(1);
+    for (auto _ : state) {
+        benchmark::DoNotOptimize(sampler.sampleBatch(logits));
+    }
+    state.SetItemsProcessed(state.iterations() * rows);
+    state.SetBytesProcessed(state.iterations() * rows * vocab * static_cast<int64_t>(sizeof(float)));
+}
+
+void BM_SamplerGreedy(benchmark::State& state) {
+    runSampler(state, SamplingParams());
+}
+
+void BM_SamplerTopK(benchmark::State& state) {
+    SamplingParams params;
+    params.doSample = true;
+    params.temperature = 0.8f;
+    params.topK = 50;
+    runSampler(state, params);
+}
+
+void BM_SamplerTopP(benchmark::State& state) {
+    SamplingParams params;
+    params.doSample = true;
+    params.temperature = 0.8f;
+    params.topK = 0;
+    params.topP = 0.9f;
+    runSampler(state, params);
+}
+
+void samplerArgs(benchmark::internal::Benchmark* b) {
+    b->ArgNames({"vocab", "rows"});
+    for (int vocab : {32768, 131072}) {
+        for (int rows : {1, 32}) {
+            b->Args({vocab, rows});
+        }
+    }
+}
+BENCHMARK(BM_SamplerGreedy)->Apply(samplerArgs);
+BENCHMARK(BM_SamplerTopK)->Apply(samplerArgs);
+BENCHMARK(BM_SamplerTopP)->Apply(samplerArgs);
+
+// ============================================================================
+// Scheduler: batch builders over range(0) active sequences
+// ============================================================================
+
+std::shared_ptr<Scheduler> activeScheduler(int active, bool decoding) {
+    auto scheduler = std::make_shared<Scheduler>(active, 1 << 20);
+    for (int i = 0; i < active; ++i) {
+        auto req = std::make_shared<Request>("bench-" + std::to_string(i),
+                                             std::vector<int>(64 + i % 256, 5), 1 << 20);
+        scheduler->submitRequest(req);
+    }
+    scheduler->acceptNewRequests();
+    if (decoding) {
+        for (int i = 0; i < active; ++i) {
+            if (auto req = scheduler->getRequest("bench-" + std::to_string(i))) {
+                scheduler->markRequestReady(req->getSeqId());
+            }
+        }
+    }
+    return scheduler;
+}
+
+void BM_SchedulerBuildDecodeBatch(benchmark::State& state) {
+    auto scheduler = activeScheduler(static_cast<int>(state.range(0)), true);
+    for (auto _ : state) {
+        Batch batch = scheduler->buildDecodeBatch();
+        benchmark::DoNotOptimize(batch.requests.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SchedulerBuildDecodeBatch)->RangeMultiplier(4)->Range(8, 512);
+
+void BM_SchedulerBuildPrefillBatch(benchmark::State& state) {
+    auto scheduler = activeScheduler(static_cast<int>(state.range(0)), false);
+    for (auto _ : state) {
+        Batch batch = scheduler->buildPrefillBatch();
+        benchmark::DoNotOptimize(batch.requests.data());
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SchedulerBuildPrefillBatch)->RangeMultiplier(4)->Range(8, 512);
+
+// Continuous-batching step: decode rows plus token-budgeted prefill
+void BM_SchedulerScheduleStep(benchmark::State& state) {
+    auto scheduler = activeScheduler(static_cast<int>(state.range(0)), true);
+    for (auto _ : state) {
+        ScheduledStep step = scheduler->scheduleStep(size_t(1) << 30);
+        benchmark::DoNotOptimize(step.numTokens);
+    }
+    state.SetItemsProcessed(state.iterations() * state.range(0));
+}
+BENCHMARK(BM_SchedulerScheduleStep)->RangeMultiplier(4)->Range(8, 512);
+
+}  // namespace
@@ -1,7 +0,0 @@
-// Benchmark example
-#include <iostream>
-
-int main() {
-    std::cout << "CortexStream Benchmark" << std::endl;
-    return 0;
-}
@@ -219,8 +219,9 @@ int main(int argc, char* argv[]) {
     std::cout << "GPU acceleration: Metal (MPS) on Apple Silicon" << std::endl;
     std::cout << "Batch processing: Up to 32 sequences in parallel" << std::endl;
     
-    // Run inference (this would normally be asynchronous)
+    // Run inference on the engine thread and wait for all requests
     engine->run();
+    engine->waitUntilIdle();
     
     // 5. Collect results
     std::cout << "\n[Results] Generated completions:" << std::endl;
@@ -81,10 +81,8 @@ int main() {
     // 3. Run inference engine
     std::cout << "\n[Inference] Starting inference engine..." << std::endl;
     
-    // Run engine in a separate thread (for demo purposes)
-    std::thread engineThread([&engine]() {
-        engine->run();
-    });
+    // Spawns the engine thread and returns immediately
+    engine->run();
     
     // Monitor progress
     std::cout << "\n[Monitor] Waiting for completions..." << std::endl;
@@ -126,6 +124,9 @@ int main() {
             case RequestState::Decoding:
                 std::cout << "DECODING";
                 break;
+            case RequestState::Swapped:
+                std::cout << "SWAPPED";
+                break;
             case RequestState::Prefilling:
                 std::cout << "PREFILLING";
                 break;
@@ -145,7 +146,6 @@ int main() {
     
     // Cleanup
     engine->shutdown();
-    engineThread.join();
     
     std::cout << "\n=== Example Complete ===" << std::endl;
     return 0;
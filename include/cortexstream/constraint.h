@@ -0,0 +1,189 @@
+#ifndef CORTEXSTREAM_CONSTRAINT_H
+#define CORTEXSTREAM_CONSTRAINT_H
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// ============================================================================
+// Constrained Decoding - Token-Level Automata
+// ============================================================================
+//
+// A constraint (regex or JSON schema) is compiled once into a byte-level DFA
+// and paired with the tokenizer vocabulary. For every DFA state the set of
+// tokens whose bytes keep the output on a path to acceptance is a packed
+// bitmask (bit t = token t allowed), which the Sampler applies before
+// temperature, top-k and top-p.
+//
+// - Masks are built lazily, one DFA state at a time, by walking a trie of
+//   the vocabulary: shared token prefixes are matched once
+// - After the first visit a state's mask is a pointer lookup, so per-step
+//   masking costs a few microseconds
+// - Compiled automata are cached by spec hash (ConstraintCache), so every
+//   request using the same schema shares one automaton and its masks;
+//   the cache is LRU-bounded so per-request schemas cannot grow it forever
+//
+// Language support: regexes are matched against the whole output (implicit
+// anchors) with literals, escapes (\d \w \s \xHH ...), `.`, classes,
+// groups, alternation and the * + ? {m,n} quantifiers. JSON schemas are
+// lowered to such a regex; recursive schemas are not regular and are
+// rejected.
+//
+// ============================================================================
+
+namespace cortexstream {
+
+class Tokenizer;
+
+/**
+ * The decoded text of every token, plus a byte trie over it. Built once per
+ * tokenizer and shared by every automaton compiled against it.
+ */
+class TokenVocabulary {
+public:
+    TokenVocabulary(std::vector<std::string> tokens, int32_t eosTokenId);
+
+    // Decodes each id on its own; tokenizers that drop a leading space when
+    // decoding a single token yield a slightly stricter vocabulary
+    static std::shared_ptr<const TokenVocabulary> fromTokenizer(Tokenizer& tokenizer);
+
+    size_t size() const;
+    const std::string& token(int32_t id) const;
+    int32_t getEosTokenId() const;
+
+private:
+    friend class TokenAutomaton;
+
+    struct TrieNode {
+        std::vector<std::pair<uint8_t, int32_t>> children;   // Sorted by byte
+        std::vector<int32_t> tokens;                         // Ending here
+    };
+
+    std::vector<std::string> tokens_;
+    int32_t eosTokenId_;
+    std::vector<TrieNode> trie_;                              // Root at 0
+};
+
+class TokenAutomaton {
+public:
+    static constexpr int kDeadState = -1;    // Output can no longer match
+    static constexpr int kDoneState = -2;    // EOS taken in an accepting state
+
+    // nullptr (and `error`, if given) on a malformed or unsupported spec
+    static std::shared_ptr<const TokenAutomaton> fromRegex(
+        const std::string& pattern,
+        std::shared_ptr<const TokenVocabulary> vocabulary,
+        std::string* error = nullptr);
+    static std::shared_ptr<const TokenAutomaton> fromJsonSchema(
+        const std::string& schema,
+        std::shared_ptr<const TokenVocabulary> vocabulary,
+        std::string* error = nullptr);
+
+    int startState() const { return 0; }
+    size_t numStates() const { return transitions_.size(); }
+    size_t vocabSize() const;
+
+    /**
+     * Packed mask of the tokens allowed in `state`: (vocabSize() + 63) / 64
+     * words, bit t of word t / 64 for token t. EOS is allowed exactly in
+     * accepting states. Thread-safe; computed on first use, then cached.
+     */
+    const uint64_t* allowedTokens(int state) const;
+
+    // State after emitting `token`; kDeadState if the token is not allowed
+    int advance(int state, int32_t token) const;
+
+    bool isAccepting(int state) const;
+    // EOS taken, or accepting with no way to extend the output
+    bool isComplete(int state) const;
+
+private:
+    TokenAutomaton() = default;
+
+    std::shared_ptr<const TokenVocabulary> vocabulary_;
+    std::vector<std::array<int32_t, 256>> transitions_;    // Byte DFA
+    std::vector<uint8_t> accepting_;
+    std::vector<uint8_t> live_;                             // Can still accept
+    size_t maskWords_ = 0;
+
+    // Lazily built masks; a published pointer is never written again
+    mutable std::mutex maskMutex_;
+    mutable std::vector<std::unique_ptr<uint64_t[]>> maskStorage_;
+    mutable std::unique_ptr<std::atomic<const uint64_t*>[]> masks_;
+    std::unique_ptr<uint64_t[]> emptyMask_;                 // Dead and done
+
+    static std::shared_ptr<const TokenAutomaton> build(
+        const std::string& pattern,
+        std::shared_ptr<const TokenVocabulary> vocabulary,
+        std::string* error);
+    const uint64_t* buildMask(int state) const;
+};
+
+enum class ConstraintKind {
+    Regex,
+    JsonSchema
+};
+
+struct ConstraintSpec {
+    ConstraintKind kind = ConstraintKind::Regex;
+    std::string source;
+};
+
+/**
+ * Process-wide cache of compiled automata, keyed by spec hash and
+ * vocabulary. Holds at most getCapacity() automata and drops the least
+ * recently compiled-or-hit one beyond that; requests keep the automaton
+ * they were given alive regardless. Thread-safe.
+ */
+class ConstraintCache {
+public:
+    static constexpr size_t kDefaultCapacity = 256;
+
+    static ConstraintCache& global();
+
+    // nullptr (logged) if the spec does not compile
+    std::shared_ptr<const TokenAutomaton> compile(
+        const ConstraintSpec& spec,
+        const std::shared_ptr<const TokenVocabulary>& vocabulary);
+
+    // Entries beyond `maxEntries` (at least 1) are evicted LRU
+    void setCapacity(size_t maxEntries);
+    size_t getCapacity() const;
+
+    // Drop every automaton compiled against `vocabulary`; returns the count
+    size_t evictVocabulary(const TokenVocabulary* vocabulary);
+    // Drop the automata of vocabularies held by nothing but this cache
+    // (no tokenizer holds them and no request uses their automata)
+    size_t evictUnusedVocabularies();
+
+    size_t size() const;
+    void clear();
+
+private:
+    struct Entry {
+        size_t key;
+        ConstraintSpec spec;
+        const TokenVocabulary* vocabulary;
+        std::weak_ptr<const TokenVocabulary> vocabularyRef;
+        std::shared_ptr<const TokenAutomaton> automaton;
+    };
+
+    mutable std::mutex mutex_;
+    std::list<Entry> lru_;                          // Most recently used first
+    std::unordered_map<size_t, std::vector<std::list<Entry>::iterator>> index_;
+    size_t capacity_ = kDefaultCapacity;
+
+    void eraseLocked(std::list<Entry>::iterator it);
+    void trimLocked();
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_CONSTRAINT_H
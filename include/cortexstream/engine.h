@@ -4,20 +4,31 @@
 #include "model.h"
 #include "scheduler.h"
 #include "kv_cache.h"
+#include "metrics.h"
 #include "request.h"
+#include "sampler.h"
+#include "speculative.h"
+#include "stop_matcher.h"
+#include "tokenizer.h"
 #include <memory>
 #include <atomic>
 #include <chrono>
+#include <condition_variable>
+#include <mutex>
+#include <string>
+#include <thread>
 
 // ============================================================================
 // OPTIMIZATION GUIDE - InferenceEngine for Apple Silicon
 // ============================================================================
 //
 // Parallel Processing Optimizations:
-// 1. emitTokens(): Parallel token extraction & sampling per-request (OpenMP)
-//    - Each request sampled in separate thread (no inter-request dependencies)
-//    - SIMD-aligned memory copies within parallel context
-//    - Critical sections for atomic updates only
+// 1. emitTokens(): One fused Sampler::sampleBatch pass over the batch logits
+//    - Rows sampled in parallel, each with its request's SamplingParams
+//      and a deterministic RNG stream keyed on the request's seed
+//    - Rows are read through zero-copy TensorViews of the batch logits
+//    - Results land in a batch-local buffer; one serial commit phase then
+//      applies tokens and a single batched scheduler update (no critical)
 //
 // 2. processDecode(): Parallel last-token extraction (OpenMP dynamic schedule)
 //    - Extracts final tokens from all decode-stage requests in parallel
@@ -31,6 +42,22 @@
 // 1. prefill() and decode() calls use MLX backend (automatically Metal on Apple Silicon)
 // 2. Logits returned as GPU tensors when possible (reduced GPU->CPU transfers)
 // 3. Warmup() compiles Metal computation graphs for lower latency
+// 4. Pipelined mode: step N+1's decode is launched before step N's
+//    callbacks and scheduling, hiding host overhead behind the GPU. It is
+//    the only forward in flight: prefill, swap-in and KV release wait for
+//    it first (settleInFlight), so backend and KV are never used by two
+//    passes at once
+// 5. Speculative mode: a Drafter proposes k tokens per sequence and one
+//    multi-token forward verifies them; accepted tokens commit in bulk
+// 6. Stop criteria (EOS, stop tokens, stop strings) are checked per
+//    committed token through a per-request Aho-Corasick cursor; a stopped
+//    sequence skips KV growth and leaves the batch the same step
+// 7. TokenStream delivery: tokens go into a per-request lock-free ring
+//    drained by client threads; slow clients throttle only themselves
+// 8. Latency metrics: TTFT, inter-token latency, step durations and batch
+//    sizes go into lock-free log-linear histograms (a few relaxed atomic
+//    adds per sample); getMetrics()/getPrometheusMetrics() read them from
+//    any thread without stalling the loop
 //
 // Memory Management:
 // 1. KV cache uses buddy allocator: O(log n) allocation vs O(n) linear scan
@@ -38,11 +65,11 @@
 // 3. Block-based pooling avoids malloc/free overhead
 //
 // Scheduling Optimizations:
-// 1. buildPrefillBatch(): Sorts by prompt length (shorter first)
-//    - Shorter sequences complete faster, freeing GPU memory
-// 2. buildDecodeBatch(): Sorts by generation progress (newer first)
-//    - Minimizes time-to-first-token (TTFT) for recent requests
-// 3. Both use dynamic priority scheduling for better throughput
+// 1. scheduleStep(): Decode tokens first, then prefill chunks, per token budget
+//    - Long prompts cannot stall running sequences
+// 2. SchedulingPolicy orders requests within priority classes
+//    - FCFS, shortest-job-first, earliest-deadline, weighted fair share
+// 3. Aging protects low-priority and long-running requests from starvation
 //
 // ============================================================================
 
@@ -52,8 +79,36 @@ struct EngineStats {
     size_t tokensProcessed = 0;
     size_t requestsCompleted = 0;
     size_t requestsFailed = 0;
-    float avgBatchSize = 0.0f;
-    std::chrono::milliseconds totalLatency{0};
+    size_t requestsPreempted = 0;
+    size_t pipelinedSteps = 0;        // Decode steps served by an early launch
+    size_t draftedTokens = 0;         // Speculative tokens proposed
+    size_t acceptedDraftTokens = 0;   // ... and kept after verification
+    size_t decodeSteps = 0;           // Decode forwards run
+    float avgBatchSize = 0.0f;        // Sequences per decode step
+    std::chrono::milliseconds totalLatency{0};  // Time spent in prefill/decode
+};
+
+/**
+ * Point-in-time view for monitoring. Latency histograms are in
+ * nanoseconds; queueWait is measured from arrival to admission.
+ */
+struct EngineMetrics {
+    EngineStats stats;
+    HistogramSnapshot timeToFirstToken;
+    HistogramSnapshot interTokenLatency;
+    HistogramSnapshot queueWait;
+    HistogramSnapshot prefillStep;
+    HistogramSnapshot decodeStep;
+    HistogramSnapshot decodeBatchSize;    // Sequences per decode step
+    
+    int activeRequests = 0;
+    int pendingRequests = 0;
+    size_t kvBlocksUsed = 0;
+    size_t kvBlocksTotal = 0;
+    float kvOccupancy = 0.0f;             // kvBlocksUsed / kvBlocksTotal
+    float kvFragmentation = 0.0f;
+    size_t prefixQueriedTokens = 0;
+    size_t prefixHitTokens = 0;
 };
 
 class InferenceEngine {
@@ -65,27 +120,146 @@ public:
 
     // Lifecycle
     bool initialize();
-    void run();
-    void shutdown();
+    
+    /**
+     * Start the persistent main loop. With `dedicatedThread` (default) the
+     * loop runs on an engine-owned thread and run() returns immediately;
+     * otherwise it runs on the caller's thread until shutdown().
+     * The loop sleeps on the scheduler while idle and wakes on submit.
+     */
+    void run(bool dedicatedThread = true);
+    void shutdown();                  // Stops the loop and joins its thread
     
     // Control
     bool isRunning() const;
     void pause();
     void resume();
     
-    // Statistics
-    const EngineStats& getStats() const;
+    /**
+     * Block until all submitted work has finished and its KV is released.
+     * Returns false on timeout; 0 waits indefinitely.
+     */
+    bool waitUntilIdle(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+    
+    /**
+     * Pipelined decode (off by default). Once a step's tokens are committed,
+     * the next forward for sequences that keep decoding is launched
+     * asynchronously; token callbacks, cleanup and the next scheduling
+     * pass then overlap with it. Rows the scheduler does not pick again
+     * are discarded, missing rows are decoded synchronously.
+     */
+    void setPipelining(bool enabled);
+    bool isPipelining() const;
+    
+    /**
+     * Speculative decoding (off by default; nullptr disables). Each decode
+     * step the drafter proposes up to `numDraftTokens` tokens per sequence,
+     * one multi-token forward scores them, and drafts are kept while they
+     * equal what the sampler draws from the target at that position, plus
+     * the target's own next token. Output is unchanged; KV slots of
+     * rejected drafts are rolled back, in the drafter too (onVerified, and
+     * release() when a request is cleaned up). Takes precedence over
+     * pipelining.
+     */
+    void setSpeculative(std::shared_ptr<Drafter> drafter, int numDraftTokens = 4);
+    bool isSpeculative() const;
+    
+    /**
+     * Tokenizer for stop criteria (set before run(); nullptr disables):
+     * its EOS token ends a request unless the request ignores EOS, and
+     * requests with stop strings are detokenized incrementally on the
+     * engine thread, as are TokenStream chunks (ResponseChunk::textPiece;
+     * without a tokenizer chunks carry token ids only). Give the engine
+     * its own instance when clients decode concurrently.
+     */
+    void setTokenizer(std::shared_ptr<Tokenizer> tokenizer);
+    
+    // Reuse sampled tokens for exactly repeated batch rows, e.g. forked
+    // sequences sharing a prompt (off by default; see Sampler::setMemoization)
+    void setSamplingMemo(bool enabled);
+    bool isSamplingMemo() const;
+    
+    // Statistics (consistent-enough snapshot; safe from any thread)
+    EngineStats getStats() const;
     int getActiveRequests() const;
+    
+    // Histograms plus queue and KV gauges; safe from any thread
+    EngineMetrics getMetrics() const;
+    
+    // getMetrics() in Prometheus text exposition format (cortexstream_*
+    // metrics, latencies in seconds), ready to serve from /metrics
+    std::string getPrometheusMetrics() const;
 
 private:
     std::shared_ptr<ModelBackend> backend;
     std::shared_ptr<Scheduler> scheduler;
     std::shared_ptr<KVCache> cache;
+    Sampler sampler;                  // Fused batched sampling for emitTokens
     
     std::atomic<bool> running{false};
     std::atomic<bool> paused{false};
+    std::atomic<bool> pipelining{false};
     
-    EngineStats stats;
+    // Stop criteria; progress indexed by SeqId, reset on cleanup
+    std::shared_ptr<Tokenizer> tokenizer;
+    int32_t eosTokenId = -1;
+    struct StopProgress {
+        StopMatcher::Cursor cursor;
+        std::unique_ptr<IncrementalDetokenizer> detokenizer;
+    };
+    std::vector<StopProgress> stopProgress;
+    
+    // TokenStream text pieces, indexed by SeqId; restarted with each stream
+    // and independent of stop progress, which runs ahead at commit time
+    std::vector<std::unique_ptr<IncrementalDetokenizer>> streamText;
+    
+    // Speculative decoding; the drafter is swapped atomically (atomic_load)
+    std::shared_ptr<Drafter> drafter;
+    std::atomic<int> numDraftTokens{4};
+    
+    // Event loop: worker thread, pause/idle signalling
+    std::thread worker;
+    std::mutex controlMutex;
+    std::condition_variable controlCv;
+    bool idle = true;                 // Guarded by controlMutex
+    
+    // Counters behind getStats(): written by the engine thread only
+    struct StatCounters {
+        std::atomic<size_t> tokensProcessed{0};
+        std::atomic<size_t> requestsCompleted{0};
+        std::atomic<size_t> requestsFailed{0};
+        std::atomic<size_t> requestsPreempted{0};
+        std::atomic<size_t> pipelinedSteps{0};
+        std::atomic<size_t> draftedTokens{0};
+        std::atomic<size_t> acceptedDraftTokens{0};
+        std::atomic<size_t> decodeSteps{0};
+        std::atomic<size_t> decodeRows{0};
+        std::atomic<uint64_t> busyNs{0};
+    };
+    StatCounters stats;
+    
+    // Latency histograms (nanoseconds); recorded on the engine thread
+    struct LatencyMetrics {
+        LatencyHistogram timeToFirstToken;
+        LatencyHistogram interTokenLatency;
+        LatencyHistogram prefillStep;
+        LatencyHistogram decodeStep;
+        LatencyHistogram decodeBatchSize;
+    };
+    LatencyMetrics metrics;
+    std::vector<uint64_t> lastTokenNs;    // [SeqId] -> time of last delivery, 0 = none
+    
+    // Decode forward launched one step ahead (pipelined mode)
+    struct InFlightDecode {
+        Batch batch;
+        std::vector<int> generatedLengths;    // Per row, at launch time
+        std::future<Tensor> logits;
+    };
+    std::unique_ptr<InFlightDecode> inFlight;
+    void settleInFlight();                  // Wait for it, keeping the result
+    
+    // Completed requests whose TokenStream could not take every token yet
+    std::vector<std::shared_ptr<Request>> streamBacklog;
     
     // Main loop
     void mainLoop();
@@ -93,21 +267,35 @@ private:
     // Processing stages
     void processPrefill(const Batch& prefillBatch);
     void processDecode(const Batch& decodeBatch);
+    Tensor collectDecodeLogits(const Batch& decodeBatch);
+    void launchNextDecode(const Batch& decodeBatch);
+    void processSpeculativeDecode(const Batch& decodeBatch, Drafter& drafter);
+    
+    // Preemption: swap sequences out under KV pressure, back in when blocks free up
+    bool resumeSwapped();
+    bool growForDecode(const std::shared_ptr<Request>& request);
+    // Retire this step's stopped sequences and free their KV before any
+    // remaining row grows, so they are neither victims nor held blocks
+    void finishStopped(const std::vector<SeqId>& finished);
     
     // Token emission and streaming
     void emitTokens(const Batch& batch, const Tensor& logits);
-    int sampleAndApply(const Tensor& logits, 
-                      std::shared_ptr<Request> request);
+    bool checkStop(Request& request);
+    void notifyTokens(const Batch& batch, const std::vector<int>& emittedFrom);
+    void recordTokenLatency(const Request& request, int emittedFrom, uint64_t now);
+    bool publishStream(Request& request);
+    void flushStreamBacklog();
+    void waitForStreams();
     
     // Cleanup and resource management
     void cleanup();
-    void cleanupRequest(const std::string& requestId);
+    void cleanupRequest(const Request& request);
     void validateMemoryState();
     
     // Failure handling
     void handleBackendFailure(const std::string& reason);
-    void handleOOM();
-    void handleStuckRequest(const std::string& requestId);
+    bool handleOOM();
+    void handleStuckRequest(const Request& request);
 };
 
 }  // namespace cortexstream
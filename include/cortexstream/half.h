@@ -0,0 +1,85 @@
+#ifndef CORTEXSTREAM_HALF_H
+#define CORTEXSTREAM_HALF_H
+
+#include <cstdint>
+#include <cstring>
+
+namespace cortexstream {
+
+// IEEE 754 binary16 <-> binary32 (round-to-nearest-even)
+inline uint16_t floatToHalf(float value) {
+    uint32_t x;
+    std::memcpy(&x, &value, sizeof(x));
+    uint32_t sign = (x >> 16) & 0x8000u;
+    uint32_t exp = (x >> 23) & 0xFFu;
+    uint32_t mant = x & 0x7FFFFFu;
+
+    if (exp == 0xFFu) {                       // Inf / NaN
+        return static_cast<uint16_t>(sign | 0x7C00u | (mant ? 0x200u : 0u));
+    }
+    int32_t e = static_cast<int32_t>(exp) - 127 + 15;
+    if (e >= 0x1F) {                          // Overflow -> Inf
+        return static_cast<uint16_t>(sign | 0x7C00u);
+    }
+    if (e <= 0) {                             // Subnormal or zero
+        if (e < -10) {
+            return static_cast<uint16_t>(sign);
+        }
+        mant |= 0x800000u;
+        uint32_t shift = static_cast<uint32_t>(14 - e);
+        uint32_t half = mant >> shift;
+        uint32_t rem = mant & ((1u << shift) - 1u);
+        uint32_t mid = 1u << (shift - 1u);
+        if (rem > mid || (rem == mid && (half & 1u))) {
+            half++;
+        }
+        return static_cast<uint16_t>(sign | half);
+    }
+    uint32_t half = sign | (static_cast<uint32_t>(e) << 10) | (mant >> 13);
+    uint32_t rem = mant & 0x1FFFu;
+    if (rem > 0x1000u || (rem == 0x1000u && (half & 1u))) {
+        half++;                               // May carry into exponent: correct
+    }
+    return static_cast<uint16_t>(half);
+}
+
+inline float halfToFloat(uint16_t h) {
+    uint32_t sign = (static_cast<uint32_t>(h) & 0x8000u) << 16;
+    uint32_t exp = (h >> 10) & 0x1Fu;
+    uint32_t mant = h & 0x3FFu;
+    uint32_t x;
+
+    if (exp == 0) {
+        if (mant == 0) {
+            x = sign;
+        } else {                              // Normalize subnormal
+            exp = 127 - 15 + 1;
+            while ((mant & 0x400u) == 0) {
+                mant <<= 1;
+                exp--;
+            }
+            mant &= 0x3FFu;
+            x = sign | (exp << 23) | (mant << 13);
+        }
+    } else if (exp == 0x1Fu) {
+        x = sign | 0x7F800000u | (mant << 13);
+    } else {
+        x = sign | ((exp - 15 + 127) << 23) | (mant << 13);
+    }
+
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+// bfloat16 is the top half of a binary32
+inline float bfloat16ToFloat(uint16_t b) {
+    uint32_t x = static_cast<uint32_t>(b) << 16;
+    float value;
+    std::memcpy(&value, &x, sizeof(value));
+    return value;
+}
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_HALF_H
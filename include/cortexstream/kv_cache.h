@@ -5,12 +5,14 @@
 #include <cstddef>
 #include <memory>
 #include <unordered_map>
-#include <map>
-#include <deque>
+#include <atomic>
 #include <algorithm>
 #include <mutex>
 #include <stdexcept>
 #include <ostream>
+#include <string>
+#include <cstdint>
+#include "seq_id.h"
 
 // ============================================================================
 // OPTIMIZATION GUIDE - KV Cache Memory Management
@@ -30,8 +32,9 @@
 // How it works:
 // 1. Free lists maintained per size class: 1, 2, 4, 8, 16, ... blocks
 // 2. Allocation: Find or split larger block from next size class
-// 3. Deallocation: Return block and try to coalesce with buddy
+// 3. Deallocation: Return block and merge with its buddy (index ^ size)
 // 4. Automatic coalescing: Merges adjacent freed blocks into larger chunks
+// 5. Single-block churn (paged decode) is served by a lock-free magazine
 //
 // GPU Memory Layout (MLX Compatible):
 // - K/V tensors stored in pre-allocated GPU arena
@@ -57,8 +60,8 @@ class Request;
 
 /**
  * KVHandle represents a contiguous block allocation.
- * For MVP: contiguous blocks
- * Future: can be extended to support scattered paging
+ * Used by KVAllocationMode::Contiguous; paged sequences track their
+ * physical blocks in SequenceKVEntry::blockTable instead.
  */
 struct KVHandle {
     int startBlockIndex;    // First block in allocation
@@ -77,9 +80,11 @@ struct KVHandle {
  * 
  * Design properties:
  *   - O(log totalBlocks) allocation via buddy system (power-of-2 size classes)
- *   - Automatic coalescing reduces fragmentation
+ *   - Buddy of block i at order k is i ^ (1 << k): merging needs no search
+ *   - O(1) statistics via atomic counters (safe to poll every iteration)
+ *   - Lock-free magazine of single blocks for the paged fast path
  *   - Fail-fast: allocate returns invalid handle on failure
- *   - Thread-safe with mutex
+ *   - Thread-safe: mutex guards the buddy lists only
  *   - Supports GPU memory layout (MLX compatible)
  */
 class KVBlockAllocator {
@@ -99,6 +104,20 @@ public:
      */
     void free(const KVHandle& handle);
 
+    /**
+     * Allocate `count` single blocks (not necessarily contiguous).
+     * Appends physical block indices to `pages`. All-or-nothing: on
+     * failure nothing is appended and the pool is left unchanged.
+     * Served lock-free from the magazine when it holds enough blocks.
+     */
+    bool allocatePages(int count, std::vector<int>& pages);
+
+    /**
+     * Release single blocks obtained from allocatePages().
+     * Blocks go to the magazine first, then back to the buddy lists.
+     */
+    void freePages(const std::vector<int>& pages);
+
     // Statistics (for monitoring and debugging)
     size_t freeBlocks() const;
     size_t usedBlocks() const;
@@ -109,42 +128,160 @@ public:
     void dumpBlockMap(std::ostream& os) const;
 
 private:
-    size_t totalBlocks_;
-    std::vector<bool> freeList_;     // true = free, false = used
-    mutable std::mutex lock_;        // Protect concurrent access
+    // Single blocks cached outside the buddy lists for lock-free reuse
+    static constexpr size_t kMagazineCapacity = 64;
+    static constexpr int kNullBlock = -1;
 
-    // Buddy allocator system: maintains free lists for each power-of-2 size class
-    // Size classes: 1, 2, 4, 8, 16, 32, ... blocks
-    std::map<int, std::deque<int>> buddyFreeLists_;  // [size] -> [start_indices]
+    size_t totalBlocks_;
+    int maxOrder_ = 0;
+    std::atomic<size_t> usedBlocks_{0};
+    mutable std::mutex lock_;        // Protects the buddy lists
+
+    // Buddy lists: intrusive doubly-linked lists of free block heads, one
+    // per order (size 1 << order). freeOrder_[i] is the order of the free
+    // block starting at i, or -1 if i is not a free head.
+    std::vector<int> freeHeads_;     // [order] -> first block or kNullBlock
+    std::vector<int> nextFree_;
+    std::vector<int> prevFree_;
+    std::vector<int8_t> freeOrder_;
+
+    // Per-block used flag, readable without the lock (dumpBlockMap)
+    std::unique_ptr<std::atomic<uint8_t>[]> blockUsed_;
+
+    // Magazine: Treiber stack of single blocks. The head packs a 32-bit
+    // ABA tag above the 32-bit block index.
+    std::atomic<uint64_t> magazineHead_;
+    std::atomic<size_t> magazineSize_{0};
+    std::unique_ptr<std::atomic<int>[]> magazineNext_;
 
     // Buddy system operations (O(log n) complexity)
     void initBuddySystem();
-    KVHandle buddyAllocate(int size);
-    void buddyCoalesce(int size);
-    
-    // Legacy: linear scan fallback (deprecated in favor of buddy system)
-    // Kept for backward compatibility
-    int findContiguousFreeRegion(int blocksNeeded);
+    KVHandle buddyAllocate(int order);
+    void buddyRelease(int start, int order);
+    void pushFree(int start, int order);
+    void unlinkFree(int start, int order);
+    void releaseLocked(const KVHandle& handle);
+    bool drainMagazineLocked();
+    void markRange(int start, int count, bool used);
+
+    // Magazine operations (lock-free)
+    bool magazinePush(int block);
+    int magazinePop();
 };
 
 // ============================================================================
 // KVCache: Logical KV memory system
 // ============================================================================
 
+/**
+ * Block placement strategy for sequences.
+ *
+ * Contiguous: one buddy range per sequence (rounded up to a power of two).
+ * Paged:      one physical block per logical block, tracked in a block
+ *             table. No internal rounding waste; blocks need not be adjacent.
+ */
+enum class KVAllocationMode {
+    Contiguous,
+    Paged
+};
+
+/**
+ * Element type of the K/V arena.
+ *
+ * FP32: float, no scaling.
+ * FP16: IEEE half stored as uint16_t bits.
+ * INT8: symmetric int8 with one float scale per (layer, block, head);
+ *       value = q * scale.
+ */
+enum class KVDType {
+    FP32,
+    FP16,
+    INT8
+};
+
+inline size_t kvDTypeSize(KVDType dtype) {
+    switch (dtype) {
+        case KVDType::FP16: return 2;
+        case KVDType::INT8: return 1;
+        default:            return 4;
+    }
+}
+
 // Lightweight tensor view for KV slices (distinct from model::Tensor)
+//
+// A sequence's KV is a list of pages, one per block in its block table.
+// Each page is laid out [numHeads, blockSize, headDim] in `dtype` and the
+// logical token t lives in page t / blockSize at row t % blockSize.
+// For INT8, scales[p][h] dequantizes head h of page p.
 struct KVView {
-    float* data = nullptr;
-    std::vector<size_t> shape;  // [numHeads, tokensUsed, headDim]
+    void* data = nullptr;           // First page (kept for legacy callers)
+    std::vector<size_t> shape;      // [numHeads, tokensUsed, headDim]
+    std::vector<void*> pages;       // Base pointer of each block, in order
+    std::vector<float*> scales;     // INT8 only: [numHeads] scales per page
+    size_t blockSize = 0;           // Tokens per page
+    KVDType dtype = KVDType::FP32;
     bool valid = false;
+
+    size_t numPages() const { return pages.size(); }
+    void* page(size_t i) const { return pages[i]; }
+
+    template <typename T>
+    T* pageAs(size_t i) const { return static_cast<T*>(pages[i]); }
+
+    // Row for (head, token) inside the paged view
+    void* at(size_t head, size_t token) const {
+        const size_t headDim = shape[2];
+        const size_t elem = head * blockSize * headDim + (token % blockSize) * headDim;
+        return static_cast<unsigned char*>(pages[token / blockSize]) + elem * kvDTypeSize(dtype);
+    }
+
+    float scale(size_t head, size_t token) const {
+        return scales.empty() ? 1.0f : scales[token / blockSize][head];
+    }
 };
 
 /**
  * Per-sequence KV allocation metadata.
  */
 struct SequenceKVEntry {
-    KVHandle handle;        // Block allocation handle
-    int tokensUsed = 0;     // Current write position
-    int maxAllowed = 0;     // Max tokens this sequence can hold
+    KVHandle handle{-1, 0};         // Buddy range (Contiguous mode only)
+    std::vector<int> blockTable;    // Logical block -> physical block
+    int tokensUsed = 0;             // Current write position
+    int maxAllowed = 0;             // Max tokens this sequence can hold
+};
+
+/**
+ * KV of a preempted sequence parked in the host swap pool.
+ */
+struct SwappedKVEntry {
+    std::vector<int> slots;         // Swap slot per logical block
+    int tokensUsed = 0;
+    int maxAllowed = 0;
+};
+
+/**
+ * Node of the prompt prefix cache.
+ *
+ * A radix tree over prompt tokens at block granularity: every edge is one
+ * full block of tokens, so a root-to-node path spells a cached prefix and
+ * the node owns one reference on the physical block holding its KV. Each
+ * LoRA adapter has its own tree: the same tokens produce different KV
+ * under different adapters.
+ */
+struct KVPrefixNode {
+    std::vector<int> tokens;        // The blockSize tokens on this edge
+    int block = -1;                 // Physical block holding their KV
+    KVPrefixNode* parent = nullptr;
+    std::unordered_map<uint64_t, std::unique_ptr<KVPrefixNode>> children;  // [block hash] -> child
+    uint64_t lastUse = 0;           // Logical clock for LRU eviction
+};
+
+struct PrefixCacheStats {
+    size_t lookups = 0;             // allocateWithPrefix() calls
+    size_t queriedTokens = 0;       // Prompt tokens looked up
+    size_t hitTokens = 0;           // Prompt tokens served from cache
+    size_t cachedBlocks = 0;        // Blocks currently held by the tree
+    size_t evictedBlocks = 0;       // Blocks reclaimed under pressure
 };
 
 /**
@@ -158,7 +295,7 @@ struct SequenceKVEntry {
  *   V: [numLayers, totalBlocks, numHeads, blockSize, headDim]
  * 
  * Indexing logic:
- *   blockIndex = (handle.startBlockIndex + offset)
+ *   blockIndex = blockTable[token / blockSize]
  *   tokenOffsetInBlock = tokensUsed % blockSize
  * 
  * Zero-Copy Design:
@@ -166,6 +303,8 @@ struct SequenceKVEntry {
  *   - No copying on allocation or token append
  *   - Block layout ensures coalesced GPU access (MLX/MPS friendly)
  */
+struct ModelConfig;
+
 class KVCache {
 public:
     /**
@@ -176,13 +315,26 @@ public:
      * @param headDim         Dimension per head (e.g., 64)
      * @param maxTotalTokens  Total tokens across all sequences
      * @param blockSize       Tokens per block (e.g., 16)
+     * @param mode            Block placement strategy (default: Paged)
+     * @param dtype           Storage type of K/V (FP16 halves, INT8 quarters
+     *                        the arena for the same token count)
      */
     explicit KVCache(size_t numLayers,
                      size_t numHeads,
                      size_t headDim,
                      size_t maxTotalTokens,
-                     size_t blockSize = 16);
-    // Legacy convenience overload (cacheBytes, hiddenSize, numLayers)
+                     size_t blockSize = 16,
+                     KVAllocationMode mode = KVAllocationMode::Paged,
+                     KVDType dtype = KVDType::FP32);
+    // Sized from the model's real geometry (numLayers, numKVHeads,
+    // headDim): as many tokens as fit in `cacheBytes` of K and V
+    KVCache(const ModelConfig& config,
+            size_t cacheBytes,
+            size_t blockSize = 16,
+            KVAllocationMode mode = KVAllocationMode::Paged,
+            KVDType dtype = KVDType::FP32);
+    // Legacy convenience overload (cacheBytes, hiddenSize, numLayers);
+    // assumes 32 heads, prefer the ModelConfig overload
     explicit KVCache(size_t cacheBytes,
                      size_t hiddenSize,
                      size_t numLayers);
@@ -194,61 +346,221 @@ public:
      * Allocate KV blocks for a new sequence.
      * Called at prefill start.
      * 
-     * @param requestId       Unique sequence identifier
+     * @param seq             Sequence handle (Request::getSeqId())
      * @param initialTokens   Initial token count (from prompt)
      * @return true on success, false if insufficient memory
      */
-    bool allocateFor(const std::string& requestId, int initialTokens);
+    bool allocateFor(SeqId seq, int initialTokens);
+
+    /**
+     * Allocate KV blocks for a new sequence, reusing cached prefix blocks.
+     * Full blocks of `promptTokens` already in the prefix cache are shared
+     * (ref-counted) instead of allocated; the last prompt token is always
+     * left uncached so the model still produces logits for it.
+     * Cached-but-unused blocks are evicted LRU if the arena runs short.
+     *
+     * `initialTokens` limits the slots reserved up front (default: the
+     * whole prompt); chunked prefill reserves only its first chunk and
+     * grows with appendTokens(). The cached prefix is always covered.
+     * Only blocks published under the same `adapter` ("" = base model)
+     * are shared.
+     *
+     * @return number of leading prompt tokens whose KV is already resident,
+     *         or -1 if the sequence could not be allocated
+     */
+    int allocateWithPrefix(SeqId seq,
+                           const std::vector<int>& promptTokens,
+                           int initialTokens = -1,
+                           const std::string& adapter = std::string());
+
+    /**
+     * Publish the full prompt blocks of a prefilled sequence to the prefix
+     * cache so later requests with the same prefix and adapter can share
+     * them.
+     */
+    void publishPrefix(SeqId seq,
+                       const std::vector<int>& promptTokens,
+                       const std::string& adapter = std::string());
+
+    /**
+     * Leading prompt tokens allocateWithPrefix() would find resident now.
+     * Read-only probe for routing: no blocks retained, LRU order and
+     * statistics untouched.
+     */
+    int matchPrefix(const std::vector<int>& promptTokens,
+                    const std::string& adapter = std::string()) const;
 
     /**
      * Free all KV blocks for a sequence.
      * Called when sequence is complete.
      */
-    void freeFor(const std::string& requestId);
+    void freeFor(SeqId seq);
 
     // ---- Tensor Access (Zero-Copy Views) ----
 
     /**
      * Get K tensor view for a sequence.
      * References arena memory directly—no copy.
-     * View shape: [numLayers, numHeads, tokensUsed, headDim]
+     * View shape: [numHeads, tokensUsed, headDim], split into pages
      */
-    KVView getKView(const std::string& requestId, int layer);
+    KVView getKView(SeqId seq, int layer);
 
     /**
      * Get V tensor view for a sequence.
      * References arena memory directly—no copy.
-     * View shape: [numLayers, numHeads, tokensUsed, headDim]
+     * View shape: [numHeads, tokensUsed, headDim], split into pages
      */
-    KVView getVView(const std::string& requestId, int layer);
+    KVView getVView(SeqId seq, int layer);
+
+    // ---- KV Writes / Reads ----
+
+    /**
+     * Store K and V for one token position, converting to the arena dtype.
+     * `k` and `v` are [numHeads, headDim] floats. For INT8, the block's
+     * per-head scale grows as needed and earlier rows are re-quantized.
+     */
+    bool writeToken(SeqId seq, int layer, int position,
+                    const float* k, const float* v);
+
+    /**
+     * Dequantize K and V for one token position into [numHeads, headDim]
+     * float buffers (CPU fallback path).
+     */
+    bool readToken(SeqId seq, int layer, int position,
+                   float* k, float* v) const;
 
     // ---- Token Management ----
 
     /**
      * Current token count for a sequence.
      */
-    int usedTokens(const std::string& requestId) const;
+    int usedTokens(SeqId seq) const;
 
     /**
      * Append one token to sequence.
-     * Updates write position. Returns success.
+     * Updates write position. When the current block is full, one more
+     * block is taken from the allocator (paged mode) or from the unused
+     * tail of the sequence's buddy range (contiguous mode).
+     * Returns false only if no block could be obtained.
      */
-    bool appendToken(const std::string& requestId);
+    bool appendToken(SeqId seq);
+
+    /**
+     * Append `count` tokens at once (one prefill chunk).
+     * All-or-nothing: on failure the sequence is unchanged.
+     */
+    bool appendTokens(SeqId seq, int count);
+
+    /**
+     * Drop the last `count` token slots (e.g. rejected speculative tokens).
+     * Paged mode returns blocks past the new end to the allocator; a
+     * contiguous range keeps its buddy block for later growth.
+     * Returns false if the sequence holds fewer than `count` tokens.
+     */
+    bool truncateTokens(SeqId seq, int count);
+
+    bool hasSequence(SeqId seq) const;
 
     /**
      * Get write position for current token in block.
      * Used by backend to know where to write KV.
      */
+    int getTokenOffsetInBlock(SeqId seq) const;
+
+    // ---- Swap Tier (Preemption) ----
+
+    /**
+     * Reserve a host swap pool of `swapBlocks` blocks for preempted
+     * sequences. With `backingFile` the pool is an mmap'd file (SSD tier);
+     * otherwise it is anonymous host memory. Replaces any previous pool.
+     */
+    bool configureSwapSpace(size_t swapBlocks, const std::string& backingFile = "");
+
+    /**
+     * Copy a sequence's blocks to the swap pool and release them.
+     * Returns false (sequence untouched) if the pool lacks space.
+     */
+    bool swapOut(SeqId seq);
+
+    /**
+     * Bring a swapped sequence back into the arena.
+     * Returns false (still swapped) if not enough blocks are free.
+     */
+    bool swapIn(SeqId seq);
+
+    bool isSwapped(SeqId seq) const;
+    size_t getNumFreeSwapBlocks() const;
+
+    // ---- Named Sequences (API edge) ----
+    // Same operations keyed by a string request ID. The name is bound to
+    // a pooled SeqId on first allocation and released by freeFor().
+    bool allocateFor(const std::string& requestId, int initialTokens);
+    int allocateWithPrefix(const std::string& requestId,
+                           const std::vector<int>& promptTokens,
+                           int initialTokens = -1,
+                           const std::string& adapter = std::string());
+    void publishPrefix(const std::string& requestId,
+                       const std::vector<int>& promptTokens,
+                       const std::string& adapter = std::string());
+    void freeFor(const std::string& requestId);
+    KVView getKView(const std::string& requestId, int layer);
+    KVView getVView(const std::string& requestId, int layer);
+    bool writeToken(const std::string& requestId, int layer, int position,
+                    const float* k, const float* v);
+    bool readToken(const std::string& requestId, int layer, int position,
+                   float* k, float* v) const;
+    int usedTokens(const std::string& requestId) const;
+    bool appendToken(const std::string& requestId);
+    bool appendTokens(const std::string& requestId, int count);
+    bool truncateTokens(const std::string& requestId, int count);
+    bool hasSequence(const std::string& requestId) const;
     int getTokenOffsetInBlock(const std::string& requestId) const;
+    bool swapOut(const std::string& requestId);
+    bool swapIn(const std::string& requestId);
+    bool isSwapped(const std::string& requestId) const;
 
     // ---- Statistics & Monitoring ----
 
     size_t getTotalAllocated() const;
     size_t getTotalFree() const;
+    size_t getNumFreeBlocks() const;
+    // Free blocks plus idle prefix-cache blocks that allocation may evict
+    size_t getNumAvailableBlocks() const;
     int getNumAllocatedSequences() const;
     bool isFull() const;
     float getFragmentation() const;
 
+    KVAllocationMode getAllocationMode() const;
+    size_t getBlockSize() const;
+    KVDType getDType() const;
+    size_t getBytesPerBlock() const;   // K + V (+ scales) for all layers
+
+    // ---- Prefix Cache ----
+    // Enabled by default in paged mode; unavailable in contiguous mode.
+    void setPrefixCachingEnabled(bool enabled);
+    bool isPrefixCachingEnabled() const;
+    PrefixCacheStats getPrefixCacheStats() const;
+    void clearPrefixCache();
+
+    // ---- Tensor-Parallel Head Shards ----
+    // Under tensor parallelism each rank owns numKVHeads / worldSize heads.
+    // This cache is rank 0 and keeps the block tables, prefix tree and swap
+    // slots for the whole group; createHeadShard() adds a rank whose arena
+    // holds another slice of heads in the same block layout. A shard's
+    // getKView / getVView / writeToken / readToken resolve sequences through
+    // rank 0, and block copies (copy-on-write, swap) are applied to every
+    // shard. Sequence management (allocate, append, free, swap) goes through
+    // rank 0 only.
+
+    /**
+     * Add a head shard to `leader`, which it keeps alive. Shards must be
+     * created before any sequence is allocated; nullptr otherwise.
+     */
+    static std::shared_ptr<KVCache> createHeadShard(const std::shared_ptr<KVCache>& leader);
+    int getShardRank() const;           // 0 for rank 0 (no leader)
+    int getNumHeadShards() const;       // Rank 0 plus its shards
+    size_t getNumHeads() const;         // Heads in this cache's arena
+
     // ---- Warmup ----
     void warmup();
 
@@ -262,23 +574,85 @@ private:
     size_t headDim_;
     size_t blockSize_;
     size_t totalBlocks_;
+    KVAllocationMode mode_;
+    KVDType dtype_;
 
     // Global arena (shared by all sequences)
     // K: [numLayers, totalBlocks, numHeads, blockSize, headDim]
     // V: [numLayers, totalBlocks, numHeads, blockSize, headDim]
-    std::vector<float> K_;
-    std::vector<float> V_;
+    // Raw bytes in dtype_; INT8 scales are [numLayers, totalBlocks, numHeads]
+    std::vector<unsigned char> K_;
+    std::vector<unsigned char> V_;
+    std::vector<float> KScales_;
+    std::vector<float> VScales_;
 
     // Block allocator
     std::unique_ptr<KVBlockAllocator> allocator_;
 
-    // Sequence tracking
-    std::unordered_map<std::string, SequenceKVEntry> sequences_;
+    // Sequence tracking: slab indexed by SeqId (seqLive_ marks used slots)
+    std::vector<SequenceKVEntry> sequences_;
+    std::vector<uint8_t> seqLive_;
+    size_t numSequences_ = 0;
+    std::unordered_map<std::string, SeqId> namedSequences_;  // String-keyed callers only
     mutable std::mutex lock_;
 
+    // Paged mode: references per physical block (sequences + prefix tree).
+    // A block returns to the allocator when its count drops to zero.
+    std::vector<int> blockRefs_;
+
+    // Prefix cache (radix tree over prompt blocks, one per adapter)
+    bool prefixCachingEnabled_ = false;
+    std::unordered_map<std::string, std::unique_ptr<KVPrefixNode>> prefixRoots_;  // [adapter] -> tree
+    uint64_t prefixClock_ = 0;
+    PrefixCacheStats prefixStats_;
+    std::vector<uint8_t> blockInTree_;     // Block is referenced by the prefix tree
+    size_t idlePrefixBlocks_ = 0;          // Tree blocks no sequence uses (ref == 1)
+
+    // Swap pool: fixed-size slots of getBytesPerBlock() bytes each
+    std::unordered_map<SeqId, SwappedKVEntry> swapped_;
+    std::vector<unsigned char> swapHeap_;   // Host memory pool
+    unsigned char* swapMap_ = nullptr;      // mmap'd file pool
+    size_t swapMapBytes_ = 0;
+    int swapFd_ = -1;
+    std::vector<int> freeSwapSlots_;
+
+    // Head shards: rank 0 lists its shards (guarded by its lock_); a shard
+    // holds rank 0 and guards its arena with rank 0's lock_
+    std::shared_ptr<KVCache> leader_;
+    int shardRank_ = 0;
+    std::vector<KVCache*> shards_;
+
     // Helpers
-    float* getKBuffer(int blockIndex, int layer, int head, int offset);
-    float* getVBuffer(int blockIndex, int layer, int head, int offset);
+    unsigned char* getKBuffer(int blockIndex, int layer, int head, int offset);
+    unsigned char* getVBuffer(int blockIndex, int layer, int head, int offset);
+    size_t scaleIndex(int blockIndex, int layer, int head) const;
+    void resetBlockScales(int block);
+    void storeRow(unsigned char* block, float* scales, size_t head, size_t row, const float* src);
+    void loadRow(const unsigned char* block, const float* scales, size_t head, size_t row,
+                 float* dst) const;
+    bool allocateLocked(SeqId seq, int initialTokens);
+    SequenceKVEntry* findSequenceLocked(SeqId seq);
+    const SequenceKVEntry* findSequenceLocked(SeqId seq) const;
+    void insertSequenceLocked(SeqId seq, SequenceKVEntry entry);
+    void eraseSequenceLocked(SeqId seq);
+    SeqId lookupName(const std::string& requestId) const;
+    SeqId bindName(const std::string& requestId);
+    void unbindName(const std::string& requestId);
+    KVView makeView(const SequenceKVEntry& entry, int layer, bool isKey);
+    bool growLocked(SequenceKVEntry& entry);
+    bool allocatePagesLocked(int count, std::vector<int>& pages);
+    void releasePagesLocked(const std::vector<int>& pages);
+    void retainBlockLocked(int block);
+    bool ensureWritableLocked(SequenceKVEntry& entry, size_t logicalBlock);
+    void copyBlock(int srcBlock, int dstBlock);
+    unsigned char* swapSlot(int slot);
+    void copyBlockToSlot(int block, int slot);
+    void copySlotToBlock(int slot, int block);
+    bool allocateSwapStorage(size_t bytes, const std::string& backingFile);
+    void releaseSwapSpaceLocked();
+    KVCache& groupLeader() const;
+    size_t evictPrefixBlocksLocked(size_t blocksNeeded);
+    static uint64_t hashBlockTokens(const int* tokens, size_t count);
 };
 
 }  // namespace cortexstream
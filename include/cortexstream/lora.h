@@ -0,0 +1,154 @@
+#ifndef CORTEXSTREAM_LORA_H
+#define CORTEXSTREAM_LORA_H
+
+#include "model.h"
+#include "weights.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Multi-LoRA Serving - Many Fine-Tunes on One Base Model
+// ============================================================================
+//
+// A LoRA adapter adds scale * B A to a projection W ([out, in]), with
+// A [rank, in] and B [out, rank] for a small rank. One process serves the
+// base weights once and any number of adapters:
+//
+// - Host tier: LoRAAdapter maps a PEFT checkpoint (adapter_model.safetensors
+//   plus adapter_config.json); nothing is copied at registration
+// - Device tier: AdapterCache is a fixed pool of equal-size pages, one
+//   page per A row or B column, so adapters of any rank share the pool
+//   without fragmentation. Adapters page in on first use and the least
+//   recently used unpinned one is evicted when pages run short
+// - Kernels: y = x W^T runs once for the whole batch; addDelta() then adds
+//   each row's adapter product. Rows may use different adapters
+//   (gathered); a run of rows with the same adapter shares each page read
+//   (segmented), and the scheduler groups batches so runs are long
+//
+// ============================================================================
+
+namespace cortexstream {
+
+/**
+ * One registered adapter: its low-rank factors, still in the mapped
+ * checkpoint, keyed by the base projection they apply to.
+ */
+class LoRAAdapter {
+public:
+    struct Target {
+        const WeightTensor* a = nullptr;    // [rank, inFeatures]
+        const WeightTensor* b = nullptr;    // [outFeatures, rank]
+        int64_t rank = 0;
+        int64_t inFeatures = 0;
+        int64_t outFeatures = 0;
+    };
+
+    /**
+     * Map the PEFT checkpoint at `path` (directory or .safetensors file).
+     * Every lora_A / lora_B pair must match a projection in
+     * `baseWeights`. nullptr (logged) on a missing path, a target without
+     * a base weight, or mismatched shapes.
+     */
+    static std::shared_ptr<LoRAAdapter> open(
+        const std::string& adapterId, const std::string& path,
+        const std::unordered_map<std::string, LinearWeight>& baseWeights);
+
+    const std::string& id() const { return id_; }
+    float scale() const { return scale_; }            // lora_alpha / r
+    const std::unordered_map<std::string, Target>& targets() const { return targets_; }
+    size_t numPages() const;                          // A rows plus B columns
+
+    // Base projection name of a PEFT tensor name ("" if not a LoRA factor)
+    static std::string baseNameOf(const std::string& tensorName, bool& isA);
+
+private:
+    LoRAAdapter() = default;
+
+    std::string id_;
+    float scale_ = 1.0f;
+    std::shared_ptr<WeightStore> store_;
+    std::unordered_map<std::string, Target> targets_;   // [base weight] -> factors
+};
+
+struct AdapterCacheStats {
+    size_t totalPages = 0;
+    size_t freePages = 0;
+    size_t residentAdapters = 0;
+    size_t pinnedAdapters = 0;
+    uint64_t hits = 0;
+    uint64_t misses = 0;                // Paged in
+    uint64_t evictions = 0;
+};
+
+/**
+ * Paged device-side pool of adapter weights. Thread-safe; a pinned
+ * adapter is never evicted, so kernels read its pages without the lock.
+ */
+class AdapterCache {
+public:
+    // `pageFloats` must cover the widest projection dimension
+    AdapterCache(size_t numPages, size_t pageFloats);
+
+    /**
+     * Resident slot for `adapter` (paged in on a miss, evicting LRU
+     * unpinned adapters), pinned until release(). -1 if it cannot fit
+     * next to the pinned adapters.
+     */
+    int acquire(const std::shared_ptr<const LoRAAdapter>& adapter);
+    void release(int slot);
+
+    bool isResident(const std::string& adapterId) const;
+    // Drop an adapter (e.g. unregistered); a pinned one goes on release
+    void evict(const std::string& adapterId);
+
+    /**
+     * output[b] += scale * (x_b A^T) B^T through projection `weightName`
+     * for every row b with rowSlots[b] >= 0 (slots from acquire()).
+     * `output` is [input.rows, outFeatures] row-major; rows whose adapter
+     * does not target the projection are left alone.
+     */
+    void addDelta(const std::string& weightName, const TensorView& input,
+                  const int* rowSlots, float* output) const;
+
+    size_t getPageFloats() const { return pageFloats_; }
+    AdapterCacheStats getStats() const;
+
+private:
+    struct ResidentTarget {
+        int64_t rank = 0;
+        int64_t inFeatures = 0;
+        int64_t outFeatures = 0;
+        std::vector<const float*> aRows;    // Page per row of A
+        std::vector<const float*> bCols;    // Page per column of B
+    };
+
+    struct Slot {
+        std::shared_ptr<const LoRAAdapter> adapter;     // null = free slot
+        std::unordered_map<std::string, ResidentTarget> targets;
+        std::vector<int> pages;
+        int pins = 0;
+        bool retired = false;           // Evict once unpinned
+        uint64_t lastUse = 0;
+    };
+
+    size_t pageFloats_;
+    std::vector<float> arena_;                          // [numPages, pageFloats]
+    std::vector<int> freePages_;
+    std::vector<Slot> slots_;                           // Fixed size: never reallocated
+    std::unordered_map<std::string, int> byId_;         // Live (not retired) adapters
+    uint64_t clock_ = 0;
+    AdapterCacheStats stats_;
+    mutable std::mutex mutex_;
+
+    bool pageInLocked(Slot& slot);
+    void freeSlotLocked(int index);
+    bool evictOneLocked();
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_LORA_H
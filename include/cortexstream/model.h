@@ -3,10 +3,16 @@
 
 #include "request.h"
 #include "scheduler.h"
+#include "weights.h"
 #include <vector>
 #include <string>
 #include <memory>
 #include <cstdint>
+#include <future>
+#include <mutex>
+#include <new>
+#include <unordered_map>
+#include <utility>
 
 // MLX header for Apple Silicon GPU acceleration
 // Uses Metal Performance Shaders (MPS) for efficient computation
@@ -17,9 +23,10 @@
 // ============================================================================
 //
 // GPU Acceleration via MLX:
-// 1. Model Loading: MLX loads weights directly to Metal GPU memory
-//    - Eliminates CPU->GPU transfer overhead
+// 1. Model Loading: safetensors / .mlx shards are memory-mapped (WeightStore)
+//    - MLX arrays wrap the mapped bytes; no parse or copy step
 //    - Unified memory architecture on M-series chips
+//    - Processes serving the same weights share the page cache
 //
 // 2. Tensor Operations: All computations use MLX which automatically dispatches to:
 //    - Metal Performance Shaders (MPS) for matrix operations (fastest)
@@ -40,13 +47,17 @@
 // - Default: FP16 (half precision) on Metal
 //   * 2x faster than FP32 on Metal
 //   * Sufficient precision for LLM generation
-// - Optional: INT8 quantization for memory efficiency
+// - Weight-only INT8 / INT4 (group-quantized engine format): decode streams
+//   2-4x fewer weight bytes; MLX quantized_matmul on Metal, dequant-in-
+//   register kernels on CPU (quant_matmul.h)
 // - GPU handles type conversions transparently
 //
 // Memory Optimizations:
 // - mlx_array: GPU-resident tensors (no CPU copy)
 // - Lazy evaluation: MLX fuses operations before computing
 // - Arena allocation: KV cache uses pre-allocated GPU buffers
+// - Tensor parallelism: heads and MLP columns sharded over N devices,
+//   each with its own KV head shard (tensor_parallel.h)
 //
 // HuggingFace Integration:
 // - loadHuggingFaceModel(modelId): Automatic download & MLX conversion
@@ -59,6 +70,11 @@
 
 namespace cortexstream {
 
+class AdapterCache;
+class Communicator;
+class LoRAAdapter;
+class TensorParallelGroup;
+
 enum class Device {
     MPS,    // Metal Performance Shaders (Apple Silicon) - primary
     CPU     // CPU fallback
@@ -67,7 +83,7 @@ enum class Device {
 enum class DType {
     FP32,   // 32-bit float
     FP16,   // 16-bit float (half precision, faster on Metal)
-    INT8    // 8-bit integer (quantized)
+    INT8    // 8-bit integer (quantized); weight quantization is set by the model file
 };
 
 // Optimized tensor abstraction with MLX support
@@ -84,16 +100,151 @@ struct Tensor {
     }
 };
 
+// Non-owning [rows, cols] view of float logits (a batch, or one row of it).
+// Making one never allocates; the viewed Tensor must outlive it.
+struct TensorView {
+    const float* data = nullptr;
+    int64_t rows = 0;
+    int64_t cols = 0;
+    int64_t rowStride = 0;          // Elements between consecutive rows
+    DType dtype = DType::FP32;      // Producer's dtype; elements are float
+    
+    TensorView() = default;
+    TensorView(const float* data, int64_t cols, DType dtype = DType::FP32)
+        : data(data), rows(1), cols(cols), rowStride(cols), dtype(dtype) {}
+    // Whole tensor: the last dimension is a row, the rest are flattened
+    TensorView(const Tensor& t)
+        : data(t.data.data()),
+          cols(t.shape.empty() ? 0 : t.shape.back()),
+          dtype(t.dtype) {
+        rows = cols > 0 ? static_cast<int64_t>(t.data.size()) / cols : 0;
+        rowStride = cols;
+    }
+    
+    bool empty() const { return data == nullptr || rows == 0 || cols == 0; }
+    const float* rowData(int64_t r) const { return data + r * rowStride; }
+    TensorView row(int64_t r) const { return TensorView(rowData(r), cols, dtype); }
+};
+
+// Allocator for cache-line aligned buffers: vector loads start on a line
+// boundary and threads' scratch buffers never share a line
+template <typename T, size_t Alignment = 64>
+struct AlignedAllocator {
+    using value_type = T;
+    template <typename U> struct rebind { using other = AlignedAllocator<U, Alignment>; };
+    
+    AlignedAllocator() = default;
+    template <typename U>
+    AlignedAllocator(const AlignedAllocator<U, Alignment>&) {}
+    
+    T* allocate(size_t n) {
+        return static_cast<T*>(::operator new(n * sizeof(T), std::align_val_t(Alignment)));
+    }
+    void deallocate(T* p, size_t) {
+        ::operator delete(p, std::align_val_t(Alignment));
+    }
+    
+    template <typename U>
+    bool operator==(const AlignedAllocator<U, Alignment>&) const { return true; }
+    template <typename U>
+    bool operator!=(const AlignedAllocator<U, Alignment>&) const { return false; }
+};
+
+template <typename T>
+using AlignedVector = std::vector<T, AlignedAllocator<T>>;
+
+/**
+ * Per-thread scratch buffers for the sampling path. Each buffer grows to
+ * the largest size requested and is then reused, so steady-state sampling
+ * performs no heap allocation. Numbered float slots let one call hold
+ * several buffers at once. All buffers are cache-line aligned.
+ */
+class ScratchArena {
+public:
+    static constexpr size_t kFloatSlots = 3;
+    
+    static ScratchArena& local();   // This thread's arena
+    
+    // Grow every buffer to `count` elements up front (e.g. the vocab size),
+    // so no buffer is resized partway through a sampling pass
+    void reserve(size_t count);
+    
+    float* floats(size_t count, size_t slot = 0);
+    std::pair<float, int>* pairs(size_t count);
+    // Zero-initialized when grown; callers must clear what they set
+    uint8_t* flags(size_t count);
+    
+private:
+    AlignedVector<float> floats_[kFloatSlots];
+    AlignedVector<std::pair<float, int>> pairs_;
+    AlignedVector<uint8_t> flags_;
+};
+
 class ModelBackend {
 public:
     explicit ModelBackend(Device device = Device::MPS, DType dtype = DType::FP16);
     ~ModelBackend();
 
     // Model lifecycle
-    // Supports: .mlx files, local directories
+    // Supports: .safetensors / .mlx files, directories of shards. Weights are
+    // mapped, not read; the architecture comes from the engine-format
+    // config or config.json, completed from the tensors. A path that does
+    // not exist loads placeholder metadata (demo builds).
     bool loadModel(const std::string& modelPath);
     bool isLoaded() const;
+    
+    // Mapped weights; nullptr for a placeholder model
+    std::shared_ptr<const WeightStore> getWeights() const;
+    // Architecture of the loaded weights (head geometry for KVCache sizing);
+    // empty for a placeholder model
+    const ModelConfig& getConfig() const;
+    
+    // Weight-only quantized inference: set by an INT8 / INT4 engine-format
+    // model (cortexstream-convert), independent of the activation DType
+    bool isQuantized() const;
+    QuantFormat getWeightFormat() const;
+    
+    // input [batch, inFeatures] x W^T through projection weight `weightName`
+    // -> [batch, outFeatures]. Quantized weights run MLX quantized_matmul on
+    // Metal and the dequant-in-register kernels (quant_matmul.h) on CPU.
+    // Throws std::runtime_error for an unknown weight or width mismatch.
+    Tensor linear(const std::string& weightName, const TensorView& input);
 
+    // Tensor parallelism (tensor_parallel.h): attention heads and MLP
+    // columns of every projection are sharded over `worldSize` in-process
+    // ranks, or over the ranks of `communicator` (one process per device),
+    // and linear() gathers / all-reduces the shard outputs. Call after
+    // loadModel(); a world size of 1 turns it off. false (logged) if the
+    // model's geometry does not split.
+    bool setTensorParallel(int worldSize);
+    bool setTensorParallel(std::shared_ptr<Communicator> communicator);
+    int getTensorParallelSize() const;
+    // The group (KV head shards, per-rank weights); nullptr when unsharded
+    std::shared_ptr<TensorParallelGroup> getTensorParallel() const;
+    
+    // ---- Multi-LoRA (lora.h) ----
+    // Adapters of the loaded base model, served from one paged cache.
+    // registerAdapter maps a PEFT checkpoint; its weights page into the
+    // cache on first use and are evicted LRU. false (logged) if the
+    // factors do not match the base projections.
+    bool registerAdapter(const std::string& adapterId, const std::string& path);
+    void unregisterAdapter(const std::string& adapterId);
+    bool hasAdapter(const std::string& adapterId) const;
+    
+    // Replace the cache with `numPages` pages of `pageFloats` floats (0 =
+    // the widest projection); false while adapters are pinned
+    bool configureAdapterCache(size_t numPages, size_t pageFloats = 0);
+    std::shared_ptr<AdapterCache> getAdapterCache() const;
+    
+    // Pin the adapters of a batch's requests and return each row's slot
+    // (-1 = base model). Throws std::runtime_error for an unknown adapter
+    // or when the cache cannot hold them all; release with releaseAdapters
+    std::vector<int> acquireAdapters(const Batch& batch);
+    void releaseAdapters(const std::vector<int>& rowSlots);
+    
+    // linear() plus row b's adapter update (rowSlots[b] from acquireAdapters)
+    Tensor linear(const std::string& weightName, const TensorView& input,
+                  const std::vector<int>& rowSlots);
     
     // Forward passes (Metal-accelerated via MLX on Apple Silicon)
     // prefill: processes full prompt sequence once
@@ -101,8 +252,20 @@ public:
     Tensor prefill(const Batch& batch, const std::vector<int>& tokenIds);
     Tensor decode(const Batch& batch, const std::vector<int>& tokenIds);
     
+    // Launch decode without waiting for it (pipelined engine). Not safe to
+    // overlap with another forward pass or with KV changes: callers wait on
+    // the future before either (the engine's settleInFlight).
+    std::future<Tensor> decodeAsync(const Batch& batch, std::vector<int> tokenIds);
+    
+    // Multi-token decode (speculative verification): row i feeds
+    // sequenceLengths[i] consecutive tokens against its cached KV, and the
+    // result holds logits for every fed position in order,
+    // [sum(sequenceLengths), vocab]
+    Tensor decodeTokens(const Batch& batch, const std::vector<int>& tokenIds);
+    
     // Sampling (GPU-accelerated on Metal when available)
-    int sampleToken(const Tensor& logits, const SamplingParams& params);
+    // `logits` is one row (a Tensor converts implicitly); no copy is made
+    int sampleToken(const TensorView& logits, const SamplingParams& params);
     
     // Model metadata
     size_t getHiddenSize() const;
@@ -130,6 +293,15 @@ private:
     // MLX model: wraps native MLX array/module for GPU computation
     bool loaded = false;
     std::string modelPath;
+    std::shared_ptr<WeightStore> weights;
+    ModelConfig config;
+    std::unordered_map<std::string, LinearWeight> linearWeights;   // Built at load
+    std::shared_ptr<TensorParallelGroup> tensorParallel;            // Views into linearWeights' bytes
+    
+    // Registered adapters and their device-side cache (adapterMutex)
+    std::unordered_map<std::string, std::shared_ptr<const LoRAAdapter>> adapters;
+    std::shared_ptr<AdapterCache> adapterCache;
+    mutable std::mutex adapterMutex;
     
     // Model architecture info
     size_t hiddenSize = 0;
@@ -154,14 +326,16 @@ private:
                       const std::vector<int>& tokenIds,
                       bool isPrefill);
     
-    int sampleGreedy(const Tensor& logits);
-    int sampleTopK(const Tensor& logits, int k, float temperature);
-    int sampleTopP(const Tensor& logits, float p, float temperature);
+    int sampleGreedy(const TensorView& logits);
+    int sampleTopK(const TensorView& logits, int k, float temperature);
+    int sampleTopP(const TensorView& logits, float p, float temperature);
     
     // GPU helpers
     mlx::core::array toMLXArray(const std::vector<float>& data, 
                                  const std::vector<int64_t>& shape);
     std::vector<float> fromMLXArray(const mlx::core::array& arr);
+    // Zero-copy: the array aliases the mapping and keeps the store alive
+    mlx::core::array toMLXArray(const WeightTensor& tensor) const;
 
 };
 
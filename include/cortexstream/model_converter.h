@@ -0,0 +1,40 @@
+#ifndef CORTEXSTREAM_MODEL_CONVERTER_H
+#define CORTEXSTREAM_MODEL_CONVERTER_H
+
+#include "weights.h"
+#include <cstddef>
+#include <string>
+
+namespace cortexstream {
+
+struct ConvertOptions {
+    std::string inputPath;          // HF checkpoint directory or safetensors file
+    std::string outputPath;         // Engine-format file (.cstream)
+    std::string tokenizerPath;      // Empty: tokenizer.json beside the input
+    QuantFormat format = QuantFormat::FP16;
+    int groupSize = 64;             // Columns per quantization scale
+};
+
+struct ConvertReport {
+    size_t tensors = 0;             // Written, scales and tokenizer included
+    size_t quantized = 0;           // Weights stored as INT8 / INT4
+    size_t inputBytes = 0;
+    size_t outputBytes = 0;
+    bool hasTokenizer = false;
+};
+
+/**
+ * Rewrites a checkpoint into the engine format (see weights.h): floats
+ * become FP16 or group-quantized INT8 / INT4, the config and tokenizer are
+ * embedded, and every tensor is aligned for mapping. The file is written
+ * beside the output and renamed into place, so readers never see a
+ * partial model.
+ *
+ * false (logged) if the input does not load, its config lacks the head
+ * geometry, the options are invalid or the output cannot be written.
+ */
+bool convertModel(const ConvertOptions& options, ConvertReport* report = nullptr);
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_MODEL_CONVERTER_H
@@ -0,0 +1,42 @@
+#ifndef CORTEXSTREAM_QUANT_MATMUL_H
+#define CORTEXSTREAM_QUANT_MATMUL_H
+
+#include "model.h"
+#include "weights.h"
+#include <cstdint>
+#include <string>
+
+// ============================================================================
+// Weight-Only Quantized Matmul - CPU Fallback Kernels
+// ============================================================================
+//
+// Decode is memory bound: every step streams every weight once, so bytes
+// per weight set the ceiling. Weights stay packed in the mapped file
+// (INT4: 0.5 B + 2 B scale per group, INT8: 1 B) and are dequantized group
+// by group into a cache-resident buffer right before the dot products:
+//
+// - One group (e.g. 64 weights) is decoded once and reused for every
+//   activation row of the batch, so prefill and batched decode read each
+//   weight byte once per call
+// - The per-group scale multiplies the group's partial sum, not every
+//   weight
+// - Output rows are split across OpenMP threads; inner loops are
+//   `omp simd` (NEON / AVX2 code generation without intrinsics)
+//
+// On Metal the same bytes go to MLX quantized_matmul (see ModelBackend).
+// Activations enter and results leave as float; accumulation is FP32.
+//
+// ============================================================================
+
+namespace cortexstream {
+
+/**
+ * y = x W^T: `input` is [batch, inFeatures] (any row stride), `output`
+ * receives [batch, outFeatures] row-major. false (nothing written) on a
+ * width mismatch.
+ */
+bool linearForward(const LinearWeight& weight, const TensorView& input, float* output);
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_QUANT_MATMUL_H
@@ -1,6 +1,7 @@
 #ifndef CORTEXSTREAM_REQUEST_H
 #define CORTEXSTREAM_REQUEST_H
 
+#include "seq_id.h"
 #include <atomic>
 #include <chrono>
 #include <cstdint>
@@ -11,15 +12,30 @@
 
 namespace cortexstream {
 
+class StopMatcher;
+class TokenAutomaton;
+class TokenStream;
+
 // Request lifecycle states used by the scheduler/engine
 enum class RequestState {
     Pending,
     Prefilling,
     Decoding,
+    Swapped,        // Preempted; KV parked in the swap tier
     Finished,
     Failed
 };
 
+// Why a finished request stopped generating
+enum class StopReason {
+    None,
+    MaxTokens,
+    EndOfSequence,  // Tokenizer's EOS token
+    StopToken,      // A stop token or stop token sequence
+    StopString,
+    Constraint      // Constrained output complete
+};
+
 // Sampling configuration (shared with sampler/model backend)
 struct SamplingParams {
     // Core strategies
@@ -71,6 +87,7 @@ public:
 
     // ---- Immutable Input ----
     const std::string& getId() const;
+    SeqId getSeqId() const;                            // Dense handle for hot paths
     const std::string& getPrompt() const;              // legacy alias
     const std::string& getPromptText() const;
     const std::vector<int>& getInputTokens() const;    // legacy alias
@@ -90,11 +107,56 @@ public:
     const std::string& getStopString() const;
     void setStopString(const std::string& stopStr);
     
+    // Any number of stop strings / token sequences; with the single forms
+    // above they compile into one StopMatcher (see stop_matcher.h). Stop
+    // strings need a tokenizer on the engine (InferenceEngine::setTokenizer).
+    const std::vector<std::string>& getStopStrings() const;
+    void setStopStrings(const std::vector<std::string>& strings);
+    const std::vector<std::vector<int>>& getStopSequences() const;
+    void setStopSequences(const std::vector<std::vector<int>>& sequences);
+    // nullptr when the request has no stop criteria of its own
+    const std::shared_ptr<const StopMatcher>& getStopMatcher() const;
+    
+    // Keep generating past the tokenizer's EOS token (default false)
+    bool isIgnoringEos() const;
+    void setIgnoreEos(bool ignore);
+    
+    // ---- Constrained Decoding ----
+    
+    // Restrict the output to what `automaton` accepts (see constraint.h);
+    // set before submission. The request finishes once it is complete.
+    void setConstraint(std::shared_ptr<const TokenAutomaton> automaton);
+    bool hasConstraint() const;
+    const std::shared_ptr<const TokenAutomaton>& getConstraint() const;
+    int getConstraintState() const;
+    // Packed mask for the next token; nullptr when unconstrained
+    const uint64_t* getAllowedTokens() const;
+    size_t getConstraintVocabSize() const;
+    bool isConstraintComplete() const;
+    
     // ---- Scheduling Controls ----
     
     RequestState getState() const;
     void setState(RequestState state);
     
+    // Priority class: higher runs first (default 0)
+    int getPriority() const;
+    void setPriority(int priority);
+    
+    // Latency SLO, relative to arrival; 0 = no deadline
+    uint64_t getDeadlineNs() const;                    // Absolute, arrival clock
+    bool hasDeadline() const;
+    void setDeadline(std::chrono::milliseconds sinceArrival);
+    
+    // Fair-share accounting key (weighted fair policy)
+    const std::string& getTenant() const;
+    void setTenant(const std::string& tenant);
+    
+    // LoRA adapter registered on the backend (ModelBackend::registerAdapter);
+    // empty = base model. Set before submission.
+    const std::string& getAdapter() const;
+    void setAdapter(const std::string& adapterId);
+    
     // ---- Streaming ----
     
     bool isStreamingEnabled() const;
@@ -116,9 +178,21 @@ public:
     int getGeneratedTokenCount() const;                // legacy alias
     int getGeneratedLength() const;
     
+    // Prefill cursor: prompt tokens whose KV is already resident (prefix-cache
+    // hit or earlier prefill chunks). Prefill resumes from this point while
+    // the request is Prefilling.
+    int getNumComputedTokens() const;
+    void setNumComputedTokens(int count);
+    
     bool isFinished() const;
     bool isFailed() const;
     
+    StopReason getStopReason() const;
+    // The stop string that ended generation (empty otherwise); it is the
+    // tail of the generated text
+    const std::string& getMatchedStop() const;
+    void setStopReason(StopReason reason, const std::string& matched = "");
+    
     // ---- Error Handling ----
     
     const std::string& getErrorMessage() const;
@@ -129,19 +203,45 @@ public:
     using TokenCallback = std::function<void(int token, bool finished)>;
     void setTokenCallback(TokenCallback callback);
     void notifyToken(int token, bool finished);
+    
+    // ---- Stream Delivery ----
+    
+    // Ring the engine pushes generated tokens into instead of (or besides)
+    // the callback; drained by a client thread (see token_stream.h). Set
+    // before submission.
+    void setTokenStream(std::shared_ptr<TokenStream> stream);
+    const std::shared_ptr<TokenStream>& getTokenStream() const;
+    // Stream past its high-water mark: the scheduler holds back decode
+    bool isStreamBackpressured() const;
+    // Generated tokens already pushed into the stream (engine-facing)
+    int getStreamedLength() const;
+    void setStreamedLength(int count);
 
 private:
     std::string id_;
+    SeqId seqId_;
     std::string promptText_;
     std::vector<int> promptTokens_;
     int maxTokens_;
     
     std::vector<int> stopTokens_;
     std::string stopString_;
+    std::vector<std::string> stopStrings_;
+    std::vector<std::vector<int>> stopSequences_;
+    std::shared_ptr<const StopMatcher> stopMatcher_;
+    bool ignoreEos_ = false;
+    
+    std::shared_ptr<const TokenAutomaton> constraint_;
+    int constraintState_ = 0;
 
     SamplingParams samplingParams_;
     bool streaming_ = true;
     
+    int priority_ = 0;
+    uint64_t deadlineNs_ = 0;
+    std::string tenant_;
+    std::string adapter_;
+    
     uint64_t arrivalTimestampNs_;
     
     // Mutable runtime state
@@ -150,11 +250,18 @@ private:
     // Engine-facing state
     RequestState state_ = RequestState::Pending;
     std::vector<int> generatedTokens_;
+    int numComputedTokens_ = 0;
     bool finished_ = false;
     bool failed_ = false;
+    StopReason stopReason_ = StopReason::None;
+    std::string matchedStop_;
     std::string errorMessage_;
     
+    void rebuildStopMatcher();
+    
     TokenCallback tokenCallback_;
+    std::shared_ptr<TokenStream> tokenStream_;
+    int streamedLength_ = 0;
 };
 
 }  // namespace cortexstream
@@ -0,0 +1,210 @@
+#ifndef CORTEXSTREAM_ROUTER_H
+#define CORTEXSTREAM_ROUTER_H
+
+#include "engine.h"
+#include "kv_cache.h"
+#include "request.h"
+#include "scheduler.h"
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// EngineRouter - KV-Aware Load Balancing Across Engine Replicas
+// ============================================================================
+//
+// Fronts N engine replicas (one per GPU, or remote nodes) and picks one per
+// request:
+//
+// - Prefix affinity: a replica whose prefix cache already holds the
+//   prompt's leading blocks skips that prefill. Each replica is probed
+//   (KVCache::matchPrefix for local ones) and the router remembers where
+//   it recently sent each block-aligned prefix, so a burst sharing a new
+//   system prompt sticks together before any of it is resident
+// - Load: queue depth and free KV blocks break ties and keep a hot prefix
+//   from overloading one replica - affinity is ignored once its replica
+//   is more than `maxQueueImbalance` requests deeper than the shallowest
+// - Health: unhealthy or disabled replicas get no traffic; a replica with
+//   repeated submit failures is only tried after every other one, and a
+//   successful submit restores it
+// - Multi-model: each replica serves one model name; requests name the
+//   model they want (empty = any)
+//
+// Remote engines plug in by implementing EngineReplica over their RPC.
+//
+// ============================================================================
+
+namespace cortexstream {
+
+// What a replica reports for routing; cheap enough to query per request
+struct ReplicaLoad {
+    bool healthy = true;
+    int pendingRequests = 0;            // Waiting for admission
+    int activeRequests = 0;
+    size_t freeKVBlocks = 0;            // Including evictable prefix blocks
+    size_t totalKVBlocks = 0;
+    size_t kvBlockSize = 16;            // Tokens per block
+};
+
+/**
+ * One engine instance behind the router.
+ *
+ * Implementations must be thread-safe: route() calls load() and
+ * cachedPrefixTokens() concurrently from submitting threads.
+ */
+class EngineReplica {
+public:
+    virtual ~EngineReplica() = default;
+
+    virtual const std::string& name() const = 0;
+    virtual const std::string& model() const = 0;
+
+    virtual ReplicaLoad load() const = 0;
+
+    // Leading prompt tokens already resident in the replica's KV cache
+    // for `adapter` ("" = base model); KV is never shared across adapters
+    virtual int cachedPrefixTokens(const std::vector<int>& promptTokens,
+                                   const std::string& adapter) const = 0;
+
+    // Hand the request to the replica; false if it was not accepted
+    virtual bool submit(std::shared_ptr<Request> request) = 0;
+};
+
+/**
+ * In-process replica: the scheduler, cache and engine of one
+ * InferenceEngine (the engine is expected to be running).
+ */
+class LocalReplica : public EngineReplica {
+public:
+    LocalReplica(std::string name, std::string model,
+                 std::shared_ptr<InferenceEngine> engine,
+                 std::shared_ptr<Scheduler> scheduler,
+                 std::shared_ptr<KVCache> cache);
+
+    const std::string& name() const override { return name_; }
+    const std::string& model() const override { return model_; }
+    ReplicaLoad load() const override;
+    int cachedPrefixTokens(const std::vector<int>& promptTokens,
+                           const std::string& adapter) const override;
+    bool submit(std::shared_ptr<Request> request) override;
+
+    const std::shared_ptr<InferenceEngine>& getEngine() const { return engine_; }
+
+private:
+    std::string name_;
+    std::string model_;
+    std::shared_ptr<InferenceEngine> engine_;
+    std::shared_ptr<Scheduler> scheduler_;
+    std::shared_ptr<KVCache> cache_;
+};
+
+struct RouterConfig {
+    // Score = prefixWeight * (resident fraction of the prompt)
+    //       - queueWeight  * (queued + active) / (fleet max + 1)
+    //       - kvWeight     * (used KV fraction)
+    double prefixWeight = 1.0;
+    double queueWeight = 0.5;
+    double kvWeight = 0.25;
+
+    // Affinity only wins while its replica's queue is at most this much
+    // deeper than the shallowest eligible replica's
+    int maxQueueImbalance = 8;
+
+    // Consecutive failed submits before a replica is only tried last
+    int maxSubmitFailures = 3;
+
+    // Granularity of remembered prefixes (the replicas' KV block size)
+    size_t affinityBlockTokens = 16;
+
+    // Block-aligned prefixes remembered per router (oldest dropped first)
+    size_t affinityCapacity = 1 << 16;
+};
+
+// Per-replica view for health checks and dashboards
+struct ReplicaStatus {
+    std::string name;
+    std::string model;
+    bool enabled = true;
+    bool healthy = true;                // Reported healthy and not failing submits
+    ReplicaLoad load;
+    size_t routedRequests = 0;
+    size_t affinityRoutes = 0;          // Routed for a resident or recent prefix
+    size_t routedPromptTokens = 0;
+    size_t expectedHitTokens = 0;       // Prompt tokens expected resident at routing
+    size_t failedSubmits = 0;
+};
+
+class EngineRouter {
+public:
+    explicit EngineRouter(RouterConfig config = RouterConfig());
+
+    // Returns the replica's index
+    size_t addReplica(std::shared_ptr<EngineReplica> replica);
+    size_t getNumReplicas() const;
+
+    // Drain a replica for maintenance (no new requests) or bring it back
+    void setReplicaEnabled(size_t index, bool enabled);
+
+    /**
+     * Route and submit. `model` restricts the choice to replicas serving
+     * it (empty: any). Falls back to the next-best replica if the chosen
+     * one refuses. Returns the replica index, or -1 (logged) if none
+     * accepted the request.
+     */
+    int submit(std::shared_ptr<Request> request, const std::string& model = "");
+
+    // The replica submit() would pick now, without submitting; -1 if none
+    int route(const Request& request, const std::string& model = "") const;
+
+    std::vector<ReplicaStatus> getReplicaStatus() const;
+
+private:
+    struct Candidate {
+        size_t index = 0;
+        double score = 0.0;
+        int expectedHitTokens = 0;
+        bool affinity = false;
+        bool failing = false;           // Past maxSubmitFailures: tried last
+        std::shared_ptr<EngineReplica> replica;
+    };
+
+    struct ReplicaSlot {
+        std::shared_ptr<EngineReplica> replica;
+        bool enabled = true;
+        int consecutiveFailures = 0;
+        size_t routedRequests = 0;
+        size_t affinityRoutes = 0;
+        size_t routedPromptTokens = 0;
+        size_t expectedHitTokens = 0;
+        size_t failedSubmits = 0;
+    };
+
+    struct AffinityEntry {
+        size_t replica = 0;
+        uint64_t lastUse = 0;
+    };
+
+    RouterConfig config;
+    std::vector<ReplicaSlot> replicas;                  // Guarded by mutex
+    std::unordered_map<uint64_t, AffinityEntry> affinity;  // [prefix hash] -> replica
+    uint64_t affinityClock = 0;
+    mutable std::mutex mutex;
+
+    // Eligible replicas, best first; replicas are queried without the lock
+    std::vector<Candidate> rank(const Request& request, const std::string& model,
+                                const std::vector<uint64_t>& hashes) const;
+    void rememberLocked(const std::vector<uint64_t>& hashes, size_t replica);
+
+    // Rolling hash of every block-aligned prompt prefix, shortest first,
+    // seeded with the adapter so prefixes never attract across adapters
+    static std::vector<uint64_t> prefixHashes(const std::vector<int>& promptTokens,
+                                              const std::string& adapter,
+                                              size_t blockSize);
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_ROUTER_H
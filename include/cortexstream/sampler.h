@@ -3,10 +3,11 @@
 
 #include "model.h"
 #include <vector>
+#include <atomic>
 #include <cstdint>
+#include <limits>
 #include <random>
 #include <optional>
-#include <unordered_map>
 #include <utility>
 
 // ============================================================================
@@ -16,42 +17,68 @@
 // This module contains all sampling operations optimized for Apple Silicon (M1+).
 // Key optimizations:
 // 
-// 1. MLX GPU Acceleration
-//    - softmaxNormalize(): Uses MLX on Metal for GPU softmax computation
-//    - categoricalSample(): Uses MLX multinomial on GPU for fast sampling
-//    - applyTemperature(): Vectorized via MLX for element-wise operations
-//    - Falls back to CPU implementations automatically if MLX unavailable
+// 1. Fused Row Sampling
+//    - sampleRow(): penalty, temperature, top-k/top-p and the categorical
+//      draw in one pass over a single scratch working copy
+//    - Vocab-wide loops (scale, max, exp/sum) are `omp simd` reductions
+//    - sampleBatch(): rows of the [batch, vocab] logits run in parallel,
+//      each with its own SamplingParams and RNG stream
+//    - Counter-based RNG: a draw depends only on (stream, position), so
+//      seeded requests replay identically in any batch, on any thread
 //
-// 2. SIMD Vectorization
-//    - applyRepetitionPenalty(): Uses #pragma omp simd for cache-friendly loops
-//    - 8-element SIMD stride for better instruction-level parallelism
-//    - Branch-free penalty application (no divergent branches)
+// 2. Zero-Copy Inputs
+//    - Logits arrive as a TensorView over the backend's batch buffer
+//    - Greedy decoding reads the view directly; other paths transform one
+//      working copy in place, held in the per-thread ScratchArena
+//    - applyRepetitionPenalty(): O(history), touches repeated tokens only
 //
 // 3. Algorithmic Improvements
 //    - getTopK(): O(n log k) partial sort instead of O(n log n) full sort
 //    - Uses nth_element for better cache locality
-//    - getNucleus(): O(n log n) single pass instead of O(n²)
+//    - Nucleus filtering is a prefix scan over descending candidates
 //
-// 4. Memory Caching
-//    - softmax_cache_: LRU cache for softmax computations (128 entry limit)
-//    - Reduces redundant GPU->CPU synchronization
-//    - Hash-based lookup for O(1) cache hits
+// 4. Workspaces Instead of Caching
+//    - Softmax and top-k scratch live in cache-line aligned per-thread
+//      ScratchArena buffers, sized to the vocab once per thread
+//    - No per-token hashing: logits differ every step, so a hash-keyed
+//      softmax cache cost a full pass per token and almost never hit
+//    - setMemoization(): opt-in exact-match memo within a batch; rows whose
+//      logits and sampling inputs repeat an earlier row reuse its token
 //
-// 5. Numerical Safety
-//    - Clamps logits to [-1e9, 1e9] to prevent numerical overflow
+// 5. Constrained Decoding
+//    - SampleRow::allowed: packed token mask from a TokenAutomaton
+//      (constraint.h), applied before top-k/top-p as one simd pass
+//
+// 6. Numerical Safety
 //    - Subtracts max logit before exp() for stability
 //    - Validates probability sums before sampling
 //
 // Performance Impact:
 // - GPU softmax: 10-50x faster than CPU exp/sum
 // - Parallel token sampling: 4-8x on M-series chips
-// - Cached softmax: 100x if hit (rare repeated logits)
+// - Memoized rows: one sampling pass per distinct row (forked sequences)
 // - Top-K selection: 2-3x faster with partial_sort
 //
 // ============================================================================
 
 namespace cortexstream {
 
+/**
+ * One row of a fused batched sample.
+ * `stream` keys the row's RNG (see Sampler::streamKey()) and `position`
+ * indexes into it; the same pair always yields the same draw.
+ */
+struct SampleRow {
+    const SamplingParams* params = nullptr;      // nullptr: the sampler's own
+    const std::vector<int>* history = nullptr;   // Generated tokens (penalty)
+    uint64_t stream = 0;
+    uint64_t position = 0;                       // Tokens generated so far
+    // Packed token mask (bit t = token t may be drawn); tokens at or past
+    // allowedSize are masked too. nullptr: unconstrained.
+    const uint64_t* allowed = nullptr;
+    size_t allowedSize = 0;
+};
+
 struct SamplingMetadata {
     float chosenProb = 0.0f;
     float entropy = 0.0f;
@@ -69,52 +96,90 @@ public:
     const SamplingParams& getParams() const;
     void setSeed(int seed);
 
-    int sampleToken(const Tensor& logits,
+    // Logits are a view (a Tensor converts implicitly); the sampling path
+    // does no per-token heap allocation
+    int sampleToken(const TensorView& logits,
                     const std::vector<int>& generatedHistory = {});
     std::vector<int> sampleBatch(
-        const Tensor& batchedLogits,
+        const TensorView& batchedLogits,
         const std::vector<std::vector<int>>& histories = {});
 
+    /**
+     * Fused batched sampling: row i of `batchedLogits` is sampled with
+     * rows[i]'s params, history and RNG stream, rows in parallel. Rows with
+     * invalid params or no logits yield -1. Does not touch sampler state,
+     * so concurrent calls are safe.
+     */
+    std::vector<int> sampleBatch(const TensorView& batchedLogits,
+                                 const std::vector<SampleRow>& rows) const;
+
+    // RNG stream for a row: fixed for a given seed, fresh on every call
+    // when unseeded (seed = -1)
+    uint64_t streamKey(const SamplingParams& rowParams) const;
+
     std::optional<SamplingMetadata> getLastMetadata() const;
 
-    void clearSoftmaxCache();
-    size_t getSoftmaxCacheSize() const;
+    /**
+     * Exact-match memo for sampleBatch (off by default). A row that repeats
+     * an earlier row of the same batch - bitwise-equal logits and, unless
+     * both are plain greedy, the same params, history, stream and position -
+     * reuses that row's token instead of being sampled again. Candidates are
+     * found by a few strided probes, then confirmed with one memcmp.
+     */
+    void setMemoization(bool enabled);
+    bool isMemoizing() const;
 
 private:
     SamplingParams params;
     std::mt19937 rng;
+    uint64_t streamEntropy = 0;                   // Base for unseeded streams
+    mutable std::atomic<uint64_t> nextStream{0};
     std::optional<SamplingMetadata> lastMetadata;
 
-    std::unordered_map<size_t, std::vector<float>> softmax_cache_;
-    static constexpr size_t MAX_SOFTMAX_CACHE_SIZE = 128;
+    std::atomic<bool> memoize{false};
+
+    // ScratchArena float slots used while sampling one row
+    static constexpr size_t kWorkSlot = 0;   // Working copy of the logits
+    static constexpr size_t kProbSlot = 1;   // Candidate probabilities
+
+    // Finite, so fast-math builds keep it ordered; exp() of it underflows to 0
+    static constexpr float kMaskedLogit = -std::numeric_limits<float>::max();
 
     void initRNG();
 
-    Tensor applyTemperature(const Tensor& logits);
-    Tensor applyRepetitionPenalty(const Tensor& logits,
-                                  const std::vector<int>& history);
-    Tensor softmaxNormalize(const Tensor& logits);
-
-    int greedySelect(const Tensor& logits);
-    int topKSample(const Tensor& logits);
-    int topPSample(const Tensor& logits);
-    int topKPSample(const Tensor& logits);
-
-    std::vector<std::pair<float, int>> getTopK(
-        const std::vector<float>& logits, int k);
-    std::vector<std::pair<float, int>> getNucleus(
-        const std::vector<float>& probs, float p);
-    int categoricalSample(const std::vector<float>& probs);
+    // The whole per-row pipeline; scratch comes from the thread's arena.
+    // -1 when the row's mask allows no token.
+    static int sampleRow(const float* logits, size_t n,
+                         const SamplingParams& rowParams, const SampleRow& row);
+
+    // In-place transforms of a scratch working copy
+    static void applyRepetitionPenalty(float* logits, size_t n,
+                                       const std::vector<int>& history,
+                                       float penalty);
+    static void applyTokenMask(float* logits, size_t n,
+                               const uint64_t* allowed, size_t allowedSize);
+
+    static int greedySelect(const float* logits, size_t n);
+
+    // Results live in the thread's ScratchArena pairs buffer, sorted
+    // descending; `count` receives their number
+    static const std::pair<float, int>* getTopK(
+        const float* logits, size_t n, int k, size_t& count);
+
+    // Shortest prefix of descending `probs` whose mass reaches `target`;
+    // `mass` receives that prefix's total
+    static size_t nucleusPrefix(const float* probs, size_t n,
+                                float target, float& mass);
+    // Inverse-transform draw of `u` in [0, 1) over unnormalized `probs`
+    static size_t categoricalSample(const float* probs, size_t n,
+                                    float mass, float u);
     float computeEntropy(const std::vector<float>& probs);
 
-    size_t hashLogits(const std::vector<float>& logits) const;
-    std::vector<float>* getCachedSoftmax(const std::vector<float>& logits);
-    void cacheSoftmax(const std::vector<float>& logits,
-                      const std::vector<float>& probs);
-
-    static constexpr float MIN_LOGIT = -1e9f;
-    static constexpr float MAX_LOGIT = 1e9f;
-    void safeSoftmax(std::vector<float>& logits, float temperature);
+    // Memo: source[i] = earlier row whose token row i reuses, or -1
+    static void findRepeatedRows(const TensorView& batchedLogits,
+                                 const std::vector<SampleRow>& rows,
+                                 const SamplingParams& fallback,
+                                 std::vector<int>& source);
 };
 
 }  // namespace cortexstream
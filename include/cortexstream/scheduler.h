@@ -1,69 +1,176 @@
 #ifndef CORTEXSTREAM_SCHEDULER_H
 #define CORTEXSTREAM_SCHEDULER_H
 
+#include "metrics.h"
 #include "request.h"
-#include <queue>
+#include "scheduling_policy.h"
+#include <deque>
 #include <vector>
 #include <memory>
 #include <string>
 #include <mutex>
+#include <condition_variable>
+#include <unordered_map>
 
 namespace cortexstream {
 
+// Victim choice when KV must be reclaimed from running sequences
+enum class PreemptionPolicy {
+    LowestProgress,     // Fewest generated tokens (least work lost)
+    LatestArrival       // Most recently submitted
+};
+
 struct Batch {
     std::vector<std::shared_ptr<Request>> requests;
     std::vector<int> sequenceLengths;
-    int batchSize;
-    bool isPrefill;
+    std::vector<int> startPositions;    // Prefill: context offset of each chunk
+    int batchSize = 0;
+    bool isPrefill = false;
     
     bool empty() const { return requests.empty(); }
     void clear() {
         requests.clear();
         sequenceLengths.clear();
+        startPositions.clear();
         batchSize = 0;
     }
 };
 
+/**
+ * One engine iteration under continuous batching: a decode token for each
+ * running sequence plus prefill work from waiting requests, bounded by a
+ * shared per-step token budget.
+ */
+struct ScheduledStep {
+    Batch decode;
+    Batch prefill;
+    int numTokens = 0;
+    int numThrottled = 0;       // Decoding sequences held back by stream backpressure
+
+    bool empty() const { return decode.empty() && prefill.empty(); }
+};
+
 class Scheduler {
 public:
-    explicit Scheduler(int maxBatchSize = 32);
+    explicit Scheduler(int maxBatchSize = 32, int maxTokensPerStep = 2048);
     ~Scheduler();
 
     // Request submission
     bool submitRequest(std::shared_ptr<Request> request);
     
+    // Engine wake-up: blocks until work is queued or interrupt() is called
+    void waitForWork();
+    void interrupt();
+    
     // State queries
     bool hasWork() const;
     bool hasPendingRequests() const;
     bool hasActiveRequests() const;
     int getNumActiveRequests() const;
+    int getNumPendingRequests() const;
+    
+    // Continuous batching: decode first, then prefill/admission while both
+    // the token budget and `freeKVTokens` allow
+    ScheduledStep scheduleStep(size_t freeKVTokens);
     
-    // Batch building
+    // Batch building (legacy two-phase API)
     void acceptNewRequests();
     Batch buildPrefillBatch();
     Batch buildDecodeBatch();
     
-    // Request management
-    void markRequestReady(const std::string& requestId);
-    void markRequestFinished(const std::string& requestId);
-    void markRequestFailed(const std::string& requestId);
+    // Request management: O(1) by Request::getSeqId()
+    void markRequestReady(SeqId seq);
+    void markRequestFinished(SeqId seq);
+    void markRequestsFinished(const std::vector<SeqId>& seqs);  // One lock, one pass
+    void markRequestFailed(SeqId seq);
+    
+    // Preemption
+    void setPreemptionPolicy(PreemptionPolicy policy);
+    std::shared_ptr<Request> selectPreemptionVictim();
+    void markRequestSwapped(SeqId seq);
+    void markRequestResumed(SeqId seq);
+    void markRequestForRecompute(SeqId seq);
+    std::vector<std::shared_ptr<Request>> getSwappedRequests() const;
     
-    // Lookup
+    // Lookup (by string ID: linear, API edge only)
+    std::shared_ptr<Request> getRequest(SeqId seq);
     std::shared_ptr<Request> getRequest(const std::string& requestId);
     
+    // Hand finished/failed requests to the engine for resource release
+    std::vector<std::shared_ptr<Request>> drainCompletedRequests();
+    
     // Statistics
     int getMaxBatchSize() const;
+    int getMaxTokensPerStep() const;
+    void setMaxTokensPerStep(int maxTokens);
+    
+    // Prefill chunk size in tokens (0 = whole prompt in one step)
+    int getPrefillChunkSize() const;
+    void setPrefillChunkSize(int chunkTokens);
+    
+    // Ordering within a priority class (default FCFS)
+    void setSchedulingPolicy(std::shared_ptr<SchedulingPolicy> policy);
+    std::shared_ptr<SchedulingPolicy> getSchedulingPolicy() const;
+    
+    // Starvation protection: a request not served for this many steps
+    // jumps ahead of every priority class (0 = disabled)
+    void setStarvationThreshold(int steps);
+    
+    // Multi-LoRA: at most this many distinct adapters among active
+    // requests (0 = unlimited). Requests for other adapters wait; a starved
+    // one stops admission until an adapter drains. Batches are grouped by
+    // adapter either way so each adapter's rows are contiguous.
+    void setMaxActiveAdapters(int maxAdapters);
+    int getMaxActiveAdapters() const;
+    
+    // Arrival -> admission wait in nanoseconds, one sample per admitted request
+    const LatencyHistogram& getQueueWaitHistogram() const { return queueWait; }
 
 private:
     int maxBatchSize;
+    int maxTokensPerStep;
+    int prefillChunkSize = 512;
+    PreemptionPolicy preemptionPolicy = PreemptionPolicy::LowestProgress;
+    std::shared_ptr<SchedulingPolicy> policy;
+    
+    // Aging state
+    int starvationThreshold = 64;
+    uint64_t stepCounter = 0;
+    std::vector<uint64_t> lastServedStep;          // [SeqId]
     
-    std::queue<std::shared_ptr<Request>> pendingQueue;
+    // Adapter -> active requests using it (base model not counted)
+    int maxActiveAdapters = 0;
+    std::unordered_map<std::string, int> activeAdapters;
+    
+    LatencyHistogram queueWait;
+    
+    std::deque<std::shared_ptr<Request>> pendingQueue;
     std::vector<std::shared_ptr<Request>> activeRequests;
+    std::vector<std::shared_ptr<Request>> activeBySeq;  // [SeqId] -> active request
+    size_t numActive = 0;
+    bool activeDirty = false;                           // Retired entries not yet erased
     std::vector<std::shared_ptr<Request>> finishedRequests;
     
     mutable std::mutex queueMutex;
+    std::condition_variable workAvailable;
+    bool interrupted = false;
     
     void removeFinished();
+    
+    // Ranking (queueMutex held): starved first, then priority, then policy
+    bool isStarved(const Request& req) const;
+    bool ranksBefore(const std::shared_ptr<Request>& a,
+                     const std::shared_ptr<Request>& b) const;
+    void rank(std::vector<std::shared_ptr<Request>>& reqs) const;
+    void markServed(const std::shared_ptr<Request>& req, int tokens);
+    void forget(const Request& req);
+    
+    // Active set (queueMutex held)
+    void activateLocked(const std::shared_ptr<Request>& req);
+    Request* findActiveLocked(SeqId seq) const;
+    void retireLocked(SeqId seq, RequestState state);
+    void compactActiveLocked();
+    bool adapterAdmissibleLocked(const Request& req) const;
 };
 
 }  // namespace cortexstream
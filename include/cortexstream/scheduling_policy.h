@@ -0,0 +1,98 @@
+#ifndef CORTEXSTREAM_SCHEDULING_POLICY_H
+#define CORTEXSTREAM_SCHEDULING_POLICY_H
+
+#include "request.h"
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <unordered_set>
+
+namespace cortexstream {
+
+// ============================================================================
+// SchedulingPolicy: ordering of requests within a priority class
+// ============================================================================
+
+/**
+ * Decides which requests the Scheduler serves first.
+ *
+ * The Scheduler always ranks starved requests first and higher priority
+ * classes next; the policy only orders requests that tie on both. The same
+ * order is used for admission/prefill and for decode slots, and its reverse
+ * picks preemption victims.
+ */
+class SchedulingPolicy {
+public:
+    virtual ~SchedulingPolicy() = default;
+
+    virtual const char* name() const = 0;
+
+    // Strict weak ordering: true if `a` should be served before `b`
+    virtual bool before(const Request& a, const Request& b) const = 0;
+
+    // Accounting hook, called once per request per scheduled step
+    virtual void onScheduled(const Request& /*request*/, int /*tokens*/) {}
+
+    // Called when a request leaves the scheduler
+    virtual void onCompleted(const Request& /*request*/) {}
+};
+
+/**
+ * First come, first served (arrival order). Default policy.
+ */
+class FCFSPolicy : public SchedulingPolicy {
+public:
+    const char* name() const override { return "fcfs"; }
+    bool before(const Request& a, const Request& b) const override;
+};
+
+/**
+ * Shortest remaining job first: remaining prefill tokens plus remaining
+ * generation budget. Minimizes mean latency; relies on aging for fairness.
+ */
+class ShortestJobFirstPolicy : public SchedulingPolicy {
+public:
+    const char* name() const override { return "sjf"; }
+    bool before(const Request& a, const Request& b) const override;
+};
+
+/**
+ * Earliest deadline first. Requests without a deadline run after all
+ * requests that have one, in arrival order.
+ */
+class EarliestDeadlinePolicy : public SchedulingPolicy {
+public:
+    const char* name() const override { return "edf"; }
+    bool before(const Request& a, const Request& b) const override;
+};
+
+/**
+ * Weighted fair share across tenants: the tenant with the least
+ * weight-normalized service (scheduled tokens / weight) goes first.
+ */
+class WeightedFairPolicy : public SchedulingPolicy {
+public:
+    const char* name() const override { return "wfq"; }
+    bool before(const Request& a, const Request& b) const override;
+    void onScheduled(const Request& request, int tokens) override;
+    void onCompleted(const Request& request) override;
+
+    // Tenants default to weight 1
+    void setWeight(const std::string& tenant, double weight);
+    double getVirtualTime(const std::string& tenant) const;
+
+private:
+    std::unordered_map<std::string, double> weights_;
+    std::unordered_map<std::string, double> virtualTime_;
+    // Tenants with requests in the scheduler -> those requests
+    std::unordered_map<std::string, std::unordered_set<SeqId>> active_;
+
+    // Lowest virtual time among active tenants (0 if none)
+    double activeFloor() const;
+    // An inactive (idle or unseen) tenant ranks no earlier than the floor
+    double effectiveVirtualTime(const std::string& tenant) const;
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_SCHEDULING_POLICY_H
@@ -0,0 +1,26 @@
+#ifndef CORTEXSTREAM_SEQ_ID_H
+#define CORTEXSTREAM_SEQ_ID_H
+
+#include <cstdint>
+
+namespace cortexstream {
+
+/**
+ * Dense integer handle for a sequence.
+ *
+ * Every Request acquires one at construction and returns it on
+ * destruction, so live ids stay close to zero and can index flat tables in
+ * the scheduler and KV cache. String request IDs remain the client-facing
+ * name; hot paths use SeqId.
+ */
+using SeqId = int32_t;
+
+constexpr SeqId kInvalidSeqId = -1;
+
+// Process-wide pool (thread-safe); released ids are reused lowest-first
+SeqId acquireSeqId();
+void releaseSeqId(SeqId id);
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_SEQ_ID_H
@@ -0,0 +1,97 @@
+#ifndef CORTEXSTREAM_SPECULATIVE_H
+#define CORTEXSTREAM_SPECULATIVE_H
+
+#include "kv_cache.h"
+#include "model.h"
+#include "request.h"
+#include "scheduler.h"
+#include <memory>
+#include <unordered_map>
+#include <vector>
+
+namespace cortexstream {
+
+/**
+ * Proposes draft continuations for speculative decoding.
+ *
+ * Drafts are only guesses: the engine scores them with one multi-token
+ * target forward and keeps the prefix the target agrees with, so a bad
+ * drafter costs speed, never correctness. Called on the engine thread.
+ */
+class Drafter {
+public:
+    virtual ~Drafter() = default;
+
+    // Up to `maxTokens` tokens expected to follow the request's output
+    virtual std::vector<int> propose(const Request& request, int maxTokens) = 0;
+
+    // One draft per batch row; maxTokens[i] caps row i. The default asks
+    // propose() row by row.
+    virtual std::vector<std::vector<int>> proposeBatch(
+        const Batch& batch, const std::vector<int>& maxTokens);
+
+    // After the target verified `batch`'s drafts and committed its tokens
+    virtual void onVerified(const Batch& /*batch*/) {}
+
+    // The request left the engine; drop any per-sequence state
+    virtual void release(const Request& /*request*/) {}
+};
+
+/**
+ * Zero-cost drafter for copy-heavy workloads (code edits, RAG summaries).
+ * Finds the most recent earlier occurrence of the context's last n tokens
+ * (prompt plus generated history, longest n first) and proposes what
+ * followed it.
+ */
+class PromptLookupDrafter : public Drafter {
+public:
+    explicit PromptLookupDrafter(int maxNgram = 3, int minNgram = 1);
+
+    std::vector<int> propose(const Request& request, int maxTokens) override;
+
+private:
+    int maxNgram;
+    int minNgram;
+};
+
+/**
+ * Drafts with a second, smaller ModelBackend: greedy decode steps over the
+ * whole batch at once.
+ *
+ * The draft model keeps its own KV in `draftCache`, per sequence, and
+ * tracks which tokens it holds. A sequence's context (prompt plus
+ * generated tokens) is prefilled into it on first use, or after a
+ * preemption. After verification the KV is cut back to the tokens the
+ * target committed, so rejected drafts never stay in the draft's context.
+ * Sequences whose draft KV does not fit are not drafted.
+ */
+class ModelDrafter : public Drafter {
+public:
+    // Default cache: kDefaultCacheBytes sized from the draft model geometry
+    explicit ModelDrafter(std::shared_ptr<ModelBackend> draftModel,
+                          std::shared_ptr<KVCache> draftCache = nullptr);
+
+    static constexpr size_t kDefaultCacheBytes = size_t(256) << 20;
+
+    std::vector<int> propose(const Request& request, int maxTokens) override;
+    std::vector<std::vector<int>> proposeBatch(
+        const Batch& batch, const std::vector<int>& maxTokens) override;
+    void onVerified(const Batch& batch) override;
+    void release(const Request& request) override;
+
+    const std::shared_ptr<KVCache>& getDraftCache() const { return draftCache; }
+    // Tokens whose draft KV is held for `seq` (0 if none)
+    int cachedTokens(SeqId seq) const;
+
+private:
+    std::shared_ptr<ModelBackend> draftModel;
+    std::shared_ptr<KVCache> draftCache;
+    std::unordered_map<SeqId, std::vector<int>> cached;    // Tokens in draft KV
+
+    // Trim the draft KV to its longest prefix shared with `context`
+    void rollback(SeqId seq, const std::vector<int>& context);
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_SPECULATIVE_H
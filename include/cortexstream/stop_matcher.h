@@ -0,0 +1,73 @@
+#ifndef CORTEXSTREAM_STOP_MATCHER_H
+#define CORTEXSTREAM_STOP_MATCHER_H
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+// ============================================================================
+// Stop Sequences - Incremental Multi-Pattern Matching
+// ============================================================================
+//
+// A request's stop strings and stop token sequences are compiled once into
+// two Aho-Corasick automata: a dense byte DFA for the strings, a sparse
+// trie with failure links for the token ids. A per-request Cursor carries
+// the match state across steps, so each new token costs O(its bytes) -
+// never a rescan of the output - and a stop string split across any number
+// of tokens is still found.
+//
+// ============================================================================
+
+namespace cortexstream {
+
+class StopMatcher {
+public:
+    StopMatcher(const std::vector<std::string>& strings,
+                const std::vector<std::vector<int>>& tokenSequences);
+
+    // Match state of one request; starts at the root of both automata
+    struct Cursor {
+        int32_t textState = 0;
+        int32_t tokenState = 0;
+    };
+
+    bool empty() const { return !hasStrings() && !hasTokenSequences(); }
+    bool hasStrings() const { return !strings_.empty(); }
+    bool hasTokenSequences() const { return !sequences_.empty(); }
+
+    /**
+     * Feed newly decoded text. Returns the index of the (longest) stop
+     * string that ends first, or -1. `matchEnd` receives the number of
+     * bytes of `piece` up to and including that match.
+     */
+    int advanceText(Cursor& cursor, const std::string& piece, size_t* matchEnd = nullptr) const;
+
+    // Feed one generated token; index of a completed sequence or -1
+    int advanceToken(Cursor& cursor, int token) const;
+
+    const std::string& string(int index) const { return strings_[index]; }
+    const std::vector<int>& tokenSequence(int index) const { return sequences_[index]; }
+
+private:
+    // Strings: full transition table [state * 256 + byte]
+    std::vector<std::string> strings_;
+    std::vector<int32_t> byteNext_;
+    std::vector<int32_t> byteOutput_;     // Longest string ending here, or -1
+
+    // Token sequences: sorted edges per node
+    struct TokenNode {
+        std::vector<std::pair<int, int32_t>> edges;
+        int32_t fail = 0;
+        int32_t output = -1;
+    };
+    std::vector<std::vector<int>> sequences_;
+    std::vector<TokenNode> tokenNodes_;
+
+    int32_t tokenEdge(int32_t node, int token) const;
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_STOP_MATCHER_H
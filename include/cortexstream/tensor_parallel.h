@@ -0,0 +1,159 @@
+#ifndef CORTEXSTREAM_TENSOR_PARALLEL_H
+#define CORTEXSTREAM_TENSOR_PARALLEL_H
+
+#include "kv_cache.h"
+#include "model.h"
+#include "weights.h"
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Tensor Parallelism - Sharding One Model Across Devices
+// ============================================================================
+//
+// Megatron-style split of every transformer block over N ranks:
+//
+// - Column-parallel (q/k/v, gate/up): each rank owns a slice of output
+//   rows - whole attention heads, or a slice of MLP columns
+// - Row-parallel (o_proj, down_proj): each rank owns the matching slice of
+//   input columns and produces a partial sum; one all-reduce per attention
+//   block and one per MLP closes the layer
+// - Everything else (embeddings, norms, lm_head) is replicated
+// - KV: each rank caches only its KV heads, in a KVCache head shard that
+//   shares rank 0's block tables (KVCache::createHeadShard)
+//
+// Shards are zero-copy views into the mapped weights (LinearWeight slices);
+// quantized shards split on group boundaries. Column and row slices of one
+// dimension use the same ranges, so a column shard's output feeds the next
+// row shard without a gather.
+//
+// Collectives go through Communicator. LocalCommunicator drives every rank
+// from one process; a process-per-device implementation (MPI, NCCL)
+// reports only its own rank in localRanks(). The engine and scheduler API
+// is unchanged: ModelBackend::setTensorParallel() routes linear() through
+// the group.
+//
+// ============================================================================
+
+namespace cortexstream {
+
+enum class ShardKind {
+    Replicated,
+    Column,     // Output rows split
+    Row         // Input columns split, outputs all-reduced
+};
+
+// Split of a projection by its (HuggingFace) name
+ShardKind shardKindFor(const std::string& weightName);
+
+struct ShardRange {
+    int64_t begin = 0;
+    int64_t count = 0;
+};
+
+// Rank `rank`'s part of `total`: units of `align`, spread as evenly as
+// possible (a remainder below `align` goes to the last rank)
+ShardRange shardRange(int64_t total, int worldSize, int rank, int64_t align = 1);
+
+// Per-rank geometry: heads and MLP width divided by `worldSize` (size a
+// rank's KVCache with it)
+ModelConfig shardModelConfig(const ModelConfig& config, int worldSize);
+
+/**
+ * Collectives across the ranks of one tensor-parallel group.
+ * Buffers are passed for every rank this process drives, in
+ * localRanks() order.
+ */
+class Communicator {
+public:
+    virtual ~Communicator() = default;
+
+    virtual int worldSize() const = 0;
+    virtual std::vector<int> localRanks() const = 0;
+
+    // Every buffer ends up holding the element-wise sum over all ranks
+    virtual void allReduceSum(const std::vector<float*>& buffers, size_t count) = 0;
+};
+
+// All ranks in this process (devices driven from one host thread)
+class LocalCommunicator : public Communicator {
+public:
+    explicit LocalCommunicator(int worldSize);
+
+    int worldSize() const override { return worldSize_; }
+    std::vector<int> localRanks() const override;
+    void allReduceSum(const std::vector<float*>& buffers, size_t count) override;
+
+private:
+    int worldSize_;
+};
+
+class TensorParallelGroup {
+public:
+    explicit TensorParallelGroup(std::shared_ptr<Communicator> communicator);
+
+    int worldSize() const;
+    const std::shared_ptr<Communicator>& getCommunicator() const { return communicator_; }
+
+    /**
+     * Shard every column / row projection in `weights` (which must outlive
+     * the group). Attention shards hold whole heads, so numHeads and
+     * numKVHeads must divide by the world size. false (logged) if the
+     * geometry does not split.
+     */
+    bool shardWeights(const std::unordered_map<std::string, LinearWeight>& weights,
+                      const ModelConfig& config);
+
+    bool isSharded(const std::string& weightName) const;
+    // nullptr for a replicated or unknown weight
+    const LinearWeight* getShard(int rank, const std::string& weightName) const;
+    // Output rows (column) or input columns (row) owned by `rank`
+    ShardRange getRange(int rank, const std::string& weightName) const;
+
+    /**
+     * One rank's part of y = x W^T. Column: [batch, range.count] of the
+     * output. Row: [batch, outFeatures] partial sums; `input` is either the
+     * full activation or already this rank's columns (a column shard's
+     * output). false on an unknown weight or width mismatch.
+     */
+    bool linearShard(int rank, const std::string& weightName, const TensorView& input,
+                     float* output) const;
+
+    /**
+     * Full [batch, outFeatures] result: local shards computed, column
+     * outputs gathered, row partials all-reduced.
+     */
+    bool linear(const std::string& weightName, const TensorView& input, float* output) const;
+
+    /**
+     * Give every local rank a KV head shard. `rank0` holds the first local
+     * rank's heads (sized with shardModelConfig) and stays the cache the
+     * engine drives; must be called before it holds sequences.
+     */
+    bool attachKVCache(const std::shared_ptr<KVCache>& rank0);
+    // The cache holding `rank`'s KV heads; nullptr if not local
+    std::shared_ptr<KVCache> getKVShard(int rank) const;
+
+private:
+    struct ShardedWeight {
+        ShardKind kind = ShardKind::Replicated;
+        LinearWeight full;
+        std::vector<LinearWeight> shards;   // Per rank
+        std::vector<ShardRange> ranges;
+    };
+
+    std::shared_ptr<Communicator> communicator_;
+    std::vector<int> localRanks_;
+    std::unordered_map<std::string, ShardedWeight> weights_;
+    std::vector<std::shared_ptr<KVCache>> kvShards_;    // Per local rank
+
+    const ShardedWeight* find(const std::string& weightName) const;
+    int localIndex(int rank) const;
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_TENSOR_PARALLEL_H
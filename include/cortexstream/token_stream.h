@@ -0,0 +1,114 @@
+#ifndef CORTEXSTREAM_TOKEN_STREAM_H
+#define CORTEXSTREAM_TOKEN_STREAM_H
+
+#include "response.h"
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstddef>
+#include <mutex>
+#include <string>
+#include <vector>
+
+// ============================================================================
+// TokenStream - Decoupled Streaming Delivery
+// ============================================================================
+//
+// A TokenCallback runs on the engine thread inside the decode step, so one
+// slow client (socket write, JSON encoding) delays every sequence in the
+// batch. A TokenStream moves delivery off that thread:
+//
+// - Bounded single-producer / single-consumer ring of ResponseChunk: the
+//   engine pushes, one client thread drains. Push and pop are wait-free
+//   (one acquire load, one release store); head and tail sit on separate
+//   cache lines
+// - Slots are pre-filled with the request id and reserve room for a text
+//   piece, so a push copies two scalars plus the piece and does not
+//   allocate on the engine thread for pieces up to kTextReserve bytes
+// - Backpressure: past the high-water mark the scheduler skips the
+//   request's decode until the consumer catches up. Tokens that still do
+//   not fit wait in the request, never in the engine's critical path
+// - The consumer may block in wait(); the producer only touches the mutex
+//   when a consumer is actually asleep
+//
+// ============================================================================
+
+namespace cortexstream {
+
+class TokenStream {
+public:
+    // Bytes of text piece each slot holds without reallocating
+    static constexpr size_t kTextReserve = 32;
+
+    /**
+     * `capacity` is rounded up to a power of two; `highWater` (0 = three
+     * quarters of it) is the fill level at which the request stops being
+     * scheduled for decode.
+     */
+    explicit TokenStream(const std::string& requestId, size_t capacity = 256, size_t highWater = 0);
+
+    TokenStream(const TokenStream&) = delete;
+    TokenStream& operator=(const TokenStream&) = delete;
+
+    // ---- Producer (engine thread) ----
+
+    // false when full; nothing is written. `textPiece` is the detokenized
+    // text the token completed (empty without a tokenizer)
+    bool push(int token, bool finished, const std::string& textPiece = std::string());
+
+    // No more chunks will follow; wakes a waiting consumer
+    void close();
+
+    // ---- Consumer (one client thread) ----
+
+    bool pop(ResponseChunk& chunk);
+
+    /**
+     * Appends up to `maxChunks` (0 = all) available chunks to `out` in one
+     * pass, letting the consumer coalesce them into a single write.
+     * Returns the number appended.
+     */
+    size_t drain(std::vector<ResponseChunk>& out, size_t maxChunks = 0);
+
+    /**
+     * Block until a chunk is available or the stream is closed. Returns
+     * false on timeout; 0 waits indefinitely.
+     */
+    bool wait(std::chrono::milliseconds timeout = std::chrono::milliseconds(0));
+
+    // ---- State (any thread) ----
+
+    size_t size() const;
+    size_t capacity() const { return slots_.size(); }
+    bool empty() const { return size() == 0; }
+    bool isFull() const { return size() >= capacity(); }
+    bool isBackpressured() const { return size() >= highWater_; }
+    bool isClosed() const { return closed_.load(std::memory_order_acquire); }
+
+    // Closed and fully drained: nothing will ever arrive again
+    bool isDone() const { return isClosed() && empty(); }
+
+private:
+    void wakeConsumer();
+
+    std::vector<ResponseChunk> slots_;
+    const size_t mask_;
+    const size_t highWater_;
+
+    // Producer-owned write index and its cached view of the read index
+    alignas(64) std::atomic<size_t> tail_{0};
+    size_t cachedHead_ = 0;
+
+    // Consumer-owned read index and its cached view of the write index
+    alignas(64) std::atomic<size_t> head_{0};
+    size_t cachedTail_ = 0;
+
+    alignas(64) std::atomic<bool> closed_{false};
+    std::atomic<bool> consumerWaiting_{false};
+    std::mutex waitMutex_;
+    std::condition_variable waitCv_;
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_TOKEN_STREAM_H
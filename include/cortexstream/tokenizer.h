@@ -18,6 +18,10 @@ public:
     // Decode token IDs to text
     virtual std::string decode(const std::vector<int32_t>& token_ids) = 0;
     
+    // Encode many texts (e.g. an admission burst); result i belongs to
+    // texts[i]. The default encodes serially.
+    virtual std::vector<std::vector<int32_t>> encodeBatch(const std::vector<std::string>& texts);
+    
     // Get the model's special tokens
     virtual int32_t getEosTokenId() const = 0;
     virtual int32_t getBosTokenId() const = 0;
@@ -30,11 +34,63 @@ public:
     virtual bool isLoaded() const = 0;
 };
 
+// ============================================================================
+// IncrementalDetokenizer: Per-request streaming text
+// ============================================================================
+
+/**
+ * Turns a stream of generated tokens into text pieces without re-decoding
+ * the whole sequence per token.
+ * 
+ * Decoding one token alone is wrong for most vocabularies (SentencePiece
+ * drops a leading space, byte-level BPE splits a UTF-8 character across
+ * tokens), so each step decodes a short window of recent tokens twice -
+ * with and without the new ones - and emits the difference. The window
+ * restarts after every emitted piece; cost per token is O(window), not
+ * O(sequence).
+ * 
+ * A piece is held back while the decoded tail is an incomplete UTF-8
+ * sequence or U+FFFD, so concatenated pieces are always valid UTF-8.
+ * One instance per request, used from one thread, typically inside its
+ * token callback (the engine does this for TokenStream chunks) to fill
+ * ResponseChunk::textPiece.
+ */
+class IncrementalDetokenizer {
+public:
+    explicit IncrementalDetokenizer(Tokenizer& tokenizer);
+
+    // New text completed by `token`; empty while a character is pending
+    std::string push(int32_t token);
+
+    // Whatever is still held back (end of stream), possibly incomplete
+    std::string flush();
+
+    // Start a new sequence
+    void reset();
+
+    // Tokens currently held in the decode window
+    size_t windowSize() const { return window_.size(); }
+
+private:
+    Tokenizer& tokenizer_;
+    std::vector<int32_t> window_;       // Tokens since prefixOffset
+    size_t readOffset_ = 0;             // Window tokens already emitted
+    std::string prefixText_;            // decode(window_[0, readOffset_))
+};
+
+// Length of the longest prefix of `text` that does not end inside a
+// UTF-8 multi-byte sequence
+size_t completeUtf8Length(const std::string& text);
+
 // Factory function to create appropriate tokenizer
 std::unique_ptr<Tokenizer> createTokenizer(
     const std::string& model_path_or_id,
     const std::string& cache_dir = "");
 
+// From the contents of a tokenizer.json, e.g. WeightStore::tokenizerBlob()
+// of an engine-format model
+std::unique_ptr<Tokenizer> createTokenizerFromJson(const std::string& json_blob);
+
 } // namespace cortexstream
 
 #endif // CORTEXSTREAM_TOKENIZER_H
@@ -0,0 +1,143 @@
+#ifndef CORTEXSTREAM_TRACE_H
+#define CORTEXSTREAM_TRACE_H
+
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#endif
+
+// ============================================================================
+// Hot-Path Tracing - Scoped Spans with Chrome Trace / Perfetto Export
+// ============================================================================
+//
+// CORTEX_TRACE_SCOPE("name") records how long the enclosing scope took:
+//
+// - Compile-time switch: the macros expand to nothing unless the library
+//   is built with CORTEXSTREAM_TRACING=1 (CMake option
+//   CORTEXSTREAM_ENABLE_TRACING), so release builds pay zero
+// - When compiled in, spans are inert until trace::start(); an inactive
+//   span is one relaxed atomic load
+// - An active span reads the cycle counter (rdtsc / cntvct_el0) twice and
+//   writes one 32-byte event into a thread-local ring: no locks, no
+//   allocation, no syscalls. Rings keep the newest events per thread
+// - writeChromeTrace() converts ticks to microseconds against a
+//   steady_clock calibration and writes the JSON that chrome://tracing and
+//   ui.perfetto.dev load directly
+//
+// Names must be string literals (or otherwise outlive the trace).
+//
+// ============================================================================
+
+#ifndef CORTEXSTREAM_TRACING
+#define CORTEXSTREAM_TRACING 0
+#endif
+
+namespace cortexstream {
+namespace trace {
+
+// One completed span
+struct Event {
+    const char* name;
+    uint64_t begin;         // Ticks
+    uint64_t end;
+    int64_t arg;            // Optional value shown in the trace (-1 = none)
+};
+
+// Per-name totals over every recorded event
+struct SpanSummary {
+    std::string name;
+    size_t count = 0;
+    double totalMs = 0.0;
+    double meanUs = 0.0;
+    double maxUs = 0.0;
+};
+
+// Whether the CORTEX_TRACE_* macros were compiled into this build
+constexpr bool compiledIn() { return CORTEXSTREAM_TRACING != 0; }
+
+/**
+ * Start recording; clears earlier events. Each thread keeps its newest
+ * `eventsPerThread` events (rounded up to a power of two).
+ */
+void start(size_t eventsPerThread = size_t(1) << 16);
+void stop();
+void clear();
+
+// Label the calling thread in exported traces
+void setThreadName(const std::string& name);
+
+// Totals per span name, largest total first. Read after stop() for a
+// consistent view
+std::vector<SpanSummary> summarize();
+
+// Chrome trace event JSON; false (logged) if the file cannot be written
+bool writeChromeTrace(const std::string& path);
+
+namespace detail {
+
+extern std::atomic<bool> active;
+
+inline uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+    return __rdtsc();
+#elif defined(__aarch64__)
+    uint64_t ticks;
+    asm volatile("mrs %0, cntvct_el0" : "=r"(ticks));
+    return ticks;
+#else
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+}
+
+void record(const char* name, uint64_t begin, uint64_t end, int64_t arg);
+
+}  // namespace detail
+
+// RAII span; prefer the macros, which compile out
+class Span {
+public:
+    explicit Span(const char* name, int64_t arg = -1)
+        : name_(detail::active.load(std::memory_order_relaxed) ? name : nullptr),
+          arg_(arg),
+          begin_(name_ ? detail::now() : 0) {
+    }
+    ~Span() {
+        if (name_) {
+            detail::record(name_, begin_, detail::now(), arg_);
+        }
+    }
+    Span(const Span&) = delete;
+    Span& operator=(const Span&) = delete;
+
+private:
+    const char* name_;
+    int64_t arg_;
+    uint64_t begin_;
+};
+
+}  // namespace trace
+}  // namespace cortexstream
+
+#define CORTEX_TRACE_CONCAT_(a, b) a##b
+#define CORTEX_TRACE_CONCAT(a, b) CORTEX_TRACE_CONCAT_(a, b)
+
+#if CORTEXSTREAM_TRACING
+#define CORTEX_TRACE_SCOPE(name) \
+    ::cortexstream::trace::Span CORTEX_TRACE_CONCAT(cortexTraceSpan_, __LINE__)(name)
+// Span annotated with a value, e.g. the batch size
+#define CORTEX_TRACE_SCOPE_ARG(name, value) \
+    ::cortexstream::trace::Span CORTEX_TRACE_CONCAT(cortexTraceSpan_, __LINE__)( \
+        name, static_cast<int64_t>(value))
+#else
+#define CORTEX_TRACE_SCOPE(name) ((void)0)
+#define CORTEX_TRACE_SCOPE_ARG(name, value) ((void)0)
+#endif
+
+#endif  // CORTEXSTREAM_TRACE_H
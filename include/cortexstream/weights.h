@@ -0,0 +1,277 @@
+#ifndef CORTEXSTREAM_WEIGHTS_H
+#define CORTEXSTREAM_WEIGHTS_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// ============================================================================
+// Memory-Mapped Weights - safetensors / .mlx Shards
+// ============================================================================
+//
+// Weights are never read into process memory. Each shard is mapped
+// read-only and MAP_SHARED, only its JSON header is parsed, and every
+// tensor is a pointer into the mapping:
+//
+// - Cold start costs one header parse per shard; the data is paged in by
+//   the first forward pass touching it (or by prefetch, below)
+// - Engine processes on one host mapping the same files share the page
+//   cache: the second process starts warm and adds no resident copy
+// - Layer-local paging: tensors are grouped by transformer block, and
+//   beginLayer() madvise(WILLNEED)s the next blocks in forward order so
+//   page-in overlaps compute
+//
+// `.mlx` files written by mlx-lm are safetensors and load the same way.
+//
+// Engine format (`.cstream`, written by cortexstream-convert): one file,
+// the magic "CSTREAM1", then a safetensors header and data. The header
+// carries the model config as metadata and the tokenizer.json blob as a U8
+// tensor; the data region starts on a 16 KiB boundary and every tensor on
+// a 64-byte one, already in the dtype and layout the backend runs
+// (FP16, or group-quantized INT8 / INT4: see QuantFormat).
+//
+// ============================================================================
+
+namespace cortexstream {
+
+enum class WeightDType {
+    F64,
+    F32,
+    F16,
+    BF16,
+    I64,
+    I32,
+    I16,
+    I8,
+    U64,
+    U32,
+    U16,
+    U8,
+    Bool
+};
+
+size_t weightDTypeSize(WeightDType dtype);
+const char* weightDTypeName(WeightDType dtype);
+
+/**
+ * Group quantization of 2-D weights in the engine format. A quantized
+ * [rows, cols] weight `name` is stored as
+ *   name          U8 [rows, cols]      (Int8: code = q + 128), or
+ *                 U8 [rows, cols / 2]  (Int4: code = q + 8, column 2c in
+ *                                       the low nibble, 2c + 1 in the high)
+ *   name.scales   F16 [rows, cols / groupSize]
+ * and w = q * scale, symmetric per group of groupSize columns. Codes are
+ * MLX's affine layout with bias = -zero * scale, so Metal kernels use the
+ * mapped bytes as they are. Norms, embeddings and weights whose width is
+ * not a multiple of the group size stay FP16.
+ */
+enum class QuantFormat {
+    FP16,
+    Int8,
+    Int4
+};
+
+const char* quantFormatName(QuantFormat format);
+bool parseQuantFormat(const std::string& name, QuantFormat& format);
+
+// Architecture of a model, from a HuggingFace config.json or the metadata
+// of an engine-format file (same keys). 0 / -1 = not given.
+struct ModelConfig {
+    std::string architecture;       // model_type
+    size_t hiddenSize = 0;
+    size_t numLayers = 0;
+    size_t vocabSize = 0;
+    size_t numHeads = 0;
+    size_t numKVHeads = 0;          // Defaults to numHeads (no GQA)
+    size_t headDim = 0;             // Defaults to hiddenSize / numHeads
+    size_t intermediateSize = 0;
+    size_t maxPositions = 0;
+    float ropeTheta = 10000.0f;
+    float normEps = 1e-5f;
+    int32_t bosTokenId = -1;
+    int32_t eosTokenId = -1;
+    QuantFormat quantization = QuantFormat::FP16;
+    int groupSize = 0;              // Quantized formats only
+
+    // Top-level scalar fields (numbers and strings as text), e.g. parsed
+    // with parseJsonFields; HF aliases (n_embd, n_layer, ...) are accepted
+    static ModelConfig fromFields(const std::unordered_map<std::string, std::string>& fields);
+    std::unordered_map<std::string, std::string> toFields() const;
+
+    bool isValid() const { return hiddenSize > 0 && numLayers > 0 && vocabSize > 0 && numHeads > 0; }
+
+    // K and V bytes one token occupies across every layer
+    size_t kvBytesPerToken(size_t elementBytes) const {
+        return 2 * numLayers * numKVHeads * headDim * elementBytes;
+    }
+};
+
+// Top-level scalars of a JSON object as text; nested values are skipped.
+// false on malformed JSON.
+bool parseJsonFields(const std::string& json,
+                     std::unordered_map<std::string, std::string>& fields);
+
+struct WeightTensor {
+    std::string name;
+    WeightDType dtype = WeightDType::F32;
+    std::vector<int64_t> shape;
+    const uint8_t* data = nullptr;  // Inside the shard mapping; never copied
+    size_t numBytes = 0;
+    int shard = 0;
+    int layer = -1;                 // Transformer block, -1 if not in one
+
+    int64_t numElements() const {
+        int64_t n = 1;
+        for (auto s : shape) n *= s;
+        return n;
+    }
+};
+
+// Read-only, shared mapping of a whole file
+class MappedFile {
+public:
+    // nullptr (logged) if the file cannot be opened or mapped
+    static std::unique_ptr<MappedFile> open(const std::string& path);
+    ~MappedFile();
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    const uint8_t* data() const { return data_; }
+    size_t size() const { return size_; }
+    const std::string& path() const { return path_; }
+
+    // Paging hints for [offset, offset + length), widened to whole pages
+    void willNeed(size_t offset, size_t length) const;
+    void dontNeed(size_t offset, size_t length) const;
+
+private:
+    MappedFile() = default;
+
+    std::string path_;
+    const uint8_t* data_ = nullptr;
+    size_t size_ = 0;
+};
+
+/**
+ * The tensors of one model: a single shard, or a directory of
+ * *.safetensors / *.mlx shards. Immutable after open() apart from the
+ * prefetch depth, so any thread may read it; share it by shared_ptr to keep
+ * the mappings alive. open() already prefetches the tensors outside any
+ * block and the first blocks.
+ */
+class WeightStore {
+public:
+    static constexpr const char* kEngineMagic = "CSTREAM1";
+    static constexpr const char* kTokenizerTensor = "__tokenizer__";
+    static constexpr size_t kDataAlignment = 16384;
+    static constexpr size_t kTensorAlignment = 64;
+
+    // nullptr (logged) on a missing path, malformed header, out-of-range
+    // offsets or a tensor name found in two shards
+    static std::shared_ptr<WeightStore> open(const std::string& path);
+
+    // An engine-format file (no transformation needed before running)
+    bool isEngineFormat() const { return engineFormat_; }
+    // From the engine-format metadata, or config.json beside the shards,
+    // completed from the tensors (embedding shape, block count)
+    const ModelConfig& config() const { return config_; }
+    // The tokenizer.json blob of an engine-format file, else nullptr
+    const WeightTensor* tokenizerBlob() const { return find(kTokenizerTensor); }
+
+    size_t numTensors() const { return tensors_.size(); }
+    const std::vector<WeightTensor>& tensors() const { return tensors_; }
+    const WeightTensor* find(const std::string& name) const;
+
+    // First tensor whose name ends with `suffix` (e.g. "embed_tokens.weight")
+    const WeightTensor* findSuffix(const std::string& suffix) const;
+
+    // One past the highest block index, 0 for a model without blocks
+    int numLayers() const { return static_cast<int>(layers_.size()); }
+    const std::vector<const WeightTensor*>& layerTensors(int layer) const;
+
+    size_t numShards() const { return shards_.size(); }
+    size_t totalBytes() const { return totalBytes_; }
+
+    // String pairs from every shard's "__metadata__" entry, plus the
+    // config.json fields of a checkpoint directory
+    const std::unordered_map<std::string, std::string>& metadata() const { return metadata_; }
+
+    /**
+     * Forward-order paging. beginLayer(l) hints that block l is about to
+     * run: blocks l .. l + depth - 1 are prefetched (depth 0 disables
+     * prefetch). prefetchLayer(-1) covers the tensors outside any block
+     * (embeddings, final norm, head). Hints never block.
+     */
+    void setPrefetchDepth(int depth);
+    int getPrefetchDepth() const { return prefetchDepth_.load(std::memory_order_relaxed); }
+    void beginLayer(int layer) const;
+    void prefetchLayer(int layer) const;
+
+    // Drop this process's pages of a block (e.g. when the resident set must
+    // stay small); the page cache keeps them for the next touch
+    void evictLayer(int layer) const;
+
+private:
+    WeightStore() = default;
+
+    bool addShard(const std::string& path);
+    // Vocab, hidden size and layer count from the tensors, where the
+    // config did not give them
+    void completeConfig();
+    void adviseLayer(int layer, bool willNeed) const;
+
+    std::vector<std::unique_ptr<MappedFile>> shards_;
+    std::vector<WeightTensor> tensors_;
+    std::unordered_map<std::string, size_t> byName_;
+    std::vector<std::vector<const WeightTensor*>> layers_;
+    std::vector<const WeightTensor*> shared_;               // Outside any block
+    std::unordered_map<std::string, std::string> metadata_;
+    ModelConfig config_;
+    bool engineFormat_ = false;
+    size_t totalBytes_ = 0;
+    std::atomic<int> prefetchDepth_{2};
+};
+
+/**
+ * A [outFeatures, inFeatures] projection weight as the kernels read it:
+ * dense (F32 / F16 / BF16), or group-quantized codes plus FP16 scales
+ * (layout: QuantFormat). Points into a WeightStore, which must outlive it.
+ */
+struct LinearWeight {
+    QuantFormat format = QuantFormat::FP16;     // FP16 = dense
+    WeightDType dtype = WeightDType::F16;       // Dense element type
+    int64_t outFeatures = 0;
+    int64_t inFeatures = 0;
+    int groupSize = 0;
+    const uint8_t* data = nullptr;
+    const uint8_t* scales = nullptr;            // F16, quantized only
+    int64_t rowStride = 0;                      // Bytes between rows; 0 = packed
+    int64_t scaleStride = 0;                    // Scales between rows; 0 = packed
+
+    // false if `name` is missing, not 2-D, or inconsistent with its scales
+    static bool resolve(const WeightStore& store, const std::string& name, LinearWeight& out);
+
+    /**
+     * Zero-copy sub-matrices over the same bytes (tensor-parallel shards):
+     * output rows [begin, begin + count), or input columns [begin, begin +
+     * count). Quantized column slices must cover whole groups. false if
+     * the range is out of bounds or misaligned.
+     */
+    bool sliceRows(int64_t begin, int64_t count, LinearWeight& out) const;
+    bool sliceColumns(int64_t begin, int64_t count, LinearWeight& out) const;
+
+    bool isQuantized() const { return format != QuantFormat::FP16; }
+    bool isPacked() const { return rowStride == 0 && scaleStride == 0; }
+    int64_t rowBytes() const;                   // Row stride in bytes
+    int64_t scalesPerRow() const;               // Scale row stride (quantized)
+    size_t numBytes() const;                    // Weight plus scale bytes
+};
+
+}  // namespace cortexstream
+
+#endif  // CORTEXSTREAM_WEIGHTS_H
@@ -1,5 +1,29 @@
 #!/bin/bash
 # Run benchmark script
+#
+#   scripts/run_bench.sh [trace.jsonl] [qps]
+#
+# Runs the microbenchmarks, then replays the trace (or a synthetic load)
+# through the engine. Results land in build/bench/ as JSON so two releases
+# can be compared with Google Benchmark's tools/compare.py.
+
+set -e
+
+BUILD_DIR=${BUILD_DIR:-build}
+OUT_DIR="$BUILD_DIR/bench"
+TRACE=${1:-}
+QPS=${2:-8}
 
 echo "Running CortexStream benchmarks..."
-# Add benchmark commands here
+cmake -S . -B "$BUILD_DIR" -DCMAKE_BUILD_TYPE=Release
+cmake --build "$BUILD_DIR" --target cortexstream_bench -j"$(nproc)"
+BENCH="$BUILD_DIR/benchmarks/cortexstream_bench"
+mkdir -p "$OUT_DIR"
+
+"$BENCH" --benchmark_out="$OUT_DIR/micro.json" --benchmark_out_format=json
+
+LOAD_ARGS=(--qps "$QPS" --json "$OUT_DIR/load.json")
+if [ -n "$TRACE" ]; then
+    LOAD_ARGS+=(--trace "$TRACE")
+fi
+"$BENCH" load "${LOAD_ARGS[@]}"
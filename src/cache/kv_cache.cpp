@@ -1,19 +1,48 @@
 #include "cortexstream/kv_cache.h"
+#include "cortexstream/half.h"
+#include "cortexstream/weights.h"
 #include "cortexstream/request.h"
+#include "cortexstream/trace.h"
 #include <algorithm>
 #include <cstring>
 #include <stdexcept>
 #include <sstream>
 #include <iomanip>
+#include <cmath>
+
+// POSIX mmap for the file-backed swap tier
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
 
 namespace cortexstream {
 
+namespace {
+
+int8_t quantizeInt8(float value, float scale) {
+    if (scale <= 0.0f) return 0;
+    float q = std::nearbyint(value / scale);
+    return static_cast<int8_t>(std::clamp(q, -127.0f, 127.0f));
+}
+
+}  // namespace
+
 // ============================================================================
 // KVBlockAllocator Implementation with Buddy System for O(log n) allocation
 // ============================================================================
 
 KVBlockAllocator::KVBlockAllocator(size_t totalBlocks)
-    : totalBlocks_(totalBlocks), freeList_(totalBlocks, true) {
+    : totalBlocks_(totalBlocks),
+      nextFree_(totalBlocks, kNullBlock),
+      prevFree_(totalBlocks, kNullBlock),
+      freeOrder_(totalBlocks, -1),
+      blockUsed_(new std::atomic<uint8_t>[totalBlocks]),
+      magazineHead_(0xFFFFFFFFull),
+      magazineNext_(new std::atomic<int>[totalBlocks]) {
+    for (size_t i = 0; i < totalBlocks_; ++i) {
+        blockUsed_[i].store(0, std::memory_order_relaxed);
+        magazineNext_[i].store(kNullBlock, std::memory_order_relaxed);
+    }
     // Initialize buddy allocator structure
     // Maintains separate free lists for each power-of-2 size
     // This enables O(log n) allocation instead of O(n) linear scan
@@ -23,21 +52,24 @@ KVBlockAllocator::KVBlockAllocator(size_t totalBlocks)
 void KVBlockAllocator::initBuddySystem() {
     // Initialize buddy allocator: maintains free lists per size class
     // Size classes: 1, 2, 4, 8, 16, 32, ... blocks
-    int powerOfTwo = 1;
-    while (powerOfTwo <= static_cast<int>(totalBlocks_)) {
-        buddyFreeLists_[powerOfTwo] = std::deque<int>();
-        powerOfTwo *= 2;
-    }
-    
-    // Add entire allocation pool to largest power-of-2 free list
-    int largestPower = 1;
-    while (largestPower * 2 <= static_cast<int>(totalBlocks_)) {
-        largestPower *= 2;
+    maxOrder_ = 0;
+    while ((size_t{1} << (maxOrder_ + 1)) <= totalBlocks_) {
+        maxOrder_++;
     }
-    
-    // If totalBlocks is not power of 2, add what fits
-    if (largestPower <= static_cast<int>(totalBlocks_)) {
-        buddyFreeLists_[largestPower].push_back(0);
+    freeHeads_.assign(maxOrder_ + 1, kNullBlock);
+
+    // Cover the pool with maximal aligned power-of-2 blocks, so totals that
+    // are not a power of two lose nothing (e.g. 100 = 64 + 32 + 4)
+    size_t start = 0;
+    while (start < totalBlocks_) {
+        int order = maxOrder_;
+        while (order > 0 &&
+               ((start & ((size_t{1} << order) - 1)) != 0 ||
+                start + (size_t{1} << order) > totalBlocks_)) {
+            order--;
+        }
+        pushFree(static_cast<int>(start), order);
+        start += size_t{1} << order;
     }
 }
 
@@ -49,66 +81,99 @@ KVHandle KVBlockAllocator::allocate(int blocksNeeded) {
         return {-1, 0};
     }
     
-    std::lock_guard<std::mutex> guard(lock_);
-    
     // Find appropriate power-of-2 size class
-    int allocSize = 1;
-    while (allocSize < blocksNeeded) {
-        allocSize *= 2;
+    int order = 0;
+    while ((1 << order) < blocksNeeded) {
+        order++;
     }
     
-    if (allocSize > static_cast<int>(totalBlocks_)) {
+    if (order > maxOrder_ || totalBlocks_ == 0) {
         return {-1, 0};  // Request too large
     }
 
-    // Try to allocate from size class (buddy system)
-    return buddyAllocate(allocSize);
+    std::lock_guard<std::mutex> guard(lock_);
+
+    // Try to allocate from size class (buddy system). Single blocks parked
+    // in the magazine block coalescing, so return them and retry once.
+    KVHandle handle = buddyAllocate(order);
+    if (!handle.isValid() && drainMagazineLocked()) {
+        handle = buddyAllocate(order);
+    }
+    return handle;
 }
 
-KVHandle KVBlockAllocator::buddyAllocate(int size) {
-    // Recursive buddy allocation with splitting and merging
+KVHandle KVBlockAllocator::buddyAllocate(int order) {
+    // Buddy allocation with splitting
     // Time: O(log totalBlocks)
-    
-    // Check if size class has free blocks
-    if (buddyFreeLists_.count(size) && !buddyFreeLists_[size].empty()) {
-        int startIdx = buddyFreeLists_[size].front();
-        buddyFreeLists_[size].pop_front();
-        
-        // Mark blocks as used
-        for (int i = startIdx; i < startIdx + size; ++i) {
-            freeList_[i] = false;
-        }
-        
-        return {startIdx, size};
-    }
 
-    // No free blocks at this size: try splitting larger blocks
-    int nextSize = size * 2;
-    if (nextSize > static_cast<int>(totalBlocks_)) {
+    // Find the smallest order >= requested that has a free block
+    int classOrder = order;
+    while (classOrder <= maxOrder_ && freeHeads_[classOrder] == kNullBlock) {
+        classOrder++;
+    }
+    if (classOrder > maxOrder_) {
         return {-1, 0};  // Out of memory
     }
 
-    if (buddyFreeLists_.count(nextSize) && !buddyFreeLists_[nextSize].empty()) {
-        int largeBlock = buddyFreeLists_[nextSize].front();
-        buddyFreeLists_[nextSize].pop_front();
+    int startIdx = freeHeads_[classOrder];
+    unlinkFree(startIdx, classOrder);
 
-        // Split into two buddies
-        int buddy1 = largeBlock;
-        int buddy2 = largeBlock + nextSize / 2;
+    // Split down to the requested size, returning upper halves to the pool
+    while (classOrder > order) {
+        classOrder--;
+        pushFree(startIdx + (1 << classOrder), classOrder);
+    }
 
-        // Add buddy2 back to free list
-        buddyFreeLists_[nextSize / 2].push_back(buddy2);
+    int size = 1 << order;
+    markRange(startIdx, size, true);
+    usedBlocks_.fetch_add(size, std::memory_order_relaxed);
+    return {startIdx, size};
+}
 
-        // Allocate buddy1
-        for (int i = buddy1; i < buddy1 + nextSize / 2; ++i) {
-            freeList_[i] = false;
+void KVBlockAllocator::buddyRelease(int start, int order) {
+    // Merge with the buddy while it is free at the same order
+    // Time: O(log totalBlocks), no searching or sorting
+    while (order < maxOrder_) {
+        int buddy = start ^ (1 << order);
+        if (buddy >= static_cast<int>(totalBlocks_) || freeOrder_[buddy] != order) {
+            break;
         }
+        unlinkFree(buddy, order);
+        start = std::min(start, buddy);
+        order++;
+    }
+    pushFree(start, order);
+}
 
-        return {buddy1, nextSize / 2};
+void KVBlockAllocator::pushFree(int start, int order) {
+    int head = freeHeads_[order];
+    nextFree_[start] = head;
+    prevFree_[start] = kNullBlock;
+    if (head != kNullBlock) {
+        prevFree_[head] = start;
     }
+    freeHeads_[order] = start;
+    freeOrder_[start] = static_cast<int8_t>(order);
+}
+
+void KVBlockAllocator::unlinkFree(int start, int order) {
+    int prev = prevFree_[start];
+    int next = nextFree_[start];
+    if (prev == kNullBlock) {
+        freeHeads_[order] = next;
+    } else {
+        nextFree_[prev] = next;
+    }
+    if (next != kNullBlock) {
+        prevFree_[next] = prev;
+    }
+    freeOrder_[start] = -1;
+}
 
-    // Recursively try next larger size
-    return buddyAllocate(nextSize);
+void KVBlockAllocator::markRange(int start, int count, bool used) {
+    for (int i = start; i < start + count; ++i) {
+        blockUsed_[i].store(used ? 1 : 0, std::memory_order_relaxed);
+    }
 }
 
 void KVBlockAllocator::free(const KVHandle& handle) {
@@ -120,107 +185,148 @@ void KVBlockAllocator::free(const KVHandle& handle) {
     }
     
     std::lock_guard<std::mutex> guard(lock_);
-    
-    // Mark blocks as free
-    for (int i = handle.startBlockIndex; i < handle.startBlockIndex + handle.numBlocks; ++i) {
-        if (i >= 0 && i < static_cast<int>(totalBlocks_)) {
-            freeList_[i] = true;
-        }
+    releaseLocked(handle);
+}
+
+void KVBlockAllocator::releaseLocked(const KVHandle& handle) {
+    if (handle.startBlockIndex + handle.numBlocks > static_cast<int>(totalBlocks_)) {
+        return;
     }
 
-    // Add to buddy free list and attempt coalescing
-    buddyFreeLists_[handle.numBlocks].push_back(handle.startBlockIndex);
-    
-    // Attempt buddy coalescence recursively
-    buddyCoalesce(handle.numBlocks);
+    // Handles always cover one aligned power-of-2 block
+    int order = 0;
+    while ((1 << order) < handle.numBlocks) {
+        order++;
+    }
+
+    markRange(handle.startBlockIndex, handle.numBlocks, false);
+    usedBlocks_.fetch_sub(handle.numBlocks, std::memory_order_relaxed);
+    buddyRelease(handle.startBlockIndex, order);
 }
 
-void KVBlockAllocator::buddyCoalesce(int size) {
-    // Merge adjacent free buddy blocks to reduce fragmentation
-    // Time: O(log totalBlocks)
-    
-    if (buddyFreeLists_.find(size) == buddyFreeLists_.end()) {
-        return;
+bool KVBlockAllocator::allocatePages(int count, std::vector<int>& pages) {
+    // Paged allocation: every page is an independent size-1 buddy block,
+    // so no rounding to a power of two is needed.
+    if (count <= 0) {
+        return count == 0;
     }
 
-    auto& freeList = buddyFreeLists_[size];
-    if (freeList.size() < 2) {
-        return;  // Need at least 2 blocks to coalesce
-    }
-
-    // Sort free list to identify adjacent buddies
-    std::sort(freeList.begin(), freeList.end());
-
-    // Look for adjacent pairs
-    auto it = freeList.begin();
-    while (it != freeList.end()) {
-        auto next_it = std::next(it);
-        
-        if (next_it != freeList.end()) {
-            int block1 = *it;
-            int block2 = *next_it;
-            
-            // Check if blocks are adjacent buddies
-            if (block2 == block1 + size) {
-                // Coalesce: merge into larger block
-                freeList.erase(next_it);
-                it = freeList.erase(it);
-                
-                // Add merged block to next size class
-                int nextSize = size * 2;
-                buddyFreeLists_[nextSize].push_back(block1);
-                
-                // Recursively try to coalesce larger blocks
-                buddyCoalesce(nextSize);
-                return;
-            }
+    size_t firstNew = pages.size();
+    pages.reserve(firstNew + count);
+
+    // Fast path: recently freed single blocks, no lock
+    while (pages.size() - firstNew < static_cast<size_t>(count)) {
+        int block = magazinePop();
+        if (block == kNullBlock) {
+            break;
         }
-        ++it;
+        blockUsed_[block].store(1, std::memory_order_relaxed);
+        usedBlocks_.fetch_add(1, std::memory_order_relaxed);
+        pages.push_back(block);
+    }
+    if (pages.size() - firstNew == static_cast<size_t>(count)) {
+        return true;
     }
-}
 
-int KVBlockAllocator::findContiguousFreeRegion(int blocksNeeded) {
-    // Legacy linear scan fallback (removed in favor of buddy system)
-    // Kept for backward compatibility but rarely used
-    
-    int contiguousCount = 0;
-    int startIdx = -1;
-    
-    for (size_t i = 0; i <= totalBlocks_; ++i) {
-        if (i < totalBlocks_ && freeList_[i]) {
-            if (contiguousCount == 0) {
-                startIdx = i;
+    std::lock_guard<std::mutex> guard(lock_);
+    while (pages.size() - firstNew < static_cast<size_t>(count)) {
+        KVHandle h = buddyAllocate(0);
+        if (!h.isValid()) {
+            if (drainMagazineLocked()) {
+                continue;
             }
-            contiguousCount++;
-        } else {
-            if (contiguousCount >= blocksNeeded) {
-                return startIdx;
+            // Roll back partial allocation
+            for (size_t j = firstNew; j < pages.size(); ++j) {
+                releaseLocked({pages[j], 1});
             }
-            contiguousCount = 0;
-            startIdx = -1;
+            pages.resize(firstNew);
+            return false;
         }
+        pages.push_back(h.startBlockIndex);
     }
-    
-    return -1;
+    return true;
 }
 
+void KVBlockAllocator::freePages(const std::vector<int>& pages) {
+    if (pages.empty()) {
+        return;
+    }
+
+    // Refill the magazine first; overflow goes back to the buddy lists
+    std::vector<int> overflow;
+    for (int page : pages) {
+        if (page < 0 || page >= static_cast<int>(totalBlocks_)) {
+            continue;
+        }
+        blockUsed_[page].store(0, std::memory_order_relaxed);
+        usedBlocks_.fetch_sub(1, std::memory_order_relaxed);
+        if (!magazinePush(page)) {
+            overflow.push_back(page);
+        }
+    }
+    if (overflow.empty()) {
+        return;
+    }
 
-size_t KVBlockAllocator::freeBlocks() const {
     std::lock_guard<std::mutex> guard(lock_);
-    size_t count = 0;
-    for (bool free : freeList_) {
-        if (free) count++;
+    for (int page : overflow) {
+        buddyRelease(page, 0);
     }
-    return count;
 }
 
-size_t KVBlockAllocator::usedBlocks() const {
-    std::lock_guard<std::mutex> guard(lock_);
-    size_t count = 0;
-    for (bool free : freeList_) {
-        if (!free) count++;
+bool KVBlockAllocator::drainMagazineLocked() {
+    bool drained = false;
+    for (int block = magazinePop(); block != kNullBlock; block = magazinePop()) {
+        buddyRelease(block, 0);
+        drained = true;
     }
-    return count;
+    return drained;
+}
+
+bool KVBlockAllocator::magazinePush(int block) {
+    // Soft capacity: concurrent pushes may overshoot by a few blocks
+    if (magazineSize_.load(std::memory_order_relaxed) >= kMagazineCapacity) {
+        return false;
+    }
+
+    uint64_t head = magazineHead_.load(std::memory_order_acquire);
+    uint64_t next;
+    do {
+        magazineNext_[block].store(static_cast<int>(head & 0xFFFFFFFFull),
+                                   std::memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | static_cast<uint32_t>(block);
+    } while (!magazineHead_.compare_exchange_weak(head, next,
+                                                  std::memory_order_release,
+                                                  std::memory_order_acquire));
+    magazineSize_.fetch_add(1, std::memory_order_relaxed);
+    return true;
+}
+
+int KVBlockAllocator::magazinePop() {
+    uint64_t head = magazineHead_.load(std::memory_order_acquire);
+    uint64_t next;
+    int block;
+    do {
+        block = static_cast<int>(head & 0xFFFFFFFFull);
+        if (block == kNullBlock) {
+            return kNullBlock;
+        }
+        // The tag in the upper half defeats ABA on concurrent pop/push
+        int after = magazineNext_[block].load(std::memory_order_relaxed);
+        next = (((head >> 32) + 1) << 32) | static_cast<uint32_t>(after);
+    } while (!magazineHead_.compare_exchange_weak(head, next,
+                                                  std::memory_order_acq_rel,
+                                                  std::memory_order_acquire));
+    magazineSize_.fetch_sub(1, std::memory_order_relaxed);
+    return block;
+}
+
+size_t KVBlockAllocator::freeBlocks() const {
+    return totalBlocks_ - usedBlocks_.load(std::memory_order_relaxed);
+}
+
+size_t KVBlockAllocator::usedBlocks() const {
+    return usedBlocks_.load(std::memory_order_relaxed);
 }
 
 size_t KVBlockAllocator::totalBlocks() const {
@@ -228,40 +334,38 @@ size_t KVBlockAllocator::totalBlocks() const {
 }
 
 float KVBlockAllocator::fragmentation() const {
-    // Simple metric: ratio of unused free blocks to total blocks
-    // Better metric would measure largest free contiguous region
-    std::lock_guard<std::mutex> guard(lock_);
-    if (totalBlocks_ == 0) return 0.0f;
-    
-    size_t largestContiguous = 0;
-    size_t currentContiguous = 0;
-    
-    for (bool free : freeList_) {
-        if (free) {
-            currentContiguous++;
-            largestContiguous = std::max(largestContiguous, currentContiguous);
-        } else {
-            currentContiguous = 0;
-        }
-    }
-    
-    // Fragmentation = 1 - (largest free region / total free blocks)
+    // Fragmentation = 1 - (largest allocatable block / total free blocks)
     size_t totalFree = freeBlocks();
     if (totalFree == 0) return 0.0f;
+
+    size_t largest = 0;
+    {
+        std::lock_guard<std::mutex> guard(lock_);
+        for (int order = maxOrder_; order >= 0 && !freeHeads_.empty(); --order) {
+            if (freeHeads_[order] != kNullBlock) {
+                largest = size_t{1} << order;
+                break;
+            }
+        }
+    }
+    if (largest == 0 && magazineSize_.load(std::memory_order_relaxed) > 0) {
+        largest = 1;
+    }
     
-    return 1.0f - (static_cast<float>(largestContiguous) / static_cast<float>(totalFree));
+    return 1.0f - (static_cast<float>(largest) / static_cast<float>(totalFree));
 }
 
 void KVBlockAllocator::dumpBlockMap(std::ostream& os) const {
-    std::lock_guard<std::mutex> guard(lock_);
+    // Counters and block flags are atomic; only fragmentation() locks
     os << "KVBlockAllocator State:\n";
     os << "  Total blocks: " << totalBlocks_ << "\n";
-    os << "  Used: " << usedBlocks() << " Free: " << freeBlocks() << "\n";
+    os << "  Used: " << usedBlocks() << " Free: " << freeBlocks()
+       << " (magazine: " << magazineSize_.load(std::memory_order_relaxed) << ")\n";
     os << "  Fragmentation: " << std::fixed << std::setprecision(2) << fragmentation() << "\n";
     os << "  Block map (. = free, X = used):\n    ";
-    for (size_t i = 0; i < freeList_.size(); ++i) {
+    for (size_t i = 0; i < totalBlocks_; ++i) {
         if (i > 0 && i % 64 == 0) os << "\n    ";
-        os << (freeList_[i] ? '.' : 'X');
+        os << (blockUsed_[i].load(std::memory_order_relaxed) ? 'X' : '.');
     }
     os << "\n";
 }
@@ -274,11 +378,15 @@ KVCache::KVCache(size_t numLayers,
                  size_t numHeads,
                  size_t headDim,
                  size_t maxTotalTokens,
-                 size_t blockSize)
+                 size_t blockSize,
+                 KVAllocationMode mode,
+                 KVDType dtype)
     : numLayers_(numLayers),
       numHeads_(numHeads),
       headDim_(headDim),
-      blockSize_(blockSize) {
+      blockSize_(blockSize),
+      mode_(mode),
+      dtype_(dtype) {
     
     // Compute total blocks needed
     totalBlocks_ = (maxTotalTokens + blockSize - 1) / blockSize;
@@ -290,13 +398,42 @@ KVCache::KVCache(size_t numLayers,
     size_t layerBytes = totalBlocks_ * blockBytes;
     size_t totalElements = numLayers_ * layerBytes;
     
-    K_.resize(totalElements, 0.0f);
-    V_.resize(totalElements, 0.0f);
+    K_.resize(totalElements * kvDTypeSize(dtype_), 0);
+    V_.resize(totalElements * kvDTypeSize(dtype_), 0);
+    
+    // INT8: one scale per (layer, block, head)
+    if (dtype_ == KVDType::INT8) {
+        KScales_.assign(numLayers_ * totalBlocks_ * numHeads_, 0.0f);
+        VScales_.assign(numLayers_ * totalBlocks_ * numHeads_, 0.0f);
+    }
     
     // Initialize block allocator
     allocator_ = std::make_unique<KVBlockAllocator>(totalBlocks_);
+
+    // Paged blocks are ref-counted so prefixes can be shared
+    if (mode_ == KVAllocationMode::Paged) {
+        blockRefs_.assign(totalBlocks_, 0);
+        blockInTree_.assign(totalBlocks_, 0);
+        prefixCachingEnabled_ = true;
+    }
 }
 
+KVCache::KVCache(const ModelConfig& config,
+                 size_t cacheBytes,
+                 size_t blockSize,
+                 KVAllocationMode mode,
+                 KVDType dtype)
+    : KVCache(
+          std::max<size_t>(1, config.numLayers),
+          std::max<size_t>(1, config.numKVHeads),
+          std::max<size_t>(1, config.headDim),
+          std::max<size_t>(
+              1,
+              cacheBytes / std::max<size_t>(1, config.kvBytesPerToken(kvDTypeSize(dtype)))),
+          blockSize,
+          mode,
+          dtype) {}
+
 KVCache::KVCache(size_t cacheBytes,
                  size_t hiddenSize,
                  size_t numLayers)
@@ -310,140 +447,935 @@ KVCache::KVCache(size_t cacheBytes,
                             std::max<size_t>(1, hiddenSize / 32) * 2ULL)), // approx tokens
           16) {}
 
-KVCache::~KVCache() = default;
+KVCache::~KVCache() {
+    if (leader_) {
+        std::lock_guard<std::mutex> guard(leader_->lock_);
+        auto& shards = leader_->shards_;
+        shards.erase(std::remove(shards.begin(), shards.end(), this), shards.end());
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    releaseSwapSpaceLocked();
+    for (const auto& named : namedSequences_) {
+        releaseSeqId(named.second);
+    }
+}
 
-bool KVCache::allocateFor(const std::string& requestId, int initialTokens) {
+bool KVCache::allocateFor(SeqId seq, int initialTokens) {
+    CORTEX_TRACE_SCOPE("kv.allocateFor");
     std::lock_guard<std::mutex> guard(lock_);
     
     // Check if already allocated
-    if (sequences_.count(requestId) > 0) {
+    if (seq < 0 || findSequenceLocked(seq) != nullptr) {
         return false;  // Already allocated
     }
     
+    return allocateLocked(seq, initialTokens);
+}
+
+bool KVCache::allocateLocked(SeqId seq, int initialTokens) {
     // Calculate blocks needed
     int blocksNeeded = (initialTokens + blockSize_ - 1) / blockSize_;
     int maxAllowed = blocksNeeded * blockSize_;
     
-    // Attempt allocation
-    KVHandle handle = allocator_->allocate(blocksNeeded);
-    if (!handle.isValid()) {
-        return false;  // Allocation failed
+    SequenceKVEntry entry;
+    if (mode_ == KVAllocationMode::Paged) {
+        // Exactly blocksNeeded pages, wherever they are free
+        if (!allocatePagesLocked(blocksNeeded, entry.blockTable)) {
+            return false;  // Allocation failed
+        }
+    } else {
+        // Attempt allocation
+        KVHandle handle = allocator_->allocate(blocksNeeded);
+        if (!handle.isValid()) {
+            return false;  // Allocation failed
+        }
+        entry.handle = handle;
+        entry.blockTable.reserve(blocksNeeded);
+        for (int i = 0; i < blocksNeeded; ++i) {
+            entry.blockTable.push_back(handle.startBlockIndex + i);
+        }
+        for (int i = 0; i < handle.numBlocks; ++i) {
+            resetBlockScales(handle.startBlockIndex + i);
+        }
     }
     
     // Store sequence entry
-    SequenceKVEntry entry;
-    entry.handle = handle;
     entry.tokensUsed = initialTokens;
     entry.maxAllowed = maxAllowed;
-    sequences_[requestId] = entry;
+    insertSequenceLocked(seq, std::move(entry));
     
     return true;
 }
 
-void KVCache::freeFor(const std::string& requestId) {
+int KVCache::allocateWithPrefix(SeqId seq,
+                                const std::vector<int>& promptTokens,
+                                int initialTokens,
+                                const std::string& adapter) {
+    CORTEX_TRACE_SCOPE("kv.allocateWithPrefix");
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (seq < 0 || findSequenceLocked(seq) != nullptr) {
+        return -1;  // Already allocated
+    }
+
+    const int numTokens = static_cast<int>(promptTokens.size());
+    const int reserveTokens = initialTokens < 0 ? numTokens
+                                                : std::min(initialTokens, numTokens);
+    if (!prefixCachingEnabled_) {
+        // Contiguous ranges cannot grow past their buddy block, so the
+        // whole prompt is reserved even when only a chunk is in use
+        if (!allocateLocked(seq, numTokens)) {
+            return -1;
+        }
+        findSequenceLocked(seq)->tokensUsed = reserveTokens;
+        return 0;
+    }
+
+    prefixStats_.lookups++;
+    prefixStats_.queriedTokens += promptTokens.size();
+
+    // Walk the tree one full block at a time. The final prompt token is
+    // never matched so prefill always has at least one token to run.
+    SequenceKVEntry entry;
+    auto root = prefixRoots_.find(adapter);
+    KVPrefixNode* node = root != prefixRoots_.end() ? root->second.get() : nullptr;
+    size_t matchable = numTokens > 0 && node ? (numTokens - 1) / blockSize_ : 0;
+    uint64_t now = ++prefixClock_;
+
+    for (size_t b = 0; b < matchable; ++b) {
+        const int* blockTokens = promptTokens.data() + b * blockSize_;
+        auto it = node->children.find(hashBlockTokens(blockTokens, blockSize_));
+        if (it == node->children.end() ||
+            !std::equal(blockTokens, blockTokens + blockSize_, it->second->tokens.begin())) {
+            break;
+        }
+        node = it->second.get();
+        node->lastUse = now;
+        retainBlockLocked(node->block);
+        entry.blockTable.push_back(node->block);
+    }
+
+    // Private blocks for the unmatched suffix
+    int matchedBlocks = static_cast<int>(entry.blockTable.size());
+    int cachedTokens = matchedBlocks * static_cast<int>(blockSize_);
+    int slotTokens = std::max(cachedTokens, reserveTokens);
+    int blocksNeeded = (slotTokens + blockSize_ - 1) / blockSize_;
+    if (!allocatePagesLocked(blocksNeeded - matchedBlocks, entry.blockTable)) {
+        releasePagesLocked(entry.blockTable);  // Drop refs on matched blocks
+        return -1;
+    }
+
+    prefixStats_.hitTokens += cachedTokens;
+
+    entry.tokensUsed = slotTokens;
+    entry.maxAllowed = blocksNeeded * blockSize_;
+    insertSequenceLocked(seq, std::move(entry));
+
+    return cachedTokens;
+}
+
+int KVCache::matchPrefix(const std::vector<int>& promptTokens,
+                         const std::string& adapter) const {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    auto root = prefixRoots_.find(adapter);
+    if (!prefixCachingEnabled_ || promptTokens.empty() || root == prefixRoots_.end()) {
+        return 0;
+    }
+
+    // Same walk as allocateWithPrefix(), final prompt token excluded
+    size_t matchable = (promptTokens.size() - 1) / blockSize_;
+    const KVPrefixNode* node = root->second.get();
+    size_t matched = 0;
+    for (; matched < matchable; ++matched) {
+        const int* blockTokens = promptTokens.data() + matched * blockSize_;
+        auto it = node->children.find(hashBlockTokens(blockTokens, blockSize_));
+        if (it == node->children.end() ||
+            !std::equal(blockTokens, blockTokens + blockSize_, it->second->tokens.begin())) {
+            break;
+        }
+        node = it->second.get();
+    }
+    return static_cast<int>(matched * blockSize_);
+}
+
+void KVCache::publishPrefix(SeqId seq,
+                            const std::vector<int>& promptTokens,
+                            const std::string& adapter) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    if (!prefixCachingEnabled_) {
+        return;
+    }
+
+    const SequenceKVEntry* found = findSequenceLocked(seq);
+    if (!found) {
+        return;
+    }
+    const auto& entry = *found;
+
+    // Only full blocks whose KV has been written are shareable
+    size_t written = std::min(promptTokens.size(), static_cast<size_t>(entry.tokensUsed));
+    size_t fullBlocks = std::min(written / blockSize_, entry.blockTable.size());
+    if (fullBlocks == 0) {
+        return;
+    }
+
+    auto& root = prefixRoots_[adapter];
+    if (!root) {
+        root = std::make_unique<KVPrefixNode>();
+    }
+    KVPrefixNode* node = root.get();
+    uint64_t now = ++prefixClock_;
+
+    for (size_t b = 0; b < fullBlocks; ++b) {
+        const int* blockTokens = promptTokens.data() + b * blockSize_;
+        uint64_t h = hashBlockTokens(blockTokens, blockSize_);
+
+        auto it = node->children.find(h);
+        if (it != node->children.end()) {
+            if (!std::equal(blockTokens, blockTokens + blockSize_, it->second->tokens.begin())) {
+                return;  // Hash collision: keep the existing entry
+            }
+            node = it->second.get();
+            node->lastUse = now;
+            continue;
+        }
+
+        auto child = std::make_unique<KVPrefixNode>();
+        child->tokens.assign(blockTokens, blockTokens + blockSize_);
+        child->block = entry.blockTable[b];
+        child->parent = node;
+        child->lastUse = now;
+
+        blockRefs_[child->block]++;  // The tree's own reference
+        blockInTree_[child->block] = 1;
+        prefixStats_.cachedBlocks++;
+
+        node = (node->children[h] = std::move(child)).get();
+    }
+}
+
+void KVCache::freeFor(SeqId seq) {
     std::lock_guard<std::mutex> guard(lock_);
     
-    auto it = sequences_.find(requestId);
-    if (it != sequences_.end()) {
+    // A preempted sequence only holds swap slots
+    auto swapIt = swapped_.find(seq);
+    if (swapIt != swapped_.end()) {
+        freeSwapSlots_.insert(freeSwapSlots_.end(),
+                              swapIt->second.slots.begin(), swapIt->second.slots.end());
+        swapped_.erase(swapIt);
+    }
+    
+    SequenceKVEntry* entry = findSequenceLocked(seq);
+    if (entry) {
         // Free blocks back to allocator
-        allocator_->free(it->second.handle);
+        if (mode_ == KVAllocationMode::Paged) {
+            releasePagesLocked(entry->blockTable);
+        } else {
+            allocator_->free(entry->handle);
+        }
         // Remove entry
-        sequences_.erase(it);
+        eraseSequenceLocked(seq);
     }
 }
 
-KVView KVCache::getKView(const std::string& requestId, int layer) {
-    std::lock_guard<std::mutex> guard(lock_);
+KVView KVCache::getKView(SeqId seq, int layer) {
+    KVCache& owner = groupLeader();
+    std::lock_guard<std::mutex> guard(owner.lock_);
     
-    auto it = sequences_.find(requestId);
-    if (it == sequences_.end()) {
-        return {nullptr, {}, false};
+    const SequenceKVEntry* entry = owner.findSequenceLocked(seq);
+    if (!entry) {
+        return KVView{};
     }
     
-    const auto& entry = it->second;
+    // K tensor view: [numHeads, tokensUsed, headDim], one page per block
+    return makeView(*entry, layer, true);
+}
+
+KVView KVCache::getVView(SeqId seq, int layer) {
+    KVCache& owner = groupLeader();
+    std::lock_guard<std::mutex> guard(owner.lock_);
     
-    // K tensor view: [numHeads, tokensUsed, headDim]
-    // Points to first block of this sequence in this layer
-    float* data = getKBuffer(entry.handle.startBlockIndex, layer, 0, 0);
+    const SequenceKVEntry* entry = owner.findSequenceLocked(seq);
+    if (!entry) {
+        return KVView{};
+    }
     
-    return {data,
-            {numHeads_, static_cast<size_t>(entry.tokensUsed), headDim_},
-            true};
+    // V tensor view: [numHeads, tokensUsed, headDim], one page per block
+    return makeView(*entry, layer, false);
 }
 
-KVView KVCache::getVView(const std::string& requestId, int layer) {
+KVView KVCache::makeView(const SequenceKVEntry& entry, int layer, bool isKey) {
+    KVView view;
+    view.shape = {numHeads_, static_cast<size_t>(entry.tokensUsed), headDim_};
+    view.blockSize = blockSize_;
+    view.dtype = dtype_;
+    view.pages.reserve(entry.blockTable.size());
+    for (int block : entry.blockTable) {
+        view.pages.push_back(isKey ? getKBuffer(block, layer, 0, 0)
+                                   : getVBuffer(block, layer, 0, 0));
+    }
+    if (dtype_ == KVDType::INT8) {
+        auto& scales = isKey ? KScales_ : VScales_;
+        view.scales.reserve(entry.blockTable.size());
+        for (int block : entry.blockTable) {
+            view.scales.push_back(scales.data() + scaleIndex(block, layer, 0));
+        }
+    }
+    view.data = view.pages.empty() ? nullptr : view.pages.front();
+    view.valid = true;
+    return view;
+}
+
+bool KVCache::writeToken(SeqId seq, int layer, int position,
+                         const float* k, const float* v) {
+    KVCache& owner = groupLeader();
+    std::lock_guard<std::mutex> guard(owner.lock_);
+
+    SequenceKVEntry* found = owner.findSequenceLocked(seq);
+    if (!found || layer < 0 || layer >= static_cast<int>(numLayers_) ||
+        position < 0 || position >= found->maxAllowed) {
+        return false;
+    }
+    auto& entry = *found;
+
+    size_t logicalBlock = position / blockSize_;
+    // Copy-on-write runs on rank 0, which copies the block in every shard
+    if (mode_ == KVAllocationMode::Paged && !owner.ensureWritableLocked(entry, logicalBlock)) {
+        return false;
+    }
+    int block = entry.blockTable[logicalBlock];
+    size_t row = position % blockSize_;
+
+    float* kScales = dtype_ == KVDType::INT8 ? KScales_.data() + scaleIndex(block, layer, 0) : nullptr;
+    float* vScales = dtype_ == KVDType::INT8 ? VScales_.data() + scaleIndex(block, layer, 0) : nullptr;
+    for (size_t h = 0; h < numHeads_; ++h) {
+        storeRow(getKBuffer(block, layer, 0, 0), kScales, h, row, k + h * headDim_);
+        storeRow(getVBuffer(block, layer, 0, 0), vScales, h, row, v + h * headDim_);
+    }
+    return true;
+}
+
+bool KVCache::readToken(SeqId seq, int layer, int position,
+                        float* k, float* v) const {
+    const KVCache& owner = groupLeader();
+    std::lock_guard<std::mutex> guard(owner.lock_);
+
+    const SequenceKVEntry* entry = owner.findSequenceLocked(seq);
+    if (!entry || layer < 0 || layer >= static_cast<int>(numLayers_) ||
+        position < 0 || position >= entry->maxAllowed) {
+        return false;
+    }
+
+    int block = entry->blockTable[position / blockSize_];
+    size_t row = position % blockSize_;
+    auto* self = const_cast<KVCache*>(this);  // Buffer helpers are non-const
+
+    const float* kScales = dtype_ == KVDType::INT8 ? KScales_.data() + scaleIndex(block, layer, 0) : nullptr;
+    const float* vScales = dtype_ == KVDType::INT8 ? VScales_.data() + scaleIndex(block, layer, 0) : nullptr;
+    for (size_t h = 0; h < numHeads_; ++h) {
+        loadRow(self->getKBuffer(block, layer, 0, 0), kScales, h, row, k + h * headDim_);
+        loadRow(self->getVBuffer(block, layer, 0, 0), vScales, h, row, v + h * headDim_);
+    }
+    return true;
+}
+
+void KVCache::storeRow(unsigned char* block, float* scales, size_t head, size_t row,
+                       const float* src) {
+    const size_t headStride = blockSize_ * headDim_;
+    const size_t offset = head * headStride + row * headDim_;
+
+    switch (dtype_) {
+        case KVDType::FP32:
+            std::memcpy(block + offset * sizeof(float), src, headDim_ * sizeof(float));
+            break;
+
+        case KVDType::FP16: {
+            auto* dst = reinterpret_cast<uint16_t*>(block) + offset;
+            for (size_t d = 0; d < headDim_; ++d) {
+                dst[d] = floatToHalf(src[d]);
+            }
+            break;
+        }
+
+        case KVDType::INT8: {
+            auto* q = reinterpret_cast<int8_t*>(block);
+            float absMax = 0.0f;
+            for (size_t d = 0; d < headDim_; ++d) {
+                absMax = std::max(absMax, std::fabs(src[d]));
+            }
+
+            // Widen the (block, head) scale and re-quantize rows already written
+            float& scale = scales[head];
+            if (absMax > scale * 127.0f) {
+                float newScale = absMax / 127.0f;
+                int8_t* headRows = q + head * headStride;
+                for (size_t i = 0; i < headStride; ++i) {
+                    headRows[i] = quantizeInt8(headRows[i] * scale, newScale);
+                }
+                scale = newScale;
+            }
+
+            for (size_t d = 0; d < headDim_; ++d) {
+                q[offset + d] = quantizeInt8(src[d], scale);
+            }
+            break;
+        }
+    }
+}
+
+void KVCache::loadRow(const unsigned char* block, const float* scales, size_t head, size_t row,
+                      float* dst) const {
+    const size_t offset = head * blockSize_ * headDim_ + row * headDim_;
+
+    switch (dtype_) {
+        case KVDType::FP32:
+            std::memcpy(dst, block + offset * sizeof(float), headDim_ * sizeof(float));
+            break;
+
+        case KVDType::FP16: {
+            const auto* src = reinterpret_cast<const uint16_t*>(block) + offset;
+            for (size_t d = 0; d < headDim_; ++d) {
+                dst[d] = halfToFloat(src[d]);
+            }
+            break;
+        }
+
+        case KVDType::INT8: {
+            const auto* src = reinterpret_cast<const int8_t*>(block) + offset;
+            const float scale = scales[head];
+            for (size_t d = 0; d < headDim_; ++d) {
+                dst[d] = src[d] * scale;
+            }
+            break;
+        }
+    }
+}
+
+void KVCache::resetBlockScales(int block) {
+    if (dtype_ != KVDType::INT8) {
+        return;
+    }
+    for (size_t layer = 0; layer < numLayers_; ++layer) {
+        std::fill_n(KScales_.begin() + scaleIndex(block, layer, 0), numHeads_, 0.0f);
+        std::fill_n(VScales_.begin() + scaleIndex(block, layer, 0), numHeads_, 0.0f);
+    }
+    for (KVCache* shard : shards_) {
+        shard->resetBlockScales(block);
+    }
+}
+
+bool KVCache::configureSwapSpace(size_t swapBlocks, const std::string& backingFile) {
     std::lock_guard<std::mutex> guard(lock_);
-    
-    auto it = sequences_.find(requestId);
-    if (it == sequences_.end()) {
-        return {nullptr, {}, false};
+
+    if (!swapped_.empty()) {
+        return false;  // Pool in use
     }
-    
-    const auto& entry = it->second;
-    
-    // V tensor view: [numHeads, tokensUsed, headDim]
-    float* data = getVBuffer(entry.handle.startBlockIndex, layer, 0, 0);
-    
-    return {data,
-            {numHeads_, static_cast<size_t>(entry.tokensUsed), headDim_},
-            true};
+    releaseSwapSpaceLocked();
+
+    for (KVCache* shard : shards_) {
+        shard->releaseSwapSpaceLocked();
+    }
+
+    if (swapBlocks * getBytesPerBlock() == 0) {
+        return true;  // Swap disabled
+    }
+
+    // Shards park their heads in pools of the same slot count
+    bool ok = allocateSwapStorage(swapBlocks * getBytesPerBlock(), backingFile);
+    for (KVCache* shard : shards_) {
+        std::string shardFile = backingFile.empty()
+            ? backingFile : backingFile + ".shard" + std::to_string(shard->shardRank_);
+        ok = ok && shard->allocateSwapStorage(swapBlocks * shard->getBytesPerBlock(), shardFile);
+    }
+    if (!ok) {
+        releaseSwapSpaceLocked();
+        for (KVCache* shard : shards_) {
+            shard->releaseSwapSpaceLocked();
+        }
+        return false;
+    }
+
+    freeSwapSlots_.reserve(swapBlocks);
+    for (int slot = static_cast<int>(swapBlocks) - 1; slot >= 0; --slot) {
+        freeSwapSlots_.push_back(slot);
+    }
+    return true;
 }
 
-int KVCache::usedTokens(const std::string& requestId) const {
+bool KVCache::allocateSwapStorage(size_t bytes, const std::string& backingFile) {
+    if (backingFile.empty()) {
+        swapHeap_.resize(bytes);
+        return true;
+    }
+    swapFd_ = ::open(backingFile.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0600);
+    if (swapFd_ < 0) {
+        return false;
+    }
+    if (::ftruncate(swapFd_, static_cast<off_t>(bytes)) != 0) {
+        ::close(swapFd_);
+        swapFd_ = -1;
+        return false;
+    }
+    void* addr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, swapFd_, 0);
+    if (addr == MAP_FAILED) {
+        ::close(swapFd_);
+        swapFd_ = -1;
+        return false;
+    }
+    swapMap_ = static_cast<unsigned char*>(addr);
+    swapMapBytes_ = bytes;
+    return true;
+}
+
+bool KVCache::swapOut(SeqId seq) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    SequenceKVEntry* found = findSequenceLocked(seq);
+    if (!found) {
+        return false;
+    }
+    auto& entry = *found;
+    if (freeSwapSlots_.size() < entry.blockTable.size()) {
+        return false;  // Caller falls back to recompute
+    }
+
+    SwappedKVEntry parked;
+    parked.tokensUsed = entry.tokensUsed;
+    parked.maxAllowed = entry.maxAllowed;
+    parked.slots.reserve(entry.blockTable.size());
+    for (int block : entry.blockTable) {
+        int slot = freeSwapSlots_.back();
+        freeSwapSlots_.pop_back();
+        copyBlockToSlot(block, slot);
+        parked.slots.push_back(slot);
+    }
+
+    // Shared prefix blocks merely lose this sequence's reference
+    if (mode_ == KVAllocationMode::Paged) {
+        releasePagesLocked(entry.blockTable);
+    } else {
+        allocator_->free(entry.handle);
+    }
+    eraseSequenceLocked(seq);
+    swapped_[seq] = std::move(parked);
+    return true;
+}
+
+bool KVCache::swapIn(SeqId seq) {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    auto it = swapped_.find(seq);
+    if (it == swapped_.end()) {
+        return false;
+    }
+    auto& parked = it->second;
+    int numBlocks = static_cast<int>(parked.slots.size());
+
+    SequenceKVEntry entry;
+    if (mode_ == KVAllocationMode::Paged) {
+        if (!allocatePagesLocked(numBlocks, entry.blockTable)) {
+            return false;
+        }
+    } else {
+        KVHandle handle = allocator_->allocate(numBlocks);
+        if (!handle.isValid()) {
+            return false;
+        }
+        entry.handle = handle;
+        for (int i = 0; i < numBlocks; ++i) {
+            entry.blockTable.push_back(handle.startBlockIndex + i);
+        }
+    }
+
+    for (int i = 0; i < numBlocks; ++i) {
+        copySlotToBlock(parked.slots[i], entry.blockTable[i]);
+    }
+    freeSwapSlots_.insert(freeSwapSlots_.end(), parked.slots.begin(), parked.slots.end());
+
+    entry.tokensUsed = parked.tokensUsed;
+    entry.maxAllowed = parked.maxAllowed;
+    insertSequenceLocked(seq, std::move(entry));
+    swapped_.erase(it);
+    return true;
+}
+
+bool KVCache::isSwapped(SeqId seq) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return swapped_.count(seq) > 0;
+}
+
+size_t KVCache::getNumFreeSwapBlocks() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return freeSwapSlots_.size();
+}
+
+unsigned char* KVCache::swapSlot(int slot) {
+    unsigned char* base = swapMap_ ? swapMap_ : swapHeap_.data();
+    return base + static_cast<size_t>(slot) * getBytesPerBlock();
+}
+
+void KVCache::copyBlockToSlot(int block, int slot) {
+    // Slot layout per layer: K block, V block, [K scales, V scales]
+    const size_t blockBytes = numHeads_ * blockSize_ * headDim_ * kvDTypeSize(dtype_);
+    unsigned char* dst = swapSlot(slot);
+    for (size_t layer = 0; layer < numLayers_; ++layer) {
+        std::memcpy(dst, getKBuffer(block, layer, 0, 0), blockBytes);
+        dst += blockBytes;
+        std::memcpy(dst, getVBuffer(block, layer, 0, 0), blockBytes);
+        dst += blockBytes;
+        if (dtype_ == KVDType::INT8) {
+            std::memcpy(dst, KScales_.data() + scaleIndex(block, layer, 0), numHeads_ * sizeof(float));
+            dst += numHeads_ * sizeof(float);
+            std::memcpy(dst, VScales_.data() + scaleIndex(block, layer, 0), numHeads_ * sizeof(float));
+            dst += numHeads_ * sizeof(float);
+        }
+    }
+    for (KVCache* shard : shards_) {
+        shard->copyBlockToSlot(block, slot);
+    }
+}
+
+void KVCache::copySlotToBlock(int slot, int block) {
+    const size_t blockBytes = numHeads_ * blockSize_ * headDim_ * kvDTypeSize(dtype_);
+    const unsigned char* src = swapSlot(slot);
+    for (size_t layer = 0; layer < numLayers_; ++layer) {
+        std::memcpy(getKBuffer(block, layer, 0, 0), src, blockBytes);
+        src += blockBytes;
+        std::memcpy(getVBuffer(block, layer, 0, 0), src, blockBytes);
+        src += blockBytes;
+        if (dtype_ == KVDType::INT8) {
+            std::memcpy(KScales_.data() + scaleIndex(block, layer, 0), src, numHeads_ * sizeof(float));
+            src += numHeads_ * sizeof(float);
+            std::memcpy(VScales_.data() + scaleIndex(block, layer, 0), src, numHeads_ * sizeof(float));
+            src += numHeads_ * sizeof(float);
+        }
+    }
+    for (KVCache* shard : shards_) {
+        shard->copySlotToBlock(slot, block);
+    }
+}
+
+void KVCache::releaseSwapSpaceLocked() {
+    if (swapMap_) {
+        ::munmap(swapMap_, swapMapBytes_);
+        swapMap_ = nullptr;
+        swapMapBytes_ = 0;
+    }
+    if (swapFd_ >= 0) {
+        ::close(swapFd_);
+        swapFd_ = -1;
+    }
+    swapHeap_.clear();
+    swapHeap_.shrink_to_fit();
+    freeSwapSlots_.clear();
+}
+
+int KVCache::usedTokens(SeqId seq) const {
     std::lock_guard<std::mutex> guard(lock_);
     
-    auto it = sequences_.find(requestId);
-    if (it == sequences_.end()) {
+    const SequenceKVEntry* entry = findSequenceLocked(seq);
+    if (!entry) {
         return 0;
     }
     
-    return it->second.tokensUsed;
+    return entry->tokensUsed;
 }
 
-bool KVCache::appendToken(const std::string& requestId) {
+bool KVCache::appendToken(SeqId seq) {
     std::lock_guard<std::mutex> guard(lock_);
     
-    auto it = sequences_.find(requestId);
-    if (it == sequences_.end()) {
+    SequenceKVEntry* found = findSequenceLocked(seq);
+    if (!found) {
         return false;  // Sequence not found
     }
     
-    auto& entry = it->second;
+    auto& entry = *found;
     
-    // Check if we have capacity
-    if (entry.tokensUsed >= entry.maxAllowed) {
+    // Grow on block boundaries: sequences hold only the blocks they have
+    // actually written, instead of reserving maxTokens upfront.
+    if (entry.tokensUsed >= entry.maxAllowed && !growLocked(entry)) {
         return false;  // Out of capacity
     }
     
+    // Never write into a block another sequence (or the prefix cache) holds
+    if (mode_ == KVAllocationMode::Paged &&
+        !ensureWritableLocked(entry, entry.tokensUsed / blockSize_)) {
+        return false;
+    }
+    
     entry.tokensUsed++;
     return true;
 }
 
-int KVCache::getTokenOffsetInBlock(const std::string& requestId) const {
+bool KVCache::appendTokens(SeqId seq, int count) {
+    CORTEX_TRACE_SCOPE_ARG("kv.appendTokens", count);
+    std::lock_guard<std::mutex> guard(lock_);
+    
+    SequenceKVEntry* found = findSequenceLocked(seq);
+    if (!found || count < 0) {
+        return false;
+    }
+    
+    auto& entry = *found;
+    int target = entry.tokensUsed + count;
+    int blocksNeeded = (target + blockSize_ - 1) / blockSize_;
+    int extraBlocks = blocksNeeded - static_cast<int>(entry.blockTable.size());
+    
+    if (mode_ == KVAllocationMode::Paged) {
+        // Only the partially filled tail block can be shared; new pages are private
+        if (count > 0 && !ensureWritableLocked(entry, entry.tokensUsed / blockSize_)) {
+            return false;
+        }
+        if (extraBlocks > 0 && !allocatePagesLocked(extraBlocks, entry.blockTable)) {
+            return false;
+        }
+    } else if (extraBlocks > 0) {
+        if (blocksNeeded > entry.handle.numBlocks) {
+            return false;  // Beyond the buddy range
+        }
+        for (int b = static_cast<int>(entry.blockTable.size()); b < blocksNeeded; ++b) {
+            entry.blockTable.push_back(entry.handle.startBlockIndex + b);
+        }
+    }
+    
+    entry.maxAllowed = std::max(entry.maxAllowed,
+                                static_cast<int>(entry.blockTable.size() * blockSize_));
+    entry.tokensUsed = target;
+    return true;
+}
+
+bool KVCache::truncateTokens(SeqId seq, int count) {
+    std::lock_guard<std::mutex> guard(lock_);
+    
+    SequenceKVEntry* found = findSequenceLocked(seq);
+    if (!found || count < 0 || count > found->tokensUsed) {
+        return false;
+    }
+    
+    auto& entry = *found;
+    entry.tokensUsed -= count;
+    
+    if (mode_ == KVAllocationMode::Paged) {
+        size_t blocksNeeded = (entry.tokensUsed + blockSize_ - 1) / blockSize_;
+        if (entry.blockTable.size() > blocksNeeded) {
+            std::vector<int> released(entry.blockTable.begin() + blocksNeeded,
+                                      entry.blockTable.end());
+            entry.blockTable.resize(blocksNeeded);
+            releasePagesLocked(released);
+            entry.maxAllowed = static_cast<int>(blocksNeeded * blockSize_);
+        }
+    }
+    return true;
+}
+
+bool KVCache::hasSequence(SeqId seq) const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return findSequenceLocked(seq) != nullptr;
+}
+
+bool KVCache::growLocked(SequenceKVEntry& entry) {
+    if (mode_ == KVAllocationMode::Paged) {
+        // Take one more page from anywhere in the arena
+        if (!allocatePagesLocked(1, entry.blockTable)) {
+            return false;
+        }
+    } else {
+        // Contiguous ranges can only extend into the slack left by
+        // power-of-two rounding of their buddy block.
+        int nextBlock = static_cast<int>(entry.blockTable.size());
+        if (nextBlock >= entry.handle.numBlocks) {
+            return false;
+        }
+        entry.blockTable.push_back(entry.handle.startBlockIndex + nextBlock);
+    }
+    entry.maxAllowed += static_cast<int>(blockSize_);
+    return true;
+}
+
+bool KVCache::allocatePagesLocked(int count, std::vector<int>& pages) {
+    size_t firstNew = pages.size();
+    if (!allocator_->allocatePages(count, pages)) {
+        // Reclaim cached prefix blocks nobody is using, then retry
+        if (!prefixCachingEnabled_ ||
+            evictPrefixBlocksLocked(count) == 0 ||
+            !allocator_->allocatePages(count, pages)) {
+            return false;
+        }
+    }
+    for (size_t i = firstNew; i < pages.size(); ++i) {
+        blockRefs_[pages[i]] = 1;
+        resetBlockScales(pages[i]);
+    }
+    return true;
+}
+
+void KVCache::releasePagesLocked(const std::vector<int>& pages) {
+    std::vector<int> released;
+    released.reserve(pages.size());
+    for (int block : pages) {
+        int refs = --blockRefs_[block];
+        if (refs == 0) {
+            released.push_back(block);
+        } else if (refs == 1 && blockInTree_[block]) {
+            idlePrefixBlocks_++;  // Only the tree holds it now
+        }
+    }
+    allocator_->freePages(released);
+}
+
+void KVCache::retainBlockLocked(int block) {
+    if (blockRefs_[block]++ == 1 && blockInTree_[block]) {
+        idlePrefixBlocks_--;
+    }
+}
+
+bool KVCache::ensureWritableLocked(SequenceKVEntry& entry, size_t logicalBlock) {
+    // Copy-on-write: a shared block is duplicated the first time this
+    // sequence diverges from the other holders.
+    if (logicalBlock >= entry.blockTable.size()) {
+        return true;
+    }
+    int block = entry.blockTable[logicalBlock];
+    if (blockRefs_[block] <= 1) {
+        return true;
+    }
+
+    std::vector<int> fresh;
+    if (!allocatePagesLocked(1, fresh)) {
+        return false;
+    }
+    copyBlock(block, fresh.front());
+    if (--blockRefs_[block] == 1 && blockInTree_[block]) {
+        idlePrefixBlocks_++;
+    }
+    entry.blockTable[logicalBlock] = fresh.front();
+    return true;
+}
+
+void KVCache::copyBlock(int srcBlock, int dstBlock) {
+    const size_t blockBytes = numHeads_ * blockSize_ * headDim_ * kvDTypeSize(dtype_);
+    for (size_t layer = 0; layer < numLayers_; ++layer) {
+        std::memcpy(getKBuffer(dstBlock, layer, 0, 0), getKBuffer(srcBlock, layer, 0, 0),
+                    blockBytes);
+        std::memcpy(getVBuffer(dstBlock, layer, 0, 0), getVBuffer(srcBlock, layer, 0, 0),
+                    blockBytes);
+        if (dtype_ == KVDType::INT8) {
+            std::copy_n(KScales_.begin() + scaleIndex(srcBlock, layer, 0), numHeads_,
+                        KScales_.begin() + scaleIndex(dstBlock, layer, 0));
+            std::copy_n(VScales_.begin() + scaleIndex(srcBlock, layer, 0), numHeads_,
+                        VScales_.begin() + scaleIndex(dstBlock, layer, 0));
+        }
+    }
+    for (KVCache* shard : shards_) {
+        shard->copyBlock(srcBlock, dstBlock);
+    }
+}
+
+size_t KVCache::evictPrefixBlocksLocked(size_t blocksNeeded) {
+    // LRU over leaves that only the tree still references. Evicting a leaf
+    // may expose its parent, so repeat until satisfied or nothing is left.
+    size_t freed = 0;
+    while (freed < blocksNeeded) {
+        std::vector<KVPrefixNode*> leaves;
+        std::vector<KVPrefixNode*> stack;
+        for (auto& [adapter, root] : prefixRoots_) {
+            stack.push_back(root.get());
+        }
+        while (!stack.empty()) {
+            KVPrefixNode* node = stack.back();
+            stack.pop_back();
+            for (auto& [h, child] : node->children) {
+                if (child->children.empty()) {
+                    if (blockRefs_[child->block] == 1) {
+                        leaves.push_back(child.get());
+                    }
+                } else {
+                    stack.push_back(child.get());
+                }
+            }
+        }
+        if (leaves.empty()) {
+            break;
+        }
+
+        std::sort(leaves.begin(), leaves.end(),
+            [](const KVPrefixNode* a, const KVPrefixNode* b) {
+                return a->lastUse < b->lastUse;
+            });
+
+        std::vector<int> released;
+        for (KVPrefixNode* leaf : leaves) {
+            if (freed >= blocksNeeded) break;
+            blockRefs_[leaf->block] = 0;
+            blockInTree_[leaf->block] = 0;
+            idlePrefixBlocks_--;
+            released.push_back(leaf->block);
+            leaf->parent->children.erase(hashBlockTokens(leaf->tokens.data(), leaf->tokens.size()));
+            freed++;
+        }
+        allocator_->freePages(released);
+        prefixStats_.cachedBlocks -= released.size();
+        prefixStats_.evictedBlocks += released.size();
+    }
+    return freed;
+}
+
+uint64_t KVCache::hashBlockTokens(const int* tokens, size_t count) {
+    // FNV-1a over the token ids of one block
+    uint64_t h = 1469598103934665603ULL;
+    for (size_t i = 0; i < count; ++i) {
+        h ^= static_cast<uint32_t>(tokens[i]);
+        h *= 1099511628211ULL;
+    }
+    return h;
+}
+
+int KVCache::getTokenOffsetInBlock(SeqId seq) const {
     std::lock_guard<std::mutex> guard(lock_);
     
-    auto it = sequences_.find(requestId);
-    if (it == sequences_.end()) {
+    const SequenceKVEntry* entry = findSequenceLocked(seq);
+    if (!entry) {
         return -1;
     }
     
     // Offset within current block (0 to blockSize-1)
-    return it->second.tokensUsed % blockSize_;
+    return entry->tokensUsed % blockSize_;
 }
 
 size_t KVCache::getTotalAllocated() const {
-    size_t blockSize = numHeads_ * blockSize_ * headDim_ * sizeof(float);
-    return allocator_->usedBlocks() * 2 * blockSize;  // 2 = K and V
+    return allocator_->usedBlocks() * getBytesPerBlock();
 }
 
 size_t KVCache::getTotalFree() const {
-    size_t blockSize = numHeads_ * blockSize_ * headDim_ * sizeof(float);
-    return allocator_->freeBlocks() * 2 * blockSize;
+    return allocator_->freeBlocks() * getBytesPerBlock();
+}
+
+size_t KVCache::getNumFreeBlocks() const {
+    return allocator_->freeBlocks();
+}
+
+size_t KVCache::getNumAvailableBlocks() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return allocator_->freeBlocks() + idlePrefixBlocks_;
+}
+
+size_t KVCache::getBytesPerBlock() const {
+    size_t perLayer = numHeads_ * blockSize_ * headDim_ * kvDTypeSize(dtype_);
+    if (dtype_ == KVDType::INT8) {
+        perLayer += numHeads_ * sizeof(float);
+    }
+    return numLayers_ * perLayer * 2;  // 2 = K and V
+}
+
+KVDType KVCache::getDType() const {
+    return dtype_;
 }
 
 int KVCache::getNumAllocatedSequences() const {
     std::lock_guard<std::mutex> guard(lock_);
-    return sequences_.size();
+    return static_cast<int>(numSequences_);
 }
 
 bool KVCache::isFull() const {
@@ -454,16 +1386,113 @@ float KVCache::getFragmentation() const {
     return allocator_->fragmentation();
 }
 
+KVAllocationMode KVCache::getAllocationMode() const {
+    return mode_;
+}
+
+size_t KVCache::getBlockSize() const {
+    return blockSize_;
+}
+
+void KVCache::setPrefixCachingEnabled(bool enabled) {
+    if (!enabled) {
+        clearPrefixCache();
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    prefixCachingEnabled_ = enabled && mode_ == KVAllocationMode::Paged;
+}
+
+bool KVCache::isPrefixCachingEnabled() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return prefixCachingEnabled_;
+}
+
+PrefixCacheStats KVCache::getPrefixCacheStats() const {
+    std::lock_guard<std::mutex> guard(lock_);
+    return prefixStats_;
+}
+
+void KVCache::clearPrefixCache() {
+    std::lock_guard<std::mutex> guard(lock_);
+
+    // Drop the tree's reference on every cached block
+    std::vector<int> blocks;
+    std::vector<KVPrefixNode*> stack;
+    for (auto& [adapter, root] : prefixRoots_) {
+        stack.push_back(root.get());
+    }
+    while (!stack.empty()) {
+        KVPrefixNode* node = stack.back();
+        stack.pop_back();
+        for (auto& [h, child] : node->children) {
+            blocks.push_back(child->block);
+            blockInTree_[child->block] = 0;
+            stack.push_back(child.get());
+        }
+    }
+    if (!blocks.empty()) {
+        releasePagesLocked(blocks);
+    }
+    idlePrefixBlocks_ = 0;
+    prefixRoots_.clear();
+    prefixStats_.cachedBlocks = 0;
+}
+
+std::shared_ptr<KVCache> KVCache::createHeadShard(const std::shared_ptr<KVCache>& leader) {
+    if (!leader || leader->leader_) {
+        return nullptr;  // Shards attach to rank 0 only
+    }
+    std::lock_guard<std::mutex> guard(leader->lock_);
+    if (leader->numSequences_ > 0 || !leader->swapped_.empty()) {
+        return nullptr;  // Live KV would be missing from the new arena
+    }
+
+    // Same geometry and block layout; the shard's own allocator stays idle
+    auto shard = std::make_shared<KVCache>(leader->numLayers_, leader->numHeads_, leader->headDim_,
+                                           leader->totalBlocks_ * leader->blockSize_,
+                                           leader->blockSize_, leader->mode_, leader->dtype_);
+    size_t swapBlocks = leader->freeSwapSlots_.size();
+    if (swapBlocks > 0) {
+        shard->swapHeap_.resize(swapBlocks * shard->getBytesPerBlock());
+    }
+    int rank = 1;
+    for (const KVCache* existing : leader->shards_) {
+        rank = std::max(rank, existing->shardRank_ + 1);
+    }
+    shard->leader_ = leader;
+    shard->shardRank_ = rank;
+    leader->shards_.push_back(shard.get());
+    return shard;
+}
+
+int KVCache::getShardRank() const {
+    return shardRank_;
+}
+
+int KVCache::getNumHeadShards() const {
+    KVCache& owner = groupLeader();
+    std::lock_guard<std::mutex> guard(owner.lock_);
+    return static_cast<int>(owner.shards_.size()) + 1;
+}
+
+size_t KVCache::getNumHeads() const {
+    return numHeads_;
+}
+
+KVCache& KVCache::groupLeader() const {
+    return leader_ ? *leader_ : const_cast<KVCache&>(*this);
+}
+
 void KVCache::warmup() {
     // Touch memory to ensure pages are allocated
     const size_t pageSize = 4096;
     
-    for (size_t i = 0; i < K_.size(); i += pageSize / sizeof(float)) {
-        K_[i] = 0.0f;
+    for (size_t i = 0; i < K_.size(); i += pageSize) {
+        K_[i] = 0;
     }
     
-    for (size_t i = 0; i < V_.size(); i += pageSize / sizeof(float)) {
-        V_[i] = 0.0f;
+    for (size_t i = 0; i < V_.size(); i += pageSize) {
+        V_[i] = 0;
     }
 }
 
@@ -474,45 +1503,226 @@ void KVCache::dumpCacheStats(std::ostream& os) const {
     os << "Configuration:\n";
     os << "  Layers: " << numLayers_ << ", Heads: " << numHeads_ 
        << ", HeadDim: " << headDim_ << "\n";
-    os << "  BlockSize: " << blockSize_ << ", TotalBlocks: " << totalBlocks_ << "\n";
+    os << "  BlockSize: " << blockSize_ << ", TotalBlocks: " << totalBlocks_
+       << ", Mode: " << (mode_ == KVAllocationMode::Paged ? "paged" : "contiguous")
+       << ", DType: " << (dtype_ == KVDType::INT8 ? "int8" : dtype_ == KVDType::FP16 ? "fp16" : "fp32")
+       << "\n";
     os << "\nAllocation State:\n";
-    os << "  Allocated sequences: " << sequences_.size() << "\n";
+    os << "  Allocated sequences: " << numSequences_ << "\n";
     os << "  Total allocated: " << (getTotalAllocated() / 1024.0f / 1024.0f) << " MB\n";
     os << "  Total free: " << (getTotalFree() / 1024.0f / 1024.0f) << " MB\n";
+    if (!swapped_.empty() || !freeSwapSlots_.empty()) {
+        os << "  Swapped sequences: " << swapped_.size()
+           << " (free swap blocks: " << freeSwapSlots_.size() << ")\n";
+    }
     os << "  Fragmentation: " << std::fixed << std::setprecision(2) 
        << getFragmentation() << "\n";
+    if (prefixCachingEnabled_) {
+        os << "  Prefix cache: " << prefixStats_.cachedBlocks << " blocks, "
+           << prefixStats_.hitTokens << "/" << prefixStats_.queriedTokens
+           << " prompt tokens hit\n";
+    }
     os << "\nSequences:\n";
     
-    for (const auto& [reqId, entry] : sequences_) {
-        os << "  " << reqId << ": " << entry.tokensUsed << "/" << entry.maxAllowed 
-           << " tokens, blocks [" << entry.handle.startBlockIndex << ", +" 
-           << entry.handle.numBlocks << "]\n";
+    for (size_t seq = 0; seq < sequences_.size(); ++seq) {
+        if (!seqLive_[seq]) {
+            continue;
+        }
+        const auto& entry = sequences_[seq];
+        os << "  #" << seq << ": " << entry.tokensUsed << "/" << entry.maxAllowed;
+        if (mode_ == KVAllocationMode::Paged) {
+            os << " tokens, pages [";
+            for (size_t i = 0; i < entry.blockTable.size(); ++i) {
+                if (i > 0) os << " ";
+                os << entry.blockTable[i];
+            }
+            os << "]\n";
+        } else {
+            os << " tokens, blocks [" << entry.handle.startBlockIndex << ", +"
+               << entry.handle.numBlocks << "]\n";
+        }
     }
 }
 
-float* KVCache::getKBuffer(int blockIndex, int layer, int head, int offset) {
+unsigned char* KVCache::getKBuffer(int blockIndex, int layer, int head, int offset) {
     // K: [numLayers, totalBlocks, numHeads, blockSize, headDim]
     // Linear offset: layer * (totalBlocks * numHeads * blockSize * headDim)
     //              + blockIndex * (numHeads * blockSize * headDim)
     //              + head * (blockSize * headDim)
     //              + offset * headDim
+    // scaled by the element size of dtype_
     
     size_t idx = layer * (totalBlocks_ * numHeads_ * blockSize_ * headDim_)
                + blockIndex * (numHeads_ * blockSize_ * headDim_)
                + head * (blockSize_ * headDim_)
                + offset * headDim_;
     
-    return K_.data() + idx;
+    return K_.data() + idx * kvDTypeSize(dtype_);
 }
 
-float* KVCache::getVBuffer(int blockIndex, int layer, int head, int offset) {
+unsigned char* KVCache::getVBuffer(int blockIndex, int layer, int head, int offset) {
     // Same layout as K
     size_t idx = layer * (totalBlocks_ * numHeads_ * blockSize_ * headDim_)
                + blockIndex * (numHeads_ * blockSize_ * headDim_)
                + head * (blockSize_ * headDim_)
                + offset * headDim_;
     
-    return V_.data() + idx;
+    return V_.data() + idx * kvDTypeSize(dtype_);
+}
+
+size_t KVCache::scaleIndex(int blockIndex, int layer, int head) const {
+    // Scales: [numLayers, totalBlocks, numHeads]
+    return (layer * totalBlocks_ + blockIndex) * numHeads_ + head;
+}
+
+// ---- Sequence table (lock_ held) ----
+
+SequenceKVEntry* KVCache::findSequenceLocked(SeqId seq) {
+    if (seq < 0 || static_cast<size_t>(seq) >= seqLive_.size() || !seqLive_[seq]) {
+        return nullptr;
+    }
+    return &sequences_[seq];
+}
+
+const SequenceKVEntry* KVCache::findSequenceLocked(SeqId seq) const {
+    return const_cast<KVCache*>(this)->findSequenceLocked(seq);
+}
+
+void KVCache::insertSequenceLocked(SeqId seq, SequenceKVEntry entry) {
+    if (static_cast<size_t>(seq) >= sequences_.size()) {
+        sequences_.resize(seq + 1);
+        seqLive_.resize(seq + 1, 0);
+    }
+    sequences_[seq] = std::move(entry);
+    seqLive_[seq] = 1;
+    numSequences_++;
+}
+
+void KVCache::eraseSequenceLocked(SeqId seq) {
+    sequences_[seq] = SequenceKVEntry{};
+    seqLive_[seq] = 0;
+    numSequences_--;
+}
+
+// ---- Named sequences (API edge) ----
+// Resolve the name to a SeqId from the shared pool, then take the SeqId path.
+
+SeqId KVCache::lookupName(const std::string& requestId) const {
+    if (leader_) {
+        return leader_->lookupName(requestId);  // Names live on rank 0
+    }
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = namedSequences_.find(requestId);
+    return it != namedSequences_.end() ? it->second : kInvalidSeqId;
+}
+
+SeqId KVCache::bindName(const std::string& requestId) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = namedSequences_.find(requestId);
+    if (it != namedSequences_.end()) {
+        return it->second;
+    }
+    SeqId seq = acquireSeqId();
+    namedSequences_[requestId] = seq;
+    return seq;
+}
+
+void KVCache::unbindName(const std::string& requestId) {
+    std::lock_guard<std::mutex> guard(lock_);
+    auto it = namedSequences_.find(requestId);
+    if (it != namedSequences_.end()) {
+        releaseSeqId(it->second);
+        namedSequences_.erase(it);
+    }
+}
+
+bool KVCache::allocateFor(const std::string& requestId, int initialTokens) {
+    bool fresh = lookupName(requestId) == kInvalidSeqId;
+    bool ok = allocateFor(bindName(requestId), initialTokens);
+    if (!ok && fresh) {
+        unbindName(requestId);
+    }
+    return ok;
+}
+
+int KVCache::allocateWithPrefix(const std::string& requestId,
+                                const std::vector<int>& promptTokens,
+                                int initialTokens,
+                                const std::string& adapter) {
+    bool fresh = lookupName(requestId) == kInvalidSeqId;
+    int cached = allocateWithPrefix(bindName(requestId), promptTokens, initialTokens, adapter);
+    if (cached < 0 && fresh) {
+        unbindName(requestId);
+    }
+    return cached;
+}
+
+void KVCache::publishPrefix(const std::string& requestId,
+                            const std::vector<int>& promptTokens,
+                            const std::string& adapter) {
+    publishPrefix(lookupName(requestId), promptTokens, adapter);
+}
+
+void KVCache::freeFor(const std::string& requestId) {
+    SeqId seq = lookupName(requestId);
+    if (seq != kInvalidSeqId) {
+        freeFor(seq);
+        unbindName(requestId);
+    }
+}
+
+KVView KVCache::getKView(const std::string& requestId, int layer) {
+    return getKView(lookupName(requestId), layer);
+}
+
+KVView KVCache::getVView(const std::string& requestId, int layer) {
+    return getVView(lookupName(requestId), layer);
+}
+
+bool KVCache::writeToken(const std::string& requestId, int layer, int position,
+                         const float* k, const float* v) {
+    return writeToken(lookupName(requestId), layer, position, k, v);
+}
+
+bool KVCache::readToken(const std::string& requestId, int layer, int position,
+                        float* k, float* v) const {
+    return readToken(lookupName(requestId), layer, position, k, v);
+}
+
+int KVCache::usedTokens(const std::string& requestId) const {
+    return usedTokens(lookupName(requestId));
+}
+
+bool KVCache::appendToken(const std::string& requestId) {
+    return appendToken(lookupName(requestId));
+}
+
+bool KVCache::appendTokens(const std::string& requestId, int count) {
+    return appendTokens(lookupName(requestId), count);
+}
+
+bool KVCache::truncateTokens(const std::string& requestId, int count) {
+    return truncateTokens(lookupName(requestId), count);
+}
+
+bool KVCache::hasSequence(const std::string& requestId) const {
+    return hasSequence(lookupName(requestId));
+}
+
+int KVCache::getTokenOffsetInBlock(const std::string& requestId) const {
+    return getTokenOffsetInBlock(lookupName(requestId));
+}
+
+bool KVCache::swapOut(const std::string& requestId) {
+    return swapOut(lookupName(requestId));
+}
+
+bool KVCache::swapIn(const std::string& requestId) {
+    return swapIn(lookupName(requestId));
+}
+
+bool KVCache::isSwapped(const std::string& requestId) const {
+    return isSwapped(lookupName(requestId));
 }
 
 }  // namespace cortexstream
@@ -2,10 +2,14 @@
 #include "cortexstream/model.h"
 #include "cortexstream/scheduler.h"
 #include "cortexstream/kv_cache.h"
+#include "cortexstream/constraint.h"
+#include "cortexstream/token_stream.h"
+#include "cortexstream/trace.h"
 #include <iostream>
 #include <thread>
 #include <vector>
 #include <chrono>
+#include <algorithm>
 
 // OpenMP for parallel processing of batch token extraction
 #include <omp.h>
@@ -15,6 +19,36 @@
 
 namespace cortexstream {
 
+namespace {
+
+// Poll interval while only stream consumers can make progress
+constexpr std::chrono::milliseconds kStreamPoll{1};
+
+// Tokens prefill must produce KV for: the prompt, plus the generated tokens
+// of a preempted request whose KV was dropped and has to be recomputed.
+std::vector<int> prefillContext(const Request& req) {
+    std::vector<int> context = req.getPromptTokens();
+    const auto& generated = req.getGeneratedTokens();
+    context.insert(context.end(), generated.begin(), generated.end());
+    return context;
+}
+
+// Decode input: each sequence's most recently generated token
+std::vector<int> lastTokens(const Batch& batch) {
+    int batchSize = batch.requests.size();
+    std::vector<int> tokens(batchSize);
+    
+    // Parallel extraction of last tokens from each request
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < batchSize; ++i) {
+        const auto& generated = batch.requests[i]->getGeneratedTokens();
+        tokens[i] = !generated.empty() ? generated.back() : 0;
+    }
+    return tokens;
+}
+
+}  // namespace
+
 InferenceEngine::InferenceEngine(std::shared_ptr<ModelBackend> backend,
                                  std::shared_ptr<Scheduler> scheduler,
                                  std::shared_ptr<KVCache> cache)
@@ -22,7 +56,7 @@ InferenceEngine::InferenceEngine(std::shared_ptr<ModelBackend> backend,
 }
 
 InferenceEngine::~InferenceEngine() {
-    if (running) {
+    if (running || worker.joinable()) {
         shutdown();
     }
 }
@@ -46,18 +80,34 @@ bool InferenceEngine::initialize() {
     return true;
 }
 
-void InferenceEngine::run() {
-    if (running) {
+void InferenceEngine::run(bool dedicatedThread) {
+    if (running.exchange(true)) {
         std::cout << "[InferenceEngine] Already running" << std::endl;
         return;
     }
+    if (worker.joinable()) {
+        worker.join();  // Previous loop already exited
+    }
     
     std::cout << "[InferenceEngine] Starting main loop" << std::endl;
-    mainLoop();
+    if (dedicatedThread) {
+        worker = std::thread(&InferenceEngine::mainLoop, this);
+    } else {
+        mainLoop();  // Returns after shutdown() from another thread
+    }
 }
 
 void InferenceEngine::shutdown() {
     running = false;
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+    }
+    controlCv.notify_all();
+    scheduler->interrupt();
+    
+    if (worker.joinable() && worker.get_id() != std::this_thread::get_id()) {
+        worker.join();
+    }
     std::cout << "[InferenceEngine] Shutdown complete" << std::endl;
 }
 
@@ -70,11 +120,140 @@ void InferenceEngine::pause() {
 }
 
 void InferenceEngine::resume() {
-    paused = false;
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        paused = false;
+    }
+    controlCv.notify_all();
+}
+
+void InferenceEngine::setPipelining(bool enabled) {
+    pipelining = enabled;
+}
+
+bool InferenceEngine::isPipelining() const {
+    return pipelining;
+}
+
+void InferenceEngine::setSpeculative(std::shared_ptr<Drafter> newDrafter, int numDraft) {
+    numDraftTokens = std::max(0, numDraft);
+    std::atomic_store(&drafter, std::move(newDrafter));
+}
+
+bool InferenceEngine::isSpeculative() const {
+    return std::atomic_load(&drafter) != nullptr;
+}
+
+void InferenceEngine::setTokenizer(std::shared_ptr<Tokenizer> newTokenizer) {
+    tokenizer = std::move(newTokenizer);
+    eosTokenId = tokenizer ? tokenizer->getEosTokenId() : -1;
+}
+
+void InferenceEngine::setSamplingMemo(bool enabled) {
+    sampler.setMemoization(enabled);
+}
+
+bool InferenceEngine::isSamplingMemo() const {
+    return sampler.isMemoizing();
+}
+
+bool InferenceEngine::waitUntilIdle(std::chrono::milliseconds timeout) {
+    std::unique_lock<std::mutex> lock(controlMutex);
+    auto done = [this] { return !running || (idle && !scheduler->hasWork()); };
+    if (timeout.count() <= 0) {
+        controlCv.wait(lock, done);
+        return true;
+    }
+    return controlCv.wait_for(lock, timeout, done);
+}
+
+EngineStats InferenceEngine::getStats() const {
+    EngineStats snapshot;
+    snapshot.tokensProcessed = stats.tokensProcessed.load(std::memory_order_relaxed);
+    snapshot.requestsCompleted = stats.requestsCompleted.load(std::memory_order_relaxed);
+    snapshot.requestsFailed = stats.requestsFailed.load(std::memory_order_relaxed);
+    snapshot.requestsPreempted = stats.requestsPreempted.load(std::memory_order_relaxed);
+    snapshot.pipelinedSteps = stats.pipelinedSteps.load(std::memory_order_relaxed);
+    snapshot.draftedTokens = stats.draftedTokens.load(std::memory_order_relaxed);
+    snapshot.acceptedDraftTokens = stats.acceptedDraftTokens.load(std::memory_order_relaxed);
+    snapshot.decodeSteps = stats.decodeSteps.load(std::memory_order_relaxed);
+    if (snapshot.decodeSteps > 0) {
+        snapshot.avgBatchSize = static_cast<float>(stats.decodeRows.load(std::memory_order_relaxed)) /
+                                static_cast<float>(snapshot.decodeSteps);
+    }
+    snapshot.totalLatency = std::chrono::duration_cast<std::chrono::milliseconds>(
+        std::chrono::nanoseconds(stats.busyNs.load(std::memory_order_relaxed)));
+    return snapshot;
+}
+
+EngineMetrics InferenceEngine::getMetrics() const {
+    EngineMetrics snapshot;
+    snapshot.stats = getStats();
+    snapshot.timeToFirstToken = metrics.timeToFirstToken.snapshot();
+    snapshot.interTokenLatency = metrics.interTokenLatency.snapshot();
+    snapshot.queueWait = scheduler->getQueueWaitHistogram().snapshot();
+    snapshot.prefillStep = metrics.prefillStep.snapshot();
+    snapshot.decodeStep = metrics.decodeStep.snapshot();
+    snapshot.decodeBatchSize = metrics.decodeBatchSize.snapshot();
+    
+    snapshot.activeRequests = scheduler->getNumActiveRequests();
+    snapshot.pendingRequests = scheduler->getNumPendingRequests();
+    const size_t bytesPerBlock = cache->getBytesPerBlock();
+    const size_t freeBlocks = cache->getNumFreeBlocks();
+    snapshot.kvBlocksUsed = bytesPerBlock > 0 ? cache->getTotalAllocated() / bytesPerBlock : 0;
+    snapshot.kvBlocksTotal = snapshot.kvBlocksUsed + freeBlocks;
+    if (snapshot.kvBlocksTotal > 0) {
+        snapshot.kvOccupancy = static_cast<float>(snapshot.kvBlocksUsed) /
+                               static_cast<float>(snapshot.kvBlocksTotal);
+    }
+    snapshot.kvFragmentation = cache->getFragmentation();
+    PrefixCacheStats prefix = cache->getPrefixCacheStats();
+    snapshot.prefixQueriedTokens = prefix.queriedTokens;
+    snapshot.prefixHitTokens = prefix.hitTokens;
+    return snapshot;
 }
 
-const EngineStats& InferenceEngine::getStats() const {
-    return stats;
+std::string InferenceEngine::getPrometheusMetrics() const {
+    const EngineMetrics m = getMetrics();
+    const auto& seconds = latencyBucketsSeconds();
+    constexpr double kNsToSeconds = 1e-9;
+    
+    PrometheusWriter out;
+    out.histogram("cortexstream_time_to_first_token_seconds",
+                  "Arrival to first generated token", m.timeToFirstToken, seconds, kNsToSeconds);
+    out.histogram("cortexstream_inter_token_latency_seconds",
+                  "Gap between consecutive tokens of a request", m.interTokenLatency, seconds, kNsToSeconds);
+    out.histogram("cortexstream_queue_wait_seconds",
+                  "Arrival to admission into the active set", m.queueWait, seconds, kNsToSeconds);
+    out.histogram("cortexstream_prefill_step_seconds",
+                  "Duration of one prefill stage", m.prefillStep, seconds, kNsToSeconds);
+    out.histogram("cortexstream_decode_step_seconds",
+                  "Duration of one decode stage", m.decodeStep, seconds, kNsToSeconds);
+    out.histogram("cortexstream_decode_batch_size",
+                  "Sequences per decode step", m.decodeBatchSize, batchSizeBuckets());
+    
+    out.counter("cortexstream_tokens_processed_total", "Generated tokens committed",
+                static_cast<double>(m.stats.tokensProcessed));
+    out.counter("cortexstream_requests_completed_total", "Requests finished",
+                static_cast<double>(m.stats.requestsCompleted));
+    out.counter("cortexstream_requests_failed_total", "Requests failed",
+                static_cast<double>(m.stats.requestsFailed));
+    out.counter("cortexstream_requests_preempted_total", "Sequence preemptions",
+                static_cast<double>(m.stats.requestsPreempted));
+    out.counter("cortexstream_prefix_cache_hit_tokens_total", "Prompt tokens served from the prefix cache",
+                static_cast<double>(m.prefixHitTokens));
+    out.counter("cortexstream_prefix_cache_queried_tokens_total", "Prompt tokens looked up in the prefix cache",
+                static_cast<double>(m.prefixQueriedTokens));
+    
+    out.gauge("cortexstream_active_requests", "Requests holding a sequence slot", m.activeRequests);
+    out.gauge("cortexstream_pending_requests", "Requests waiting for admission", m.pendingRequests);
+    out.gauge("cortexstream_kv_blocks_used", "KV cache blocks allocated",
+              static_cast<double>(m.kvBlocksUsed));
+    out.gauge("cortexstream_kv_blocks_total", "KV cache blocks in the pool",
+              static_cast<double>(m.kvBlocksTotal));
+    out.gauge("cortexstream_kv_occupancy_ratio", "Fraction of KV blocks allocated", m.kvOccupancy);
+    out.gauge("cortexstream_kv_fragmentation_ratio", "Buddy allocator fragmentation", m.kvFragmentation);
+    return out.str();
 }
 
 int InferenceEngine::getActiveRequests() const {
@@ -82,136 +261,602 @@ int InferenceEngine::getActiveRequests() const {
 }
 
 void InferenceEngine::mainLoop() {
-    running = true;
-    
-    while (scheduler->hasWork() && !paused) {
-        // Accept new requests from queue
-        scheduler->acceptNewRequests();
+    trace::setThreadName("engine");
+    while (running) {
+        if (paused) {
+            std::unique_lock<std::mutex> lock(controlMutex);
+            controlCv.wait(lock, [this] { return !paused || !running; });
+            continue;
+        }
         
-        // Build and process prefill batch
-        Batch prefillBatch = scheduler->buildPrefillBatch();
-        if (!prefillBatch.empty()) {
+        flushStreamBacklog();
+        
+        if (!scheduler->hasWork()) {
+            if (!streamBacklog.empty()) {
+                waitForStreams();   // Finished output still being drained
+                continue;
+            }
+            // Publish idleness, then sleep until submitRequest() or shutdown()
+            {
+                std::lock_guard<std::mutex> lock(controlMutex);
+                idle = true;
+            }
+            controlCv.notify_all();
+            scheduler->waitForWork();
+            continue;
+        }
+        {
+            std::lock_guard<std::mutex> lock(controlMutex);
+            idle = false;
+        }
+        
+        CORTEX_TRACE_SCOPE("engine.step");
+        
+        // Preempted sequences get freed blocks before any new prefill
+        bool allResumed = resumeSwapped();
+        size_t freeKVTokens = allResumed
+            ? cache->getNumAvailableBlocks() * cache->getBlockSize()
+            : 0;
+        
+        // One token-budgeted step: decode for running sequences, prefill
+        // and admission for waiting ones
+        ScheduledStep step = scheduler->scheduleStep(freeKVTokens);
+        
+        if (!step.decode.empty()) {
+            const uint64_t begin = metricsClockNs();
             try {
-                processPrefill(prefillBatch);
+                processDecode(step.decode);
             } catch (const std::exception& e) {
-                std::cerr << "[InferenceEngine] Prefill error: " << e.what() << std::endl;
+                std::cerr << "[InferenceEngine] Decode error: " << e.what() << std::endl;
                 handleBackendFailure(e.what());
             }
+            const uint64_t elapsed = metricsClockNs() - begin;
+            metrics.decodeStep.record(elapsed);
+            metrics.decodeBatchSize.record(step.decode.batchSize);
+            stats.decodeSteps.fetch_add(1, std::memory_order_relaxed);
+            stats.decodeRows.fetch_add(step.decode.batchSize, std::memory_order_relaxed);
+            stats.busyNs.fetch_add(elapsed, std::memory_order_relaxed);
         }
         
-        // Build and process decode batch
-        Batch decodeBatch = scheduler->buildDecodeBatch();
-        if (!decodeBatch.empty()) {
+        if (!step.prefill.empty()) {
+            const uint64_t begin = metricsClockNs();
             try {
-                processDecode(decodeBatch);
+                processPrefill(step.prefill);
             } catch (const std::exception& e) {
-                std::cerr << "[InferenceEngine] Decode error: " << e.what() << std::endl;
+                std::cerr << "[InferenceEngine] Prefill error: " << e.what() << std::endl;
                 handleBackendFailure(e.what());
             }
+            const uint64_t elapsed = metricsClockNs() - begin;
+            metrics.prefillStep.record(elapsed);
+            stats.busyNs.fetch_add(elapsed, std::memory_order_relaxed);
         }
         
         // Cleanup finished requests
         cleanup();
         
+        // Every running sequence is waiting on its client: do not spin
+        if (step.empty() && step.numThrottled > 0) {
+            waitForStreams();
+        }
+        
         // Validate memory state
         validateMemoryState();
-        
-        // Small sleep to prevent busy loop if no work
-        if (!scheduler->hasWork()) {
-            std::this_thread::sleep_for(std::chrono::milliseconds(10));
-        }
     }
     
-    running = false;
+    inFlight.reset();  // Waits for an outstanding early launch
+    for (const auto& req : streamBacklog) {
+        req->getTokenStream()->close();   // Undelivered output is dropped
+    }
+    streamBacklog.clear();
+    {
+        std::lock_guard<std::mutex> lock(controlMutex);
+        idle = true;
+    }
+    controlCv.notify_all();
     std::cout << "[InferenceEngine] Main loop exited" << std::endl;
     std::cout << "[InferenceEngine] Stats: " 
               << "tokens=" << stats.tokensProcessed
               << ", requests=" << stats.requestsCompleted
-              << ", failed=" << stats.requestsFailed << std::endl;
+              << ", failed=" << stats.requestsFailed
+              << ", preempted=" << stats.requestsPreempted << std::endl;
 }
 
 void InferenceEngine::processPrefill(const Batch& prefillBatch) {
+    CORTEX_TRACE_SCOPE_ARG("engine.prefill", prefillBatch.batchSize);
     if (prefillBatch.empty()) {
         return;
     }
+    settleInFlight();   // One forward pass at a time per backend and cache
+    
+    // Reserve KV for this step's chunk of each request before the forward
+    // pass. Prompt blocks already in the prefix cache are shared, so the
+    // first chunk starts after the cached prefix.
+    Batch runBatch;
+    runBatch.isPrefill = true;
+    runBatch.batchSize = 0;
+    std::vector<std::vector<int>> contexts;
+    
+    for (size_t i = 0; i < prefillBatch.requests.size(); ++i) {
+        const auto& req = prefillBatch.requests[i];
+        if (!req->getAdapter().empty() && !backend->hasAdapter(req->getAdapter())) {
+            // Caught here so one bad ID does not fail the whole forward pass
+            std::cerr << "[InferenceEngine] Unknown adapter '" << req->getAdapter()
+                      << "' for request: " << req->getId() << std::endl;
+            scheduler->markRequestFailed(req->getSeqId());
+            stats.requestsFailed++;
+            continue;
+        }
+        std::vector<int> context = prefillContext(*req);
+        int start = req->getNumComputedTokens();
+        
+        bool reserved = true;
+        if (!cache->hasSequence(req->getSeqId())) {
+            int cached = cache->allocateWithPrefix(req->getSeqId(), context, 0, req->getAdapter());
+            reserved = cached >= 0;
+            if (reserved) {
+                start = cached;
+                req->setNumComputedTokens(cached);
+            }
+        }
+        
+        int end = std::min(start + prefillBatch.sequenceLengths[i],
+                           static_cast<int>(context.size()));
+        int grow = end - cache->usedTokens(req->getSeqId());
+        if (reserved && grow > 0) {
+            reserved = cache->appendTokens(req->getSeqId(), grow);
+        }
+        
+        if (!reserved) {
+            bool holdsKV = cache->hasSequence(req->getSeqId());
+            if (cache->getNumAllocatedSequences() == (holdsKV ? 1 : 0)) {
+                // Cannot fit even into an otherwise empty cache
+                std::cerr << "[InferenceEngine] KV allocation failed for request: "
+                          << req->getId() << std::endl;
+                scheduler->markRequestFailed(req->getSeqId());
+                stats.requestsFailed++;
+            }
+            // Otherwise stays Prefilling at its cursor; retried once running
+            // sequences release blocks (new work never preempts running work)
+            continue;
+        }
+        
+        runBatch.requests.push_back(req);
+        runBatch.sequenceLengths.push_back(end - start);
+        runBatch.startPositions.push_back(start);
+        runBatch.batchSize++;
+        contexts.push_back(std::move(context));
+    }
+    
+    if (runBatch.empty()) {
+        return;
+    }
     
     // Optimized batch token collection with parallel extraction
-    int batchSize = prefillBatch.requests.size();
+    int batchSize = runBatch.requests.size();
     std::vector<int> allTokens;
     std::vector<size_t> offsets;
     offsets.reserve(batchSize + 1);
     offsets.push_back(0);
     
-    // Parallel token extraction from each request
+    // Parallel token extraction from each request (this step's chunk only)
     #pragma omp parallel for ordered schedule(dynamic)
     for (int i = 0; i < batchSize; ++i) {
-        const auto& promptTokens = prefillBatch.requests[i]->getPromptTokens();
+        const auto& context = contexts[i];
+        int start = runBatch.startPositions[i];
         
         #pragma omp ordered
         {
-            allTokens.insert(allTokens.end(), promptTokens.begin(), promptTokens.end());
+            allTokens.insert(allTokens.end(),
+                             context.begin() + start,
+                             context.begin() + start + runBatch.sequenceLengths[i]);
             offsets.push_back(allTokens.size());
         }
     }
     
     // Forward pass through backend (Metal/MPS accelerated with MLX)
-    Tensor logits = backend->prefill(prefillBatch, allTokens);
+    Tensor logits = backend->prefill(runBatch, allTokens);
     
-    // Allocate KV blocks for each request with error handling
-    #pragma omp parallel for schedule(dynamic)
+    // Advance cursors, share the freshly written prompt blocks, and mark
+    // fully prefilled requests ready for decode
     for (int i = 0; i < batchSize; ++i) {
-        const auto& req = prefillBatch.requests[i];
-        try {
-            bool ok = cache->allocateFor(req->getId(), req->getPromptLength());
-            if (!ok) {
-                #pragma omp critical
-                {
-                    std::cerr << "[InferenceEngine] KV allocation failed for request: "
-                              << req->getId() << std::endl;
-                    handleOOM();
+        const auto& req = runBatch.requests[i];
+        int end = runBatch.startPositions[i] + runBatch.sequenceLengths[i];
+        req->setNumComputedTokens(end);
+        cache->publishPrefix(req->getSeqId(), req->getPromptTokens(), req->getAdapter());
+        if (end >= static_cast<int>(contexts[i].size())) {
+            scheduler->markRequestReady(req->getSeqId());
+        }
+    }
+}
+
+void InferenceEngine::processDecode(const Batch& decodeBatch) {
+    CORTEX_TRACE_SCOPE_ARG("engine.decode", decodeBatch.batchSize);
+    if (decodeBatch.empty()) {
+        return;
+    }
+    
+    // Speculative mode verifies drafts instead; an early launch from
+    // pipelined steps before it was enabled is stale
+    if (auto activeDrafter = std::atomic_load(&drafter)) {
+        if (inFlight) {
+            inFlight->logits.wait();
+            inFlight.reset();
+        }
+        processSpeculativeDecode(decodeBatch, *activeDrafter);
+        return;
+    }
+    
+    std::vector<int> emittedFrom;
+    emittedFrom.reserve(decodeBatch.requests.size());
+    for (const auto& req : decodeBatch.requests) {
+        emittedFrom.push_back(req->getGeneratedLength());
+    }
+    
+    // Forward pass through backend (Metal/MPS accelerated), or the result
+    // of the one launched at the end of the previous step
+    Tensor logits = collectDecodeLogits(decodeBatch);
+    
+    // Parallel token emission and sampling
+    emitTokens(decodeBatch, logits);
+    
+    // Token inputs and KV slots for the next step now exist
+    if (pipelining) {
+        launchNextDecode(decodeBatch);
+    }
+    
+    // Client callbacks run while the next forward is in flight
+    notifyTokens(decodeBatch, emittedFrom);
+}
+
+Tensor InferenceEngine::collectDecodeLogits(const Batch& decodeBatch) {
+    CORTEX_TRACE_SCOPE("engine.collectDecodeLogits");
+    int batchSize = decodeBatch.requests.size();
+    
+    // Match this step's sequences to rows of the early launch. A row is only
+    // valid if its sequence has not generated since (same input token).
+    Tensor launched;
+    std::vector<int> launchedRow(batchSize, -1);
+    if (inFlight) {
+        std::unique_ptr<InFlightDecode> pending = std::move(inFlight);
+        launched = pending->logits.get();
+        for (int i = 0; i < batchSize && !launched.data.empty(); ++i) {
+            const auto& req = decodeBatch.requests[i];
+            for (size_t row = 0; row < pending->batch.requests.size(); ++row) {
+                if (pending->batch.requests[row] == req &&
+                    pending->generatedLengths[row] == req->getGeneratedLength()) {
+                    launchedRow[i] = static_cast<int>(row);
+                    break;
                 }
             }
-        } catch (const std::exception& e) {
-            #pragma omp critical
-            {
-                std::cerr << "[InferenceEngine] KV allocation exception: " << e.what() << std::endl;
-                scheduler->markRequestFailed(req->getId());
-            }
         }
     }
     
-    // Mark requests ready for decode
-    #pragma omp parallel for
+    Batch missing;
+    missing.isPrefill = false;
+    missing.batchSize = 0;
+    std::vector<int> missingIdx;
+    for (int i = 0; i < batchSize; ++i) {
+        if (launchedRow[i] < 0) {
+            missing.requests.push_back(decodeBatch.requests[i]);
+            missing.sequenceLengths.push_back(decodeBatch.sequenceLengths[i]);
+            missing.batchSize++;
+            missingIdx.push_back(i);
+        }
+    }
+    if (missing.batchSize == batchSize) {
+        return backend->decode(decodeBatch, lastTokens(decodeBatch));
+    }
+    
+    // Sequences that joined decode this step (e.g. finished prefill)
+    Tensor fresh;
+    if (!missing.empty()) {
+        fresh = backend->decode(missing, lastTokens(missing));
+    }
+    stats.pipelinedSteps++;
+    
+    // Stitch rows back into scheduler order
+    int64_t vocabSize = launched.shape.back();
+    Tensor logits;
+    logits.shape = {static_cast<int64_t>(batchSize), vocabSize};
+    logits.dtype = launched.dtype;
+    logits.data.resize(static_cast<size_t>(batchSize * vocabSize));
     for (int i = 0; i < batchSize; ++i) {
-        scheduler->markRequestReady(prefillBatch.requests[i]->getId());
+        if (launchedRow[i] >= 0) {
+            std::copy_n(launched.data.data() + launchedRow[i] * vocabSize, vocabSize,
+                        logits.data.data() + i * vocabSize);
+        }
+    }
+    for (size_t m = 0; m < missingIdx.size(); ++m) {
+        std::copy_n(fresh.data.data() + m * vocabSize, vocabSize,
+                    logits.data.data() + missingIdx[m] * vocabSize);
     }
+    return logits;
 }
 
-void InferenceEngine::processDecode(const Batch& decodeBatch) {
-    if (decodeBatch.empty()) {
+void InferenceEngine::settleInFlight() {
+    // The result stays in the future for collectDecodeLogits
+    if (inFlight && inFlight->logits.valid()) {
+        CORTEX_TRACE_SCOPE("engine.settleInFlight");
+        inFlight->logits.wait();
+    }
+}
+
+void InferenceEngine::launchNextDecode(const Batch& decodeBatch) {
+    auto next = std::make_unique<InFlightDecode>();
+    next->batch.isPrefill = false;
+    next->batch.batchSize = 0;
+    
+    // Only sequences certain to decode again; finished, failed and
+    // preempted ones would waste the forward
+    for (const auto& req : decodeBatch.requests) {
+        if (req->getState() != RequestState::Decoding || req->isCancelled()) {
+            continue;
+        }
+        next->batch.requests.push_back(req);
+        next->batch.sequenceLengths.push_back(1);
+        next->batch.batchSize++;
+        next->generatedLengths.push_back(req->getGeneratedLength());
+    }
+    if (next->batch.empty()) {
         return;
     }
     
-    // Optimized batch construction with parallel extraction
-    int batchSize = decodeBatch.requests.size();
-    std::vector<int> lastTokens(batchSize);
+    next->logits = backend->decodeAsync(next->batch, lastTokens(next->batch));
+    inFlight = std::move(next);
+}
+
+void InferenceEngine::processSpeculativeDecode(const Batch& decodeBatch, Drafter& activeDrafter) {
+    CORTEX_TRACE_SCOPE_ARG("engine.speculativeDecode", decodeBatch.batchSize);
+    const int batchSize = decodeBatch.requests.size();
+    const int maxDraft = std::max(0, numDraftTokens.load());
     
-    // Parallel extraction of last tokens from each request
-    #pragma omp parallel for schedule(static)
+    // Drafts are capped so accepted drafts plus the target's own token
+    // never overshoot maxTokens
+    std::vector<int> emittedFrom(batchSize);
+    std::vector<int> budget(batchSize);
+    for (int i = 0; i < batchSize; ++i) {
+        const auto& req = decodeBatch.requests[i];
+        emittedFrom[i] = req->getGeneratedLength();
+        budget[i] = std::clamp(req->getMaxTokens() - req->getGeneratedLength() - 1, 0, maxDraft);
+    }
+    std::vector<std::vector<int>> drafts = activeDrafter.proposeBatch(decodeBatch, budget);
+    drafts.resize(batchSize);
+    
+    // Per row: constraint states along the draft (a draft the automaton
+    // rejects is cut there), then KV for the draft positions. A sequence
+    // whose slots do not fit just verifies no draft this step.
+    std::vector<std::vector<int>> states(batchSize);
+    for (int i = 0; i < batchSize; ++i) {
+        const auto& req = decodeBatch.requests[i];
+        auto& draft = drafts[i];
+        if (static_cast<int>(draft.size()) > budget[i]) {
+            draft.resize(budget[i]);
+        }
+        if (const auto& automaton = req->getConstraint()) {
+            int state = req->getConstraintState();
+            states[i].push_back(state);
+            for (size_t j = 0; j < draft.size(); ++j) {
+                state = automaton->advance(state, draft[j]);
+                if (state == TokenAutomaton::kDeadState) {
+                    draft.resize(j);
+                    break;
+                }
+                states[i].push_back(state);
+            }
+        }
+        if (!draft.empty() && !cache->appendTokens(req->getSeqId(), draft.size())) {
+            draft.clear();
+        }
+        stats.draftedTokens.fetch_add(draft.size(), std::memory_order_relaxed);
+    }
+    
+    // One forward over [last token, drafts...] of every sequence
+    Batch verifyBatch = decodeBatch;
+    std::vector<int> inputs = lastTokens(decodeBatch);
+    std::vector<int> tokens;
+    std::vector<int> firstRow(batchSize + 1, 0);
     for (int i = 0; i < batchSize; ++i) {
-        const auto& generated = decodeBatch.requests[i]->getGeneratedTokens();
-        lastTokens[i] = !generated.empty() ? generated.back() : 0;
+        verifyBatch.sequenceLengths[i] = 1 + drafts[i].size();
+        tokens.push_back(inputs[i]);
+        tokens.insert(tokens.end(), drafts[i].begin(), drafts[i].end());
+        firstRow[i + 1] = firstRow[i] + verifyBatch.sequenceLengths[i];
     }
+    Tensor logits = backend->decodeTokens(verifyBatch, tokens);
     
-    // Forward pass through backend (Metal/MPS accelerated)
-    // MLX handles batched operations on GPU efficiently
-    Tensor logits = backend->decode(decodeBatch, lastTokens);
+    // Sample every position as if its draft prefix had been committed: same
+    // params, history, RNG position and constraint mask
+    std::vector<SampleRow> rows(firstRow[batchSize]);
+    std::vector<std::vector<int>> histories;
+    histories.reserve(rows.size());
+    for (int i = 0; i < batchSize; ++i) {
+        const auto& req = decodeBatch.requests[i];
+        const auto& params = req->getSamplingParams();
+        const auto& generated = req->getGeneratedTokens();
+        const auto& automaton = req->getConstraint();
+        for (size_t j = 0; j <= drafts[i].size(); ++j) {
+            SampleRow& row = rows[firstRow[i] + j];
+            row.params = &params;
+            row.history = &generated;
+            row.stream = sampler.streamKey(params);
+            row.position = generated.size() + j;
+            if (automaton) {
+                row.allowed = automaton->allowedTokens(states[i][j]);
+                row.allowedSize = automaton->vocabSize();
+            }
+            if (j > 0 && params.repetitionPenaltyEnabled) {
+                histories.push_back(generated);
+                histories.back().insert(histories.back().end(),
+                                        drafts[i].begin(), drafts[i].begin() + j);
+                row.history = &histories.back();
+            }
+        }
+    }
+    const std::vector<int> sampled = sampler.sampleBatch(TensorView(logits), rows);
     
-    // Parallel token emission and sampling
-    emitTokens(decodeBatch, logits);
+    // Serial commit: the matching draft prefix, then the target's token at
+    // the first mismatch; KV is then trimmed (or grown) to the new length.
+    // As in emitTokens, stopped rows are retired before any row grows.
+    std::vector<SeqId> finished;
+    std::vector<int> growing;
+    size_t committed = 0;
+    for (int i = 0; i < batchSize; ++i) {
+        const auto& req = decodeBatch.requests[i];
+        const auto& draft = drafts[i];
+        const int* drawn = sampled.data() + firstRow[i];
+        
+        size_t accepted = 0;
+        while (accepted < draft.size() && drawn[accepted] == draft[accepted]) {
+            accepted++;
+        }
+        std::vector<int> emit(draft.begin(), draft.begin() + accepted);
+        if (drawn[accepted] >= 0) {
+            emit.push_back(drawn[accepted]);
+        }
+        stats.acceptedDraftTokens.fetch_add(accepted, std::memory_order_relaxed);
+        
+        if (emit.empty()) {
+            std::cerr << "[InferenceEngine] Token emission failed for request: "
+                      << req->getId() << std::endl;
+            scheduler->markRequestFailed(req->getSeqId());
+            stats.requestsFailed++;
+            continue;
+        }
+        bool stopped = false;
+        for (size_t t = 0; t < emit.size() && !stopped; ++t) {
+            req->addGeneratedToken(emit[t]);
+            committed++;
+            stopped = checkStop(*req);
+        }
+        if (stopped) {
+            // Needs no slot for a next token; its KV is released below
+            finished.push_back(req->getSeqId());
+            continue;
+        }
+        
+        // Slots for rejected drafts go back; an all-accepted row needs one
+        // more for the target's token, exactly like a plain decode step
+        int target = req->getPromptLength() + req->getGeneratedLength();
+        int excess = cache->usedTokens(req->getSeqId()) - target;
+        if (excess > 0) {
+            cache->truncateTokens(req->getSeqId(), excess);
+        } else if (excess < 0) {
+            growing.push_back(i);
+        }
+    }
+    finishStopped(finished);
+    stats.tokensProcessed.fetch_add(committed, std::memory_order_relaxed);
+    
+    for (int i : growing) {
+        const auto& req = decodeBatch.requests[i];
+        if (!growForDecode(req)) {
+            std::cerr << "[InferenceEngine] KV growth failed for request: "
+                      << req->getId() << std::endl;
+            scheduler->markRequestFailed(req->getSeqId());
+            stats.requestsFailed++;
+        }
+    }
+    activeDrafter.onVerified(decodeBatch);    // Drop rejected drafts' state
+    
+    notifyTokens(decodeBatch, emittedFrom);
+}
+
+void InferenceEngine::notifyTokens(const Batch& batch, const std::vector<int>& emittedFrom) {
+    CORTEX_TRACE_SCOPE("engine.notifyTokens");
+    const uint64_t now = metricsClockNs();
+    for (size_t i = 0; i < batch.requests.size(); ++i) {
+        const auto& req = batch.requests[i];
+        const auto& generated = req->getGeneratedTokens();
+        bool done = req->isFinished() || req->isFailed();
+        recordTokenLatency(*req, emittedFrom[i], now);
+        for (size_t t = emittedFrom[i]; t < generated.size(); ++t) {
+            req->notifyToken(generated[t], done && t + 1 == generated.size());
+        }
+        if (req->getTokenStream()) {
+            publishStream(*req);
+        }
+    }
+}
+
+void InferenceEngine::recordTokenLatency(const Request& request, int emittedFrom, uint64_t now) {
+    const int emitted = request.getGeneratedLength() - emittedFrom;
+    if (emitted <= 0) {
+        return;
+    }
+    const size_t seq = request.getSeqId();
+    if (seq >= lastTokenNs.size()) {
+        lastTokenNs.resize(seq + 1, 0);
+    }
+    if (emittedFrom == 0) {
+        const uint64_t arrival = request.getArrivalTimestampNs();
+        metrics.timeToFirstToken.record(now > arrival ? now - arrival : 0);
+    } else if (lastTokenNs[seq] != 0 && now > lastTokenNs[seq]) {
+        // Tokens committed together (speculative decode) share the gap
+        metrics.interTokenLatency.recordMany((now - lastTokenNs[seq]) / emitted, emitted);
+    }
+    lastTokenNs[seq] = now;
+}
+
+bool InferenceEngine::publishStream(Request& request) {
+    // Pushes from the request's own cursor, so tokens refused by a full
+    // ring are retried next step; backpressure keeps that rare
+    TokenStream& stream = *request.getTokenStream();
+    const auto& generated = request.getGeneratedTokens();
+    const int total = static_cast<int>(generated.size());
+    const bool done = request.isFinished() || request.isFailed();
+    int sent = request.getStreamedLength();
+    IncrementalDetokenizer* detokenizer = nullptr;
+    if (tokenizer && sent < total) {
+        const size_t seq = request.getSeqId();
+        if (seq >= streamText.size()) {
+            streamText.resize(seq + 1);
+        }
+        if (sent == 0 || !streamText[seq]) {
+            streamText[seq] = std::make_unique<IncrementalDetokenizer>(*tokenizer);
+        }
+        detokenizer = streamText[seq].get();
+    }
+    // Only this thread pushes, so a ring that is not full takes the next
+    // chunk; the detokenizer never advances past a refused token
+    while (sent < total && !stream.isFull()) {
+        const bool last = done && sent + 1 == total;
+        std::string piece;
+        if (detokenizer) {
+            piece = detokenizer->push(generated[sent]);
+            if (last) {
+                piece += detokenizer->flush();
+            }
+        }
+        stream.push(generated[sent], last, piece);
+        sent++;
+    }
+    request.setStreamedLength(sent);
+    if (sent < total) {
+        return false;
+    }
+    if (done) {
+        stream.close();
+        const size_t seq = request.getSeqId();
+        if (seq < streamText.size()) {
+            streamText[seq].reset();
+        }
+    }
+    return true;
+}
+
+void InferenceEngine::flushStreamBacklog() {
+    streamBacklog.erase(
+        std::remove_if(streamBacklog.begin(), streamBacklog.end(),
+                       [this](const std::shared_ptr<Request>& req) { return publishStream(*req); }),
+        streamBacklog.end());
+}
+
+void InferenceEngine::waitForStreams() {
+    std::unique_lock<std::mutex> lock(controlMutex);
+    controlCv.wait_for(lock, kStreamPoll, [this] { return !running.load(); });
 }
 
 void InferenceEngine::emitTokens(const Batch& batch, const Tensor& logits) {
+    CORTEX_TRACE_SCOPE_ARG("engine.emitTokens", batch.batchSize);
     // Optimized token sampling with parallel processing and Metal acceleration
     
     if (batch.requests.empty() || logits.data.empty()) {
@@ -219,80 +864,187 @@ void InferenceEngine::emitTokens(const Batch& batch, const Tensor& logits) {
     }
     
     int batchSize = batch.requests.size();
-    int vocabSize = logits.shape.back();
     
-    // Parallel extraction of per-request logits and sampling (OpenMP + MLX)
-    // Each thread samples one request's token, utilizing all CPU cores
-    #pragma omp parallel for schedule(dynamic) collapse(1)
+    // Phase 1: one fused sampling pass over the [batch, vocab] logits. Each
+    // row carries its request's params, history and RNG stream; rows are
+    // sampled in parallel into a batch-local buffer (-1 marks a failure).
+    std::vector<SampleRow> rows(batchSize);
     for (int i = 0; i < batchSize; ++i) {
-        try {
-            auto req = batch.requests[i];
-            
-            // Extract logits for this request from batch
-            // Optimized: direct memory offset instead of copy
-            const float* req_logits_ptr = logits.data.data() + (i * vocabSize);
-            
-            // Create view (avoid unnecessary copy)
-            Tensor reqLogits;
-            reqLogits.shape = {1, static_cast<int64_t>(vocabSize)};
-            reqLogits.data.resize(vocabSize);
-            
-            // Vectorized copy with aligned memory
-            #pragma omp simd aligned(req_logits_ptr:32)
-            for (int j = 0; j < vocabSize; ++j) {
-                reqLogits.data[j] = req_logits_ptr[j];
-            }
-            
-            // Sample token (Metal-accelerated if available)
-            int nextToken = sampleAndApply(reqLogits, req);
-            
-            // Atomic update to request (thread-safe)
-            #pragma omp critical
-            {
-                req->addGeneratedToken(nextToken);
-                stats.tokensProcessed++;
-                
-                // Check if request is finished
-                if (req->getGeneratedLength() >= req->getMaxTokens()) {
-                    scheduler->markRequestFinished(req->getId());
-                    stats.requestsCompleted++;
-                }
-            }
-        } catch (const std::exception& e) {
-            // Error handling in parallel context
-            #pragma omp critical
-            {
-                std::cerr << "[InferenceEngine] Error in parallel token emission: " << e.what() << std::endl;
-            }
+        const auto& req = batch.requests[i];
+        const auto& generated = req->getGeneratedTokens();
+        rows[i].params = &req->getSamplingParams();
+        rows[i].history = &generated;
+        rows[i].stream = sampler.streamKey(req->getSamplingParams());
+        rows[i].position = generated.size();
+        rows[i].allowed = req->getAllowedTokens();
+        rows[i].allowedSize = req->getConstraintVocabSize();
+    }
+    const std::vector<int> sampled = sampler.sampleBatch(TensorView(logits), rows);
+    
+    // Phase 2: serial commit. Tokens and stop checks first; then, with the
+    // stopped sequences retired and their blocks freed, the survivors grow.
+    // KV growth may preempt other sequences and must not race.
+    std::vector<SeqId> finished;
+    std::vector<int> growing;
+    size_t committed = 0;
+    for (int i = 0; i < batchSize; ++i) {
+        const auto& req = batch.requests[i];
+        if (sampled[i] < 0) {
+            // Invalid params or a constraint that allows nothing: retrying
+            // the step would fail the same way
+            std::cerr << "[InferenceEngine] Token emission failed for request: "
+                      << req->getId() << std::endl;
+            scheduler->markRequestFailed(req->getSeqId());
+            stats.requestsFailed++;
+            continue;
+        }
+        
+        req->addGeneratedToken(sampled[i]);
+        committed++;
+        
+        // A stopped sequence needs no slot for a next token
+        if (checkStop(*req)) {
+            finished.push_back(req->getSeqId());
+        } else {
+            growing.push_back(i);
         }
     }
+    finishStopped(finished);
+    stats.tokensProcessed.fetch_add(committed, std::memory_order_relaxed);
+    
+    for (int i : growing) {
+        // Grow the sequence's KV by one slot (may take a new block)
+        const auto& req = batch.requests[i];
+        if (!growForDecode(req)) {
+            std::cerr << "[InferenceEngine] KV growth failed for request: "
+                      << req->getId() << std::endl;
+            scheduler->markRequestFailed(req->getSeqId());
+            stats.requestsFailed++;
+        }
+    }
+}
+
+void InferenceEngine::finishStopped(const std::vector<SeqId>& finished) {
+    if (finished.empty()) {
+        return;
+    }
+    // One scheduler transition for every sequence that completed this step;
+    // cleanup() frees again (a no-op) and publishes the streams
+    scheduler->markRequestsFinished(finished);
+    stats.requestsCompleted.fetch_add(finished.size(), std::memory_order_relaxed);
+    settleInFlight();
+    for (SeqId seq : finished) {
+        cache->freeFor(seq);
+    }
 }
 
-int InferenceEngine::sampleAndApply(const Tensor& logits,
-                                   std::shared_ptr<Request> request) {
-    try {
-        return backend->sampleToken(logits, request->getSamplingParams());
-    } catch (const std::exception& e) {
-        std::cerr << "[InferenceEngine] Sampling failed: " << e.what() << std::endl;
-        return 0;  // Fallback token
+bool InferenceEngine::growForDecode(const std::shared_ptr<Request>& request) {
+    // Preempt other sequences until the new slot fits
+    while (!cache->appendToken(request->getSeqId())) {
+        if (request->getState() != RequestState::Decoding) {
+            // Preempted itself; the slot is restored on resume or recompute
+            return true;
+        }
+        if (!handleOOM()) {
+            return false;
+        }
     }
+    return true;
 }
 
-void InferenceEngine::cleanup() {
-    // Find and remove finished requests
-    auto numBefore = scheduler->getNumActiveRequests();
+bool InferenceEngine::resumeSwapped() {
+    // Oldest first; stop at the first sequence that does not fit yet
+    for (const auto& req : scheduler->getSwappedRequests()) {
+        settleInFlight();   // Swap-in writes KV
+        if (!cache->swapIn(req->getSeqId())) {
+            return false;
+        }
+        
+        // A sequence preempted mid-emit missed the slot for its last token
+        int target = req->getPromptLength() + req->getGeneratedLength();
+        while (cache->usedTokens(req->getSeqId()) < target &&
+               cache->appendToken(req->getSeqId())) {
+        }
+        // ... or, preempted mid speculative commit, still holds draft slots
+        int excess = cache->usedTokens(req->getSeqId()) - target;
+        if (excess > 0) {
+            cache->truncateTokens(req->getSeqId(), excess);
+        }
+        scheduler->markRequestResumed(req->getSeqId());
+    }
+    return true;
+}
+
+bool InferenceEngine::checkStop(Request& request) {
+    // Called once per committed token, in order: the cursor only ever sees
+    // the newest token and its text
+    const int token = request.getGeneratedTokens().back();
+    if (tokenizer && token == eosTokenId && !request.isIgnoringEos()) {
+        request.setStopReason(StopReason::EndOfSequence);
+        return true;
+    }
+    
+    if (const auto& matcher = request.getStopMatcher()) {
+        const size_t seq = request.getSeqId();
+        if (seq >= stopProgress.size()) {
+            stopProgress.resize(seq + 1);
+        }
+        StopProgress& progress = stopProgress[seq];
+        if (matcher->advanceToken(progress.cursor, token) >= 0) {
+            request.setStopReason(StopReason::StopToken);
+            return true;
+        }
+        if (matcher->hasStrings() && tokenizer) {
+            if (!progress.detokenizer) {
+                progress.detokenizer = std::make_unique<IncrementalDetokenizer>(*tokenizer);
+            }
+            int match = matcher->advanceText(progress.cursor, progress.detokenizer->push(token));
+            if (match >= 0) {
+                request.setStopReason(StopReason::StopString, matcher->string(match));
+                return true;
+            }
+        }
+    }
     
-    for (int i = 0; i < numBefore; ++i) {
-        // Note: In production, would iterate through finished queue
-        // For MVP, scheduler handles this internally
+    if (request.getGeneratedLength() >= request.getMaxTokens()) {
+        request.setStopReason(StopReason::MaxTokens);
+        return true;
+    }
+    if (request.isConstraintComplete()) {
+        request.setStopReason(StopReason::Constraint);
+        return true;
+    }
+    return false;
+}
+
+void InferenceEngine::cleanup() {
+    CORTEX_TRACE_SCOPE("engine.cleanup");
+    // Release KV blocks of requests that finished or failed this iteration
+    for (const auto& req : scheduler->drainCompletedRequests()) {
+        cleanupRequest(*req);
+        if (req->getTokenStream() && !publishStream(*req)) {
+            streamBacklog.push_back(req);
+        }
     }
 }
 
-void InferenceEngine::cleanupRequest(const std::string& requestId) {
-    // Free KV cache blocks
-    cache->freeFor(requestId);
+void InferenceEngine::cleanupRequest(const Request& request) {
+    // Free KV cache blocks (the drafter's too). A request cancelled after
+    // the early launch may still be part of it.
+    settleInFlight();
+    cache->freeFor(request.getSeqId());
+    if (auto activeDrafter = std::atomic_load(&drafter)) {
+        activeDrafter->release(request);
+    }
+    const size_t seq = request.getSeqId();
+    if (seq < stopProgress.size()) {
+        stopProgress[seq] = StopProgress();
+    }
+    if (seq < lastTokenNs.size()) {
+        lastTokenNs[seq] = 0;
+    }
     
-    std::cout << "[InferenceEngine] Cleaned up request: " << requestId << std::endl;
+    std::cout << "[InferenceEngine] Cleaned up request: " << request.getId() << std::endl;
 }
 
 void InferenceEngine::validateMemoryState() {
@@ -310,15 +1062,35 @@ void InferenceEngine::handleBackendFailure(const std::string& reason) {
     stats.requestsFailed++;
 }
 
-void InferenceEngine::handleOOM() {
-    std::cerr << "[InferenceEngine] Out of memory - evicting oldest requests" << std::endl;
-    // In production, would implement eviction policy
+bool InferenceEngine::handleOOM() {
+    auto victim = scheduler->selectPreemptionVictim();
+    if (!victim) {
+        return false;
+    }
+    
+    // The early launch may still be reading the victim's blocks
+    settleInFlight();
+    
+    // Park the victim's KV in the swap tier; without swap space, drop it and
+    // recompute prompt + generated tokens when the victim is rescheduled
+    if (cache->swapOut(victim->getSeqId())) {
+        scheduler->markRequestSwapped(victim->getSeqId());
+        std::cerr << "[InferenceEngine] Out of memory - swapped out request: "
+                  << victim->getId() << std::endl;
+    } else {
+        cache->freeFor(victim->getSeqId());
+        scheduler->markRequestForRecompute(victim->getSeqId());
+        std::cerr << "[InferenceEngine] Out of memory - recomputing request: "
+                  << victim->getId() << std::endl;
+    }
+    stats.requestsPreempted++;
+    return true;
 }
 
-void InferenceEngine::handleStuckRequest(const std::string& requestId) {
-    std::cerr << "[InferenceEngine] Request stuck, killing: " << requestId << std::endl;
-    scheduler->markRequestFailed(requestId);
-    cleanupRequest(requestId);
+void InferenceEngine::handleStuckRequest(const Request& request) {
+    std::cerr << "[InferenceEngine] Request stuck, killing: " << request.getId() << std::endl;
+    scheduler->markRequestFailed(request.getSeqId());
+    cleanupRequest(request);
     stats.requestsFailed++;
 }
 
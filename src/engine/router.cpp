@@ -0,0 +1,258 @@
+#include "cortexstream/router.h"
+#include <algorithm>
+#include <iostream>
+
+namespace cortexstream {
+
+// ============================================================================
+// LocalReplica
+// ============================================================================
+
+LocalReplica::LocalReplica(std::string name, std::string model,
+                           std::shared_ptr<InferenceEngine> engine,
+                           std::shared_ptr<Scheduler> scheduler,
+                           std::shared_ptr<KVCache> cache)
+    : name_(std::move(name)),
+      model_(std::move(model)),
+      engine_(std::move(engine)),
+      scheduler_(std::move(scheduler)),
+      cache_(std::move(cache)) {
+}
+
+ReplicaLoad LocalReplica::load() const {
+    ReplicaLoad load;
+    load.healthy = engine_->isRunning();
+    load.pendingRequests = scheduler_->getNumPendingRequests();
+    load.activeRequests = scheduler_->getNumActiveRequests();
+    load.freeKVBlocks = cache_->getNumAvailableBlocks();
+    const size_t bytesPerBlock = cache_->getBytesPerBlock();
+    const size_t usedBlocks = bytesPerBlock > 0 ? cache_->getTotalAllocated() / bytesPerBlock : 0;
+    load.totalKVBlocks = usedBlocks + cache_->getNumFreeBlocks();
+    load.kvBlockSize = cache_->getBlockSize();
+    return load;
+}
+
+int LocalReplica::cachedPrefixTokens(const std::vector<int>& promptTokens,
+                                     const std::string& adapter) const {
+    return cache_->matchPrefix(promptTokens, adapter);
+}
+
+bool LocalReplica::submit(std::shared_ptr<Request> request) {
+    return engine_->isRunning() && scheduler_->submitRequest(std::move(request));
+}
+
+// ============================================================================
+// EngineRouter
+// ============================================================================
+
+EngineRouter::EngineRouter(RouterConfig config) : config(config) {
+    this->config.affinityBlockTokens = std::max<size_t>(this->config.affinityBlockTokens, 1);
+}
+
+size_t EngineRouter::addReplica(std::shared_ptr<EngineReplica> replica) {
+    std::lock_guard<std::mutex> lock(mutex);
+    ReplicaSlot slot;
+    slot.replica = std::move(replica);
+    replicas.push_back(std::move(slot));
+    return replicas.size() - 1;
+}
+
+size_t EngineRouter::getNumReplicas() const {
+    std::lock_guard<std::mutex> lock(mutex);
+    return replicas.size();
+}
+
+void EngineRouter::setReplicaEnabled(size_t index, bool enabled) {
+    std::lock_guard<std::mutex> lock(mutex);
+    if (index < replicas.size()) {
+        replicas[index].enabled = enabled;
+    }
+}
+
+std::vector<uint64_t> EngineRouter::prefixHashes(const std::vector<int>& promptTokens,
+                                                 const std::string& adapter,
+                                                 size_t blockSize) {
+    // Mirrors KVCache: the final prompt token is never cached
+    const size_t blocks = promptTokens.empty() ? 0 : (promptTokens.size() - 1) / blockSize;
+    std::vector<uint64_t> hashes;
+    hashes.reserve(blocks);
+    uint64_t hash = 14695981039346656037ull;
+    if (!adapter.empty()) {
+        for (unsigned char c : adapter) {
+            hash = (hash ^ c) * 1099511628211ull;
+        }
+        hash = (hash ^ 0xffu) * 1099511628211ull;    // Not a byte of any name
+    }
+    for (size_t b = 0; b < blocks; ++b) {
+        for (size_t t = b * blockSize; t < (b + 1) * blockSize; ++t) {
+            hash = (hash ^ static_cast<uint32_t>(promptTokens[t])) * 1099511628211ull;
+        }
+        hashes.push_back(hash);
+    }
+    return hashes;
+}
+
+std::vector<EngineRouter::Candidate> EngineRouter::rank(const Request& request,
+                                                        const std::string& model,
+                                                        const std::vector<uint64_t>& hashes) const {
+    // Snapshot routing state, then query replicas without the lock: a
+    // remote replica's load() may block
+    std::vector<Candidate> candidates;
+    std::vector<int> recentTokens;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        std::vector<int> recent(replicas.size(), 0);
+        for (size_t b = 0; b < hashes.size(); ++b) {
+            auto it = affinity.find(hashes[b]);
+            if (it != affinity.end() && it->second.replica < recent.size()) {
+                recent[it->second.replica] = static_cast<int>((b + 1) * config.affinityBlockTokens);
+            }
+        }
+        for (size_t i = 0; i < replicas.size(); ++i) {
+            const ReplicaSlot& slot = replicas[i];
+            if (!slot.enabled || (!model.empty() && slot.replica->model() != model)) {
+                continue;
+            }
+            Candidate candidate;
+            candidate.index = i;
+            candidate.replica = slot.replica;
+            candidate.failing = slot.consecutiveFailures >= config.maxSubmitFailures;
+            candidates.push_back(std::move(candidate));
+            recentTokens.push_back(recent[i]);
+        }
+    }
+
+    const auto& prompt = request.getPromptTokens();
+    std::vector<ReplicaLoad> loads;
+    std::vector<Candidate> eligible;
+    std::vector<int> depths;
+    for (size_t c = 0; c < candidates.size(); ++c) {
+        ReplicaLoad load = candidates[c].replica->load();
+        if (!load.healthy) {
+            continue;
+        }
+        int resident = candidates[c].replica->cachedPrefixTokens(prompt, request.getAdapter());
+        candidates[c].expectedHitTokens = std::max(resident, recentTokens[c]);
+        eligible.push_back(std::move(candidates[c]));
+        depths.push_back(load.pendingRequests + load.activeRequests);
+        loads.push_back(load);
+    }
+    if (eligible.empty()) {
+        return eligible;
+    }
+
+    const int minDepth = *std::min_element(depths.begin(), depths.end());
+    const int maxDepth = *std::max_element(depths.begin(), depths.end());
+    const double promptLen = static_cast<double>(std::max<size_t>(prompt.size(), 1));
+    for (size_t c = 0; c < eligible.size(); ++c) {
+        Candidate& candidate = eligible[c];
+        const ReplicaLoad& load = loads[c];
+        double prefix = 0.0;
+        if (candidate.expectedHitTokens > 0 && depths[c] - minDepth <= config.maxQueueImbalance) {
+            prefix = candidate.expectedHitTokens / promptLen;
+            candidate.affinity = true;
+        } else {
+            candidate.expectedHitTokens = 0;    // Routed away from its KV
+        }
+        double queue = static_cast<double>(depths[c]) / (maxDepth + 1);
+        double kvUsed = load.totalKVBlocks > 0
+            ? 1.0 - std::min(1.0, static_cast<double>(load.freeKVBlocks) / load.totalKVBlocks)
+            : 0.0;
+        candidate.score = config.prefixWeight * prefix -
+                          config.queueWeight * queue -
+                          config.kvWeight * kvUsed;
+    }
+
+    std::vector<size_t> order(eligible.size());
+    for (size_t c = 0; c < order.size(); ++c) order[c] = c;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) {
+        if (eligible[a].failing != eligible[b].failing) return !eligible[a].failing;
+        if (eligible[a].score != eligible[b].score) return eligible[a].score > eligible[b].score;
+        if (depths[a] != depths[b]) return depths[a] < depths[b];
+        return eligible[a].index < eligible[b].index;
+    });
+    std::vector<Candidate> ranked;
+    ranked.reserve(order.size());
+    for (size_t c : order) {
+        ranked.push_back(std::move(eligible[c]));
+    }
+    return ranked;
+}
+
+void EngineRouter::rememberLocked(const std::vector<uint64_t>& hashes, size_t replica) {
+    for (uint64_t hash : hashes) {
+        affinity[hash] = AffinityEntry{replica, ++affinityClock};
+    }
+    // Keep the newest half once over capacity (amortized O(1) per insert)
+    if (affinity.size() > config.affinityCapacity) {
+        const uint64_t keepFrom = affinityClock - std::min<uint64_t>(affinityClock, config.affinityCapacity / 2);
+        for (auto it = affinity.begin(); it != affinity.end();) {
+            it = it->second.lastUse <= keepFrom ? affinity.erase(it) : std::next(it);
+        }
+    }
+}
+
+int EngineRouter::route(const Request& request, const std::string& model) const {
+    auto ranked = rank(request, model, prefixHashes(request.getPromptTokens(), request.getAdapter(),
+                                                    config.affinityBlockTokens));
+    return ranked.empty() ? -1 : static_cast<int>(ranked.front().index);
+}
+
+int EngineRouter::submit(std::shared_ptr<Request> request, const std::string& model) {
+    if (!request) {
+        return -1;
+    }
+    const auto hashes = prefixHashes(request->getPromptTokens(), request->getAdapter(),
+                                     config.affinityBlockTokens);
+    for (const Candidate& candidate : rank(*request, model, hashes)) {
+        bool accepted = candidate.replica->submit(request);
+        std::lock_guard<std::mutex> lock(mutex);
+        ReplicaSlot& slot = replicas[candidate.index];
+        if (!accepted) {
+            slot.consecutiveFailures++;
+            slot.failedSubmits++;
+            continue;
+        }
+        slot.consecutiveFailures = 0;
+        slot.routedRequests++;
+        slot.routedPromptTokens += request->getPromptTokens().size();
+        slot.expectedHitTokens += candidate.expectedHitTokens;
+        if (candidate.affinity) {
+            slot.affinityRoutes++;
+        }
+        rememberLocked(hashes, candidate.index);
+        return static_cast<int>(candidate.index);
+    }
+    std::cerr << "[EngineRouter] No replica accepted request: " << request->getId()
+              << (model.empty() ? "" : " (model " + model + ")") << std::endl;
+    return -1;
+}
+
+std::vector<ReplicaStatus> EngineRouter::getReplicaStatus() const {
+    std::vector<ReplicaStatus> status;
+    std::vector<std::shared_ptr<EngineReplica>> handles;
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        for (const ReplicaSlot& slot : replicas) {
+            ReplicaStatus s;
+            s.name = slot.replica->name();
+            s.model = slot.replica->model();
+            s.enabled = slot.enabled;
+            s.healthy = slot.consecutiveFailures < config.maxSubmitFailures;
+            s.routedRequests = slot.routedRequests;
+            s.affinityRoutes = slot.affinityRoutes;
+            s.routedPromptTokens = slot.routedPromptTokens;
+            s.expectedHitTokens = slot.expectedHitTokens;
+            s.failedSubmits = slot.failedSubmits;
+            status.push_back(std::move(s));
+            handles.push_back(slot.replica);
+        }
+    }
+    for (size_t i = 0; i < status.size(); ++i) {
+        status[i].load = handles[i]->load();
+        status[i].healthy = status[i].healthy && status[i].load.healthy;
+    }
+    return status;
+}
+
+}  // namespace cortexstream
@@ -4,12 +4,12 @@
 //
 // KEY OPTIMIZATIONS IMPLEMENTED:
 //
-// 1. MLX GPU Acceleration (softmax, temperature, categorical sampling)
-//    Location: src/model/sampling.cpp
-//    - softmaxNormalize(): GPU via MLX Metal, falls back to CPU
-//    - applyTemperature(): Vectorized element-wise division on Metal
-//    - categoricalSample(): GPU multinomial sampling vs CPU inverse transform
-//    Impact: 10-50x faster softmax, parallel GPU sampling
+// 1. Fused Batched Sampling
+//    Location: src/model/sampling.cpp (sampleBatch, sampleRow)
+//    - Penalty, temperature, top-k/top-p and draw in one pass per row
+//    - Rows in parallel with per-row params and counter-based RNG streams
+//    - Vocab-wide loops are omp simd reductions
+//    Impact: SamplingParams honored without a per-row dispatch
 //
 // 2. Buddy Allocator for KV Cache (O(log n) vs O(n))
 //    Location: src/cache/kv_cache.cpp
@@ -30,11 +30,11 @@
 //    - Better cache locality than full sort
 //    Impact: 2-3x faster top-K retrieval
 //
-// 5. Softmax Result Caching
-//    Location: src/model/sampling.cpp, include/cortexstream/sampler.h
-//    - LRU cache with 128-entry limit
-//    - Hash-based O(1) lookup
-//    Impact: 100x if cache hit (reduces GPU->CPU sync)
+// 5. Per-Thread Sampling Workspaces
+//    Location: src/model/sampling.cpp, include/cortexstream/model.h
+//    - Cache-line aligned ScratchArena buffers, sized to the vocab once
+//    - Opt-in exact-match memo for repeated rows within a batch
+//    Impact: no per-token hashing or allocation on the sampling path
 //
 // 6. Parallel Batch Processing (OpenMP)
 //    Location: src/engine/engine.cpp
@@ -45,8 +45,10 @@
 //
 // 7. Batch Scheduling Optimizations
 //    Location: src/engine/scheduler.cpp
-//    - buildPrefillBatch(): Sort by prompt length (shorter first)
-//    - buildDecodeBatch(): Sort by generation progress (newer first)
+//    - scheduleStep(): Token-budgeted steps mixing decode and chunked prefill
+//    - Pluggable SchedulingPolicy (FCFS/SJF/EDF/WFQ) within priority classes
+//    - Aging: requests unserved for N steps jump ahead of every class
+//    - Multi-LoRA: active-adapter cap, batches grouped by adapter
 //    Impact: Reduces time-to-first-token (TTFT), improves throughput
 //
 // 8. MLX Tensor Integration
@@ -69,12 +71,57 @@
 // ============================================================================
 
 #include "cortexstream/scheduler.h"
+#include "cortexstream/trace.h"
 #include <algorithm>
+#include <numeric>
 
 namespace cortexstream {
 
-Scheduler::Scheduler(int maxBatchSize)
-    : maxBatchSize(maxBatchSize) {
+namespace {
+
+// Tokens a request still has to prefill (prompt, plus generated tokens when
+// it is recomputed after preemption)
+int remainingPrefillTokens(const Request& req) {
+    return req.getPromptLength() + req.getGeneratedLength() - req.getNumComputedTokens();
+}
+
+// Make each adapter's rows contiguous (groups in order of first row,
+// rank order kept within a group) so adapter kernels run long segments
+void groupByAdapter(Batch& batch) {
+    const auto& reqs = batch.requests;
+    if (std::all_of(reqs.begin(), reqs.end(), [](const auto& req) { return req->getAdapter().empty(); })) {
+        return;
+    }
+    std::unordered_map<std::string, size_t> groupOf;
+    std::vector<size_t> group(reqs.size());
+    for (size_t i = 0; i < reqs.size(); ++i) {
+        group[i] = groupOf.emplace(reqs[i]->getAdapter(), groupOf.size()).first->second;
+    }
+    std::vector<size_t> order(reqs.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::stable_sort(order.begin(), order.end(),
+        [&group](size_t a, size_t b) { return group[a] < group[b]; });
+    
+    auto permute = [&order](auto& values) {
+        if (values.size() != order.size()) {
+            return;  // startPositions is empty for decode
+        }
+        auto original = values;
+        for (size_t i = 0; i < order.size(); ++i) {
+            values[i] = std::move(original[order[i]]);
+        }
+    };
+    permute(batch.requests);
+    permute(batch.sequenceLengths);
+    permute(batch.startPositions);
+}
+
+}  // namespace
+
+Scheduler::Scheduler(int maxBatchSize, int maxTokensPerStep)
+    : maxBatchSize(maxBatchSize),
+      maxTokensPerStep(maxTokensPerStep),
+      policy(std::make_shared<FCFSPolicy>()) {
 }
 
 Scheduler::~Scheduler() = default;
@@ -84,14 +131,36 @@ bool Scheduler::submitRequest(std::shared_ptr<Request> request) {
     
     {
         std::lock_guard<std::mutex> lock(queueMutex);
-        pendingQueue.push(request);
+        pendingQueue.push_back(request);
+        SeqId seq = request->getSeqId();
+        if (static_cast<size_t>(seq) >= lastServedStep.size()) {
+            lastServedStep.resize(seq + 1, 0);
+        }
+        lastServedStep[seq] = stepCounter;  // Waiting starts now
     }
+    workAvailable.notify_one();
     return true;
 }
 
+void Scheduler::waitForWork() {
+    std::unique_lock<std::mutex> lock(queueMutex);
+    workAvailable.wait(lock, [this] {
+        return interrupted || !pendingQueue.empty() || numActive > 0;
+    });
+    interrupted = false;
+}
+
+void Scheduler::interrupt() {
+    {
+        std::lock_guard<std::mutex> lock(queueMutex);
+        interrupted = true;
+    }
+    workAvailable.notify_all();
+}
+
 bool Scheduler::hasWork() const {
     std::lock_guard<std::mutex> lock(queueMutex);
-    return !pendingQueue.empty() || !activeRequests.empty();
+    return !pendingQueue.empty() || numActive > 0;
 }
 
 bool Scheduler::hasPendingRequests() const {
@@ -101,33 +170,157 @@ bool Scheduler::hasPendingRequests() const {
 
 bool Scheduler::hasActiveRequests() const {
     std::lock_guard<std::mutex> lock(queueMutex);
-    return !activeRequests.empty();
+    return numActive > 0;
 }
 
 int Scheduler::getNumActiveRequests() const {
     std::lock_guard<std::mutex> lock(queueMutex);
-    return activeRequests.size();
+    return static_cast<int>(numActive);
+}
+
+int Scheduler::getNumPendingRequests() const {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return static_cast<int>(pendingQueue.size());
 }
 
 void Scheduler::acceptNewRequests() {
-    // Optimized batch scheduling: prioritize by sequence length for better GPU utilization
-    // Shorter sequences encode faster, freeing resources for longer sequences
+    // Admit in policy order up to the active-sequence cap
     
     std::lock_guard<std::mutex> lock(queueMutex);
     
-    while (!pendingQueue.empty() && 
-           activeRequests.size() < static_cast<size_t>(maxBatchSize)) {
-        auto req = pendingQueue.front();
-        pendingQueue.pop();
+    std::vector<std::shared_ptr<Request>> waiting(pendingQueue.begin(), pendingQueue.end());
+    rank(waiting);
+    for (auto& req : waiting) {
+        if (numActive >= static_cast<size_t>(maxBatchSize)) {
+            break;
+        }
+        if (!adapterAdmissibleLocked(*req)) {
+            if (isStarved(*req)) {
+                break;  // Hold the line until an adapter drains
+            }
+            continue;
+        }
+        pendingQueue.erase(std::find(pendingQueue.begin(), pendingQueue.end(), req));
         req->setState(RequestState::Prefilling);
-        activeRequests.push_back(req);
+        activateLocked(req);
+    }
+}
+
+ScheduledStep Scheduler::scheduleStep(size_t freeKVTokens) {
+    CORTEX_TRACE_SCOPE("scheduler.scheduleStep");
+    std::lock_guard<std::mutex> lock(queueMutex);
+    
+    ScheduledStep step;
+    step.decode.isPrefill = false;
+    step.prefill.isPrefill = true;
+    int budget = maxTokensPerStep;
+    stepCounter++;
+    compactActiveLocked();
+    
+    // 1. Decode: one token per running sequence in rank order.
+    // Running sequences are never stalled behind a prompt; only a client
+    // that does not drain its stream stalls its own sequence.
+    std::vector<std::shared_ptr<Request>> decodeReqs;
+    for (auto& req : activeRequests) {
+        if (req->getState() != RequestState::Decoding) {
+            continue;
+        }
+        if (req->isStreamBackpressured()) {
+            step.numThrottled++;
+            continue;
+        }
+        decodeReqs.push_back(req);
+    }
+    rank(decodeReqs);
+    for (auto& req : decodeReqs) {
+        if (budget <= 0 || step.decode.batchSize >= maxBatchSize) {
+            break;
+        }
+        step.decode.requests.push_back(req);
+        step.decode.sequenceLengths.push_back(req->getGeneratedLength() + 1);
+        step.decode.batchSize++;
+        budget--;
+        markServed(req, 1);
+    }
+    groupByAdapter(step.decode);
+    
+    // 2. Prefill with what is left, one chunk per request. Chunks shrink to
+    // the remaining budget; with chunking off, a prompt larger than a whole
+    // step may only run as the step's sole prefill so it cannot starve.
+    // The KV check covers the request's entire remaining prompt so partial
+    // prefills cannot deadlock each other. It ignores prefix-cache hits, so
+    // with nothing decoding (no blocks will be released) the head request
+    // goes to allocation, which has the final say.
+    bool idle = step.decode.empty();
+    auto chunkFor = [&](const Request& req) {
+        int remaining = remainingPrefillTokens(req);
+        if (static_cast<size_t>(remaining) > freeKVTokens &&
+            !(idle && step.prefill.empty())) {
+            return 0;
+        }
+        int tokens = prefillChunkSize > 0 ? std::min(remaining, prefillChunkSize) : remaining;
+        if (tokens <= budget) {
+            return tokens;
+        }
+        if (prefillChunkSize > 0) {
+            return std::max(budget, 0);
+        }
+        return step.prefill.empty() && tokens > maxTokensPerStep ? tokens : 0;
+    };
+    auto addPrefill = [&](const std::shared_ptr<Request>& req, int tokens) {
+        int remaining = remainingPrefillTokens(*req);
+        step.prefill.requests.push_back(req);
+        step.prefill.sequenceLengths.push_back(tokens);
+        step.prefill.startPositions.push_back(req->getNumComputedTokens());
+        step.prefill.batchSize++;
+        budget -= tokens;
+        freeKVTokens -= std::min(freeKVTokens, static_cast<size_t>(remaining));
+        markServed(req, tokens);
+    };
+    
+    // Admitted requests waiting for prefill and new arrivals compete in one
+    // rank order. Stopping at the first that does not fit keeps a large
+    // request from being overtaken forever.
+    std::vector<std::shared_ptr<Request>> prefillReqs;
+    for (auto& req : activeRequests) {
+        if (req->getState() == RequestState::Prefilling) {
+            prefillReqs.push_back(req);
+        }
+    }
+    prefillReqs.insert(prefillReqs.end(), pendingQueue.begin(), pendingQueue.end());
+    rank(prefillReqs);
+    for (auto& req : prefillReqs) {
+        bool admitted = req->getState() == RequestState::Prefilling;
+        if (!admitted && numActive >= static_cast<size_t>(maxBatchSize)) {
+            continue;  // No sequence slot; admitted work may still run
+        }
+        if (!admitted && !adapterAdmissibleLocked(*req)) {
+            if (isStarved(*req)) {
+                break;
+            }
+            continue;  // Its adapter would exceed the active-adapter cap
+        }
+        int tokens = chunkFor(*req);
+        if (tokens <= 0) {
+            break;
+        }
+        if (!admitted) {
+            pendingQueue.erase(std::find(pendingQueue.begin(), pendingQueue.end(), req));
+            req->setState(RequestState::Prefilling);
+            activateLocked(req);
+        }
+        addPrefill(req, tokens);
     }
+    groupByAdapter(step.prefill);
+    
+    step.numTokens = maxTokensPerStep - budget;
+    return step;
 }
 
 Batch Scheduler::buildPrefillBatch() {
+    CORTEX_TRACE_SCOPE("scheduler.buildPrefillBatch");
     // Optimized prefill batch construction
-    // Prefill processes prompts (variable length) - prioritize by sequence length
-    // Shorter prompts complete faster, allowing more parallelism
+    // Prefill processes prompts (variable length) in scheduling-policy order
     
     std::lock_guard<std::mutex> lock(queueMutex);
     
@@ -143,12 +336,8 @@ Batch Scheduler::buildPrefillBatch() {
         }
     }
     
-    // Sort by prompt length (ascending): shorter prompts first
-    // This improves GPU utilization by completing short sequences faster
-    std::sort(prefillReqs.begin(), prefillReqs.end(),
-        [](const auto& a, const auto& b) {
-            return a->getPromptLength() < b->getPromptLength();
-        });
+    // Rank order (starved, priority, then policy)
+    rank(prefillReqs);
     
     // Add to batch up to max batch size
     for (auto& req : prefillReqs) {
@@ -160,14 +349,16 @@ Batch Scheduler::buildPrefillBatch() {
             break;
         }
     }
+    groupByAdapter(batch);
     
     return batch;
 }
 
 Batch Scheduler::buildDecodeBatch() {
+    CORTEX_TRACE_SCOPE("scheduler.buildDecodeBatch");
     // Optimized decode batch construction
     // Decode processes one token per sequence (fixed length)
-    // Priority: early-stage sequences to minimize latency
+    // in scheduling-policy order
     
     std::lock_guard<std::mutex> lock(queueMutex);
     
@@ -183,12 +374,8 @@ Batch Scheduler::buildDecodeBatch() {
         }
     }
     
-    // Sort by age (ascending): newer requests first (lower generated length)
-    // This minimizes time-to-first-token (TTFT) for recent requests
-    std::sort(decodeReqs.begin(), decodeReqs.end(),
-        [](const auto& a, const auto& b) {
-            return a->getGeneratedLength() < b->getGeneratedLength();
-        });
+    // Rank order (starved, priority, then policy)
+    rank(decodeReqs);
     
     // Add to batch up to max batch size
     for (auto& req : decodeReqs) {
@@ -200,53 +387,138 @@ Batch Scheduler::buildDecodeBatch() {
             break;
         }
     }
+    groupByAdapter(batch);
     
     return batch;
 }
 
-void Scheduler::markRequestReady(const std::string& requestId) {
+void Scheduler::markRequestReady(SeqId seq) {
     std::lock_guard<std::mutex> lock(queueMutex);
     
+    Request* req = findActiveLocked(seq);
+    if (req && req->getState() == RequestState::Prefilling) {
+        req->setState(RequestState::Decoding);
+    }
+}
+
+void Scheduler::markRequestFinished(SeqId seq) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    retireLocked(seq, RequestState::Finished);
+}
+
+void Scheduler::markRequestsFinished(const std::vector<SeqId>& seqs) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    for (SeqId seq : seqs) {
+        retireLocked(seq, RequestState::Finished);
+    }
+}
+
+void Scheduler::markRequestFailed(SeqId seq) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    retireLocked(seq, RequestState::Failed);
+}
+
+void Scheduler::setPreemptionPolicy(PreemptionPolicy policy) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    preemptionPolicy = policy;
+}
+
+std::shared_ptr<Request> Scheduler::selectPreemptionVictim() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    
+    // Only decoding sequences hold KV worth reclaiming. The lowest
+    // priority class is preempted first.
+    std::shared_ptr<Request> victim;
     for (auto& req : activeRequests) {
-        if (req->getId() == requestId) {
-            if (req->getState() == RequestState::Prefilling) {
-                req->setState(RequestState::Decoding);
+        if (req->getState() != RequestState::Decoding) {
+            continue;
+        }
+        if (!victim || req->getPriority() < victim->getPriority()) {
+            victim = req;
+            continue;
+        }
+        if (req->getPriority() > victim->getPriority()) {
+            continue;
+        }
+        bool later = req->getArrivalTimestampNs() > victim->getArrivalTimestampNs();
+        if (preemptionPolicy == PreemptionPolicy::LowestProgress) {
+            int progress = req->getGeneratedLength();
+            int victimProgress = victim->getGeneratedLength();
+            if (progress < victimProgress || (progress == victimProgress && later)) {
+                victim = req;
             }
-            return;
+        } else if (later) {
+            victim = req;
         }
     }
+    return victim;
 }
 
-void Scheduler::markRequestFinished(const std::string& requestId) {
+void Scheduler::markRequestSwapped(SeqId seq) {
     std::lock_guard<std::mutex> lock(queueMutex);
     
-    auto it = std::find_if(activeRequests.begin(), activeRequests.end(),
-        [&](const auto& req) { return req->getId() == requestId; });
+    Request* req = findActiveLocked(seq);
+    if (req && req->getState() == RequestState::Decoding) {
+        req->setState(RequestState::Swapped);
+    }
+}
+
+void Scheduler::markRequestResumed(SeqId seq) {
+    std::lock_guard<std::mutex> lock(queueMutex);
     
-    if (it != activeRequests.end()) {
-        (*it)->setState(RequestState::Finished);
-        finishedRequests.push_back(*it);
-        activeRequests.erase(it);
+    Request* req = findActiveLocked(seq);
+    if (req && req->getState() == RequestState::Swapped) {
+        req->setState(RequestState::Decoding);
     }
 }
 
-void Scheduler::markRequestFailed(const std::string& requestId) {
+void Scheduler::markRequestForRecompute(SeqId seq) {
     std::lock_guard<std::mutex> lock(queueMutex);
     
-    auto it = std::find_if(activeRequests.begin(), activeRequests.end(),
-        [&](const auto& req) { return req->getId() == requestId; });
+    // KV was dropped: prefill prompt + generated tokens again
+    Request* req = findActiveLocked(seq);
+    if (req) {
+        req->setNumComputedTokens(0);
+        req->setState(RequestState::Prefilling);
+    }
+}
+
+std::vector<std::shared_ptr<Request>> Scheduler::getSwappedRequests() const {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    
+    // Oldest first so earlier arrivals resume first
+    std::vector<std::shared_ptr<Request>> swapped;
+    for (const auto& req : activeRequests) {
+        if (req->getState() == RequestState::Swapped) {
+            swapped.push_back(req);
+        }
+    }
+    std::sort(swapped.begin(), swapped.end(),
+        [](const auto& a, const auto& b) {
+            return a->getArrivalTimestampNs() < b->getArrivalTimestampNs();
+        });
+    return swapped;
+}
+
+std::shared_ptr<Request> Scheduler::getRequest(SeqId seq) {
+    std::lock_guard<std::mutex> lock(queueMutex);
     
-    if (it != activeRequests.end()) {
-        (*it)->setState(RequestState::Failed);
-        activeRequests.erase(it);
+    if (findActiveLocked(seq)) {
+        return activeBySeq[seq];
     }
+    for (auto& req : finishedRequests) {
+        if (req->getSeqId() == seq) {
+            return req;
+        }
+    }
+    return nullptr;
 }
 
 std::shared_ptr<Request> Scheduler::getRequest(const std::string& requestId) {
     std::lock_guard<std::mutex> lock(queueMutex);
     
     for (auto& req : activeRequests) {
-        if (req->getId() == requestId) {
+        if (req->getId() == requestId && findActiveLocked(req->getSeqId())) {
             return req;
         }
     }
@@ -260,10 +532,165 @@ std::shared_ptr<Request> Scheduler::getRequest(const std::string& requestId) {
     return nullptr;
 }
 
+std::vector<std::shared_ptr<Request>> Scheduler::drainCompletedRequests() {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    std::vector<std::shared_ptr<Request>> completed;
+    completed.swap(finishedRequests);
+    return completed;
+}
+
 int Scheduler::getMaxBatchSize() const {
     return maxBatchSize;
 }
 
+int Scheduler::getMaxTokensPerStep() const {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return maxTokensPerStep;
+}
+
+void Scheduler::setMaxTokensPerStep(int maxTokens) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    maxTokensPerStep = std::max(1, maxTokens);
+}
+
+int Scheduler::getPrefillChunkSize() const {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return prefillChunkSize;
+}
+
+void Scheduler::setPrefillChunkSize(int chunkTokens) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    prefillChunkSize = std::max(0, chunkTokens);
+}
+
+void Scheduler::setSchedulingPolicy(std::shared_ptr<SchedulingPolicy> newPolicy) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    policy = newPolicy ? newPolicy : std::make_shared<FCFSPolicy>();
+}
+
+std::shared_ptr<SchedulingPolicy> Scheduler::getSchedulingPolicy() const {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return policy;
+}
+
+void Scheduler::setStarvationThreshold(int steps) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    starvationThreshold = std::max(0, steps);
+}
+
+void Scheduler::setMaxActiveAdapters(int maxAdapters) {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    maxActiveAdapters = std::max(0, maxAdapters);
+}
+
+int Scheduler::getMaxActiveAdapters() const {
+    std::lock_guard<std::mutex> lock(queueMutex);
+    return maxActiveAdapters;
+}
+
+bool Scheduler::isStarved(const Request& req) const {
+    if (starvationThreshold <= 0) {
+        return false;
+    }
+    SeqId seq = req.getSeqId();
+    return static_cast<size_t>(seq) < lastServedStep.size() &&
+           stepCounter - lastServedStep[seq] > static_cast<uint64_t>(starvationThreshold);
+}
+
+bool Scheduler::ranksBefore(const std::shared_ptr<Request>& a,
+                            const std::shared_ptr<Request>& b) const {
+    // Starved requests go first, longest-waiting first
+    bool starvedA = isStarved(*a);
+    bool starvedB = isStarved(*b);
+    if (starvedA != starvedB) {
+        return starvedA;
+    }
+    if (starvedA) {
+        uint64_t servedA = lastServedStep[a->getSeqId()];
+        uint64_t servedB = lastServedStep[b->getSeqId()];
+        if (servedA != servedB) {
+            return servedA < servedB;
+        }
+    }
+    if (a->getPriority() != b->getPriority()) {
+        return a->getPriority() > b->getPriority();
+    }
+    return policy->before(*a, *b);
+}
+
+void Scheduler::rank(std::vector<std::shared_ptr<Request>>& reqs) const {
+    // Stable: ties keep admission/submission order
+    std::stable_sort(reqs.begin(), reqs.end(),
+        [this](const auto& a, const auto& b) { return ranksBefore(a, b); });
+}
+
+void Scheduler::markServed(const std::shared_ptr<Request>& req, int tokens) {
+    lastServedStep[req->getSeqId()] = stepCounter;
+    policy->onScheduled(*req, tokens);
+}
+
+void Scheduler::forget(const Request& req) {
+    policy->onCompleted(req);
+}
+
+void Scheduler::activateLocked(const std::shared_ptr<Request>& req) {
+    SeqId seq = req->getSeqId();
+    if (static_cast<size_t>(seq) >= activeBySeq.size()) {
+        activeBySeq.resize(seq + 1);
+    }
+    activeBySeq[seq] = req;
+    activeRequests.push_back(req);
+    numActive++;
+    if (!req->getAdapter().empty()) {
+        activeAdapters[req->getAdapter()]++;
+    }
+    
+    uint64_t now = metricsClockNs();
+    uint64_t arrival = req->getArrivalTimestampNs();
+    queueWait.record(now > arrival ? now - arrival : 0);
+}
+
+Request* Scheduler::findActiveLocked(SeqId seq) const {
+    if (seq < 0 || static_cast<size_t>(seq) >= activeBySeq.size()) {
+        return nullptr;
+    }
+    return activeBySeq[seq].get();
+}
+
+void Scheduler::retireLocked(SeqId seq, RequestState state) {
+    Request* req = findActiveLocked(seq);
+    if (!req) {
+        return;
+    }
+    req->setState(state);
+    forget(*req);
+    auto adapter = activeAdapters.find(req->getAdapter());
+    if (adapter != activeAdapters.end() && --adapter->second == 0) {
+        activeAdapters.erase(adapter);
+    }
+    finishedRequests.push_back(std::move(activeBySeq[seq]));
+    numActive--;
+    activeDirty = true;  // Erased from activeRequests at the next step
+}
+
+void Scheduler::compactActiveLocked() {
+    if (!activeDirty) {
+        return;
+    }
+    activeRequests.erase(
+        std::remove_if(activeRequests.begin(), activeRequests.end(),
+            [this](const auto& req) { return findActiveLocked(req->getSeqId()) != req.get(); }),
+        activeRequests.end());
+    activeDirty = false;
+}
+
+bool Scheduler::adapterAdmissibleLocked(const Request& req) const {
+    const std::string& adapter = req.getAdapter();
+    return adapter.empty() || maxActiveAdapters <= 0 ||
+           activeAdapters.count(adapter) > 0 ||
+           activeAdapters.size() < static_cast<size_t>(maxActiveAdapters);
+}
+
 void Scheduler::removeFinished() {
     std::lock_guard<std::mutex> lock(queueMutex);
     finishedRequests.clear();
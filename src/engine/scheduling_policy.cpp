@@ -0,0 +1,101 @@
+#include "cortexstream/scheduling_policy.h"
+#include <algorithm>
+
+namespace cortexstream {
+
+namespace {
+
+int remainingWork(const Request& req) {
+    int prefill = req.getPromptLength() - std::min(req.getNumComputedTokens(), req.getPromptLength());
+    int decode = std::max(0, req.getMaxTokens() - req.getGeneratedLength());
+    return prefill + decode;
+}
+
+}  // namespace
+
+bool FCFSPolicy::before(const Request& a, const Request& b) const {
+    return a.getArrivalTimestampNs() < b.getArrivalTimestampNs();
+}
+
+bool ShortestJobFirstPolicy::before(const Request& a, const Request& b) const {
+    int workA = remainingWork(a);
+    int workB = remainingWork(b);
+    if (workA != workB) {
+        return workA < workB;
+    }
+    return a.getArrivalTimestampNs() < b.getArrivalTimestampNs();
+}
+
+bool EarliestDeadlinePolicy::before(const Request& a, const Request& b) const {
+    if (a.hasDeadline() != b.hasDeadline()) {
+        return a.hasDeadline();
+    }
+    if (a.hasDeadline() && a.getDeadlineNs() != b.getDeadlineNs()) {
+        return a.getDeadlineNs() < b.getDeadlineNs();
+    }
+    return a.getArrivalTimestampNs() < b.getArrivalTimestampNs();
+}
+
+bool WeightedFairPolicy::before(const Request& a, const Request& b) const {
+    double vtA = effectiveVirtualTime(a.getTenant());
+    double vtB = effectiveVirtualTime(b.getTenant());
+    if (vtA != vtB) {
+        return vtA < vtB;
+    }
+    return a.getArrivalTimestampNs() < b.getArrivalTimestampNs();
+}
+
+void WeightedFairPolicy::onScheduled(const Request& request, int tokens) {
+    const std::string& tenant = request.getTenant();
+    auto active = active_.find(tenant);
+    if (active == active_.end()) {
+        // A new or returning tenant starts level with the least-served
+        // active one instead of at its old (lower) time, so it cannot
+        // monopolize the engine to "catch up"
+        double start = effectiveVirtualTime(tenant);
+        virtualTime_[tenant] = start;
+        active = active_.emplace(tenant, std::unordered_set<SeqId>()).first;
+    }
+    active->second.insert(request.getSeqId());
+    auto it = weights_.find(tenant);
+    double weight = it != weights_.end() ? it->second : 1.0;
+    virtualTime_[tenant] += tokens / weight;
+}
+
+void WeightedFairPolicy::onCompleted(const Request& request) {
+    auto active = active_.find(request.getTenant());
+    if (active == active_.end()) {
+        return;
+    }
+    active->second.erase(request.getSeqId());
+    if (active->second.empty()) {
+        active_.erase(active);      // Idle: levelled again when it returns
+    }
+}
+
+double WeightedFairPolicy::activeFloor() const {
+    double floor = 0.0;
+    bool any = false;
+    for (const auto& entry : active_) {
+        double vt = getVirtualTime(entry.first);
+        floor = any ? std::min(floor, vt) : vt;
+        any = true;
+    }
+    return floor;
+}
+
+double WeightedFairPolicy::effectiveVirtualTime(const std::string& tenant) const {
+    double vt = getVirtualTime(tenant);
+    return active_.count(tenant) ? vt : std::max(vt, activeFloor());
+}
+
+void WeightedFairPolicy::setWeight(const std::string& tenant, double weight) {
+    weights_[tenant] = std::max(weight, 1e-6);
+}
+
+double WeightedFairPolicy::getVirtualTime(const std::string& tenant) const {
+    auto it = virtualTime_.find(tenant);
+    return it != virtualTime_.end() ? it->second : 0.0;
+}
+
+}  // namespace cortexstream
@@ -0,0 +1,237 @@
+#include "cortexstream/speculative.h"
+#include <algorithm>
+
+namespace cortexstream {
+
+std::vector<std::vector<int>> Drafter::proposeBatch(
+    const Batch& batch, const std::vector<int>& maxTokens) {
+    std::vector<std::vector<int>> drafts(batch.requests.size());
+    for (size_t i = 0; i < batch.requests.size(); ++i) {
+        if (maxTokens[i] > 0) {
+            drafts[i] = propose(*batch.requests[i], maxTokens[i]);
+        }
+    }
+    return drafts;
+}
+
+// ============================================================================
+// PromptLookupDrafter
+// ============================================================================
+
+PromptLookupDrafter::PromptLookupDrafter(int maxNgram, int minNgram)
+    : maxNgram(std::max(maxNgram, 1)),
+      minNgram(std::clamp(minNgram, 1, std::max(maxNgram, 1))) {}
+
+std::vector<int> PromptLookupDrafter::propose(const Request& request, int maxTokens) {
+    const auto& prompt = request.getPromptTokens();
+    const auto& generated = request.getGeneratedTokens();
+    const int length = static_cast<int>(prompt.size() + generated.size());
+    auto at = [&](int i) {
+        return i < static_cast<int>(prompt.size()) ? prompt[i] : generated[i - prompt.size()];
+    };
+
+    std::vector<int> draft;
+    if (maxTokens <= 0) {
+        return draft;
+    }
+
+    // Longest suffix first: a longer match predicts the continuation better
+    for (int n = std::min(maxNgram, length - 1); n >= minNgram; --n) {
+        const int suffix = length - n;
+        // Most recent earlier occurrence; recent context is the likelier copy
+        for (int start = suffix - 1; start >= 0; --start) {
+            int k = 0;
+            while (k < n && at(start + k) == at(suffix + k)) {
+                ++k;
+            }
+            if (k < n) {
+                continue;
+            }
+            for (int p = start + n; p < length && static_cast<int>(draft.size()) < maxTokens; ++p) {
+                draft.push_back(at(p));
+            }
+            return draft;
+        }
+    }
+    return draft;
+}
+
+// ============================================================================
+// ModelDrafter
+// ============================================================================
+
+namespace {
+
+// Tokens the draft model conditions on: the prompt, then generated tokens
+std::vector<int> contextOf(const Request& request) {
+    std::vector<int> context = request.getPromptTokens();
+    const auto& generated = request.getGeneratedTokens();
+    context.insert(context.end(), generated.begin(), generated.end());
+    return context;
+}
+
+}  // namespace
+
+ModelDrafter::ModelDrafter(std::shared_ptr<ModelBackend> draftModel,
+                           std::shared_ptr<KVCache> draftCache)
+    : draftModel(std::move(draftModel)), draftCache(std::move(draftCache)) {
+    if (!this->draftCache && this->draftModel) {
+        this->draftCache = std::make_shared<KVCache>(
+            kDefaultCacheBytes, std::max<size_t>(1, this->draftModel->getHiddenSize()),
+            std::max<size_t>(1, this->draftModel->getNumLayers()));
+    }
+}
+
+std::vector<int> ModelDrafter::propose(const Request& request, int maxTokens) {
+    // Non-owning alias: the batch does not outlive this call
+    Batch batch;
+    batch.requests.emplace_back(std::shared_ptr<Request>(), const_cast<Request*>(&request));
+    batch.sequenceLengths.push_back(1);
+    batch.batchSize = 1;
+    return proposeBatch(batch, {maxTokens})[0];
+}
+
+std::vector<std::vector<int>> ModelDrafter::proposeBatch(
+    const Batch& batch, const std::vector<int>& maxTokens) {
+    const size_t rows = batch.requests.size();
+    std::vector<std::vector<int>> drafts(rows);
+    if (!draftModel || !draftModel->isLoaded() || !draftCache) {
+        return drafts;
+    }
+
+    // 1. Catch the draft KV up to each context, all but its last token
+    // (that one is the first decode input). Only the missing suffix runs:
+    // the whole context on first use, the committed tokens afterwards.
+    std::vector<int> budget(maxTokens.begin(), maxTokens.end());
+    budget.resize(rows, 0);
+    std::vector<int> lastToken(rows, 0);
+    Batch prefill;
+    prefill.isPrefill = true;
+    std::vector<int> prefillTokens;
+    for (size_t i = 0; i < rows; ++i) {
+        if (budget[i] <= 0) {
+            continue;
+        }
+        const Request& req = *batch.requests[i];
+        const SeqId seq = req.getSeqId();
+        std::vector<int> context = contextOf(req);
+        if (context.empty()) {
+            budget[i] = 0;
+            continue;
+        }
+        // The last token is always re-fed as a decode input
+        rollback(seq, std::vector<int>(context.begin(), context.end() - 1));
+        auto& held = cached[seq];
+        const int have = static_cast<int>(held.size());
+        const int need = static_cast<int>(context.size()) - 1 - have;
+        bool ok = draftCache->hasSequence(seq) || draftCache->allocateFor(seq, 0);
+        ok = ok && (need <= 0 || draftCache->appendTokens(seq, need));
+        if (!ok) {
+            budget[i] = 0;      // Draft KV full: the target decodes alone
+            continue;
+        }
+        lastToken[i] = context.back();
+        if (need > 0) {
+            prefill.requests.push_back(batch.requests[i]);
+            prefill.sequenceLengths.push_back(need);
+            prefill.startPositions.push_back(have);
+            prefill.batchSize++;
+            prefillTokens.insert(prefillTokens.end(), context.begin() + have, context.end() - 1);
+            held.assign(context.begin(), context.end() - 1);
+        }
+    }
+    if (!prefill.empty()) {
+        try {
+            draftModel->prefill(prefill, prefillTokens);
+        } catch (const std::exception&) {
+            for (const auto& req : prefill.requests) {
+                release(*req);      // KV contents unknown; rebuilt next time
+            }
+            return drafts;
+        }
+    }
+
+    // 2. Greedy decode; every input token's KV is appended to the draft
+    const int steps = budget.empty() ? 0 : *std::max_element(budget.begin(), budget.end());
+    const SamplingParams greedy;
+    for (int step = 0; step < steps; ++step) {
+        // Rows still drafting decode together, one token per step
+        Batch active;
+        active.isPrefill = false;
+        std::vector<size_t> rowOf;
+        std::vector<int> tokens;
+        for (size_t i = 0; i < rows; ++i) {
+            if (budget[i] <= step) {
+                continue;
+            }
+            const SeqId seq = batch.requests[i]->getSeqId();
+            if (!draftCache->appendToken(seq)) {
+                budget[i] = step;
+                continue;
+            }
+            const int input = drafts[i].empty() ? lastToken[i] : drafts[i].back();
+            cached[seq].push_back(input);
+            active.requests.push_back(batch.requests[i]);
+            active.sequenceLengths.push_back(1);
+            rowOf.push_back(i);
+            tokens.push_back(input);
+        }
+        if (active.empty()) {
+            break;
+        }
+        active.batchSize = static_cast<int>(active.requests.size());
+
+        Tensor logits;
+        try {
+            logits = draftModel->decode(active, tokens);
+        } catch (const std::exception&) {
+            break;  // Keep what was drafted so far; onVerified trims the KV
+        }
+        const TensorView view(logits);
+        for (size_t r = 0; r < rowOf.size() && static_cast<int64_t>(r) < view.rows; ++r) {
+            drafts[rowOf[r]].push_back(draftModel->sampleToken(view.row(r), greedy));
+        }
+    }
+    return drafts;
+}
+
+void ModelDrafter::onVerified(const Batch& batch) {
+    for (const auto& req : batch.requests) {
+        if (req->isFinished() || req->isFailed()) {
+            release(*req);
+        } else if (cached.count(req->getSeqId())) {
+            rollback(req->getSeqId(), contextOf(*req));
+        }
+    }
+}
+
+void ModelDrafter::release(const Request& request) {
+    const SeqId seq = request.getSeqId();
+    cached.erase(seq);
+    if (draftCache && draftCache->hasSequence(seq)) {
+        draftCache->freeFor(seq);
+    }
+}
+
+int ModelDrafter::cachedTokens(SeqId seq) const {
+    auto it = cached.find(seq);
+    return it != cached.end() ? static_cast<int>(it->second.size()) : 0;
+}
+
+void ModelDrafter::rollback(SeqId seq, const std::vector<int>& context) {
+    auto it = cached.find(seq);
+    if (it == cached.end()) {
+        return;
+    }
+    auto& held = it->second;
+    size_t keep = 0;
+    while (keep < held.size() && keep < context.size() && held[keep] == context[keep]) {
+        keep++;
+    }
+    if (keep < held.size() && draftCache->hasSequence(seq)) {
+        draftCache->truncateTokens(seq, static_cast<int>(held.size() - keep));
+    }
+    held.resize(keep);
+}
+
+}  // namespace cortexstream
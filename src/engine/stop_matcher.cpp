@@ -0,0 +1,136 @@
+#include "cortexstream/stop_matcher.h"
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+
+namespace cortexstream {
+
+StopMatcher::StopMatcher(const std::vector<std::string>& strings,
+                         const std::vector<std::vector<int>>& tokenSequences) {
+    // ---- Strings: trie, then BFS completes it into a DFA ----
+    for (const auto& s : strings) {
+        if (!s.empty()) strings_.push_back(s);
+    }
+    if (!strings_.empty()) {
+        std::vector<int32_t> own(1, -1);
+        byteNext_.assign(256, -1);
+        for (size_t p = 0; p < strings_.size(); ++p) {
+            int32_t node = 0;
+            for (unsigned char c : strings_[p]) {
+                const size_t edge = node * 256 + c;
+                if (byteNext_[edge] < 0) {
+                    byteNext_[edge] = static_cast<int32_t>(own.size());
+                    own.push_back(-1);
+                    byteNext_.resize(own.size() * 256, -1);
+                }
+                node = byteNext_[edge];
+            }
+            if (own[node] < 0) own[node] = static_cast<int32_t>(p);
+        }
+
+        std::vector<int32_t> fail(own.size(), 0);
+        byteOutput_.assign(own.size(), -1);
+        byteOutput_[0] = own[0];
+        std::deque<int32_t> queue = {0};
+        while (!queue.empty()) {
+            int32_t node = queue.front();
+            queue.pop_front();
+            for (int c = 0; c < 256; ++c) {
+                int32_t& next = byteNext_[node * 256 + c];
+                int32_t viaFail = node == 0 ? 0 : byteNext_[fail[node] * 256 + c];
+                if (next < 0) {
+                    next = viaFail;         // Shallower states are complete
+                    continue;
+                }
+                fail[next] = viaFail;
+                // A node's own string is the longest ending here
+                byteOutput_[next] = own[next] >= 0 ? own[next] : byteOutput_[viaFail];
+                queue.push_back(next);
+            }
+        }
+    }
+
+    // ---- Token sequences: sparse trie with failure links ----
+    for (const auto& seq : tokenSequences) {
+        if (!seq.empty()) sequences_.push_back(seq);
+    }
+    if (!sequences_.empty()) {
+        tokenNodes_.emplace_back();
+        for (size_t p = 0; p < sequences_.size(); ++p) {
+            int32_t node = 0;
+            for (int token : sequences_[p]) {
+                auto& edges = tokenNodes_[node].edges;
+                auto it = std::lower_bound(edges.begin(), edges.end(), std::make_pair(token, INT32_MIN));
+                if (it == edges.end() || it->first != token) {
+                    int32_t created = static_cast<int32_t>(tokenNodes_.size());
+                    edges.insert(it, {token, created});
+                    tokenNodes_.emplace_back();
+                    node = created;
+                } else {
+                    node = it->second;
+                }
+            }
+            if (tokenNodes_[node].output < 0) tokenNodes_[node].output = static_cast<int32_t>(p);
+        }
+
+        std::deque<int32_t> queue;
+        for (const auto& edge : tokenNodes_[0].edges) {
+            queue.push_back(edge.second);
+        }
+        while (!queue.empty()) {
+            int32_t node = queue.front();
+            queue.pop_front();
+            for (const auto& edge : tokenNodes_[node].edges) {
+                int32_t fail = tokenNodes_[node].fail;
+                int32_t target = tokenEdge(fail, edge.first);
+                while (target < 0 && fail != 0) {
+                    fail = tokenNodes_[fail].fail;
+                    target = tokenEdge(fail, edge.first);
+                }
+                TokenNode& child = tokenNodes_[edge.second];
+                child.fail = target >= 0 ? target : 0;
+                if (child.output < 0) child.output = tokenNodes_[child.fail].output;
+                queue.push_back(edge.second);
+            }
+        }
+    }
+}
+
+int32_t StopMatcher::tokenEdge(int32_t node, int token) const {
+    const auto& edges = tokenNodes_[node].edges;
+    auto it = std::lower_bound(edges.begin(), edges.end(), std::make_pair(token, INT32_MIN));
+    return it != edges.end() && it->first == token ? it->second : -1;
+}
+
+int StopMatcher::advanceText(Cursor& cursor, const std::string& piece, size_t* matchEnd) const {
+    if (strings_.empty()) {
+        return -1;
+    }
+    int32_t state = cursor.textState;
+    for (size_t i = 0; i < piece.size(); ++i) {
+        state = byteNext_[state * 256 + static_cast<unsigned char>(piece[i])];
+        if (byteOutput_[state] >= 0) {
+            cursor.textState = state;
+            if (matchEnd) *matchEnd = i + 1;
+            return byteOutput_[state];
+        }
+    }
+    cursor.textState = state;
+    return -1;
+}
+
+int StopMatcher::advanceToken(Cursor& cursor, int token) const {
+    if (sequences_.empty()) {
+        return -1;
+    }
+    int32_t node = cursor.tokenState;
+    int32_t next = tokenEdge(node, token);
+    while (next < 0 && node != 0) {
+        node = tokenNodes_[node].fail;
+        next = tokenEdge(node, token);
+    }
+    cursor.tokenState = next >= 0 ? next : 0;
+    return tokenNodes_[cursor.tokenState].output;
+}
+
+}  // namespace cortexstream
@@ -0,0 +1,1223 @@
+#include "cortexstream/constraint.h"
+#include "cortexstream/tokenizer.h"
+#include <algorithm>
+#include <bitset>
+#include <cctype>
+#include <cstring>
+#include <functional>
+#include <iostream>
+#include <map>
+
+namespace cortexstream {
+
+namespace {
+
+using ByteSet = std::bitset<256>;
+
+constexpr size_t kMaxNfaStates = 200000;
+constexpr size_t kMaxDfaStates = 20000;
+constexpr int kMaxRepeat = 256;
+constexpr int kMaxSchemaDepth = 32;
+
+// ============================================================================
+// Regex -> AST
+// ============================================================================
+
+struct RegexNode {
+    enum Type { Empty, Set, Concat, Alt, Repeat } type = Empty;
+    ByteSet set;
+    std::vector<int> children;
+    int min = 0;
+    int max = 0;    // Repeat only; -1 = unbounded
+};
+
+class RegexParser {
+public:
+    explicit RegexParser(const std::string& pattern) : pattern_(pattern) {}
+
+    // Root node index, or -1 with error()
+    int parse() {
+        // The whole output must match: explicit anchors are redundant
+        size_t end = pattern_.size();
+        if (pos_ < end && pattern_[pos_] == '^') {
+            ++pos_;
+        }
+        if (end > pos_ && pattern_[end - 1] == '$' &&
+            (end < 2 || pattern_[end - 2] != '\\')) {
+            pattern_.pop_back();
+        }
+        int root = parseAlt();
+        if (root >= 0 && pos_ < pattern_.size()) {
+            return fail("unbalanced ')'");
+        }
+        return root;
+    }
+
+    const std::vector<RegexNode>& nodes() const { return nodes_; }
+    const std::string& error() const { return error_; }
+
+private:
+    std::string pattern_;
+    size_t pos_ = 0;
+    std::vector<RegexNode> nodes_;
+    std::string error_;
+
+    int fail(const std::string& message) {
+        if (error_.empty()) {
+            error_ = message + " at offset " + std::to_string(pos_);
+        }
+        return -1;
+    }
+
+    bool atEnd() const { return pos_ >= pattern_.size(); }
+    char peek() const { return pattern_[pos_]; }
+
+    int add(RegexNode node) {
+        nodes_.push_back(std::move(node));
+        return static_cast<int>(nodes_.size()) - 1;
+    }
+
+    int addSet(const ByteSet& set) {
+        RegexNode node;
+        node.type = RegexNode::Set;
+        node.set = set;
+        return add(std::move(node));
+    }
+
+    int parseAlt() {
+        RegexNode alt;
+        alt.type = RegexNode::Alt;
+        int branch = parseConcat();
+        if (branch < 0) return -1;
+        alt.children.push_back(branch);
+        while (!atEnd() && peek() == '|') {
+            ++pos_;
+            branch = parseConcat();
+            if (branch < 0) return -1;
+            alt.children.push_back(branch);
+        }
+        return alt.children.size() == 1 ? alt.children[0] : add(std::move(alt));
+    }
+
+    int parseConcat() {
+        RegexNode concat;
+        concat.type = RegexNode::Concat;
+        while (!atEnd() && peek() != '|' && peek() != ')') {
+            int piece = parseRepeat();
+            if (piece < 0) return -1;
+            concat.children.push_back(piece);
+        }
+        if (concat.children.empty()) {
+            return add(RegexNode{});
+        }
+        return concat.children.size() == 1 ? concat.children[0] : add(std::move(concat));
+    }
+
+    int parseRepeat() {
+        int atom = parseAtom();
+        while (atom >= 0 && !atEnd()) {
+            int min = 0;
+            int max = 0;
+            char c = peek();
+            if (c == '*') {
+                min = 0; max = -1; ++pos_;
+            } else if (c == '+') {
+                min = 1; max = -1; ++pos_;
+            } else if (c == '?') {
+                min = 0; max = 1; ++pos_;
+            } else if (c == '{' && parseBounds(min, max)) {
+                // Bounds consumed
+            } else {
+                break;
+            }
+            if (!error_.empty()) return -1;
+            // Lazy/possessive suffixes do not change a full match
+            if (!atEnd() && (peek() == '?' || peek() == '+')) {
+                ++pos_;
+            }
+            RegexNode repeat;
+            repeat.type = RegexNode::Repeat;
+            repeat.children.push_back(atom);
+            repeat.min = min;
+            repeat.max = max;
+            atom = add(std::move(repeat));
+        }
+        return atom;
+    }
+
+    // {m}, {m,}, {m,n}; anything else leaves '{' as a literal
+    bool parseBounds(int& min, int& max) {
+        size_t p = pos_ + 1;
+        auto number = [&](int& out) {
+            size_t start = p;
+            long value = 0;
+            while (p < pattern_.size() && std::isdigit(static_cast<unsigned char>(pattern_[p]))) {
+                value = std::min<long>(value * 10 + (pattern_[p] - '0'), kMaxRepeat + 1);
+                ++p;
+            }
+            out = static_cast<int>(value);
+            return p > start;
+        };
+        if (!number(min)) return false;
+        max = min;
+        if (p < pattern_.size() && pattern_[p] == ',') {
+            ++p;
+            if (!number(max)) max = -1;
+        }
+        if (p >= pattern_.size() || pattern_[p] != '}') return false;
+        pos_ = p + 1;
+        if (min > kMaxRepeat || max > kMaxRepeat || (max >= 0 && max < min)) {
+            fail("bad repetition bounds");
+        }
+        return true;
+    }
+
+    int parseAtom() {
+        char c = peek();
+        switch (c) {
+        case '(': {
+            ++pos_;
+            if (pattern_.compare(pos_, 2, "?:") == 0) {
+                pos_ += 2;
+            }
+            int inner = parseAlt();
+            if (inner < 0) return -1;
+            if (atEnd() || peek() != ')') return fail("missing ')'");
+            ++pos_;
+            return inner;
+        }
+        case '[': {
+            ByteSet set;
+            if (!parseClass(set)) return -1;
+            return addSet(set);
+        }
+        case '.': {
+            ++pos_;
+            ByteSet set;
+            set.set();
+            set.reset('\n');
+            return addSet(set);
+        }
+        case '\\': {
+            ++pos_;
+            ByteSet set;
+            if (!parseEscape(set)) return -1;
+            return addSet(set);
+        }
+        case '*':
+        case '+':
+        case '?':
+            return fail("nothing to repeat");
+        default: {
+            ++pos_;
+            ByteSet set;
+            set.set(static_cast<unsigned char>(c));
+            return addSet(set);
+        }
+        }
+    }
+
+    // After a backslash; fills `set` with the escaped byte or class
+    bool parseEscape(ByteSet& set) {
+        if (atEnd()) {
+            fail("trailing backslash");
+            return false;
+        }
+        char c = pattern_[pos_++];
+        auto range = [&](char lo, char hi) {
+            for (int b = static_cast<unsigned char>(lo); b <= static_cast<unsigned char>(hi); ++b) {
+                set.set(b);
+            }
+        };
+        switch (c) {
+        case 'd': case 'D':
+            range('0', '9');
+            break;
+        case 'w': case 'W':
+            range('a', 'z'); range('A', 'Z'); range('0', '9'); set.set('_');
+            break;
+        case 's': case 'S':
+            for (char ws : {' ', '\t', '\n', '\r', '\f', '\v'}) set.set(static_cast<unsigned char>(ws));
+            break;
+        case 'n': set.set('\n'); return true;
+        case 't': set.set('\t'); return true;
+        case 'r': set.set('\r'); return true;
+        case 'f': set.set('\f'); return true;
+        case 'v': set.set('\v'); return true;
+        case '0': set.set(0); return true;
+        case 'x': {
+            if (pos_ + 2 > pattern_.size() ||
+                !std::isxdigit(static_cast<unsigned char>(pattern_[pos_])) ||
+                !std::isxdigit(static_cast<unsigned char>(pattern_[pos_ + 1]))) {
+                fail("bad \\x escape");
+                return false;
+            }
+            set.set(std::stoi(pattern_.substr(pos_, 2), nullptr, 16));
+            pos_ += 2;
+            return true;
+        }
+        default:
+            set.set(static_cast<unsigned char>(c));
+            return true;
+        }
+        if (std::isupper(static_cast<unsigned char>(c))) {
+            set.flip();
+        }
+        return true;
+    }
+
+    bool parseClass(ByteSet& set) {
+        ++pos_;  // '['
+        bool negate = false;
+        if (!atEnd() && peek() == '^') {
+            negate = true;
+            ++pos_;
+        }
+        bool first = true;
+        while (!atEnd() && (peek() != ']' || first)) {
+            first = false;
+            ByteSet item;
+            int lo = -1;
+            if (peek() == '\\') {
+                ++pos_;
+                if (!parseEscape(item)) return false;
+                if (item.count() == 1) {
+                    for (int b = 0; b < 256; ++b) {
+                        if (item.test(b)) lo = b;
+                    }
+                }
+            } else {
+                lo = static_cast<unsigned char>(pattern_[pos_++]);
+                item.set(lo);
+            }
+            // Range: lo-hi, unless '-' is the last character of the class
+            if (lo >= 0 && pos_ + 1 < pattern_.size() && peek() == '-' &&
+                pattern_[pos_ + 1] != ']') {
+                ++pos_;
+                ByteSet hiSet;
+                int hi = -1;
+                if (peek() == '\\') {
+                    ++pos_;
+                    if (!parseEscape(hiSet)) return false;
+                    if (hiSet.count() == 1) {
+                        for (int b = 0; b < 256; ++b) {
+                            if (hiSet.test(b)) hi = b;
+                        }
+                    }
+                } else {
+                    hi = static_cast<unsigned char>(pattern_[pos_++]);
+                }
+                if (hi < lo) {
+                    fail("bad class range");
+                    return false;
+                }
+                for (int b = lo; b <= hi; ++b) {
+                    item.set(b);
+                }
+            }
+            set |= item;
+        }
+        if (atEnd()) {
+            fail("missing ']'");
+            return false;
+        }
+        ++pos_;  // ']'
+        if (negate) {
+            set.flip();
+        }
+        return true;
+    }
+};
+
+// ============================================================================
+// AST -> NFA (Thompson) -> DFA (subset construction)
+// ============================================================================
+
+struct NfaState {
+    std::vector<std::pair<ByteSet, int>> edges;
+    std::vector<int> epsilon;
+};
+
+class NfaBuilder {
+public:
+    explicit NfaBuilder(const std::vector<RegexNode>& nodes) : nodes_(nodes) {}
+
+    int add() {
+        states.emplace_back();
+        return static_cast<int>(states.size()) - 1;
+    }
+
+    // Wires node between `in` and `out`; false if the NFA grows too large
+    bool compile(int node, int in, int out) {
+        if (states.size() > kMaxNfaStates) {
+            return false;
+        }
+        const RegexNode& n = nodes_[node];
+        switch (n.type) {
+        case RegexNode::Empty:
+            states[in].epsilon.push_back(out);
+            return true;
+        case RegexNode::Set:
+            states[in].edges.emplace_back(n.set, out);
+            return true;
+        case RegexNode::Alt:
+            for (int child : n.children) {
+                if (!compile(child, in, out)) return false;
+            }
+            return true;
+        case RegexNode::Concat: {
+            int cur = in;
+            for (size_t i = 0; i + 1 < n.children.size(); ++i) {
+                int next = add();
+                if (!compile(n.children[i], cur, next)) return false;
+                cur = next;
+            }
+            return compile(n.children.back(), cur, out);
+        }
+        case RegexNode::Repeat: {
+            const int child = n.children[0];
+            int cur = in;
+            for (int k = 0; k < n.min; ++k) {
+                int next = add();
+                if (!compile(child, cur, next)) return false;
+                cur = next;
+            }
+            if (n.max < 0) {
+                int loop = add();
+                int back = add();
+                states[cur].epsilon.push_back(loop);
+                if (!compile(child, loop, back)) return false;
+                states[back].epsilon.push_back(loop);
+                states[loop].epsilon.push_back(out);
+                return true;
+            }
+            for (int k = n.min; k < n.max; ++k) {
+                states[cur].epsilon.push_back(out);
+                int next = add();
+                if (!compile(child, cur, next)) return false;
+                cur = next;
+            }
+            states[cur].epsilon.push_back(out);
+            return true;
+        }
+        }
+        return false;
+    }
+
+    std::vector<NfaState> states;
+
+private:
+    const std::vector<RegexNode>& nodes_;
+};
+
+void epsilonClosure(const std::vector<NfaState>& nfa, std::vector<int>& set) {
+    std::vector<uint8_t> seen(nfa.size(), 0);
+    std::vector<int> stack(set.begin(), set.end());
+    set.clear();
+    while (!stack.empty()) {
+        int s = stack.back();
+        stack.pop_back();
+        if (seen[s]) continue;
+        seen[s] = 1;
+        set.push_back(s);
+        for (int t : nfa[s].epsilon) {
+            stack.push_back(t);
+        }
+    }
+    std::sort(set.begin(), set.end());
+}
+
+// ============================================================================
+// JSON schema -> regex
+// ============================================================================
+
+struct JsonValue {
+    enum Type { Null, Bool, Number, String, Array, Object } type = Null;
+    bool boolean = false;
+    std::string text;    // String contents, or a number's literal spelling
+    std::vector<JsonValue> items;
+    std::vector<std::pair<std::string, JsonValue>> members;
+
+    const JsonValue* find(const std::string& key) const {
+        for (const auto& member : members) {
+            if (member.first == key) return &member.second;
+        }
+        return nullptr;
+    }
+};
+
+class JsonReader {
+public:
+    explicit JsonReader(const std::string& text) : text_(text) {}
+
+    bool parse(JsonValue& value) {
+        return parseValue(value, 0) && (skipSpace(), pos_ == text_.size());
+    }
+
+private:
+    const std::string& text_;
+    size_t pos_ = 0;
+
+    void skipSpace() {
+        while (pos_ < text_.size() && std::isspace(static_cast<unsigned char>(text_[pos_]))) {
+            ++pos_;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (pos_ < text_.size() && text_[pos_] == c) {
+            ++pos_;
+            return true;
+        }
+        return false;
+    }
+
+    bool literal(const char* word) {
+        size_t len = std::strlen(word);
+        if (text_.compare(pos_, len, word) != 0) return false;
+        pos_ += len;
+        return true;
+    }
+
+    bool parseValue(JsonValue& value, int depth) {
+        if (depth > kMaxSchemaDepth) return false;
+        skipSpace();
+        if (pos_ >= text_.size()) return false;
+        char c = text_[pos_];
+        if (c == '{') {
+            ++pos_;
+            value.type = JsonValue::Object;
+            if (consume('}')) return true;
+            do {
+                std::string key;
+                skipSpace();
+                if (!parseString(key) || !consume(':')) return false;
+                value.members.emplace_back(std::move(key), JsonValue{});
+                if (!parseValue(value.members.back().second, depth + 1)) return false;
+            } while (consume(','));
+            return consume('}');
+        }
+        if (c == '[') {
+            ++pos_;
+            value.type = JsonValue::Array;
+            if (consume(']')) return true;
+            do {
+                value.items.emplace_back();
+                if (!parseValue(value.items.back(), depth + 1)) return false;
+            } while (consume(','));
+            return consume(']');
+        }
+        if (c == '"') {
+            value.type = JsonValue::String;
+            return parseString(value.text);
+        }
+        if (literal("true")) { value.type = JsonValue::Bool; value.boolean = true; return true; }
+        if (literal("false")) { value.type = JsonValue::Bool; return true; }
+        if (literal("null")) { value.type = JsonValue::Null; return true; }
+        size_t start = pos_;
+        while (pos_ < text_.size() && std::strchr("+-0123456789.eE", text_[pos_])) {
+            ++pos_;
+        }
+        if (pos_ == start) return false;
+        value.type = JsonValue::Number;
+        value.text = text_.substr(start, pos_ - start);
+        return true;
+    }
+
+    bool parseString(std::string& out) {
+        if (pos_ >= text_.size() || text_[pos_] != '"') return false;
+        ++pos_;
+        while (pos_ < text_.size() && text_[pos_] != '"') {
+            char c = text_[pos_++];
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (pos_ >= text_.size()) return false;
+            char e = text_[pos_++];
+            switch (e) {
+            case 'b': out.push_back('\b'); break;
+            case 'f': out.push_back('\f'); break;
+            case 'n': out.push_back('\n'); break;
+            case 'r': out.push_back('\r'); break;
+            case 't': out.push_back('\t'); break;
+            case 'u': {
+                if (pos_ + 4 > text_.size() ||
+                    !std::all_of(text_.begin() + pos_, text_.begin() + pos_ + 4,
+                                 [](char h) { return std::isxdigit(static_cast<unsigned char>(h)); })) {
+                    return false;
+                }
+                unsigned code = std::stoul(text_.substr(pos_, 4), nullptr, 16);
+                pos_ += 4;
+                // BMP only; encode as UTF-8
+                if (code < 0x80) {
+                    out.push_back(static_cast<char>(code));
+                } else if (code < 0x800) {
+                    out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                } else {
+                    out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                    out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                    out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                }
+                break;
+            }
+            default: out.push_back(e); break;
+            }
+        }
+        if (pos_ >= text_.size()) return false;
+        ++pos_;  // Closing quote
+        return true;
+    }
+};
+
+std::string regexEscape(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (std::strchr("\\.[](){}*+?|^$", c)) {
+            out.push_back('\\');
+        }
+        out.push_back(c);
+    }
+    return out;
+}
+
+// Compact JSON spelling of a literal (enum / const members)
+std::string jsonLiteral(const JsonValue& value) {
+    switch (value.type) {
+    case JsonValue::Null: return "null";
+    case JsonValue::Bool: return value.boolean ? "true" : "false";
+    case JsonValue::Number: return value.text;
+    case JsonValue::String: {
+        std::string out = "\"";
+        for (char c : value.text) {
+            if (c == '"' || c == '\\') out.push_back('\\');
+            out.push_back(c);
+        }
+        return out + "\"";
+    }
+    case JsonValue::Array: {
+        std::string out = "[";
+        for (size_t i = 0; i < value.items.size(); ++i) {
+            out += (i ? "," : "") + jsonLiteral(value.items[i]);
+        }
+        return out + "]";
+    }
+    case JsonValue::Object: {
+        std::string out = "{";
+        for (size_t i = 0; i < value.members.size(); ++i) {
+            JsonValue key;
+            key.type = JsonValue::String;
+            key.text = value.members[i].first;
+            out += (i ? "," : "") + jsonLiteral(key) + ":" + jsonLiteral(value.members[i].second);
+        }
+        return out + "}";
+    }
+    }
+    return "";
+}
+
+// Optional single space around punctuation: enough for natural output
+// without letting the model pad forever
+const char* const kWs = " ?";
+const char* const kJsonChar = "([^\"\\\\\\x00-\\x1f]|\\\\[\"\\\\/bfnrt])";
+
+bool schemaToRegex(const JsonValue& schema, std::string& out,
+                   std::string& error, int depth);
+
+bool alternatives(const std::vector<JsonValue>& schemas, std::string& out,
+                  std::string& error, int depth) {
+    out += "(";
+    for (size_t i = 0; i < schemas.size(); ++i) {
+        if (i) out += "|";
+        if (!schemaToRegex(schemas[i], out, error, depth + 1)) return false;
+    }
+    out += ")";
+    return true;
+}
+
+bool objectToRegex(const JsonValue& schema, std::string& out,
+                   std::string& error, int depth) {
+    const JsonValue* properties = schema.find("properties");
+    if (!properties || properties->members.empty()) {
+        out += std::string("\\{") + kWs + "\\}";
+        return true;
+    }
+    const JsonValue* required = schema.find("required");
+    auto isRequired = [&](const std::string& name) {
+        if (!required) return true;   // No list: every property is emitted
+        for (const auto& item : required->items) {
+            if (item.type == JsonValue::String && item.text == name) return true;
+        }
+        return false;
+    };
+
+    std::vector<std::string> mandatory;
+    std::vector<std::string> optional;
+    for (const auto& member : properties->members) {
+        std::string property = "\"" + regexEscape(member.first) + "\"" + kWs + ":" + kWs;
+        if (!schemaToRegex(member.second, property, error, depth + 1)) return false;
+        (isRequired(member.first) ? mandatory : optional).push_back(std::move(property));
+    }
+
+    // Required properties first, in declaration order, then each optional
+    // one may follow; with nothing required any property may lead
+    const std::string comma = std::string(kWs) + "," + kWs;
+    out += std::string("\\{") + kWs;
+    if (!mandatory.empty()) {
+        for (size_t i = 0; i < mandatory.size(); ++i) {
+            out += (i ? comma : "") + mandatory[i];
+        }
+        for (const auto& property : optional) {
+            out += "(" + comma + property + ")?";
+        }
+    } else {
+        out += "(";
+        for (size_t i = 0; i < optional.size(); ++i) {
+            out += (i ? "|" : "") + optional[i];
+            for (size_t j = i + 1; j < optional.size(); ++j) {
+                out += "(" + comma + optional[j] + ")?";
+            }
+        }
+        out += ")?";
+    }
+    out += std::string(kWs) + "\\}";
+    return true;
+}
+
+bool typeToRegex(const std::string& type, const JsonValue& schema,
+                 std::string& out, std::string& error, int depth) {
+    if (type == "string") {
+        if (const JsonValue* pattern = schema.find("pattern")) {
+            std::string body = pattern->text;
+            if (!body.empty() && body.front() == '^') body.erase(0, 1);
+            if (!body.empty() && body.back() == '$') body.pop_back();
+            out += "\"(" + body + ")\"";
+            return true;
+        }
+        const JsonValue* minLength = schema.find("minLength");
+        const JsonValue* maxLength = schema.find("maxLength");
+        out += std::string("\"") + kJsonChar;
+        if (minLength || maxLength) {
+            out += "{" + (minLength ? minLength->text : "0") + "," +
+                   (maxLength ? maxLength->text : "") + "}";
+        } else {
+            out += "*";
+        }
+        out += "\"";
+        return true;
+    }
+    if (type == "integer") {
+        out += "-?(0|[1-9][0-9]*)";
+        return true;
+    }
+    if (type == "number") {
+        out += "-?(0|[1-9][0-9]*)(\\.[0-9]+)?([eE][+-]?[0-9]+)?";
+        return true;
+    }
+    if (type == "boolean") {
+        out += "(true|false)";
+        return true;
+    }
+    if (type == "null") {
+        out += "null";
+        return true;
+    }
+    if (type == "array") {
+        const JsonValue* items = schema.find("items");
+        if (!items) {
+            error = "array schema without \"items\" is not supported";
+            return false;
+        }
+        std::string item;
+        if (!schemaToRegex(*items, item, error, depth + 1)) return false;
+        out += std::string("\\[") + kWs + "(" + item + "(" + kWs + "," + kWs +
+               item + ")*)?" + kWs + "\\]";
+        return true;
+    }
+    if (type == "object") {
+        return objectToRegex(schema, out, error, depth);
+    }
+    error = "unsupported type \"" + type + "\"";
+    return false;
+}
+
+bool schemaToRegex(const JsonValue& schema, std::string& out,
+                   std::string& error, int depth) {
+    if (depth > kMaxSchemaDepth) {
+        error = "schema nested too deeply";
+        return false;
+    }
+    if (schema.type != JsonValue::Object) {
+        error = "schema must be an object";
+        return false;
+    }
+    if (schema.find("$ref")) {
+        error = "recursive schemas ($ref) are not supported";
+        return false;
+    }
+    if (const JsonValue* constant = schema.find("const")) {
+        out += regexEscape(jsonLiteral(*constant));
+        return true;
+    }
+    if (const JsonValue* values = schema.find("enum")) {
+        out += "(";
+        for (size_t i = 0; i < values->items.size(); ++i) {
+            out += (i ? "|" : "") + regexEscape(jsonLiteral(values->items[i]));
+        }
+        out += ")";
+        return true;
+    }
+    for (const char* key : {"anyOf", "oneOf"}) {
+        if (const JsonValue* options = schema.find(key)) {
+            return alternatives(options->items, out, error, depth);
+        }
+    }
+    const JsonValue* type = schema.find("type");
+    if (!type) {
+        error = "schema without \"type\" (any JSON value) is not regular";
+        return false;
+    }
+    if (type->type == JsonValue::Array) {
+        out += "(";
+        for (size_t i = 0; i < type->items.size(); ++i) {
+            if (i) out += "|";
+            if (!typeToRegex(type->items[i].text, schema, out, error, depth)) return false;
+        }
+        out += ")";
+        return true;
+    }
+    return typeToRegex(type->text, schema, out, error, depth);
+}
+
+}  // namespace
+
+// ============================================================================
+// TokenVocabulary
+// ============================================================================
+
+TokenVocabulary::TokenVocabulary(std::vector<std::string> tokens, int32_t eosTokenId)
+    : tokens_(std::move(tokens)), eosTokenId_(eosTokenId) {
+    trie_.emplace_back();
+    for (size_t id = 0; id < tokens_.size(); ++id) {
+        int32_t node = 0;
+        for (unsigned char byte : tokens_[id]) {
+            auto& children = trie_[node].children;
+            auto it = std::lower_bound(
+                children.begin(), children.end(), byte,
+                [](const std::pair<uint8_t, int32_t>& child, unsigned char b) {
+                    return child.first < b;
+                });
+            if (it != children.end() && it->first == byte) {
+                node = it->second;
+                continue;
+            }
+            int32_t child = static_cast<int32_t>(trie_.size());
+            children.insert(it, {byte, child});
+            trie_.emplace_back();   // Invalidates `children`; not used again
+            node = child;
+        }
+        trie_[node].tokens.push_back(static_cast<int32_t>(id));
+    }
+}
+
+std::shared_ptr<const TokenVocabulary> TokenVocabulary::fromTokenizer(Tokenizer& tokenizer) {
+    std::vector<std::string> tokens(tokenizer.getVocabSize());
+    for (size_t id = 0; id < tokens.size(); ++id) {
+        tokens[id] = tokenizer.decode({static_cast<int32_t>(id)});
+    }
+    return std::make_shared<TokenVocabulary>(std::move(tokens), tokenizer.getEosTokenId());
+}
+
+size_t TokenVocabulary::size() const {
+    return tokens_.size();
+}
+
+const std::string& TokenVocabulary::token(int32_t id) const {
+    return tokens_.at(id);
+}
+
+int32_t TokenVocabulary::getEosTokenId() const {
+    return eosTokenId_;
+}
+
+// ============================================================================
+// TokenAutomaton
+// ============================================================================
+
+std::shared_ptr<const TokenAutomaton> TokenAutomaton::fromRegex(
+    const std::string& pattern,
+    std::shared_ptr<const TokenVocabulary> vocabulary,
+    std::string* error) {
+    return build(pattern, std::move(vocabulary), error);
+}
+
+std::shared_ptr<const TokenAutomaton> TokenAutomaton::fromJsonSchema(
+    const std::string& schema,
+    std::shared_ptr<const TokenVocabulary> vocabulary,
+    std::string* error) {
+    JsonValue root;
+    if (!JsonReader(schema).parse(root)) {
+        if (error) *error = "malformed JSON schema";
+        return nullptr;
+    }
+    std::string pattern;
+    std::string message;
+    if (!schemaToRegex(root, pattern, message, 0)) {
+        if (error) *error = message;
+        return nullptr;
+    }
+    return build(pattern, std::move(vocabulary), error);
+}
+
+std::shared_ptr<const TokenAutomaton> TokenAutomaton::build(
+    const std::string& pattern,
+    std::shared_ptr<const TokenVocabulary> vocabulary,
+    std::string* error) {
+    auto failWith = [&](const std::string& message) {
+        if (error) *error = message;
+        return std::shared_ptr<const TokenAutomaton>();
+    };
+    if (!vocabulary) {
+        return failWith("no vocabulary");
+    }
+
+    RegexParser parser(pattern);
+    int root = parser.parse();
+    if (root < 0) {
+        return failWith("bad pattern: " + parser.error());
+    }
+
+    NfaBuilder nfa(parser.nodes());
+    const int nfaStart = nfa.add();
+    const int nfaAccept = nfa.add();
+    if (!nfa.compile(root, nfaStart, nfaAccept)) {
+        return failWith("pattern too large");
+    }
+
+    // Subset construction over bytes; the empty set is the implicit dead state
+    std::shared_ptr<TokenAutomaton> automaton(new TokenAutomaton());
+    std::map<std::vector<int>, int32_t> ids;
+    std::vector<std::vector<int>> subsets;
+    std::vector<int> start{nfaStart};
+    epsilonClosure(nfa.states, start);
+    ids.emplace(start, 0);
+    subsets.push_back(std::move(start));
+
+    for (size_t d = 0; d < subsets.size(); ++d) {
+        std::array<int32_t, 256> row;
+        row.fill(kDeadState);
+        std::array<std::vector<int>, 256> targets;
+        for (int s : subsets[d]) {
+            for (const auto& edge : nfa.states[s].edges) {
+                for (int b = 0; b < 256; ++b) {
+                    if (edge.first.test(b)) targets[b].push_back(edge.second);
+                }
+            }
+        }
+        // Bytes usually fall into a few classes with equal targets: close
+        // each distinct target set once
+        std::map<std::vector<int>, std::vector<int>> closures;
+        for (int b = 0; b < 256; ++b) {
+            if (targets[b].empty()) continue;
+            std::sort(targets[b].begin(), targets[b].end());
+            targets[b].erase(std::unique(targets[b].begin(), targets[b].end()), targets[b].end());
+            auto closed = closures.find(targets[b]);
+            if (closed == closures.end()) {
+                std::vector<int> closure = targets[b];
+                epsilonClosure(nfa.states, closure);
+                closed = closures.emplace(targets[b], std::move(closure)).first;
+            }
+            targets[b] = closed->second;
+            auto it = ids.find(targets[b]);
+            if (it == ids.end()) {
+                if (subsets.size() >= kMaxDfaStates) {
+                    return failWith("constraint too large (DFA state limit)");
+                }
+                it = ids.emplace(targets[b], static_cast<int32_t>(subsets.size())).first;
+                subsets.push_back(targets[b]);
+            }
+            row[b] = it->second;
+        }
+        automaton->transitions_.push_back(row);
+        automaton->accepting_.push_back(
+            std::binary_search(subsets[d].begin(), subsets[d].end(), nfaAccept) ? 1 : 0);
+    }
+
+    // Live states can still reach acceptance; edges into the rest are cut,
+    // so any state a token walk ends in is on a path to a match
+    const size_t numStates = automaton->transitions_.size();
+    std::vector<std::vector<int32_t>> reverse(numStates);
+    for (size_t s = 0; s < numStates; ++s) {
+        for (int32_t t : automaton->transitions_[s]) {
+            if (t >= 0) reverse[t].push_back(static_cast<int32_t>(s));
+        }
+    }
+    automaton->live_.assign(numStates, 0);
+    std::vector<int32_t> stack;
+    for (size_t s = 0; s < numStates; ++s) {
+        if (automaton->accepting_[s]) {
+            automaton->live_[s] = 1;
+            stack.push_back(static_cast<int32_t>(s));
+        }
+    }
+    while (!stack.empty()) {
+        int32_t s = stack.back();
+        stack.pop_back();
+        for (int32_t p : reverse[s]) {
+            if (!automaton->live_[p]) {
+                automaton->live_[p] = 1;
+                stack.push_back(p);
+            }
+        }
+    }
+    if (!automaton->live_[0]) {
+        return failWith("pattern matches nothing");
+    }
+    for (auto& row : automaton->transitions_) {
+        for (auto& t : row) {
+            if (t >= 0 && !automaton->live_[t]) t = kDeadState;
+        }
+    }
+
+    automaton->vocabulary_ = std::move(vocabulary);
+    automaton->maskWords_ = (automaton->vocabulary_->size() + 63) / 64;
+    automaton->emptyMask_.reset(new uint64_t[automaton->maskWords_]());
+    automaton->masks_.reset(new std::atomic<const uint64_t*>[numStates]);
+    for (size_t s = 0; s < numStates; ++s) {
+        automaton->masks_[s].store(nullptr, std::memory_order_relaxed);
+    }
+    return automaton;
+}
+
+size_t TokenAutomaton::vocabSize() const {
+    return vocabulary_->size();
+}
+
+const uint64_t* TokenAutomaton::allowedTokens(int state) const {
+    if (state < 0 || static_cast<size_t>(state) >= numStates()) {
+        return emptyMask_.get();
+    }
+    const uint64_t* mask = masks_[state].load(std::memory_order_acquire);
+    return mask ? mask : buildMask(state);
+}
+
+const uint64_t* TokenAutomaton::buildMask(int state) const {
+    std::lock_guard<std::mutex> lock(maskMutex_);
+    if (const uint64_t* mask = masks_[state].load(std::memory_order_acquire)) {
+        return mask;  // Built by another thread meanwhile
+    }
+
+    std::unique_ptr<uint64_t[]> mask(new uint64_t[maskWords_]());
+    const auto& trie = vocabulary_->trie_;
+
+    // Walk the vocabulary trie and the DFA together: a subtree is skipped as
+    // soon as its prefix falls off the DFA. Tokens with empty text (root)
+    // would not advance the output and stay masked.
+    std::vector<std::pair<int32_t, int32_t>> stack;   // (trie node, DFA state)
+    for (const auto& child : trie[0].children) {
+        int32_t next = transitions_[state][child.first];
+        if (next >= 0) stack.emplace_back(child.second, next);
+    }
+    while (!stack.empty()) {
+        auto [node, dfa] = stack.back();
+        stack.pop_back();
+        for (int32_t token : trie[node].tokens) {
+            mask[token >> 6] |= uint64_t(1) << (token & 63);
+        }
+        for (const auto& child : trie[node].children) {
+            int32_t next = transitions_[dfa][child.first];
+            if (next >= 0) stack.emplace_back(child.second, next);
+        }
+    }
+
+    // EOS ends the output: allowed exactly where the output is a match
+    const int32_t eos = vocabulary_->getEosTokenId();
+    if (eos >= 0 && static_cast<size_t>(eos) < vocabSize()) {
+        const uint64_t bit = uint64_t(1) << (eos & 63);
+        mask[eos >> 6] = accepting_[state] ? (mask[eos >> 6] | bit) : (mask[eos >> 6] & ~bit);
+    }
+
+    const uint64_t* published = mask.get();
+    maskStorage_.push_back(std::move(mask));
+    masks_[state].store(published, std::memory_order_release);
+    return published;
+}
+
+int TokenAutomaton::advance(int state, int32_t token) const {
+    if (state < 0 || static_cast<size_t>(state) >= numStates() ||
+        token < 0 || static_cast<size_t>(token) >= vocabSize()) {
+        return kDeadState;
+    }
+    if (token == vocabulary_->getEosTokenId()) {
+        return accepting_[state] ? kDoneState : kDeadState;
+    }
+    const std::string& text = vocabulary_->token(token);
+    if (text.empty()) {
+        return kDeadState;
+    }
+    int32_t s = state;
+    for (unsigned char byte : text) {
+        s = transitions_[s][byte];
+        if (s < 0) return kDeadState;
+    }
+    return s;
+}
+
+bool TokenAutomaton::isAccepting(int state) const {
+    return state == kDoneState ||
+           (state >= 0 && static_cast<size_t>(state) < numStates() && accepting_[state]);
+}
+
+bool TokenAutomaton::isComplete(int state) const {
+    if (state == kDoneState) {
+        return true;
+    }
+    if (!isAccepting(state)) {
+        return false;
+    }
+    // Accepting with nothing but EOS left: the output cannot grow
+    const uint64_t* mask = allowedTokens(state);
+    const int32_t eos = vocabulary_->getEosTokenId();
+    for (size_t w = 0; w < maskWords_; ++w) {
+        uint64_t word = mask[w];
+        if (eos >= 0 && static_cast<size_t>(eos >> 6) == w) {
+            word &= ~(uint64_t(1) << (eos & 63));
+        }
+        if (word) return false;
+    }
+    return true;
+}
+
+// ============================================================================
+// ConstraintCache
+// ============================================================================
+
+ConstraintCache& ConstraintCache::global() {
+    static ConstraintCache cache;
+    return cache;
+}
+
+std::shared_ptr<const TokenAutomaton> ConstraintCache::compile(
+    const ConstraintSpec& spec,
+    const std::shared_ptr<const TokenVocabulary>& vocabulary) {
+    const size_t key = std::hash<std::string>()(spec.source) ^
+                       (static_cast<size_t>(spec.kind) * 0x9e3779b97f4a7c15ULL) ^
+                       std::hash<const void*>()(vocabulary.get());
+    auto lookup = [&]() -> std::shared_ptr<const TokenAutomaton> {
+        auto it = index_.find(key);
+        if (it == index_.end()) return nullptr;
+        for (auto entry : it->second) {
+            if (entry->vocabulary == vocabulary.get() && entry->spec.kind == spec.kind &&
+                entry->spec.source == spec.source) {
+                lru_.splice(lru_.begin(), lru_, entry);     // Iterators stay valid
+                return entry->automaton;
+            }
+        }
+        return nullptr;
+    };
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        if (auto hit = lookup()) return hit;
+    }
+
+    // Compile outside the lock; a racing compile of the same spec loses
+    std::string error;
+    auto automaton = spec.kind == ConstraintKind::JsonSchema
+        ? TokenAutomaton::fromJsonSchema(spec.source, vocabulary, &error)
+        : TokenAutomaton::fromRegex(spec.source, vocabulary, &error);
+    if (!automaton) {
+        std::cerr << "[ConstraintCache] Compile failed: " << error << std::endl;
+        return nullptr;
+    }
+
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (auto hit = lookup()) return hit;
+    // The automaton keeps the vocabulary alive, so its address stays unique
+    lru_.push_front({key, spec, vocabulary.get(), vocabulary, automaton});
+    index_[key].push_back(lru_.begin());
+    trimLocked();
+    return automaton;
+}
+
+void ConstraintCache::setCapacity(size_t maxEntries) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = std::max<size_t>(1, maxEntries);
+    trimLocked();
+}
+
+size_t ConstraintCache::getCapacity() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return capacity_;
+}
+
+size_t ConstraintCache::evictVocabulary(const TokenVocabulary* vocabulary) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    size_t evicted = 0;
+    for (auto it = lru_.begin(); it != lru_.end();) {
+        auto next = std::next(it);
+        if (it->vocabulary == vocabulary) {
+            eraseLocked(it);
+            evicted++;
+        }
+        it = next;
+    }
+    return evicted;
+}
+
+size_t ConstraintCache::evictUnusedVocabularies() {
+    std::lock_guard<std::mutex> lock(mutex_);
+
+    // Each cached automaton holds one reference to its vocabulary; any
+    // reference beyond those, or an automaton a request still holds, keeps
+    // the vocabulary's entries
+    std::unordered_map<const TokenVocabulary*, long> cachedRefs;
+    std::unordered_map<const TokenVocabulary*, bool> inUse;
+    for (const auto& entry : lru_) {
+        cachedRefs[entry.vocabulary]++;
+        inUse[entry.vocabulary] = inUse[entry.vocabulary] || entry.automaton.use_count() > 1;
+    }
+    size_t evicted = 0;
+    for (auto it = lru_.begin(); it != lru_.end();) {
+        auto next = std::next(it);
+        const TokenVocabulary* vocabulary = it->vocabulary;
+        if (!inUse[vocabulary] && it->vocabularyRef.use_count() <= cachedRefs[vocabulary]) {
+            eraseLocked(it);
+            evicted++;
+        }
+        it = next;
+    }
+    return evicted;
+}
+
+size_t ConstraintCache::size() const {
+    std::lock_guard<std::mutex> lock(mutex_);
+    return lru_.size();
+}
+
+void ConstraintCache::clear() {
+    std::lock_guard<std::mutex> lock(mutex_);
+    index_.clear();
+    lru_.clear();
+}
+
+void ConstraintCache::eraseLocked(std::list<Entry>::iterator it) {
+    auto bucket = index_.find(it->key);
+    if (bucket != index_.end()) {
+        auto& entries = bucket->second;
+        entries.erase(std::remove(entries.begin(), entries.end(), it), entries.end());
+        if (entries.empty()) {
+            index_.erase(bucket);
+        }
+    }
+    lru_.erase(it);
+}
+
+void ConstraintCache::trimLocked() {
+    while (lru_.size() > capacity_) {
+        eraseLocked(std::prev(lru_.end()));
+    }
+}
+
+}  // namespace cortexstream
@@ -0,0 +1,388 @@
+#include "cortexstream/lora.h"
+#include "cortexstream/half.h"
+#include "cortexstream/trace.h"
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+
+namespace cortexstream {
+
+namespace {
+
+// Output columns per thread in the expand step
+constexpr int64_t kExpandChunk = 256;
+
+// Below this many multiply-adds the thread fork costs more than it saves
+constexpr int64_t kParallelWork = 1 << 16;
+
+float elementAt(const WeightTensor& tensor, int64_t index) {
+    switch (tensor.dtype) {
+        case WeightDType::F32: {
+            float v;
+            std::memcpy(&v, tensor.data + index * sizeof(float), sizeof(v));
+            return v;
+        }
+        case WeightDType::F16:
+        case WeightDType::BF16: {
+            uint16_t h;
+            std::memcpy(&h, tensor.data + index * sizeof(uint16_t), sizeof(h));
+            return tensor.dtype == WeightDType::F16 ? halfToFloat(h) : bfloat16ToFloat(h);
+        }
+        default:
+            return 0.0f;
+    }
+}
+
+bool isFloatTensor(const WeightTensor& tensor) {
+    return tensor.shape.size() == 2 &&
+           (tensor.dtype == WeightDType::F32 || tensor.dtype == WeightDType::F16 ||
+            tensor.dtype == WeightDType::BF16);
+}
+
+// lora_alpha / r from adapter_config.json beside the weights; 1 if absent
+float readScale(const std::string& path) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+    fs::path dir = fs::is_directory(path, ec) ? fs::path(path) : fs::path(path).parent_path();
+    std::ifstream in(dir / "adapter_config.json");
+    if (!in) {
+        return 1.0f;
+    }
+    std::stringstream json;
+    json << in.rdbuf();
+    std::unordered_map<std::string, std::string> fields;
+    if (!parseJsonFields(json.str(), fields) || !fields.count("r") || !fields.count("lora_alpha")) {
+        return 1.0f;
+    }
+    float rank = std::strtof(fields["r"].c_str(), nullptr);
+    float alpha = std::strtof(fields["lora_alpha"].c_str(), nullptr);
+    return rank > 0.0f ? alpha / rank : 1.0f;
+}
+
+}  // namespace
+
+// ============================================================================
+// LoRAAdapter
+// ============================================================================
+
+std::string LoRAAdapter::baseNameOf(const std::string& tensorName, bool& isA) {
+    // PEFT: base_model.model.<base>.lora_A.weight -> <base>.weight
+    static const std::string kPrefix = "base_model.model.";
+    static const std::string kA = ".lora_A.weight";
+    static const std::string kB = ".lora_B.weight";
+    auto endsWith = [&](const std::string& suffix) {
+        return tensorName.size() > suffix.size() &&
+               tensorName.compare(tensorName.size() - suffix.size(), suffix.size(), suffix) == 0;
+    };
+    isA = endsWith(kA);
+    if (!isA && !endsWith(kB)) {
+        return "";
+    }
+    std::string stem = tensorName.substr(0, tensorName.size() - kA.size());
+    if (stem.compare(0, kPrefix.size(), kPrefix) == 0) {
+        stem = stem.substr(kPrefix.size());
+    }
+    return stem + ".weight";
+}
+
+std::shared_ptr<LoRAAdapter> LoRAAdapter::open(
+        const std::string& adapterId, const std::string& path,
+        const std::unordered_map<std::string, LinearWeight>& baseWeights) {
+    auto store = WeightStore::open(path);
+    if (!store) {
+        return nullptr;
+    }
+
+    std::shared_ptr<LoRAAdapter> adapter(new LoRAAdapter());
+    adapter->id_ = adapterId;
+    adapter->scale_ = readScale(path);
+    for (const auto& tensor : store->tensors()) {
+        bool isA = false;
+        std::string base = baseNameOf(tensor.name, isA);
+        if (base.empty()) {
+            continue;
+        }
+        auto baseIt = baseWeights.find(base);
+        if (baseIt == baseWeights.end() || !isFloatTensor(tensor)) {
+            std::cerr << "[LoRA] " << adapterId << ": no base projection for " << tensor.name
+                      << std::endl;
+            return nullptr;
+        }
+        Target& target = adapter->targets_[base];
+        target.inFeatures = baseIt->second.inFeatures;
+        target.outFeatures = baseIt->second.outFeatures;
+        (isA ? target.a : target.b) = &tensor;
+    }
+
+    for (auto& [name, target] : adapter->targets_) {
+        bool valid = target.a && target.b &&
+                     target.a->shape[1] == target.inFeatures &&
+                     target.b->shape[0] == target.outFeatures &&
+                     target.a->shape[0] == target.b->shape[1] && target.a->shape[0] > 0;
+        if (!valid) {
+            std::cerr << "[LoRA] " << adapterId << ": factors of " << name
+                      << " do not match the base projection" << std::endl;
+            return nullptr;
+        }
+        target.rank = target.a->shape[0];
+    }
+    if (adapter->targets_.empty()) {
+        std::cerr << "[LoRA] " << adapterId << ": no LoRA factors in " << path << std::endl;
+        return nullptr;
+    }
+    adapter->store_ = std::move(store);
+    return adapter;
+}
+
+size_t LoRAAdapter::numPages() const {
+    size_t pages = 0;
+    for (const auto& entry : targets_) {
+        pages += 2 * static_cast<size_t>(entry.second.rank);
+    }
+    return pages;
+}
+
+// ============================================================================
+// AdapterCache
+// ============================================================================
+
+AdapterCache::AdapterCache(size_t numPages, size_t pageFloats)
+    : pageFloats_(std::max<size_t>(1, pageFloats)),
+      arena_(numPages * std::max<size_t>(1, pageFloats), 0.0f),
+      slots_(numPages) {
+    freePages_.reserve(numPages);
+    for (size_t i = numPages; i > 0; --i) {
+        freePages_.push_back(static_cast<int>(i - 1));
+    }
+    stats_.totalPages = numPages;
+}
+
+int AdapterCache::acquire(const std::shared_ptr<const LoRAAdapter>& adapter) {
+    CORTEX_TRACE_SCOPE("lora.acquire");
+    if (!adapter) {
+        return -1;
+    }
+    std::lock_guard<std::mutex> guard(mutex_);
+
+    auto it = byId_.find(adapter->id());
+    if (it != byId_.end() && slots_[it->second].adapter == adapter) {
+        Slot& slot = slots_[it->second];
+        slot.pins++;
+        slot.lastUse = ++clock_;
+        stats_.hits++;
+        return it->second;
+    }
+    if (it != byId_.end()) {
+        slots_[it->second].retired = true;  // Re-registered: the old copy goes
+        if (slots_[it->second].pins == 0) {
+            freeSlotLocked(it->second);
+        }
+        byId_.erase(adapter->id());
+    }
+
+    // Make room: pages for every row, and a slot
+    const size_t pages = adapter->numPages();
+    auto freeSlot = std::find_if(slots_.begin(), slots_.end(),
+                                 [](const Slot& slot) { return !slot.adapter; });
+    while ((freePages_.size() < pages || freeSlot == slots_.end()) && evictOneLocked()) {
+        freeSlot = std::find_if(slots_.begin(), slots_.end(),
+                                [](const Slot& slot) { return !slot.adapter; });
+    }
+    if (freePages_.size() < pages || freeSlot == slots_.end()) {
+        return -1;
+    }
+
+    Slot& slot = *freeSlot;
+    slot.adapter = adapter;
+    if (!pageInLocked(slot)) {
+        freeSlotLocked(static_cast<int>(freeSlot - slots_.begin()));
+        return -1;
+    }
+    slot.pins = 1;
+    slot.retired = false;
+    slot.lastUse = ++clock_;
+    stats_.misses++;
+    int index = static_cast<int>(freeSlot - slots_.begin());
+    byId_[adapter->id()] = index;
+    return index;
+}
+
+void AdapterCache::release(int slot) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    if (slot < 0 || static_cast<size_t>(slot) >= slots_.size() || slots_[slot].pins == 0) {
+        return;
+    }
+    if (--slots_[slot].pins == 0 && slots_[slot].retired) {
+        freeSlotLocked(slot);
+    }
+}
+
+bool AdapterCache::isResident(const std::string& adapterId) const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    return byId_.count(adapterId) > 0;
+}
+
+void AdapterCache::evict(const std::string& adapterId) {
+    std::lock_guard<std::mutex> guard(mutex_);
+    auto it = byId_.find(adapterId);
+    if (it == byId_.end()) {
+        return;
+    }
+    int index = it->second;
+    byId_.erase(it);
+    slots_[index].retired = true;
+    if (slots_[index].pins == 0) {
+        freeSlotLocked(index);
+    }
+}
+
+void AdapterCache::addDelta(const std::string& weightName, const TensorView& input,
+                            const int* rowSlots, float* output) const {
+    CORTEX_TRACE_SCOPE("lora.addDelta");
+    const int64_t batch = input.rows;
+    int64_t begin = 0;
+    while (begin < batch) {
+        // One segment: a run of rows sharing an adapter
+        const int slotIndex = rowSlots[begin];
+        int64_t end = begin + 1;
+        while (end < batch && rowSlots[end] == slotIndex) {
+            end++;
+        }
+        const int64_t rows = end - begin;
+
+        const ResidentTarget* target = nullptr;
+        float scale = 0.0f;
+        if (slotIndex >= 0 && static_cast<size_t>(slotIndex) < slots_.size()) {
+            std::lock_guard<std::mutex> guard(mutex_);
+            const Slot& slot = slots_[slotIndex];
+            auto it = slot.targets.find(weightName);
+            if (slot.adapter && it != slot.targets.end()) {
+                target = &it->second;       // Stable while the slot is pinned
+                scale = slot.adapter->scale();
+            }
+        }
+        if (!target || target->inFeatures != input.cols) {
+            begin = end;
+            continue;
+        }
+
+        // Shrink: t[b, j] = scale * A_j . x_b, each row of A read once per segment
+        const int64_t rank = target->rank;
+        const int64_t outFeatures = target->outFeatures;
+        float* shrunk = ScratchArena::local().floats(static_cast<size_t>(rows * rank), 0);
+        #pragma omp parallel for schedule(static) if (rows * rank * input.cols >= kParallelWork)
+        for (int64_t j = 0; j < rank; ++j) {
+            const float* a = target->aRows[j];
+            for (int64_t b = 0; b < rows; ++b) {
+                const float* x = input.rowData(begin + b);
+                float sum = 0.0f;
+                #pragma omp simd reduction(+:sum)
+                for (int64_t i = 0; i < input.cols; ++i) {
+                    sum += a[i] * x[i];
+                }
+                shrunk[b * rank + j] = scale * sum;
+            }
+        }
+
+        // Expand: y_b += sum_j t[b, j] * B_j, output columns split across threads
+        const int64_t chunks = (outFeatures + kExpandChunk - 1) / kExpandChunk;
+        #pragma omp parallel for schedule(static) if (rows * rank * outFeatures >= kParallelWork)
+        for (int64_t c = 0; c < chunks; ++c) {
+            const int64_t first = c * kExpandChunk;
+            const int64_t count = std::min(kExpandChunk, outFeatures - first);
+            for (int64_t j = 0; j < rank; ++j) {
+                const float* column = target->bCols[j] + first;
+                for (int64_t b = 0; b < rows; ++b) {
+                    const float t = shrunk[b * rank + j];
+                    float* y = output + (begin + b) * outFeatures + first;
+                    #pragma omp simd
+                    for (int64_t o = 0; o < count; ++o) {
+                        y[o] += t * column[o];
+                    }
+                }
+            }
+        }
+        begin = end;
+    }
+}
+
+AdapterCacheStats AdapterCache::getStats() const {
+    std::lock_guard<std::mutex> guard(mutex_);
+    AdapterCacheStats stats = stats_;
+    stats.freePages = freePages_.size();
+    for (const Slot& slot : slots_) {
+        if (slot.adapter) {
+            stats.residentAdapters++;
+            stats.pinnedAdapters += slot.pins > 0 ? 1 : 0;
+        }
+    }
+    return stats;
+}
+
+bool AdapterCache::pageInLocked(Slot& slot) {
+    // A rows and B columns become one page each, dequantized to float
+    for (const auto& [name, source] : slot.adapter->targets()) {
+        if (static_cast<size_t>(std::max(source.inFeatures, source.outFeatures)) > pageFloats_) {
+            std::cerr << "[LoRA] " << slot.adapter->id() << ": " << name
+                      << " is wider than an adapter page" << std::endl;
+            return false;
+        }
+        ResidentTarget& target = slot.targets[name];
+        target.rank = source.rank;
+        target.inFeatures = source.inFeatures;
+        target.outFeatures = source.outFeatures;
+        for (int64_t j = 0; j < source.rank; ++j) {
+            int page = freePages_.back();
+            freePages_.pop_back();
+            slot.pages.push_back(page);
+            float* dst = arena_.data() + static_cast<size_t>(page) * pageFloats_;
+            for (int64_t i = 0; i < source.inFeatures; ++i) {
+                dst[i] = elementAt(*source.a, j * source.inFeatures + i);
+            }
+            target.aRows.push_back(dst);
+        }
+        for (int64_t j = 0; j < source.rank; ++j) {
+            int page = freePages_.back();
+            freePages_.pop_back();
+            slot.pages.push_back(page);
+            float* dst = arena_.data() + static_cast<size_t>(page) * pageFloats_;
+            for (int64_t o = 0; o < source.outFeatures; ++o) {
+                dst[o] = elementAt(*source.b, o * source.rank + j);
+            }
+            target.bCols.push_back(dst);
+        }
+    }
+    return true;
+}
+
+void AdapterCache::freeSlotLocked(int index) {
+    Slot& slot = slots_[index];
+    freePages_.insert(freePages_.end(), slot.pages.begin(), slot.pages.end());
+    auto it = slot.adapter ? byId_.find(slot.adapter->id()) : byId_.end();
+    if (it != byId_.end() && it->second == index) {
+        byId_.erase(it);
+    }
+    slot = Slot();
+}
+
+bool AdapterCache::evictOneLocked() {
+    int victim = -1;
+    for (size_t i = 0; i < slots_.size(); ++i) {
+        const Slot& slot = slots_[i];
+        if (slot.adapter && slot.pins == 0 &&
+            (victim < 0 || slot.lastUse < slots_[victim].lastUse)) {
+            victim = static_cast<int>(i);
+        }
+    }
+    if (victim < 0) {
+        return false;
+    }
+    freeSlotLocked(victim);
+    stats_.evictions++;
+    return true;
+}
+
+}  // namespace cortexstream
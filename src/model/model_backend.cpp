@@ -1,5 +1,11 @@
 #include "cortexstream/model.h"
+#include "cortexstream/lora.h"
+#include "cortexstream/quant_matmul.h"
+#include "cortexstream/tensor_parallel.h"
+#include "cortexstream/trace.h"
 #include <algorithm>
+#include <filesystem>
+#include <iostream>
 #include <stdexcept>
 #include <random>
 #include <cmath>
@@ -7,6 +13,62 @@
 
 namespace cortexstream {
 
+namespace {
+
+// Adapter cache created on first registration when none was configured
+constexpr size_t kDefaultAdapterPages = 4096;
+
+// Pins a batch's adapters for one forward pass
+class AdapterPins {
+public:
+    AdapterPins(ModelBackend& backend, const Batch& batch)
+        : backend_(backend), slots_(backend.acquireAdapters(batch)) {}
+    ~AdapterPins() { backend_.releaseAdapters(slots_); }
+
+private:
+    ModelBackend& backend_;
+    std::vector<int> slots_;
+};
+
+}  // namespace
+
+ScratchArena& ScratchArena::local() {
+    static thread_local ScratchArena arena;
+    return arena;
+}
+
+void ScratchArena::reserve(size_t count) {
+    for (auto& buffer : floats_) {
+        if (buffer.size() < count) {
+            buffer.resize(count);
+        }
+    }
+    pairs(count);
+    flags(count);
+}
+
+float* ScratchArena::floats(size_t count, size_t slot) {
+    auto& buffer = floats_[slot];
+    if (buffer.size() < count) {
+        buffer.resize(count);
+    }
+    return buffer.data();
+}
+
+std::pair<float, int>* ScratchArena::pairs(size_t count) {
+    if (pairs_.size() < count) {
+        pairs_.resize(count);
+    }
+    return pairs_.data();
+}
+
+uint8_t* ScratchArena::flags(size_t count) {
+    if (flags_.size() < count) {
+        flags_.resize(count, 0);
+    }
+    return flags_.data();
+}
+
 ModelBackend::ModelBackend(Device device, DType dtype)
     : device(device), dtype(dtype) {}
 
@@ -14,7 +76,38 @@ ModelBackend::~ModelBackend() = default;
 
 bool ModelBackend::loadModel(const std::string& path) {
     modelPath = path;
-    // Placeholder metadata for demo builds
+    tensorParallel.reset();     // Shards point into the old mapping
+    {
+        std::lock_guard<std::mutex> lock(adapterMutex);
+        adapters.clear();       // Adapters are tied to their base weights
+        adapterCache.reset();
+    }
+    
+    std::error_code ec;
+    if (std::filesystem::exists(path, ec)) {
+        auto store = WeightStore::open(path);
+        if (!store) {
+            std::cerr << "[ModelBackend] Failed to load weights from " << path << std::endl;
+            return false;
+        }
+        
+        config = store->config();
+        hiddenSize = config.hiddenSize;
+        numLayers = config.numLayers;
+        vocabSize = config.vocabSize;
+        
+        // Every projection resolved once; the tensors stay in the mapping
+        linearWeights.clear();
+        for (const auto& tensor : store->tensors()) {
+            LinearWeight weight;
+            if (LinearWeight::resolve(*store, tensor.name, weight)) {
+                linearWeights.emplace(tensor.name, weight);
+            }
+        }
+        weights = std::move(store);
+    }
+    
+    // Placeholder metadata for demo builds (and what the weights did not give)
     hiddenSize = hiddenSize == 0 ? 4096 : hiddenSize;
     numLayers = numLayers == 0 ? 32 : numLayers;
     vocabSize = vocabSize == 0 ? 32000 : vocabSize;
@@ -27,8 +120,231 @@ bool ModelBackend::isLoaded() const {
     return loaded;
 }
 
+std::shared_ptr<const WeightStore> ModelBackend::getWeights() const {
+    return weights;
+}
+
+const ModelConfig& ModelBackend::getConfig() const {
+    return config;
+}
+
+bool ModelBackend::isQuantized() const {
+    return config.quantization != QuantFormat::FP16;
+}
+
+QuantFormat ModelBackend::getWeightFormat() const {
+    return config.quantization;
+}
+
+Tensor ModelBackend::linear(const std::string& weightName, const TensorView& input) {
+    CORTEX_TRACE_SCOPE("backend.linear");
+    auto it = linearWeights.find(weightName);
+    if (it == linearWeights.end()) {
+        throw std::runtime_error("Unknown projection weight: " + weightName);
+    }
+    const LinearWeight& weight = it->second;
+    if (input.cols != weight.inFeatures) {
+        throw std::runtime_error("Input width does not match weight: " + weightName);
+    }
+    
+    Tensor output;
+    output.shape = {input.rows, weight.outFeatures};
+    output.dtype = dtype;
+    
+    if (tensorParallel && tensorParallel->isSharded(weightName)) {
+        output.data.resize(static_cast<size_t>(input.rows * weight.outFeatures));
+        tensorParallel->linear(weightName, input, output.data.data());
+        return output;
+    }
+    
+#ifdef MLX_AVAILABLE
+    if (device == Device::MPS && metal_optimized_ && weight.isQuantized()) {
+        namespace mx = mlx::core;
+        // Codes and scales alias the mapping; offset-binary codes are MLX's
+        // affine layout with bias = -zero * scale
+        const int bits = weight.format == QuantFormat::Int4 ? 4 : 8;
+        const int groups = static_cast<int>(weight.inFeatures / weight.groupSize);
+        std::shared_ptr<const WeightStore> owner = weights;
+        mx::array codes(const_cast<uint8_t*>(weight.data),
+                        {static_cast<int>(weight.outFeatures),
+                         static_cast<int>(weight.inFeatures * bits / 32)},
+                        mx::uint32, [owner](void*) {});
+        mx::array scales(const_cast<uint8_t*>(weight.scales),
+                         {static_cast<int>(weight.outFeatures), groups},
+                         mx::float16, [owner](void*) {});
+        mx::array biases = mx::multiply(scales, mx::array(-static_cast<float>(1 << (bits - 1)),
+                                                          mx::float16));
+        std::vector<float> packed(static_cast<size_t>(input.rows * input.cols));
+        for (int64_t r = 0; r < input.rows; ++r) {
+            std::copy(input.rowData(r), input.rowData(r) + input.cols, packed.data() + r * input.cols);
+        }
+        mx::array x(packed.data(), {static_cast<int>(input.rows), static_cast<int>(input.cols)},
+                    mx::float32);
+        mx::array y = mx::quantized_matmul(mx::astype(x, mx::float16), codes, scales, biases,
+                                           /*transpose=*/true, weight.groupSize, bits);
+        y = mx::astype(y, mx::float32);
+        mx::eval(y);
+        const float* result = y.data<float>();
+        output.data.assign(result, result + y.size());
+        return output;
+    }
+#endif
+    
+    output.data.resize(static_cast<size_t>(input.rows * weight.outFeatures));
+    linearForward(weight, input, output.data.data());
+    return output;
+}
+
+bool ModelBackend::setTensorParallel(int worldSize) {
+    if (worldSize <= 1) {
+        tensorParallel.reset();
+        return true;
+    }
+    return setTensorParallel(std::make_shared<LocalCommunicator>(worldSize));
+}
+
+bool ModelBackend::setTensorParallel(std::shared_ptr<Communicator> communicator) {
+    if (!loaded) {
+        std::cerr << "[ModelBackend] Load a model before enabling tensor parallelism" << std::endl;
+        return false;
+    }
+    if (!communicator || communicator->worldSize() <= 1) {
+        tensorParallel.reset();
+        return true;
+    }
+    auto group = std::make_shared<TensorParallelGroup>(std::move(communicator));
+    if (!group->shardWeights(linearWeights, config)) {
+        return false;
+    }
+    tensorParallel = std::move(group);
+    return true;
+}
+
+int ModelBackend::getTensorParallelSize() const {
+    return tensorParallel ? tensorParallel->worldSize() : 1;
+}
+
+std::shared_ptr<TensorParallelGroup> ModelBackend::getTensorParallel() const {
+    return tensorParallel;
+}
+
+Tensor ModelBackend::linear(const std::string& weightName, const TensorView& input,
+                            const std::vector<int>& rowSlots) {
+    Tensor output = linear(weightName, input);
+    std::shared_ptr<AdapterCache> cache = getAdapterCache();
+    bool anyAdapter = std::any_of(rowSlots.begin(), rowSlots.end(), [](int slot) { return slot >= 0; });
+    if (cache && anyAdapter) {
+        if (rowSlots.size() != static_cast<size_t>(input.rows)) {
+            throw std::runtime_error("One adapter slot per row required: " + weightName);
+        }
+        cache->addDelta(weightName, input, rowSlots.data(), output.data.data());
+    }
+    return output;
+}
+
+bool ModelBackend::registerAdapter(const std::string& adapterId, const std::string& path) {
+    if (!loaded || adapterId.empty()) {
+        std::cerr << "[ModelBackend] Adapters need a loaded base model and an ID" << std::endl;
+        return false;
+    }
+    auto adapter = LoRAAdapter::open(adapterId, path, linearWeights);
+    if (!adapter) {
+        return false;
+    }
+    std::lock_guard<std::mutex> lock(adapterMutex);
+    if (!adapterCache) {
+        size_t widest = 1;
+        for (const auto& entry : linearWeights) {
+            widest = std::max<size_t>(widest, std::max(entry.second.inFeatures, entry.second.outFeatures));
+        }
+        adapterCache = std::make_shared<AdapterCache>(kDefaultAdapterPages, widest);
+    }
+    adapterCache->evict(adapterId);     // A re-registered ID pages in afresh
+    adapters[adapterId] = std::move(adapter);
+    return true;
+}
+
+void ModelBackend::unregisterAdapter(const std::string& adapterId) {
+    std::lock_guard<std::mutex> lock(adapterMutex);
+    adapters.erase(adapterId);
+    if (adapterCache) {
+        adapterCache->evict(adapterId);
+    }
+}
+
+bool ModelBackend::hasAdapter(const std::string& adapterId) const {
+    std::lock_guard<std::mutex> lock(adapterMutex);
+    return adapters.count(adapterId) > 0;
+}
+
+bool ModelBackend::configureAdapterCache(size_t numPages, size_t pageFloats) {
+    std::lock_guard<std::mutex> lock(adapterMutex);
+    if (adapterCache && adapterCache->getStats().pinnedAdapters > 0) {
+        return false;
+    }
+    if (pageFloats == 0) {
+        pageFloats = 1;
+        for (const auto& entry : linearWeights) {
+            pageFloats = std::max<size_t>(pageFloats, std::max(entry.second.inFeatures, entry.second.outFeatures));
+        }
+    }
+    adapterCache = std::make_shared<AdapterCache>(numPages, pageFloats);
+    return true;
+}
+
+std::shared_ptr<AdapterCache> ModelBackend::getAdapterCache() const {
+    std::lock_guard<std::mutex> lock(adapterMutex);
+    return adapterCache;
+}
+
+std::vector<int> ModelBackend::acquireAdapters(const Batch& batch) {
+    std::vector<int> rowSlots(batch.requests.size(), -1);
+    std::unordered_map<std::string, int> pinned;    // One pin per adapter per batch
+    std::lock_guard<std::mutex> lock(adapterMutex);
+    for (size_t i = 0; i < batch.requests.size(); ++i) {
+        const std::string& id = batch.requests[i]->getAdapter();
+        if (id.empty()) {
+            continue;
+        }
+        auto found = pinned.find(id);
+        if (found != pinned.end()) {
+            rowSlots[i] = found->second;
+            continue;
+        }
+        auto it = adapters.find(id);
+        int slot = it != adapters.end() && adapterCache ? adapterCache->acquire(it->second) : -1;
+        if (slot < 0) {
+            for (const auto& entry : pinned) {
+                adapterCache->release(entry.second);
+            }
+            throw std::runtime_error(it == adapters.end()
+                ? "Unknown adapter: " + id
+                : "Adapter cache cannot hold the batch's adapters: " + id);
+        }
+        pinned.emplace(id, slot);
+        rowSlots[i] = slot;
+    }
+    return rowSlots;
+}
+
+void ModelBackend::releaseAdapters(const std::vector<int>& rowSlots) {
+    std::shared_ptr<AdapterCache> cache = getAdapterCache();
+    if (!cache) {
+        return;
+    }
+    std::vector<int> released;
+    for (int slot : rowSlots) {
+        if (slot >= 0 && std::find(released.begin(), released.end(), slot) == released.end()) {
+            cache->release(slot);
+            released.push_back(slot);
+        }
+    }
+}
+
 Tensor ModelBackend::prefill(const Batch& batch, const std::vector<int>& /*tokenIds*/) {
+    CORTEX_TRACE_SCOPE_ARG("backend.prefill", batch.batchSize);
     if (!loaded) throw std::runtime_error("Model not loaded");
+    AdapterPins pins(*this, batch);     // Resident for the whole pass
     Tensor logits;
     logits.shape = {static_cast<int64_t>(batch.batchSize), static_cast<int64_t>(vocabSize)};
     logits.data.assign(static_cast<size_t>(batch.batchSize * vocabSize), 0.0f);
@@ -37,14 +353,36 @@ Tensor ModelBackend::prefill(const Batch& batch, const std::vector<int>& /*token
 }
 
 Tensor ModelBackend::decode(const Batch& batch, const std::vector<int>& /*tokenIds*/) {
+    CORTEX_TRACE_SCOPE_ARG("backend.decode", batch.batchSize);
     // Reuse same dummy output shape as prefill
     return prefill(batch, {});
 }
 
-int ModelBackend::sampleToken(const Tensor& logits, const SamplingParams& /*params*/) {
-    if (logits.data.empty()) return 0;
-    auto it = std::max_element(logits.data.begin(), logits.data.end());
-    return static_cast<int>(std::distance(logits.data.begin(), it));
+std::future<Tensor> ModelBackend::decodeAsync(const Batch& batch, std::vector<int> tokenIds) {
+    if (!loaded) throw std::runtime_error("Model not loaded");
+    // Stub: a helper thread stands in for the asynchronous GPU stream
+    return std::async(std::launch::async, [this, batch, tokenIds = std::move(tokenIds)]() {
+        return decode(batch, tokenIds);
+    });
+}
+
+Tensor ModelBackend::decodeTokens(const Batch& batch, const std::vector<int>& /*tokenIds*/) {
+    CORTEX_TRACE_SCOPE_ARG("backend.decodeTokens", batch.batchSize);
+    if (!loaded) throw std::runtime_error("Model not loaded");
+    AdapterPins pins(*this, batch);
+    int64_t positions = 0;
+    for (int len : batch.sequenceLengths) {
+        positions += len;
+    }
+    Tensor logits;
+    logits.shape = {positions, static_cast<int64_t>(vocabSize)};
+    logits.data.assign(static_cast<size_t>(positions * vocabSize), 0.0f);
+    logits.dtype = dtype;
+    return logits;
+}
+
+int ModelBackend::sampleToken(const TensorView& logits, const SamplingParams& /*params*/) {
+    return sampleGreedy(logits);
 }
 
 size_t ModelBackend::getHiddenSize() const { return hiddenSize; }
@@ -93,37 +431,67 @@ std::vector<float> ModelBackend::fromMLXArray(const mlx::core::array& /*arr*/) {
     return {};
 }
 
-int ModelBackend::sampleGreedy(const Tensor& logits) {
-    if (logits.data.empty()) {
+mlx::core::array ModelBackend::toMLXArray(const WeightTensor& tensor) const {
+#ifdef MLX_AVAILABLE
+    namespace mx = mlx::core;
+    mx::Dtype type = mx::float32;
+    switch (tensor.dtype) {
+        case WeightDType::F16: type = mx::float16; break;
+        case WeightDType::BF16: type = mx::bfloat16; break;
+        case WeightDType::I8: type = mx::int8; break;
+        case WeightDType::U8: type = mx::uint8; break;
+        case WeightDType::I16: type = mx::int16; break;
+        case WeightDType::U16: type = mx::uint16; break;
+        case WeightDType::I32: type = mx::int32; break;
+        case WeightDType::U32: type = mx::uint32; break;
+        case WeightDType::I64: type = mx::int64; break;
+        case WeightDType::U64: type = mx::uint64; break;
+        case WeightDType::Bool: type = mx::bool_; break;
+        default: break;
+    }
+    mx::Shape shape(tensor.shape.begin(), tensor.shape.end());
+    // The deleter holds the store, so the mapping outlives every alias
+    std::shared_ptr<const WeightStore> owner = weights;
+    return mx::array(const_cast<uint8_t*>(tensor.data), std::move(shape), type,
+                     [owner](void*) {});
+#else
+    (void)tensor;
+    return mlx::core::array({0.0f});
+#endif
+}
+
+int ModelBackend::sampleGreedy(const TensorView& logits) {
+    if (logits.empty()) {
         return 0;
     }
-    auto it = std::max_element(logits.data.begin(), logits.data.end());
-    return static_cast<int>(std::distance(logits.data.begin(), it));
+    const float* row = logits.rowData(0);
+    return static_cast<int>(std::max_element(row, row + logits.cols) - row);
 }
 
-int ModelBackend::sampleTopK(const Tensor& logits, int k, float temperature) {
-    if (logits.data.empty() || k <= 0) {
+int ModelBackend::sampleTopK(const TensorView& logits, int k, float temperature) {
+    if (logits.empty() || k <= 0) {
         return sampleGreedy(logits);
     }
 
-    // Create indexed pairs of (logit, index)
-    std::vector<std::pair<float, int>> pairs;
-    pairs.reserve(logits.data.size());
-    for (size_t i = 0; i < logits.data.size(); ++i) {
-        pairs.emplace_back(logits.data[i], static_cast<int>(i));
+    // Indexed (logit, index) pairs in this thread's scratch buffer
+    const float* row = logits.rowData(0);
+    const int vocab = static_cast<int>(logits.cols);
+    std::pair<float, int>* pairs = ScratchArena::local().pairs(vocab);
+    for (int i = 0; i < vocab; ++i) {
+        pairs[i] = {row[i], i};
     }
 
     // Partial sort to get top-K elements
-    int actualK = std::min(k, static_cast<int>(pairs.size()));
+    int actualK = std::min(k, vocab);
     std::nth_element(
-        pairs.begin(),
-        pairs.begin() + actualK - 1,
-        pairs.end(),
+        pairs,
+        pairs + actualK - 1,
+        pairs + vocab,
         [](const auto& a, const auto& b) { return a.first > b.first; }
     );
 
     // Apply temperature and convert to probabilities
-    std::vector<float> probs(actualK);
+    float* probs = ScratchArena::local().floats(actualK);
     float maxLogit = pairs[0].first;
     for (int i = 1; i < actualK; ++i) {
         maxLogit = std::max(maxLogit, pairs[i].first);
@@ -138,8 +506,8 @@ int ModelBackend::sampleTopK(const Tensor& logits, int k, float temperature) {
 
     // Normalize
     if (sum > 0.0f) {
-        for (auto& p : probs) {
-            p /= sum;
+        for (int i = 0; i < actualK; ++i) {
+            probs[i] /= sum;
         }
     }
 
@@ -159,74 +527,59 @@ int ModelBackend::sampleTopK(const Tensor& logits, int k, float temperature) {
     return pairs[actualK - 1].second;
 }
 
-int ModelBackend::sampleTopP(const Tensor& logits, float p, float temperature) {
-    if (logits.data.empty() || p <= 0.0f) {
+int ModelBackend::sampleTopP(const TensorView& logits, float p, float temperature) {
+    if (logits.empty() || p <= 0.0f) {
         return sampleGreedy(logits);
     }
 
-    // Apply temperature and softmax
-    std::vector<std::pair<float, int>> pairs;
-    pairs.reserve(logits.data.size());
+    // Apply temperature and softmax into this thread's scratch pairs
+    const float* row = logits.rowData(0);
+    const int vocab = static_cast<int>(logits.cols);
+    std::pair<float, int>* pairs = ScratchArena::local().pairs(vocab);
 
-    float maxLogit = *std::max_element(logits.data.begin(), logits.data.end());
+    float maxLogit = *std::max_element(row, row + vocab);
 
-    for (size_t i = 0; i < logits.data.size(); ++i) {
-        float scaled = (logits.data[i] - maxLogit) / std::max(temperature, 1e-6f);
-        float prob = std::exp(std::clamp(scaled, -88.0f, 88.0f));
-        pairs.emplace_back(prob, static_cast<int>(i));
+    float sum = 0.0f;
+    for (int i = 0; i < vocab; ++i) {
+        float scaled = (row[i] - maxLogit) / std::max(temperature, 1e-6f);
+        pairs[i] = {std::exp(std::clamp(scaled, -88.0f, 88.0f)), i};
+        sum += pairs[i].first;
     }
 
     // Sort by probability descending
-    std::sort(pairs.begin(), pairs.end(),
+    std::sort(pairs, pairs + vocab,
               [](const auto& a, const auto& b) { return a.first > b.first; });
 
-    // Normalize probabilities
-    float sum = 0.0f;
-    for (const auto& pair : pairs) {
-        sum += pair.first;
-    }
-    if (sum > 0.0f) {
-        for (auto& pair : pairs) {
-            pair.first /= sum;
-        }
-    }
-
-    // Find nucleus (tokens with cumulative probability >= p)
-    std::vector<std::pair<float, int>> nucleus;
+    // Nucleus: shortest prefix with cumulative probability >= p
+    int nucleusSize = 0;
     float cumProb = 0.0f;
-    for (const auto& pair : pairs) {
-        cumProb += pair.first;
-        nucleus.push_back(pair);
+    while (nucleusSize < vocab) {
+        cumProb += sum > 0.0f ? pairs[nucleusSize].first / sum : 0.0f;
+        nucleusSize++;
         if (cumProb >= p) {
             break;
         }
     }
 
-    // Renormalize nucleus probabilities
+    // Sample from the renormalized nucleus
     float nucleusSum = 0.0f;
-    for (const auto& pair : nucleus) {
-        nucleusSum += pair.first;
-    }
-    if (nucleusSum > 0.0f) {
-        for (auto& pair : nucleus) {
-            pair.first /= nucleusSum;
-        }
+    for (int i = 0; i < nucleusSize; ++i) {
+        nucleusSum += pairs[i].first;
     }
 
-    // Sample from nucleus
     static thread_local std::mt19937 rng(std::random_device{}());
     std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    float rand = dist(rng);
+    float rand = dist(rng) * nucleusSum;
 
     cumProb = 0.0f;
-    for (const auto& pair : nucleus) {
-        cumProb += pair.first;
+    for (int i = 0; i < nucleusSize; ++i) {
+        cumProb += pairs[i].first;
         if (rand < cumProb) {
-            return pair.second;
+            return pairs[i].second;
         }
     }
 
-    return nucleus.back().second;
+    return pairs[nucleusSize - 1].second;
 }
 
 }  // namespace cortexstream
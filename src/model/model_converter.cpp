@@ -0,0 +1,367 @@
+#include "cortexstream/model_converter.h"
+#include "cortexstream/half.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <vector>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace cortexstream {
+
+namespace {
+
+// How one output tensor is produced from its source
+enum class Produce {
+    Copy,           // Non-float data, as stored
+    Half,           // Any float -> FP16
+    Quantized,      // Group-quantized codes
+    Scales,         // FP16 scales of the preceding Quantized entry
+    Tokenizer       // tokenizer.json bytes
+};
+
+struct Planned {
+    std::string name;
+    WeightDType dtype;
+    std::vector<int64_t> shape;
+    size_t numBytes = 0;
+    size_t offset = 0;              // From the data start
+    Produce produce = Produce::Copy;
+    const WeightTensor* source = nullptr;
+};
+
+bool isFloat(WeightDType dtype) {
+    return dtype == WeightDType::F64 || dtype == WeightDType::F32 ||
+           dtype == WeightDType::F16 || dtype == WeightDType::BF16;
+}
+
+float loadFloat(const WeightTensor& tensor, size_t i) {
+    const uint8_t* p = tensor.data + i * weightDTypeSize(tensor.dtype);
+    switch (tensor.dtype) {
+        case WeightDType::F64: {
+            double v;
+            std::memcpy(&v, p, sizeof(v));
+            return static_cast<float>(v);
+        }
+        case WeightDType::F32: {
+            float v;
+            std::memcpy(&v, p, sizeof(v));
+            return v;
+        }
+        case WeightDType::F16:
+        case WeightDType::BF16: {
+            uint16_t v;
+            std::memcpy(&v, p, sizeof(v));
+            return tensor.dtype == WeightDType::F16 ? halfToFloat(v) : bfloat16ToFloat(v);
+        }
+        default:
+            return 0.0f;
+    }
+}
+
+// Quantized blocks only: norms and embeddings are small and precision
+// sensitive, so they stay FP16
+bool shouldQuantize(const WeightTensor& tensor, const ConvertOptions& options) {
+    if (options.format == QuantFormat::FP16 || !isFloat(tensor.dtype) ||
+        tensor.shape.size() != 2 || tensor.shape[1] % options.groupSize != 0) {
+        return false;
+    }
+    const std::string& name = tensor.name;
+    if (name.size() < 7 || name.compare(name.size() - 7, 7, ".weight") != 0) {
+        return false;
+    }
+    for (const char* keep : {"norm", "embed", "wte", "wpe", "ln_"}) {
+        if (name.find(keep) != std::string::npos) {
+            return false;
+        }
+    }
+    return true;
+}
+
+size_t alignUp(size_t value, size_t alignment) {
+    return (value + alignment - 1) / alignment * alignment;
+}
+
+void appendJsonString(std::string& out, const std::string& text) {
+    out.push_back('"');
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out.push_back('\\');
+            out.push_back(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char escaped[8];
+            std::snprintf(escaped, sizeof(escaped), "\\u%04x", c);
+            out += escaped;
+        } else {
+            out.push_back(c);
+        }
+    }
+    out.push_back('"');
+}
+
+// Quantizes one [rows, cols] weight into codes plus per-group FP16 scales.
+// Codes are computed against the rounded scale, so dequantizing with the
+// stored scale reproduces exactly what was rounded.
+void quantizeWeight(const WeightTensor& tensor, QuantFormat format, int groupSize,
+                    std::vector<uint8_t>& codes, std::vector<uint8_t>& scales) {
+    const int64_t rows = tensor.shape[0];
+    const int64_t cols = tensor.shape[1];
+    const int64_t groups = cols / groupSize;
+    const float maxCode = format == QuantFormat::Int8 ? 127.0f : 7.0f;
+    const int64_t rowBytes = format == QuantFormat::Int8 ? cols : cols / 2;
+    codes.assign(rows * rowBytes, 0);
+    scales.assign(rows * groups * sizeof(uint16_t), 0);
+
+    #pragma omp parallel for schedule(static)
+    for (int64_t r = 0; r < rows; ++r) {
+        std::vector<float> row(cols);
+        for (int64_t c = 0; c < cols; ++c) {
+            row[c] = loadFloat(tensor, r * cols + c);
+        }
+        uint8_t* out = codes.data() + r * rowBytes;
+        for (int64_t g = 0; g < groups; ++g) {
+            const float* w = row.data() + g * groupSize;
+            float maxAbs = 0.0f;
+            for (int i = 0; i < groupSize; ++i) {
+                maxAbs = std::max(maxAbs, std::fabs(w[i]));
+            }
+            const uint16_t halfScale = floatToHalf(maxAbs / maxCode);
+            std::memcpy(scales.data() + (r * groups + g) * sizeof(uint16_t),
+                        &halfScale, sizeof(halfScale));
+            const float scale = halfToFloat(halfScale);
+            const float inverse = scale > 0.0f ? 1.0f / scale : 0.0f;
+
+            for (int i = 0; i < groupSize; ++i) {
+                const int64_t c = g * groupSize + i;
+                float q = std::nearbyint(w[i] * inverse);
+                if (format == QuantFormat::Int8) {
+                    q = std::clamp(q, -127.0f, 127.0f);
+                    out[c] = static_cast<uint8_t>(static_cast<int>(q) + 128);
+                } else {
+                    q = std::clamp(q, -8.0f, 7.0f);
+                    uint8_t nibble = static_cast<uint8_t>(static_cast<int>(q) + 8);
+                    out[c / 2] |= (c % 2 == 0) ? nibble : static_cast<uint8_t>(nibble << 4);
+                }
+            }
+        }
+    }
+}
+
+}  // namespace
+
+bool convertModel(const ConvertOptions& options, ConvertReport* report) {
+    namespace fs = std::filesystem;
+    auto fail = [](const std::string& reason) {
+        std::cerr << "[ModelConverter] " << reason << std::endl;
+        return false;
+    };
+
+    if (options.outputPath.empty()) {
+        return fail("no output path");
+    }
+    if (options.format != QuantFormat::FP16 &&
+        (options.groupSize <= 0 || options.groupSize % 2 != 0)) {
+        return fail("group size must be a positive even number");
+    }
+
+    auto source = WeightStore::open(options.inputPath);
+    if (!source) {
+        return fail("cannot load " + options.inputPath);
+    }
+    if (source->isEngineFormat()) {
+        return fail(options.inputPath + " is already in the engine format");
+    }
+    ModelConfig config = source->config();
+    if (!config.isValid()) {
+        return fail("config.json with hidden_size, num_hidden_layers, vocab_size and "
+                    "num_attention_heads is required next to the weights");
+    }
+    config.quantization = options.format;
+    config.groupSize = options.format == QuantFormat::FP16 ? 0 : options.groupSize;
+
+    // Tokenizer blob: explicit path, else beside the checkpoint
+    std::string tokenizer;
+    std::error_code ec;
+    fs::path tokenizerPath = options.tokenizerPath;
+    if (tokenizerPath.empty()) {
+        fs::path base = fs::is_directory(options.inputPath, ec)
+                            ? fs::path(options.inputPath)
+                            : fs::path(options.inputPath).parent_path();
+        tokenizerPath = base / "tokenizer.json";
+    }
+    if (fs::is_regular_file(tokenizerPath, ec)) {
+        std::ifstream in(tokenizerPath, std::ios::binary);
+        std::stringstream text;
+        text << in.rdbuf();
+        tokenizer = text.str();
+    } else if (!options.tokenizerPath.empty()) {
+        return fail("cannot read tokenizer " + options.tokenizerPath);
+    }
+
+    // Plan every output tensor, then lay them out 64-byte aligned
+    std::vector<Planned> plan;
+    size_t quantized = 0;
+    for (const auto& tensor : source->tensors()) {
+        Planned entry;
+        entry.name = tensor.name;
+        entry.shape = tensor.shape;
+        entry.source = &tensor;
+        if (shouldQuantize(tensor, options)) {
+            const int64_t rows = tensor.shape[0];
+            const int64_t cols = tensor.shape[1];
+            entry.produce = Produce::Quantized;
+            entry.dtype = WeightDType::U8;
+            if (options.format == QuantFormat::Int8) {
+                entry.numBytes = rows * cols;
+            } else {
+                entry.shape = {rows, cols / 2};
+                entry.numBytes = rows * cols / 2;
+            }
+            plan.push_back(entry);
+
+            Planned scales;
+            scales.name = tensor.name + ".scales";
+            scales.dtype = WeightDType::F16;
+            scales.shape = {rows, cols / options.groupSize};
+            scales.numBytes = rows * (cols / options.groupSize) * sizeof(uint16_t);
+            scales.produce = Produce::Scales;
+            scales.source = &tensor;
+            plan.push_back(scales);
+            quantized++;
+            continue;
+        }
+        if (isFloat(tensor.dtype)) {
+            entry.produce = Produce::Half;
+            entry.dtype = WeightDType::F16;
+            entry.numBytes = tensor.numElements() * sizeof(uint16_t);
+        } else {
+            entry.produce = Produce::Copy;
+            entry.dtype = tensor.dtype;
+            entry.numBytes = tensor.numBytes;
+        }
+        plan.push_back(entry);
+    }
+    if (!tokenizer.empty()) {
+        Planned entry;
+        entry.name = WeightStore::kTokenizerTensor;
+        entry.dtype = WeightDType::U8;
+        entry.shape = {static_cast<int64_t>(tokenizer.size())};
+        entry.numBytes = tokenizer.size();
+        entry.produce = Produce::Tokenizer;
+        plan.push_back(entry);
+    }
+
+    size_t dataBytes = 0;
+    for (auto& entry : plan) {
+        entry.offset = alignUp(dataBytes, WeightStore::kTensorAlignment);
+        dataBytes = entry.offset + entry.numBytes;
+    }
+
+    // Header: config as metadata, then the tensor table; padded with spaces
+    // so the data region starts on a page boundary
+    std::string header = "{\"__metadata__\":{";
+    bool first = true;
+    auto fields = config.toFields();
+    fields["format"] = "cortexstream";
+    for (const auto& [key, value] : fields) {
+        header += first ? "" : ",";
+        first = false;
+        appendJsonString(header, key);
+        header += ":";
+        appendJsonString(header, value);
+    }
+    header += "}";
+    for (const auto& entry : plan) {
+        header += ",";
+        appendJsonString(header, entry.name);
+        header += ":{\"dtype\":\"";
+        header += weightDTypeName(entry.dtype);
+        header += "\",\"shape\":[";
+        for (size_t i = 0; i < entry.shape.size(); ++i) {
+            header += (i ? "," : "") + std::to_string(entry.shape[i]);
+        }
+        header += "],\"data_offsets\":[" + std::to_string(entry.offset) + "," +
+                  std::to_string(entry.offset + entry.numBytes) + "]}";
+    }
+    header += "}";
+    const size_t prefix = std::strlen(WeightStore::kEngineMagic) + 8;
+    header.resize(alignUp(prefix + header.size(), WeightStore::kDataAlignment) - prefix, ' ');
+
+    // Written aside and renamed, so a reader never maps a partial file
+    const std::string partial = options.outputPath + ".partial";
+    std::ofstream out(partial, std::ios::binary | std::ios::trunc);
+    if (!out) {
+        return fail("cannot write " + partial);
+    }
+    out.write(WeightStore::kEngineMagic, std::strlen(WeightStore::kEngineMagic));
+    uint64_t headerBytes = header.size();
+    for (int i = 0; i < 8; ++i) {
+        out.put(static_cast<char>((headerBytes >> (8 * i)) & 0xFF));
+    }
+    out.write(header.data(), header.size());
+
+    size_t written = 0;
+    std::vector<uint8_t> buffer, scales;
+    for (const auto& entry : plan) {
+        static const char kZeros[WeightStore::kTensorAlignment] = {};
+        out.write(kZeros, entry.offset - written);
+
+        const uint8_t* bytes = nullptr;
+        switch (entry.produce) {
+            case Produce::Copy:
+                bytes = entry.source->data;
+                break;
+            case Produce::Half: {
+                const size_t n = entry.source->numElements();
+                buffer.resize(n * sizeof(uint16_t));
+                #pragma omp parallel for schedule(static)
+                for (int64_t i = 0; i < static_cast<int64_t>(n); ++i) {
+                    uint16_t h = floatToHalf(loadFloat(*entry.source, i));
+                    std::memcpy(buffer.data() + i * sizeof(uint16_t), &h, sizeof(h));
+                }
+                bytes = buffer.data();
+                break;
+            }
+            case Produce::Quantized:
+                quantizeWeight(*entry.source, options.format, options.groupSize, buffer, scales);
+                bytes = buffer.data();
+                break;
+            case Produce::Scales:
+                bytes = scales.data();      // From the Quantized entry before it
+                break;
+            case Produce::Tokenizer:
+                bytes = reinterpret_cast<const uint8_t*>(tokenizer.data());
+                break;
+        }
+        out.write(reinterpret_cast<const char*>(bytes), entry.numBytes);
+        written = entry.offset + entry.numBytes;
+    }
+    out.close();
+    if (!out) {
+        fs::remove(partial, ec);
+        return fail("write failed for " + partial);
+    }
+    fs::rename(partial, options.outputPath, ec);
+    if (ec) {
+        fs::remove(partial, ec);
+        return fail("cannot move " + partial + " to " + options.outputPath);
+    }
+
+    if (report) {
+        report->tensors = plan.size();
+        report->quantized = quantized;
+        report->inputBytes = source->totalBytes();
+        report->outputBytes = prefix + header.size() + dataBytes;
+        report->hasTokenizer = !tokenizer.empty();
+    }
+    return true;
+}
+
+}  // namespace cortexstream
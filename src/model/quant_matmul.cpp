@@ -0,0 +1,115 @@
+#include "cortexstream/quant_matmul.h"
+#include "cortexstream/half.h"
+#include <algorithm>
+#include <cstring>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
+
+namespace cortexstream {
+
+namespace {
+
+// Columns decoded at a time for dense weights; a multiple of any group
+constexpr int64_t kDenseChunk = 256;
+
+// Below this many weights the thread fork costs more than it saves
+constexpr int64_t kParallelWeights = 1 << 16;
+
+float scaleAt(const uint8_t* scales, int64_t index) {
+    uint16_t h;
+    std::memcpy(&h, scales + index * sizeof(uint16_t), sizeof(h));
+    return halfToFloat(h);
+}
+
+// Codes of columns [begin, begin + count) of one row, minus the zero point
+void decodeInt8(const uint8_t* row, int64_t begin, int64_t count, float* out) {
+    const uint8_t* codes = row + begin;
+    #pragma omp simd
+    for (int64_t i = 0; i < count; ++i) {
+        out[i] = static_cast<float>(static_cast<int>(codes[i]) - 128);
+    }
+}
+
+void decodeInt4(const uint8_t* row, int64_t begin, int64_t count, float* out) {
+    // Groups have even width and start on even columns: whole bytes
+    const uint8_t* codes = row + begin / 2;
+    #pragma omp simd
+    for (int64_t i = 0; i < count / 2; ++i) {
+        out[2 * i] = static_cast<float>(static_cast<int>(codes[i] & 0xF) - 8);
+        out[2 * i + 1] = static_cast<float>(static_cast<int>(codes[i] >> 4) - 8);
+    }
+}
+
+void decodeDense(const uint8_t* row, WeightDType dtype, int64_t begin, int64_t count, float* out) {
+    if (dtype == WeightDType::F32) {
+        std::memcpy(out, row + begin * sizeof(float), count * sizeof(float));
+        return;
+    }
+    const uint8_t* bytes = row + begin * sizeof(uint16_t);
+    for (int64_t i = 0; i < count; ++i) {
+        uint16_t h;
+        std::memcpy(&h, bytes + i * sizeof(h), sizeof(h));
+        out[i] = dtype == WeightDType::F16 ? halfToFloat(h) : bfloat16ToFloat(h);
+    }
+}
+
+float dot(const float* a, const float* b, int64_t n) {
+    float sum = 0.0f;
+    #pragma omp simd reduction(+:sum)
+    for (int64_t i = 0; i < n; ++i) {
+        sum += a[i] * b[i];
+    }
+    return sum;
+}
+
+}  // namespace
+
+bool linearForward(const LinearWeight& weight, const TensorView& input, float* output) {
+    if (input.cols != weight.inFeatures || !weight.data || !output) {
+        return false;
+    }
+    const int64_t batch = input.rows;
+    const int64_t outFeatures = weight.outFeatures;
+    const int64_t inFeatures = weight.inFeatures;
+    if (batch == 0 || outFeatures == 0) {
+        return true;
+    }
+
+    const bool quantized = weight.isQuantized();
+    const int64_t chunk = quantized ? weight.groupSize : std::min(kDenseChunk, inFeatures);
+    // Strided for column slices (tensor-parallel shards)
+    const int64_t rowBytes = weight.rowBytes();
+    const int64_t groups = quantized ? weight.scalesPerRow() : 0;
+
+    #pragma omp parallel for schedule(static) if (outFeatures * inFeatures >= kParallelWeights)
+    for (int64_t o = 0; o < outFeatures; ++o) {
+        // One chunk of this row, decoded once for every activation row
+        float* decoded = ScratchArena::local().floats(chunk, 2);
+        const uint8_t* row = weight.data + o * rowBytes;
+        for (int64_t b = 0; b < batch; ++b) {
+            output[b * outFeatures + o] = 0.0f;
+        }
+        for (int64_t begin = 0; begin < inFeatures; begin += chunk) {
+            const int64_t count = std::min(chunk, inFeatures - begin);
+            float scale = 1.0f;
+            if (!quantized) {
+                decodeDense(row, weight.dtype, begin, count, decoded);
+            } else {
+                scale = scaleAt(weight.scales, o * groups + begin / chunk);
+                if (weight.format == QuantFormat::Int8) {
+                    decodeInt8(row, begin, count, decoded);
+                } else {
+                    decodeInt4(row, begin, count, decoded);
+                }
+            }
+            for (int64_t b = 0; b < batch; ++b) {
+                output[b * outFeatures + o] += scale * dot(decoded, input.rowData(b) + begin, count);
+            }
+        }
+    }
+    return true;
+}
+
+}  // namespace cortexstream
@@ -1,4 +1,5 @@
 #include "cortexstream/sampler.h"
+#include "cortexstream/trace.h"
 #include <algorithm>
 #include <cmath>
 #include <numeric>
@@ -6,10 +7,82 @@
 #include <stdexcept>
 #include <iostream>
 #include <limits>
-#include <queue>
+#include <cstring>
+#include <unordered_map>
 
 namespace cortexstream {
 
+namespace {
+
+// SplitMix64 finalizer
+inline uint64_t mix64(uint64_t x) {
+    x += 0x9e3779b97f4a7c15ULL;
+    x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+    x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+    return x ^ (x >> 31);
+}
+
+// Counter-based draw in [0, 1): a pure function of (stream, position), so
+// rows need no shared generator and no ordering between threads
+inline float uniformAt(uint64_t stream, uint64_t position) {
+    return static_cast<float>(mix64(stream ^ mix64(position)) >> 40) * 0x1.0p-24f;
+}
+
+inline bool isGreedy(const SamplingParams& p) {
+    return !p.doSample || p.temperature <= 0.0f || (p.topK == 1 && p.topP >= 1.0f);
+}
+
+inline bool penalizes(const SamplingParams& p, const std::vector<int>* history) {
+    return p.repetitionPenaltyEnabled && p.repetitionPenalty > 1.0f &&
+           history && !history->empty();
+}
+
+// Cheap row signature from a few strided elements; only a prefilter, equal
+// probes are confirmed with a full comparison
+uint64_t probeRow(const float* row, size_t n) {
+    constexpr size_t kProbes = 8;
+    uint64_t probe = n;
+    for (size_t k = 0; k < kProbes; ++k) {
+        uint32_t bits;
+        std::memcpy(&bits, row + (k * (n - 1)) / (kProbes - 1), sizeof(bits));
+        probe = mix64(probe ^ bits);
+    }
+    return probe;
+}
+
+bool sameParams(const SamplingParams& a, const SamplingParams& b) {
+    return a.temperature == b.temperature && a.topK == b.topK &&
+           a.topP == b.topP && a.doSample == b.doSample &&
+           a.repetitionPenaltyEnabled == b.repetitionPenaltyEnabled &&
+           a.repetitionPenalty == b.repetitionPenalty;
+}
+
+// Whether row `b` would draw exactly what row `a` draws, given equal logits
+bool sameInputs(const SampleRow& a, const SampleRow& b,
+                const SamplingParams& fallback) {
+    if (a.allowed != b.allowed || a.allowedSize != b.allowedSize) {
+        return false;
+    }
+    const SamplingParams& pa = a.params ? *a.params : fallback;
+    const SamplingParams& pb = b.params ? *b.params : fallback;
+    const bool plainA = isGreedy(pa) && !penalizes(pa, a.history);
+    const bool plainB = isGreedy(pb) && !penalizes(pb, b.history);
+    if (plainA || plainB) {
+        return plainA && plainB;   // Argmax depends on the logits alone
+    }
+    if (!sameParams(pa, pb)) {
+        return false;
+    }
+    const bool penalizedA = penalizes(pa, a.history);
+    if (penalizedA != penalizes(pb, b.history) ||
+        (penalizedA && a.history != b.history && *a.history != *b.history)) {
+        return false;
+    }
+    return isGreedy(pa) || (a.stream == b.stream && a.position == b.position);
+}
+
+}  // namespace
+
 // Validation helper
 bool SamplingParams::validate() const {
     if (temperature < 0.0f) return false;
@@ -46,81 +119,116 @@ std::optional<SamplingMetadata> Sampler::getLastMetadata() const {
     return lastMetadata;
 }
 
-int Sampler::sampleToken(const Tensor& logits,
+int Sampler::sampleToken(const TensorView& logits,
                         const std::vector<int>& generatedHistory) {
-    if (logits.shape.empty() || logits.data.empty()) {
+    if (logits.empty()) {
         throw std::invalid_argument("Invalid logits tensor");
     }
 
-    // Make working copy
-    Tensor workingLogits = logits;
+    // The sampler's own generator picks the stream, so a seeded Sampler
+    // still replays its sequence of calls
+    SampleRow row;
+    row.history = &generatedHistory;
+    row.stream = (static_cast<uint64_t>(rng()) << 32) | rng();
+    return sampleRow(logits.rowData(0), static_cast<size_t>(logits.cols), params, row);
+}
 
-    // Step 1: Apply repetition penalty if enabled
-    if (params.repetitionPenaltyEnabled && !generatedHistory.empty()) {
-        workingLogits = applyRepetitionPenalty(workingLogits, generatedHistory);
+std::vector<int> Sampler::sampleBatch(
+    const TensorView& batchedLogits,
+    const std::vector<std::vector<int>>& histories) {
+    
+    std::vector<SampleRow> rows(static_cast<size_t>(batchedLogits.rows));
+    for (size_t i = 0; i < rows.size(); ++i) {
+        rows[i].history = !histories.empty() ? &histories[i] : nullptr;
+        rows[i].stream = (static_cast<uint64_t>(rng()) << 32) | rng();
     }
+    return sampleBatch(batchedLogits, rows);
+}
 
-    // Step 2: Greedy override (when sampling disabled or trivial config)
-    if (!params.doSample || (params.topK == 1 && params.topP >= 1.0f)) {
-        return greedySelect(workingLogits);
+std::vector<int> Sampler::sampleBatch(const TensorView& batchedLogits,
+                                      const std::vector<SampleRow>& rows) const {
+    CORTEX_TRACE_SCOPE_ARG("sampler.sampleBatch", rows.size());
+    const int numRows = static_cast<int>(rows.size());
+    const size_t n = static_cast<size_t>(batchedLogits.cols);
+    std::vector<int> tokens(rows.size(), -1);
+    
+    std::vector<int> source(rows.size(), -1);
+    if (memoize.load(std::memory_order_relaxed)) {
+        findRepeatedRows(batchedLogits, rows, params, source);
+    }
+    
+    // One pass per row, rows in parallel: every thread works in its own
+    // ScratchArena and writes only its own slot
+    #pragma omp parallel for schedule(dynamic)
+    for (int i = 0; i < numRows; ++i) {
+        const SampleRow& row = rows[i];
+        const SamplingParams& rowParams = row.params ? *row.params : params;
+        if (source[i] >= 0 || i >= batchedLogits.rows || n == 0 ||
+            !rowParams.validate()) {
+            continue;
+        }
+        try {
+            // Full-vocab workspaces once per thread; later rows reuse them
+            ScratchArena::local().reserve(n);
+            tokens[i] = sampleRow(batchedLogits.rowData(i), n, rowParams, row);
+        } catch (const std::exception&) {
+            tokens[i] = -1;
+        }
     }
-
-    // Step 3: Apply temperature
-    if (params.temperature != 1.0f) {
-        workingLogits = applyTemperature(workingLogits);
+    
+    // Sources precede their repeats, so one forward pass resolves them
+    for (int i = 0; i < numRows; ++i) {
+        if (source[i] >= 0) {
+            tokens[i] = tokens[source[i]];
+        }
     }
+    
+    return tokens;
+}
 
-    // Step 4: Route to sampling strategy
-    int selectedToken = -1;
-
-    if (params.topK > 1 && params.topP < 1.0f) {
-        // Top-K + Top-P combined
-        selectedToken = topKPSample(workingLogits);
-    } else if (params.topK > 1) {
-        // Top-K only
-        selectedToken = topKSample(workingLogits);
-    } else if (params.topP < 1.0f) {
-        // Top-P (Nucleus) only
-        selectedToken = topPSample(workingLogits);
-    } else {
-        // Fallback to greedy
-        selectedToken = greedySelect(workingLogits);
-    }
+void Sampler::setMemoization(bool enabled) {
+    memoize.store(enabled, std::memory_order_relaxed);
+}
 
-    return selectedToken;
+bool Sampler::isMemoizing() const {
+    return memoize.load(std::memory_order_relaxed);
 }
 
-std::vector<int> Sampler::sampleBatch(
-    const Tensor& batchedLogits,
-    const std::vector<std::vector<int>>& histories) {
-    
-    // MVP: Simple sequential sampling per sequence
-    // Future: Vectorized batch operations on GPU
-    
-    std::vector<int> tokens;
-    
-    int batchSize = batchedLogits.shape[0];
-    int vocabSize = batchedLogits.shape[1];
-    
-    for (int i = 0; i < batchSize; ++i) {
-        // Extract logits for this sequence
-        Tensor seqLogits;
-        seqLogits.shape = {1, static_cast<int64_t>(vocabSize)};
-        seqLogits.data.resize(vocabSize);
-        
-        std::copy(
-            batchedLogits.data.begin() + i * vocabSize,
-            batchedLogits.data.begin() + (i + 1) * vocabSize,
-            seqLogits.data.begin()
-        );
-
-        // Sample using history if provided
-        auto history = !histories.empty() ? histories[i] : std::vector<int>{};
-        int token = sampleToken(seqLogits, history);
-        tokens.push_back(token);
+void Sampler::findRepeatedRows(const TensorView& batchedLogits,
+                               const std::vector<SampleRow>& rows,
+                               const SamplingParams& fallback,
+                               std::vector<int>& source) {
+    const size_t n = static_cast<size_t>(batchedLogits.cols);
+    const int numRows = static_cast<int>(
+        std::min<int64_t>(static_cast<int64_t>(rows.size()), batchedLogits.rows));
+    if (n == 0 || numRows < 2) {
+        return;
+    }
+    
+    // Distinct rows seen so far, bucketed by probe
+    std::unordered_map<uint64_t, std::vector<int>> distinct;
+    for (int i = 0; i < numRows; ++i) {
+        const float* data = batchedLogits.rowData(i);
+        auto& bucket = distinct[probeRow(data, n)];
+        for (int j : bucket) {
+            const float* other = batchedLogits.rowData(j);
+            if (sameInputs(rows[j], rows[i], fallback) &&
+                (other == data || std::memcmp(other, data, n * sizeof(float)) == 0)) {
+                source[i] = j;
+                break;
+            }
+        }
+        if (source[i] < 0) {
+            bucket.push_back(i);
+        }
     }
+}
 
-    return tokens;
+uint64_t Sampler::streamKey(const SamplingParams& rowParams) const {
+    if (rowParams.seed >= 0) {
+        return mix64(static_cast<uint64_t>(rowParams.seed));
+    }
+    return mix64(streamEntropy + nextStream.fetch_add(1, std::memory_order_relaxed));
 }
 
 void Sampler::initRNG() {
@@ -130,362 +238,232 @@ void Sampler::initRNG() {
         std::random_device rd;
         rng.seed(rd());
     }
-}
-
-Tensor Sampler::applyTemperature(const Tensor& logits) {
-    if (params.temperature <= 0.0f) {
-        throw std::invalid_argument("Temperature must be positive");
-    }
-
-    Tensor result = logits;
-    for (auto& val : result.data) {
-        val = val / params.temperature;
+    if (streamEntropy == 0) {
+        std::random_device rd;
+        streamEntropy = (static_cast<uint64_t>(rd()) << 32) | rd();
     }
-    return result;
 }
 
-Tensor Sampler::applyRepetitionPenalty(const Tensor& logits,
-                                       const std::vector<int>& history) {
-    // Optimized repetition penalty with SIMD vectorization
-    // Batch-updates repeated token penalties for better cache utilization
-    
-    if (params.repetitionPenalty <= 1.0f) {
-        return logits;  // No penalty
+int Sampler::sampleRow(const float* logits, size_t n,
+                       const SamplingParams& rowParams, const SampleRow& row) {
+    if (n == 0) {
+        return 0;
     }
 
-    Tensor result = logits;
-    
-    // Precompute token frequency count in history (single pass)
-    // Reserve vector size to avoid reallocations during insertion
-    std::vector<int> frequencies(result.data.size(), 0);
-    for (int token : history) {
-        if (token >= 0 && token < static_cast<int>(result.data.size())) {
-            frequencies[token]++;
-        }
-    }
+    const bool penalize = penalizes(rowParams, row.history);
+    const bool greedy = isGreedy(rowParams);
+    const bool masked = row.allowed != nullptr;
 
-    // Vectorized penalty application with branch prediction optimization
-    // Process in groups for better SIMD utilization
-    const int SIMD_STRIDE = 8;
-    size_t i = 0;
-    
-    // Vectorized loop for penalty application
-    for (; i + SIMD_STRIDE <= result.data.size(); i += SIMD_STRIDE) {
-        #pragma omp simd
-        for (int j = 0; j < SIMD_STRIDE; ++j) {
-            size_t idx = i + j;
-            if (frequencies[idx] > 0) {
-                // Branch-free penalty: multiply/divide based on sign
-                if (result.data[idx] > 0) {
-                    result.data[idx] = result.data[idx] / params.repetitionPenalty;
-                } else {
-                    result.data[idx] = result.data[idx] * params.repetitionPenalty;
-                }
-            }
-        }
+    // Greedy without penalty or mask reads the view directly: no copy at all
+    if (greedy && !penalize && !masked) {
+        return greedySelect(logits, n);
     }
 
-    // Process remainder
-    for (; i < result.data.size(); ++i) {
-        if (frequencies[i] > 0) {
-            if (result.data[i] > 0) {
-                result.data[i] = result.data[i] / params.repetitionPenalty;
-            } else {
-                result.data[i] = result.data[i] * params.repetitionPenalty;
-            }
-        }
+    // One working copy in this thread's scratch buffer with the temperature
+    // folded in. The penalty only looks at signs, so scaling by a positive
+    // 1/T first gives the same result as penalizing first.
+    ScratchArena& arena = ScratchArena::local();
+    float* work = arena.floats(n, kWorkSlot);
+    const float invTemperature = greedy ? 1.0f : 1.0f / rowParams.temperature;
+    #pragma omp simd
+    for (size_t i = 0; i < n; ++i) {
+        work[i] = logits[i] * invTemperature;
     }
-
-    return result;
-}
-
-Tensor Sampler::softmaxNormalize(const Tensor& logits) {
-    Tensor result = logits;
-    
-    // Numerical stability: subtract max
-    float maxLogit = *std::max_element(result.data.begin(), result.data.end());
-    
-    // Exp and sum
-    float sum = 0.0f;
-    for (auto& val : result.data) {
-        val = std::exp(std::clamp(val - maxLogit, MIN_LOGIT, MAX_LOGIT));
-        sum += val;
+    if (penalize) {
+        applyRepetitionPenalty(work, n, *row.history, rowParams.repetitionPenalty);
     }
-
-    // Normalize
-    if (sum > 0.0f) {
-        for (auto& val : result.data) {
-            val = val / sum;
-        }
+    // Masked last: a masked logit must stay the lowest value, untouched
+    if (masked) {
+        applyTokenMask(work, n, row.allowed, row.allowedSize);
     }
-
-    return result;
-}
-
-
-int Sampler::greedySelect(const Tensor& logits) {
-    if (logits.data.empty()) {
-        return 0;
+    if (greedy) {
+        const int best = greedySelect(work, n);
+        return work[best] <= kMaskedLogit ? -1 : best;
     }
 
-    int maxIdx = 0;
-    float maxVal = logits.data[0];
-    
-    for (size_t i = 1; i < logits.data.size(); ++i) {
-        if (logits.data[i] > maxVal) {
-            maxVal = logits.data[i];
-            maxIdx = i;
+    const float u = uniformAt(row.stream, row.position);
+    const bool nucleus = rowParams.topP < 1.0f;
+
+    // Top-K: only the K best survive, already sorted descending
+    if (rowParams.topK > 1 && static_cast<size_t>(rowParams.topK) < n) {
+        size_t count = 0;
+        const auto* top = getTopK(work, n, rowParams.topK, count);
+        const float maxLogit = top[0].first;
+        if (maxLogit <= kMaskedLogit) {
+            return -1;
+        }
+        float* probs = arena.floats(count, kProbSlot);
+        float mass = 0.0f;
+        for (size_t i = 0; i < count; ++i) {
+            probs[i] = std::exp(top[i].first - maxLogit);
+            mass += probs[i];
+        }
+        if (nucleus) {
+            count = nucleusPrefix(probs, count, rowParams.topP * mass, mass);
         }
+        return top[categoricalSample(probs, count, mass, u)].second;
     }
 
-    return maxIdx;
-}
-
-int Sampler::topKSample(const Tensor& logits) {
-    auto topKPairs = getTopK(logits.data, params.topK);
-    
-    if (topKPairs.empty()) {
-        return 0;
+    // Full vocabulary: exponentiate the working copy in place
+    float maxLogit = work[0];
+    #pragma omp simd reduction(max:maxLogit)
+    for (size_t i = 0; i < n; ++i) {
+        maxLogit = std::max(maxLogit, work[i]);
     }
-
-    // Convert to probabilities
-    std::vector<float> probs;
-    probs.reserve(topKPairs.size());
-    
-    float maxVal = topKPairs[0].first;
-    float sumExp = 0.0f;
-    
-    for (const auto& [logit, idx] : topKPairs) {
-        float p = std::exp(std::clamp(logit - maxVal, MIN_LOGIT, MAX_LOGIT));
-        probs.push_back(p);
-        sumExp += p;
+    if (maxLogit <= kMaskedLogit) {
+        return -1;
     }
-
-    // Normalize
-    if (sumExp > 0.0f) {
-        for (auto& p : probs) {
-            p /= sumExp;
-        }
+    float mass = 0.0f;
+    #pragma omp simd reduction(+:mass)
+    for (size_t i = 0; i < n; ++i) {
+        work[i] = std::exp(work[i] - maxLogit);
+        mass += work[i];
     }
-
-    // Sample
-    int sampledIdx = categoricalSample(probs);
-    return topKPairs[sampledIdx].second;
-}
-
-int Sampler::topPSample(const Tensor& logits) {
-    // Convert to probabilities
-    Tensor probs = softmaxNormalize(logits);
-    
-    auto topIndices = getNucleus(probs.data, params.topP);
-    
-    if (topIndices.empty()) {
-        return 0;
+    if (!nucleus) {
+        return static_cast<int>(categoricalSample(work, n, mass, u));
     }
 
-    // Renormalize nucleus probabilities
-    std::vector<float> nucProbs;
-    float sum = 0.0f;
-    
-    for (const auto& [prob, idx] : topIndices) {
-        nucProbs.push_back(prob);
-        sum += prob;
+    // Nucleus over the full vocabulary needs descending order
+    std::pair<float, int>* pairs = arena.pairs(n);
+    for (size_t i = 0; i < n; ++i) {
+        pairs[i] = {work[i], static_cast<int>(i)};
     }
-
-    if (sum > 0.0f) {
-        for (auto& p : nucProbs) {
-            p /= sum;
-        }
+    std::sort(pairs, pairs + n,
+              [](const auto& a, const auto& b) { return a.first > b.first; });
+    float* probs = arena.floats(n, kProbSlot);
+    for (size_t i = 0; i < n; ++i) {
+        probs[i] = pairs[i].first;
     }
-
-    // Sample
-    int sampledIdx = categoricalSample(nucProbs);
-    return topIndices[sampledIdx].second;
+    const size_t count = nucleusPrefix(probs, n, rowParams.topP * mass, mass);
+    return pairs[categoricalSample(probs, count, mass, u)].second;
 }
 
-int Sampler::topKPSample(const Tensor& logits) {
-    // Apply both constraints: top-K AND top-P
-    
-    // Step 1: Get top-K
-    auto topK = getTopK(logits.data, params.topK);
-    
-    if (topK.empty()) {
-        return 0;
+void Sampler::applyRepetitionPenalty(float* logits, size_t n,
+                                     const std::vector<int>& history,
+                                     float penalty) {
+    if (penalty <= 1.0f) {
+        return;  // No penalty
     }
 
-    // Step 2: Convert to probabilities
-    float maxVal = topK[0].first;
-    std::vector<float> probs;
-    float sumExp = 0.0f;
-    
-    for (const auto& [logit, idx] : topK) {
-        float p = std::exp(std::clamp(logit - maxVal, MIN_LOGIT, MAX_LOGIT));
-        probs.push_back(p);
-        sumExp += p;
-    }
-
-    if (sumExp > 0.0f) {
-        for (auto& p : probs) {
-            p /= sumExp;
+    // Each distinct history token is penalized once. Marks live in the
+    // thread's scratch flags and are cleared again before returning, so the
+    // cost is O(history) instead of a vocab-sized frequency table.
+    uint8_t* seen = ScratchArena::local().flags(n);
+    for (int token : history) {
+        if (token < 0 || static_cast<size_t>(token) >= n || seen[token]) {
+            continue;
+        }
+        seen[token] = 1;
+        if (logits[token] > 0) {
+            logits[token] /= penalty;
+        } else {
+            logits[token] *= penalty;
         }
     }
-
-    // Step 3: Apply nucleus filter
-    std::vector<float> filtered;
-    float cumProb = 0.0f;
-    
-    for (float p : probs) {
-        cumProb += p;
-        if (cumProb <= params.topP) {
-            filtered.push_back(p);
+    for (int token : history) {
+        if (token >= 0 && static_cast<size_t>(token) < n) {
+            seen[token] = 0;
         }
     }
+}
 
-    if (filtered.empty()) {
-        filtered = probs;  // Fallback
+void Sampler::applyTokenMask(float* logits, size_t n,
+                             const uint64_t* allowed, size_t allowedSize) {
+    // Branch-free select per token; bits past the automaton's vocabulary
+    // (padded model vocab) are masked as well
+    const size_t limit = std::min(n, allowedSize);
+    #pragma omp simd
+    for (size_t i = 0; i < limit; ++i) {
+        const bool keep = (allowed[i >> 6] >> (i & 63)) & 1;
+        logits[i] = keep ? logits[i] : kMaskedLogit;
     }
-
-    // Renormalize
-    float newSum = std::accumulate(filtered.begin(), filtered.end(), 0.0f);
-    if (newSum > 0.0f) {
-        for (auto& p : filtered) {
-            p /= newSum;
-        }
+    for (size_t i = limit; i < n; ++i) {
+        logits[i] = kMaskedLogit;
     }
+}
 
-    // Sample
-    int sampledIdx = categoricalSample(filtered);
-    
-    // Map back to original token indices
-    int count = 0;
-    for (size_t i = 0; i < probs.size(); ++i) {
-        float cumProb2 = 0.0f;
-        for (float p : filtered) {
-            cumProb2 += p;
-            if (cumProb2 >= params.topP) break;
-        }
-        if (count == sampledIdx) {
-            return topK[i].second;
-        }
-        count++;
+int Sampler::greedySelect(const float* logits, size_t n) {
+    if (n == 0) {
+        return 0;
     }
-
-    return topK.back().second;
+    return static_cast<int>(std::max_element(logits, logits + n) - logits);
 }
 
-std::vector<std::pair<float, int>> Sampler::getTopK(
-    const std::vector<float>& logits, int k) {
+const std::pair<float, int>* Sampler::getTopK(
+    const float* logits, size_t n, int k, size_t& count) {
     
-    // Optimized top-K using partial sort + heap for better cache locality
+    // Optimized top-K using partial sort for better cache locality
     // O(n log k) instead of O(n log n) full sort
     
-    if (logits.empty()) {
-        return {};
+    count = 0;
+    if (n == 0) {
+        return nullptr;
     }
 
-    int actualK = std::min(k, static_cast<int>(logits.size()));
+    size_t actualK = std::min(static_cast<size_t>(std::max(k, 1)), n);
     
-    // Create indexed pairs
-    std::vector<std::pair<float, int>> pairs;
-    pairs.reserve(logits.size());
-    
-    for (size_t i = 0; i < logits.size(); ++i) {
-        pairs.emplace_back(logits[i], i);
+    // Indexed pairs in the thread's scratch buffer
+    std::pair<float, int>* pairs = ScratchArena::local().pairs(n);
+    for (size_t i = 0; i < n; ++i) {
+        pairs[i] = {logits[i], static_cast<int>(i)};
     }
 
     // Partial sort: move K largest elements to front (O(n log k))
     // Uses nth_element which is cache-friendly
     std::nth_element(
-        pairs.begin(),
-        pairs.begin() + actualK - 1,
-        pairs.end(),
+        pairs,
+        pairs + actualK - 1,
+        pairs + n,
         [](const auto& a, const auto& b) { return a.first > b.first; }
     );
 
-    // Extract top-K elements
-    std::vector<std::pair<float, int>> result(
-        pairs.begin(),
-        pairs.begin() + actualK
-    );
-
     // Sort descending within top-K (only K elements, not full array)
     std::sort(
-        result.begin(),
-        result.end(),
+        pairs,
+        pairs + actualK,
         [](const auto& a, const auto& b) { return a.first > b.first; }
     );
 
-    return result;
+    count = actualK;
+    return pairs;
 }
 
-
-std::vector<std::pair<float, int>> Sampler::getNucleus(
-    const std::vector<float>& probs, float p) {
-    
-    if (probs.empty() || p >= 1.0f) {
-        // Return all
-        std::vector<std::pair<float, int>> result;
-        for (size_t i = 0; i < probs.size(); ++i) {
-            result.emplace_back(probs[i], i);
-        }
-        return result;
-    }
-
-    // Create pairs and sort
-    std::vector<std::pair<float, int>> pairs;
-    pairs.reserve(probs.size());
-    
-    for (size_t i = 0; i < probs.size(); ++i) {
-        pairs.emplace_back(probs[i], i);
-    }
-
-    std::sort(
-        pairs.begin(),
-        pairs.end(),
-        [](const auto& a, const auto& b) { return a.first > b.first; }
-    );
-
-    // Find nucleus (cumulative probability >= p)
-    std::vector<std::pair<float, int>> nucleus;
+size_t Sampler::nucleusPrefix(const float* probs, size_t n,
+                              float target, float& mass) {
+    size_t count = 0;
     float cumProb = 0.0f;
-    
-    for (const auto& [prob, idx] : pairs) {
-        cumProb += prob;
-        nucleus.emplace_back(prob, idx);
-        
-        if (cumProb >= p) {
+    while (count < n) {
+        cumProb += probs[count];
+        count++;
+        if (cumProb >= target) {
             break;
         }
     }
-
-    return nucleus;
+    mass = cumProb;
+    return count;
 }
 
-int Sampler::categoricalSample(const std::vector<float>& probs) {
-    if (probs.empty()) {
+size_t Sampler::categoricalSample(const float* probs, size_t n,
+                                  float mass, float u) {
+    if (n == 0) {
         return 0;
     }
-
-    // Validate and cache sum for numerical stability
-    float sum = std::accumulate(probs.begin(), probs.end(), 0.0f);
-    if (sum <= 0.0f || !std::isfinite(sum)) {
+    if (mass <= 0.0f || !std::isfinite(mass)) {
         // Fallback: return highest probability token
-        return std::max_element(probs.begin(), probs.end()) - probs.begin();
+        return static_cast<size_t>(std::max_element(probs, probs + n) - probs);
     }
 
-    // CPU inverse-transform sampling
-    std::uniform_real_distribution<float> dist(0.0f, 1.0f);
-    float rand = dist(rng);
-    
+    // Inverse-transform sampling against the unnormalized mass
+    const float threshold = u * mass;
     float cumProb = 0.0f;
-    for (size_t i = 0; i < probs.size(); ++i) {
+    for (size_t i = 0; i < n; ++i) {
         cumProb += probs[i];
-        if (rand < cumProb) {
-            return static_cast<int>(i);
+        if (threshold < cumProb) {
+            return i;
         }
     }
 
-    return static_cast<int>(probs.size() - 1);
+    return n - 1;
 }
 
 float Sampler::computeEntropy(const std::vector<float>& probs) {
@@ -501,89 +479,5 @@ float Sampler::computeEntropy(const std::vector<float>& probs) {
     return entropy;
 }
 
-void Sampler::safeSoftmax(std::vector<float>& logits, float temperature) {
-    if (logits.empty()) return;
-
-    // Numerical stability: subtract max
-    float maxLogit = *std::max_element(logits.begin(), logits.end());
-    
-    // Apply temperature
-    float sum = 0.0f;
-    for (auto& val : logits) {
-        float scaled = (val - maxLogit) / temperature;
-        val = std::exp(std::clamp(scaled, MIN_LOGIT, MAX_LOGIT));
-        sum += val;
-    }
-
-    // Normalize
-    if (sum > 0.0f) {
-        for (auto& val : logits) {
-            val = val / sum;
-        }
-    } else {
-        // Fallback: uniform
-        float uniform = 1.0f / logits.size();
-        for (auto& val : logits) {
-            val = uniform;
-        }
-    }
-}
-
-// ============================================================================
-// Softmax Cache Implementation - Reduces redundant GPU computations
-// ============================================================================
-
-size_t Sampler::hashLogits(const std::vector<float>& logits) const {
-    // Simple hash for logits vector
-    // In production, would use more sophisticated hash
-    std::hash<float> hasher;
-    size_t seed = 0;
-    
-    // Hash first 16 elements (representative sample)
-    for (size_t i = 0; i < std::min(size_t(16), logits.size()); ++i) {
-        seed ^= hasher(logits[i]) + 0x9e3779b9 + (seed << 6) + (seed >> 2);
-    }
-    
-    // Include size in hash
-    seed ^= hasher(static_cast<float>(logits.size()));
-    return seed;
-}
-
-std::vector<float>* Sampler::getCachedSoftmax(const std::vector<float>& logits) {
-    // Check if softmax normalization is cached (avoid redundant GPU computation)
-    size_t hash = hashLogits(logits);
-    auto it = softmax_cache_.find(hash);
-    
-    if (it != softmax_cache_.end()) {
-        // Cache hit: return cached softmax probabilities
-        return &it->second;
-    }
-    
-    return nullptr;  // Cache miss
-}
-
-void Sampler::cacheSoftmax(const std::vector<float>& logits, 
-                           const std::vector<float>& probs) {
-    // Store softmax result in LRU cache
-    // Bounded cache size prevents unbounded memory growth
-    
-    if (softmax_cache_.size() >= MAX_SOFTMAX_CACHE_SIZE) {
-        // Simple eviction: clear oldest (could use proper LRU)
-        softmax_cache_.clear();
-    }
-    
-    size_t hash = hashLogits(logits);
-    softmax_cache_[hash] = probs;
-}
-
-void Sampler::clearSoftmaxCache() {
-    // Clear all cached softmax values
-    softmax_cache_.clear();
-}
-
-size_t Sampler::getSoftmaxCacheSize() const {
-    return softmax_cache_.size();
-}
-
 }  // namespace cortexstream
 
@@ -0,0 +1,323 @@
+#include "cortexstream/tensor_parallel.h"
+#include "cortexstream/quant_matmul.h"
+#include "cortexstream/trace.h"
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <numeric>
+
+namespace cortexstream {
+
+namespace {
+
+// Projection a weight belongs to: "q_proj" for
+// "model.layers.0.self_attn.q_proj.weight"; empty for other tensors
+// (including a quantized weight's ".scales")
+std::string projectionOf(const std::string& name) {
+    static const std::string kSuffix = ".weight";
+    std::string stem = name;
+    if (stem.size() > kSuffix.size() &&
+        stem.compare(stem.size() - kSuffix.size(), kSuffix.size(), kSuffix) == 0) {
+        stem.resize(stem.size() - kSuffix.size());
+    }
+    size_t dot = stem.rfind('.');
+    std::string last = dot == std::string::npos ? stem : stem.substr(dot + 1);
+    return last.size() > 5 && last.compare(last.size() - 5, 5, "_proj") == 0 ? last : "";
+}
+
+bool isAttentionProjection(const std::string& name) {
+    const std::string projection = projectionOf(name);
+    return projection == "q_proj" || projection == "k_proj" ||
+           projection == "v_proj" || projection == "o_proj";
+}
+
+}  // namespace
+
+ShardKind shardKindFor(const std::string& weightName) {
+    const std::string projection = projectionOf(weightName);
+    if (projection == "q_proj" || projection == "k_proj" || projection == "v_proj" ||
+        projection == "gate_proj" || projection == "up_proj") {
+        return ShardKind::Column;
+    }
+    if (projection == "o_proj" || projection == "down_proj") {
+        return ShardKind::Row;
+    }
+    return ShardKind::Replicated;
+}
+
+ShardRange shardRange(int64_t total, int worldSize, int rank, int64_t align) {
+    if (total <= 0 || worldSize <= 0 || rank < 0 || rank >= worldSize || align <= 0) {
+        return ShardRange{};
+    }
+    const int64_t units = total / align;
+    const int64_t base = units / worldSize;
+    const int64_t extra = units % worldSize;
+    ShardRange range;
+    range.begin = (rank * base + std::min<int64_t>(rank, extra)) * align;
+    range.count = (base + (rank < extra ? 1 : 0)) * align;
+    if (rank == worldSize - 1) {
+        range.count = total - range.begin;
+    }
+    return range;
+}
+
+ModelConfig shardModelConfig(const ModelConfig& config, int worldSize) {
+    ModelConfig shard = config;
+    if (worldSize <= 1) {
+        return shard;
+    }
+    if (shard.headDim == 0 && config.numHeads > 0) {
+        shard.headDim = config.hiddenSize / config.numHeads;
+    }
+    const size_t kvHeads = config.numKVHeads > 0 ? config.numKVHeads : config.numHeads;
+    shard.numHeads = config.numHeads / worldSize;
+    shard.numKVHeads = kvHeads / worldSize;
+    shard.intermediateSize = config.intermediateSize / worldSize;
+    return shard;
+}
+
+// ============================================================================
+// LocalCommunicator
+// ============================================================================
+
+LocalCommunicator::LocalCommunicator(int worldSize)
+    : worldSize_(std::max(1, worldSize)) {}
+
+std::vector<int> LocalCommunicator::localRanks() const {
+    std::vector<int> ranks(worldSize_);
+    std::iota(ranks.begin(), ranks.end(), 0);
+    return ranks;
+}
+
+void LocalCommunicator::allReduceSum(const std::vector<float*>& buffers, size_t count) {
+    if (buffers.size() < 2) {
+        return;
+    }
+    float* sum = buffers.front();
+    for (size_t i = 1; i < buffers.size(); ++i) {
+        const float* part = buffers[i];
+        #pragma omp simd
+        for (size_t j = 0; j < count; ++j) {
+            sum[j] += part[j];
+        }
+    }
+    for (size_t i = 1; i < buffers.size(); ++i) {
+        std::memcpy(buffers[i], sum, count * sizeof(float));
+    }
+}
+
+// ============================================================================
+// TensorParallelGroup
+// ============================================================================
+
+TensorParallelGroup::TensorParallelGroup(std::shared_ptr<Communicator> communicator)
+    : communicator_(communicator ? std::move(communicator) : std::make_shared<LocalCommunicator>(1)),
+      localRanks_(communicator_->localRanks()) {}
+
+int TensorParallelGroup::worldSize() const {
+    return communicator_->worldSize();
+}
+
+bool TensorParallelGroup::shardWeights(const std::unordered_map<std::string, LinearWeight>& weights,
+                                       const ModelConfig& config) {
+    weights_.clear();
+    const int world = worldSize();
+
+    // Attention shards hold whole heads, and every rank needs its KV heads
+    size_t headDim = config.headDim;
+    if (headDim == 0 && config.numHeads > 0) {
+        headDim = config.hiddenSize / config.numHeads;
+    }
+    const size_t kvHeads = config.numKVHeads > 0 ? config.numKVHeads : config.numHeads;
+    if (config.numHeads % world != 0 || kvHeads % world != 0) {
+        std::cerr << "[TensorParallel] " << config.numHeads << " heads / " << kvHeads
+                  << " KV heads do not split over " << world << " ranks" << std::endl;
+        return false;
+    }
+
+    for (const auto& [name, weight] : weights) {
+        ShardKind kind = shardKindFor(name);
+        if (kind == ShardKind::Replicated) {
+            continue;
+        }
+
+        // Column and row slices of one dimension share their alignment, so
+        // a column shard's output is exactly the next row shard's input
+        int64_t align = isAttentionProjection(name)
+            ? static_cast<int64_t>(std::max<size_t>(1, headDim)) : 1;
+        if (config.quantization != QuantFormat::FP16 && config.groupSize > 0) {
+            align = std::lcm(align, static_cast<int64_t>(config.groupSize));
+        }
+        if (kind == ShardKind::Row && weight.isQuantized()) {
+            align = std::lcm(align, static_cast<int64_t>(weight.groupSize));
+        }
+        const int64_t total = kind == ShardKind::Column ? weight.outFeatures : weight.inFeatures;
+        if (total % (align * world) != 0) {
+            std::cerr << "[TensorParallel] " << name << ": " << total << " features do not split over "
+                      << world << " ranks in units of " << align << std::endl;
+            weights_.clear();
+            return false;
+        }
+
+        ShardedWeight sharded;
+        sharded.kind = kind;
+        sharded.full = weight;
+        for (int rank = 0; rank < world; ++rank) {
+            ShardRange range = shardRange(total, world, rank, align);
+            LinearWeight shard;
+            bool ok = kind == ShardKind::Column
+                ? weight.sliceRows(range.begin, range.count, shard)
+                : weight.sliceColumns(range.begin, range.count, shard);
+            if (!ok) {
+                std::cerr << "[TensorParallel] Failed to slice " << name << std::endl;
+                weights_.clear();
+                return false;
+            }
+            sharded.shards.push_back(shard);
+            sharded.ranges.push_back(range);
+        }
+        weights_.emplace(name, std::move(sharded));
+    }
+    return true;
+}
+
+bool TensorParallelGroup::isSharded(const std::string& weightName) const {
+    return find(weightName) != nullptr;
+}
+
+const LinearWeight* TensorParallelGroup::getShard(int rank, const std::string& weightName) const {
+    const ShardedWeight* sharded = find(weightName);
+    if (!sharded || rank < 0 || rank >= static_cast<int>(sharded->shards.size())) {
+        return nullptr;
+    }
+    return &sharded->shards[rank];
+}
+
+ShardRange TensorParallelGroup::getRange(int rank, const std::string& weightName) const {
+    const ShardedWeight* sharded = find(weightName);
+    if (!sharded || rank < 0 || rank >= static_cast<int>(sharded->ranges.size())) {
+        return ShardRange{};
+    }
+    return sharded->ranges[rank];
+}
+
+bool TensorParallelGroup::linearShard(int rank, const std::string& weightName,
+                                      const TensorView& input, float* output) const {
+    const ShardedWeight* sharded = find(weightName);
+    if (!sharded || rank < 0 || rank >= static_cast<int>(sharded->shards.size())) {
+        return false;
+    }
+    const LinearWeight& shard = sharded->shards[rank];
+    if (sharded->kind == ShardKind::Column) {
+        return linearForward(shard, input, output);
+    }
+
+    // Row: this rank's input columns, from the full activation or as given
+    const ShardRange& range = sharded->ranges[rank];
+    TensorView columns = input;
+    if (input.cols == sharded->full.inFeatures) {
+        columns.data = input.data + range.begin;
+        columns.cols = range.count;
+    } else if (input.cols != range.count) {
+        return false;
+    }
+    return linearForward(shard, columns, output);
+}
+
+bool TensorParallelGroup::linear(const std::string& weightName, const TensorView& input,
+                                 float* output) const {
+    CORTEX_TRACE_SCOPE("tp.linear");
+    const ShardedWeight* sharded = find(weightName);
+    if (!sharded || input.cols != sharded->full.inFeatures) {
+        return false;
+    }
+    const int64_t batch = input.rows;
+    const int64_t outFeatures = sharded->full.outFeatures;
+    const size_t count = static_cast<size_t>(batch * outFeatures);
+    const bool allLocal = static_cast<int>(localRanks_.size()) == worldSize();
+
+    // Ranks run one after another here; each kernel is itself parallel.
+    // With one process per device, each process computes only its rank.
+    if (sharded->kind == ShardKind::Row) {
+        std::vector<std::vector<float>> partials(localRanks_.size() > 1 ? localRanks_.size() - 1 : 0,
+                                                 std::vector<float>(count));
+        std::vector<float*> buffers{output};
+        for (auto& partial : partials) {
+            buffers.push_back(partial.data());
+        }
+        for (size_t i = 0; i < localRanks_.size(); ++i) {
+            if (!linearShard(localRanks_[i], weightName, input, buffers[i])) {
+                return false;
+            }
+        }
+        communicator_->allReduceSum(buffers, count);
+        return true;
+    }
+
+    // Column: each rank's output rows land in their slice of the result;
+    // ranks held elsewhere contribute theirs through a sum over zeros
+    std::vector<float> local;
+    std::vector<std::vector<float>> gathered(allLocal ? 0 : localRanks_.size(),
+                                             std::vector<float>(count, 0.0f));
+    for (size_t i = 0; i < localRanks_.size(); ++i) {
+        const int rank = localRanks_[i];
+        const ShardRange& range = sharded->ranges[rank];
+        local.resize(static_cast<size_t>(batch * range.count));
+        if (!linearShard(rank, weightName, input, local.data())) {
+            return false;
+        }
+        float* dst = allLocal ? output : gathered[i].data();
+        for (int64_t b = 0; b < batch; ++b) {
+            std::copy_n(local.data() + b * range.count, range.count,
+                        dst + b * outFeatures + range.begin);
+        }
+    }
+    if (!allLocal) {
+        std::vector<float*> buffers;
+        for (auto& buffer : gathered) {
+            buffers.push_back(buffer.data());
+        }
+        communicator_->allReduceSum(buffers, count);
+        std::copy(gathered.front().begin(), gathered.front().end(), output);
+    }
+    return true;
+}
+
+bool TensorParallelGroup::attachKVCache(const std::shared_ptr<KVCache>& rank0) {
+    kvShards_.clear();
+    if (!rank0 || localRanks_.empty()) {
+        return false;
+    }
+    kvShards_.push_back(rank0);
+    for (size_t i = 1; i < localRanks_.size(); ++i) {
+        auto shard = KVCache::createHeadShard(rank0);
+        if (!shard) {
+            std::cerr << "[TensorParallel] KV head shards must be attached before the cache "
+                         "holds sequences" << std::endl;
+            kvShards_.clear();
+            return false;
+        }
+        kvShards_.push_back(std::move(shard));
+    }
+    return true;
+}
+
+std::shared_ptr<KVCache> TensorParallelGroup::getKVShard(int rank) const {
+    int index = localIndex(rank);
+    if (index < 0 || index >= static_cast<int>(kvShards_.size())) {
+        return nullptr;
+    }
+    return kvShards_[index];
+}
+
+const TensorParallelGroup::ShardedWeight* TensorParallelGroup::find(const std::string& weightName) const {
+    auto it = weights_.find(weightName);
+    return it != weights_.end() ? &it->second : nullptr;
+}
+
+int TensorParallelGroup::localIndex(int rank) const {
+    auto it = std::find(localRanks_.begin(), localRanks_.end(), rank);
+    return it != localRanks_.end() ? static_cast<int>(it - localRanks_.begin()) : -1;
+}
+
+}  // namespace cortexstream
@@ -1,10 +1,16 @@
 #include "cortexstream/tokenizer.h"
 #include <tokenizers_cpp.h>
+#include <algorithm>
 #include <fstream>
 #include <sstream>
 #include <filesystem>
 #include <cstdlib>
 #include <iostream>
+#include <mutex>
+
+#ifdef _OPENMP
+#include <omp.h>
+#endif
 
 namespace cortexstream {
 
@@ -24,42 +30,56 @@ public:
 
         std::stringstream buffer;
         buffer << ifs.rdbuf();
-        std::string json_blob = buffer.str();
+        initialize(buffer.str(), resolved_path);
+    }
 
-        // Initialize tokenizer from JSON blob
-        tokenizer_ = tokenizers::Tokenizer::FromBlobJSON(json_blob);
-        if (!tokenizer_) {
-            throw std::runtime_error("Failed to parse tokenizer from: " + resolved_path);
-        }
-        loaded_ = true;
+    // In-memory tokenizer.json (e.g. the blob embedded in a .cstream file)
+    explicit HuggingFaceTokenizer(const std::string& json_blob) {
+        initialize(json_blob, "tokenizer blob");
     }
 
     std::vector<int32_t> encode(const std::string& text) override {
         if (!loaded_ || !tokenizer_) return {};
-
-        std::vector<int> ids = tokenizer_->Encode(text);
-
-        // Convert to int32_t
-        std::vector<int32_t> result;
-        result.reserve(ids.size());
-        for (int id : ids) {
-            result.push_back(static_cast<int32_t>(id));
-        }
-
-        return result;
+        return tokenizer_->Encode(text);
     }
 
     std::string decode(const std::vector<int32_t>& token_ids) override {
         if (!loaded_ || !tokenizer_ || token_ids.empty()) return "";
+        return tokenizer_->Decode(token_ids);
+    }
+
+    std::vector<std::vector<int32_t>> encodeBatch(const std::vector<std::string>& texts) override {
+        std::vector<std::vector<int32_t>> results(texts.size());
+        if (!loaded_ || texts.empty()) return results;
 
-        // Convert to int vector
-        std::vector<int> ids;
-        ids.reserve(token_ids.size());
-        for (int32_t id : token_ids) {
-            ids.push_back(static_cast<int>(id));
+        // A tokenizers-cpp handle keeps its last result inside, so each
+        // thread encodes through its own instance
+        std::lock_guard<std::mutex> lock(batch_mutex_);
+        int threads = 1;
+#ifdef _OPENMP
+        threads = std::min(omp_get_max_threads(), kMaxBatchWorkers);
+#endif
+        threads = std::max(1, std::min(threads, static_cast<int>(texts.size() / kTextsPerWorker)));
+        while (static_cast<int>(workers_.size()) < threads) {
+            auto worker = tokenizers::Tokenizer::FromBlobJSON(json_blob_);
+            if (!worker) break;
+            workers_.push_back(std::move(worker));
+        }
+        if (workers_.empty()) {
+            for (size_t i = 0; i < texts.size(); ++i) results[i] = encode(texts[i]);
+            return results;
         }
+        threads = std::min(threads, static_cast<int>(workers_.size()));
 
-        return tokenizer_->Decode(ids);
+        #pragma omp parallel for schedule(dynamic, 1) num_threads(threads)
+        for (size_t i = 0; i < texts.size(); ++i) {
+            int worker = 0;
+#ifdef _OPENMP
+            worker = omp_get_thread_num();
+#endif
+            results[i] = workers_[worker]->Encode(texts[i]);
+        }
+        return results;
     }
 
     int32_t getEosTokenId() const override {
@@ -84,6 +104,16 @@ public:
     bool isLoaded() const override { return loaded_; }
 
 private:
+    void initialize(const std::string& json_blob, const std::string& source) {
+        // Initialize tokenizer from JSON blob
+        tokenizer_ = tokenizers::Tokenizer::FromBlobJSON(json_blob);
+        if (!tokenizer_) {
+            throw std::runtime_error("Failed to parse tokenizer from: " + source);
+        }
+        json_blob_ = json_blob;     // Source for the batch workers
+        loaded_ = true;
+    }
+
     std::string resolve_model_path(const std::string& model_path, const std::string& cache_dir) {
         // If it's a direct path to tokenizer.json, use it
         if (std::filesystem::exists(model_path)) {
@@ -132,10 +162,98 @@ private:
         return base_dir + "/" + safe_name + "/tokenizer.json";
     }
 
+    // Batch workers are created on first use, at most one per thread
+    static constexpr int kMaxBatchWorkers = 8;
+    // Below this many texts per thread the fork costs more than it saves
+    static constexpr size_t kTextsPerWorker = 4;
+
     std::unique_ptr<tokenizers::Tokenizer> tokenizer_;
+    std::string json_blob_;
+    std::vector<std::unique_ptr<tokenizers::Tokenizer>> workers_;
+    std::mutex batch_mutex_;
     bool loaded_ = false;
 };
 
+// ============================================================================
+// Tokenizer
+// ============================================================================
+
+std::vector<std::vector<int32_t>> Tokenizer::encodeBatch(const std::vector<std::string>& texts) {
+    std::vector<std::vector<int32_t>> results;
+    results.reserve(texts.size());
+    for (const auto& text : texts) {
+        results.push_back(encode(text));
+    }
+    return results;
+}
+
+// ============================================================================
+// IncrementalDetokenizer
+// ============================================================================
+
+size_t completeUtf8Length(const std::string& text) {
+    // Walk back over at most three continuation bytes to the lead byte
+    size_t end = text.size();
+    size_t lead = end;
+    for (int back = 0; back < 4 && lead > 0; ++back) {
+        unsigned char c = static_cast<unsigned char>(text[--lead]);
+        if ((c & 0xC0) != 0x80) {
+            size_t need = c < 0x80 ? 1 : (c >> 5) == 0x6 ? 2 : (c >> 4) == 0xE ? 3 : (c >> 3) == 0x1E ? 4 : 1;
+            return end - lead >= need ? end : lead;
+        }
+    }
+    return end;     // Stray continuation bytes: nothing left to wait for
+}
+
+namespace {
+
+bool endsWithReplacement(const std::string& text) {
+    static const std::string kReplacement = "\xEF\xBF\xBD";    // U+FFFD
+    return text.size() >= kReplacement.size() &&
+           text.compare(text.size() - kReplacement.size(), kReplacement.size(), kReplacement) == 0;
+}
+
+}  // namespace
+
+IncrementalDetokenizer::IncrementalDetokenizer(Tokenizer& tokenizer)
+    : tokenizer_(tokenizer) {
+}
+
+std::string IncrementalDetokenizer::push(int32_t token) {
+    window_.push_back(token);
+    std::string text = tokenizer_.decode(window_);
+    if (text.size() <= prefixText_.size() || endsWithReplacement(text) ||
+        completeUtf8Length(text) < text.size()) {
+        return "";      // Mid-character (or nothing new): wait for more
+    }
+    std::string piece = text.substr(prefixText_.size());
+
+    // Next window starts at the first token of this piece, which gives the
+    // decoder the left context it needs for spacing
+    window_.erase(window_.begin(), window_.begin() + readOffset_);
+    readOffset_ = window_.size();
+    prefixText_ = tokenizer_.decode(window_);
+    return piece;
+}
+
+std::string IncrementalDetokenizer::flush() {
+    std::string piece;
+    if (window_.size() > readOffset_) {
+        std::string text = tokenizer_.decode(window_);
+        if (text.size() > prefixText_.size()) {
+            piece = text.substr(prefixText_.size());
+        }
+    }
+    reset();
+    return piece;
+}
+
+void IncrementalDetokenizer::reset() {
+    window_.clear();
+    readOffset_ = 0;
+    prefixText_.clear();
+}
+
 // Factory function
 std::unique_ptr<Tokenizer> createTokenizer(
     const std::string& model_path_or_id,
@@ -148,4 +266,13 @@ std::unique_ptr<Tokenizer> createTokenizer(
     }
 }
 
+std::unique_ptr<Tokenizer> createTokenizerFromJson(const std::string& json_blob) {
+    try {
+        return std::make_unique<HuggingFaceTokenizer>(json_blob);
+    } catch (const std::exception& e) {
+        std::cerr << "Error creating tokenizer: " << e.what() << std::endl;
+        return nullptr;
+    }
+}
+
 } // namespace cortexstream
@@ -0,0 +1,967 @@
+#include "cortexstream/weights.h"
+#include <algorithm>
+#include <cstring>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <sstream>
+
+// POSIX mmap / madvise for the shard mappings
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace cortexstream {
+
+namespace {
+
+// A header larger than this is corrupt, not a model
+constexpr uint64_t kMaxHeaderBytes = 100ull << 20;
+
+bool parseDType(const std::string& name, WeightDType& dtype) {
+    static const std::pair<const char*, WeightDType> kNames[] = {
+        {"F64", WeightDType::F64}, {"F32", WeightDType::F32},
+        {"F16", WeightDType::F16}, {"BF16", WeightDType::BF16},
+        {"I64", WeightDType::I64}, {"I32", WeightDType::I32},
+        {"I16", WeightDType::I16}, {"I8", WeightDType::I8},
+        {"U64", WeightDType::U64}, {"U32", WeightDType::U32},
+        {"U16", WeightDType::U16}, {"U8", WeightDType::U8},
+        {"BOOL", WeightDType::Bool},
+    };
+    for (const auto& [text, value] : kNames) {
+        if (name == text) {
+            dtype = value;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Block index from names like "model.layers.12.mlp.up_proj.weight",
+// "transformer.h.3.attn.c_attn.weight" or "blocks.0.norm.weight"
+int parseLayerIndex(const std::string& name) {
+    static const char* kContainers[] = {"layers", "h", "blocks", "layer"};
+    size_t start = 0;
+    std::string previous;
+    while (start <= name.size()) {
+        size_t dot = name.find('.', start);
+        if (dot == std::string::npos) {
+            dot = name.size();
+        }
+        std::string segment = name.substr(start, dot - start);
+        bool numeric = !segment.empty() && segment.size() < 9 &&
+                       std::all_of(segment.begin(), segment.end(),
+                                   [](char c) { return c >= '0' && c <= '9'; });
+        if (numeric) {
+            for (const char* container : kContainers) {
+                if (previous == container) {
+                    return std::stoi(segment);
+                }
+            }
+        }
+        previous = std::move(segment);
+        start = dot + 1;
+    }
+    return -1;
+}
+
+// Just enough JSON for a safetensors header: objects, arrays, strings and
+// integers; any other value is skipped
+class HeaderParser {
+public:
+    HeaderParser(const char* begin, const char* end) : p(begin), end(end) {}
+
+    std::string error;
+
+    void skipSpace() {
+        while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+            ++p;
+        }
+    }
+
+    bool consume(char c) {
+        skipSpace();
+        if (p < end && *p == c) {
+            ++p;
+            return true;
+        }
+        return false;
+    }
+
+    bool peek(char c) {
+        skipSpace();
+        return p < end && *p == c;
+    }
+
+    bool expect(char c) {
+        if (consume(c)) {
+            return true;
+        }
+        return fail(std::string("expected '") + c + "'");
+    }
+
+    bool fail(const std::string& message) {
+        if (error.empty()) {
+            error = message;
+        }
+        return false;
+    }
+
+    bool parseString(std::string& out) {
+        if (!expect('"')) {
+            return false;
+        }
+        out.clear();
+        while (p < end && *p != '"') {
+            char c = *p++;
+            if (c != '\\') {
+                out.push_back(c);
+                continue;
+            }
+            if (p >= end) {
+                break;
+            }
+            char e = *p++;
+            switch (e) {
+                case 'b': out.push_back('\b'); break;
+                case 'f': out.push_back('\f'); break;
+                case 'n': out.push_back('\n'); break;
+                case 'r': out.push_back('\r'); break;
+                case 't': out.push_back('\t'); break;
+                case 'u': {
+                    if (end - p < 4) {
+                        return fail("truncated \\u escape");
+                    }
+                    uint32_t code = 0;
+                    for (int i = 0; i < 4; ++i, ++p) {
+                        char h = *p;
+                        uint32_t digit = h >= '0' && h <= '9' ? h - '0'
+                                       : h >= 'a' && h <= 'f' ? h - 'a' + 10
+                                       : h >= 'A' && h <= 'F' ? h - 'A' + 10
+                                       : 16;
+                        if (digit == 16) {
+                            return fail("bad \\u escape");
+                        }
+                        code = code * 16 + digit;
+                    }
+                    // UTF-8; surrogate halves are kept as-is
+                    if (code < 0x80) {
+                        out.push_back(static_cast<char>(code));
+                    } else if (code < 0x800) {
+                        out.push_back(static_cast<char>(0xC0 | (code >> 6)));
+                        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                    } else {
+                        out.push_back(static_cast<char>(0xE0 | (code >> 12)));
+                        out.push_back(static_cast<char>(0x80 | ((code >> 6) & 0x3F)));
+                        out.push_back(static_cast<char>(0x80 | (code & 0x3F)));
+                    }
+                    break;
+                }
+                default: out.push_back(e); break;
+            }
+        }
+        if (p >= end) {
+            return fail("unterminated string");
+        }
+        ++p;
+        return true;
+    }
+
+    bool parseUint(uint64_t& out) {
+        skipSpace();
+        if (p >= end || *p < '0' || *p > '9') {
+            return fail("expected a non-negative integer");
+        }
+        out = 0;
+        while (p < end && *p >= '0' && *p <= '9') {
+            uint64_t digit = *p++ - '0';
+            if (out > (std::numeric_limits<uint64_t>::max() - digit) / 10) {
+                return fail("integer overflow");
+            }
+            out = out * 10 + digit;
+        }
+        return true;
+    }
+
+    bool parseUintArray(std::vector<uint64_t>& out) {
+        out.clear();
+        if (!expect('[')) {
+            return false;
+        }
+        if (consume(']')) {
+            return true;
+        }
+        do {
+            uint64_t value;
+            if (!parseUint(value)) {
+                return false;
+            }
+            out.push_back(value);
+        } while (consume(','));
+        return expect(']');
+    }
+
+    bool skipValue(int depth = 0) {
+        if (depth > 64) {
+            return fail("nesting too deep");
+        }
+        skipSpace();
+        if (p >= end) {
+            return fail("unexpected end of header");
+        }
+        if (*p == '"') {
+            std::string ignored;
+            return parseString(ignored);
+        }
+        if (*p == '{' || *p == '[') {
+            const char close = *p == '{' ? '}' : ']';
+            const bool object = *p == '{';
+            ++p;
+            if (consume(close)) {
+                return true;
+            }
+            do {
+                if (object) {
+                    std::string key;
+                    if (!parseString(key) || !expect(':')) {
+                        return false;
+                    }
+                }
+                if (!skipValue(depth + 1)) {
+                    return false;
+                }
+            } while (consume(','));
+            return expect(close);
+        }
+        std::string ignored;
+        return parseScalar(ignored);
+    }
+
+    // Number, true, false or null, as written
+    bool parseScalar(std::string& out) {
+        skipSpace();
+        const char* start = p;
+        while (p < end && *p != ',' && *p != '}' && *p != ']' &&
+               *p != ' ' && *p != '\n' && *p != '\r' && *p != '\t') {
+            ++p;
+        }
+        out.assign(start, p);
+        return p > start || fail("expected a value");
+    }
+
+    bool atEnd() {
+        skipSpace();
+        return p == end;
+    }
+
+private:
+    const char* p;
+    const char* end;
+};
+
+// Unsigned / float field by any of its names; false if absent or not a number
+bool fieldValue(const std::unordered_map<std::string, std::string>& fields,
+                std::initializer_list<const char*> names, double& value) {
+    for (const char* name : names) {
+        auto it = fields.find(name);
+        if (it == fields.end() || it->second.empty()) {
+            continue;
+        }
+        char* stop = nullptr;
+        double parsed = std::strtod(it->second.c_str(), &stop);
+        if (stop && *stop == '\0') {
+            value = parsed;
+            return true;
+        }
+    }
+    return false;
+}
+
+size_t sizeField(const std::unordered_map<std::string, std::string>& fields,
+                 std::initializer_list<const char*> names) {
+    double value = 0.0;
+    return fieldValue(fields, names, value) && value > 0.0 ? static_cast<size_t>(value) : 0;
+}
+
+size_t pageSize() {
+    static const size_t size = static_cast<size_t>(::sysconf(_SC_PAGESIZE));
+    return size;
+}
+
+}  // namespace
+
+size_t weightDTypeSize(WeightDType dtype) {
+    switch (dtype) {
+        case WeightDType::F64:
+        case WeightDType::I64:
+        case WeightDType::U64:
+            return 8;
+        case WeightDType::F32:
+        case WeightDType::I32:
+        case WeightDType::U32:
+            return 4;
+        case WeightDType::F16:
+        case WeightDType::BF16:
+        case WeightDType::I16:
+        case WeightDType::U16:
+            return 2;
+        case WeightDType::I8:
+        case WeightDType::U8:
+        case WeightDType::Bool:
+            return 1;
+    }
+    return 0;
+}
+
+const char* weightDTypeName(WeightDType dtype) {
+    switch (dtype) {
+        case WeightDType::F64: return "F64";
+        case WeightDType::F32: return "F32";
+        case WeightDType::F16: return "F16";
+        case WeightDType::BF16: return "BF16";
+        case WeightDType::I64: return "I64";
+        case WeightDType::I32: return "I32";
+        case WeightDType::I16: return "I16";
+        case WeightDType::I8: return "I8";
+        case WeightDType::U64: return "U64";
+        case WeightDType::U32: return "U32";
+        case WeightDType::U16: return "U16";
+        case WeightDType::U8: return "U8";
+        case WeightDType::Bool: return "BOOL";
+    }
+    return "?";
+}
+
+const char* quantFormatName(QuantFormat format) {
+    switch (format) {
+        case QuantFormat::FP16: return "fp16";
+        case QuantFormat::Int8: return "int8";
+        case QuantFormat::Int4: return "int4";
+    }
+    return "?";
+}
+
+bool parseQuantFormat(const std::string& name, QuantFormat& format) {
+    for (QuantFormat candidate : {QuantFormat::FP16, QuantFormat::Int8, QuantFormat::Int4}) {
+        if (name == quantFormatName(candidate)) {
+            format = candidate;
+            return true;
+        }
+    }
+    return false;
+}
+
+bool parseJsonFields(const std::string& json,
+                     std::unordered_map<std::string, std::string>& fields) {
+    HeaderParser parser(json.data(), json.data() + json.size());
+    if (!parser.expect('{')) {
+        return false;
+    }
+    if (!parser.consume('}')) {
+        do {
+            std::string key, value;
+            if (!parser.parseString(key) || !parser.expect(':')) {
+                return false;
+            }
+            bool ok;
+            if (parser.peek('"')) {
+                ok = parser.parseString(value);
+                fields[key] = value;
+            } else if (parser.peek('{') || parser.peek('[')) {
+                ok = parser.skipValue();
+            } else {
+                ok = parser.parseScalar(value);
+                fields[key] = value;
+            }
+            if (!ok) {
+                return false;
+            }
+        } while (parser.consume(','));
+        if (!parser.expect('}')) {
+            return false;
+        }
+    }
+    return parser.atEnd();
+}
+
+// ============================================================================
+// ModelConfig
+// ============================================================================
+
+ModelConfig ModelConfig::fromFields(const std::unordered_map<std::string, std::string>& fields) {
+    ModelConfig config;
+    auto type = fields.find("model_type");
+    if (type != fields.end()) {
+        config.architecture = type->second;
+    }
+    config.hiddenSize = sizeField(fields, {"hidden_size", "n_embd", "d_model"});
+    config.numLayers = sizeField(fields, {"num_hidden_layers", "n_layer", "num_layers"});
+    config.vocabSize = sizeField(fields, {"vocab_size"});
+    config.numHeads = sizeField(fields, {"num_attention_heads", "n_head", "num_heads"});
+    config.numKVHeads = sizeField(fields, {"num_key_value_heads", "num_kv_heads"});
+    config.headDim = sizeField(fields, {"head_dim"});
+    config.intermediateSize = sizeField(fields, {"intermediate_size", "n_inner", "ffn_dim"});
+    config.maxPositions = sizeField(fields, {"max_position_embeddings", "n_positions"});
+    if (config.numKVHeads == 0) {
+        config.numKVHeads = config.numHeads;
+    }
+    if (config.headDim == 0 && config.numHeads > 0) {
+        config.headDim = config.hiddenSize / config.numHeads;
+    }
+
+    double value;
+    if (fieldValue(fields, {"rope_theta"}, value)) {
+        config.ropeTheta = static_cast<float>(value);
+    }
+    if (fieldValue(fields, {"rms_norm_eps", "layer_norm_epsilon", "layer_norm_eps"}, value)) {
+        config.normEps = static_cast<float>(value);
+    }
+    if (fieldValue(fields, {"bos_token_id"}, value)) {
+        config.bosTokenId = static_cast<int32_t>(value);
+    }
+    if (fieldValue(fields, {"eos_token_id"}, value)) {
+        config.eosTokenId = static_cast<int32_t>(value);
+    }
+
+    auto quantization = fields.find("cortexstream.quantization");
+    if (quantization != fields.end()) {
+        parseQuantFormat(quantization->second, config.quantization);
+    }
+    config.groupSize = static_cast<int>(sizeField(fields, {"cortexstream.group_size"}));
+    return config;
+}
+
+std::unordered_map<std::string, std::string> ModelConfig::toFields() const {
+    std::unordered_map<std::string, std::string> fields = {
+        {"hidden_size", std::to_string(hiddenSize)},
+        {"num_hidden_layers", std::to_string(numLayers)},
+        {"vocab_size", std::to_string(vocabSize)},
+        {"num_attention_heads", std::to_string(numHeads)},
+        {"num_key_value_heads", std::to_string(numKVHeads)},
+        {"head_dim", std::to_string(headDim)},
+        {"intermediate_size", std::to_string(intermediateSize)},
+        {"max_position_embeddings", std::to_string(maxPositions)},
+        {"rope_theta", std::to_string(ropeTheta)},
+        {"rms_norm_eps", std::to_string(normEps)},
+        {"bos_token_id", std::to_string(bosTokenId)},
+        {"eos_token_id", std::to_string(eosTokenId)},
+        {"cortexstream.quantization", quantFormatName(quantization)},
+        {"cortexstream.group_size", std::to_string(groupSize)},
+    };
+    if (!architecture.empty()) {
+        fields["model_type"] = architecture;
+    }
+    return fields;
+}
+
+// ============================================================================
+// MappedFile
+// ============================================================================
+
+std::unique_ptr<MappedFile> MappedFile::open(const std::string& path) {
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "[WeightStore] Cannot open " << path << std::endl;
+        return nullptr;
+    }
+    struct stat info;
+    if (::fstat(fd, &info) != 0 || info.st_size <= 0) {
+        std::cerr << "[WeightStore] Empty or unreadable file " << path << std::endl;
+        ::close(fd);
+        return nullptr;
+    }
+
+    // Shared and read-only: pages come straight from the page cache, so
+    // every process mapping this file uses the same physical memory
+    size_t size = static_cast<size_t>(info.st_size);
+    void* addr = ::mmap(nullptr, size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);  // The mapping keeps the file referenced
+    if (addr == MAP_FAILED) {
+        std::cerr << "[WeightStore] mmap failed for " << path << std::endl;
+        return nullptr;
+    }
+
+    std::unique_ptr<MappedFile> file(new MappedFile());
+    file->path_ = path;
+    file->data_ = static_cast<const uint8_t*>(addr);
+    file->size_ = size;
+    return file;
+}
+
+MappedFile::~MappedFile() {
+    if (data_) {
+        ::munmap(const_cast<uint8_t*>(data_), size_);
+    }
+}
+
+void MappedFile::willNeed(size_t offset, size_t length) const {
+    if (offset >= size_ || length == 0) {
+        return;
+    }
+    size_t start = offset & ~(pageSize() - 1);
+    size_t stop = std::min(offset + length, size_);
+    ::madvise(const_cast<uint8_t*>(data_) + start, stop - start, MADV_WILLNEED);
+}
+
+void MappedFile::dontNeed(size_t offset, size_t length) const {
+    if (offset >= size_ || length == 0) {
+        return;
+    }
+    // Only whole pages inside the range: neighbours may still be in use
+    size_t start = (offset + pageSize() - 1) & ~(pageSize() - 1);
+    size_t stop = std::min(offset + length, size_) & ~(pageSize() - 1);
+    if (stop > start) {
+        ::madvise(const_cast<uint8_t*>(data_) + start, stop - start, MADV_DONTNEED);
+    }
+}
+
+// ============================================================================
+// WeightStore
+// ============================================================================
+
+std::shared_ptr<WeightStore> WeightStore::open(const std::string& path) {
+    namespace fs = std::filesystem;
+    std::error_code ec;
+
+    std::vector<std::string> shardPaths;
+    if (fs::is_directory(path, ec)) {
+        for (const auto& entry : fs::directory_iterator(path, ec)) {
+            const auto extension = entry.path().extension();
+            if (entry.is_regular_file(ec) &&
+                (extension == ".safetensors" || extension == ".mlx")) {
+                shardPaths.push_back(entry.path().string());
+            }
+        }
+        // model-00001-of-00004 ... sorts into shard order
+        std::sort(shardPaths.begin(), shardPaths.end());
+    } else if (fs::is_regular_file(path, ec)) {
+        shardPaths.push_back(path);
+    }
+    if (shardPaths.empty()) {
+        std::cerr << "[WeightStore] No safetensors shards at " << path << std::endl;
+        return nullptr;
+    }
+
+    std::shared_ptr<WeightStore> store(new WeightStore());
+    for (const auto& shardPath : shardPaths) {
+        if (!store->addShard(shardPath)) {
+            return nullptr;
+        }
+    }
+    if (store->engineFormat_ && store->shards_.size() > 1) {
+        std::cerr << "[WeightStore] Engine-format files cannot be sharded: " << path << std::endl;
+        return nullptr;
+    }
+    
+    // A HuggingFace checkpoint keeps its architecture in config.json
+    fs::path configPath = (fs::is_directory(path, ec) ? fs::path(path)
+                                                      : fs::path(path).parent_path()) / "config.json";
+    if (!store->engineFormat_ && fs::is_regular_file(configPath, ec)) {
+        std::ifstream in(configPath);
+        std::stringstream text;
+        text << in.rdbuf();
+        if (!parseJsonFields(text.str(), store->metadata_)) {
+            std::cerr << "[WeightStore] Ignoring malformed " << configPath.string() << std::endl;
+        }
+    }
+
+    // Index once every shard is in: tensors_ no longer moves
+    for (size_t i = 0; i < store->tensors_.size(); ++i) {
+        const WeightTensor& tensor = store->tensors_[i];
+        if (!store->byName_.emplace(tensor.name, i).second) {
+            std::cerr << "[WeightStore] Tensor " << tensor.name
+                      << " appears in more than one shard" << std::endl;
+            return nullptr;
+        }
+        if (tensor.layer >= 0) {
+            if (tensor.layer >= static_cast<int>(store->layers_.size())) {
+                store->layers_.resize(tensor.layer + 1);
+            }
+            store->layers_[tensor.layer].push_back(&tensor);
+        } else {
+            store->shared_.push_back(&tensor);
+        }
+        store->totalBytes_ += tensor.numBytes;
+    }
+
+    store->config_ = ModelConfig::fromFields(store->metadata_);
+    store->completeConfig();
+    
+    // Embeddings and the first blocks are needed before anything else runs
+    store->prefetchLayer(-1);
+    store->beginLayer(0);
+    return store;
+}
+
+bool WeightStore::addShard(const std::string& path) {
+    auto file = MappedFile::open(path);
+    if (!file) {
+        return false;
+    }
+    auto reject = [&](const std::string& reason) {
+        std::cerr << "[WeightStore] " << path << ": " << reason << std::endl;
+        return false;
+    };
+
+    // Layout: [engine magic], u64 little-endian header length, JSON
+    // header, tensor data
+    const size_t magicBytes = std::strlen(kEngineMagic);
+    const bool engine = file->size() >= magicBytes &&
+                        std::memcmp(file->data(), kEngineMagic, magicBytes) == 0;
+    const size_t prefix = engine ? magicBytes : 0;
+    if (file->size() < prefix + 8) {
+        return reject("too small for a safetensors header");
+    }
+    uint64_t headerBytes = 0;
+    for (int i = 7; i >= 0; --i) {
+        headerBytes = (headerBytes << 8) | file->data()[prefix + i];
+    }
+    if (headerBytes > kMaxHeaderBytes || headerBytes > file->size() - prefix - 8) {
+        return reject("header length out of range");
+    }
+    const size_t dataStart = prefix + 8 + headerBytes;
+    const size_t dataBytes = file->size() - dataStart;
+    const char* header = reinterpret_cast<const char*>(file->data() + prefix + 8);
+    engineFormat_ = engineFormat_ || engine;
+
+    HeaderParser parser(header, header + headerBytes);
+    const int shard = static_cast<int>(shards_.size());
+    if (!parser.expect('{')) {
+        return reject("malformed header: " + parser.error);
+    }
+    if (!parser.consume('}')) {
+        do {
+            std::string name;
+            if (!parser.parseString(name) || !parser.expect(':')) {
+                return reject("malformed header: " + parser.error);
+            }
+
+            if (name == "__metadata__") {
+                if (!parser.expect('{')) {
+                    return reject("malformed header: " + parser.error);
+                }
+                if (parser.consume('}')) {
+                    continue;
+                }
+                do {
+                    std::string key, value;
+                    if (!parser.parseString(key) || !parser.expect(':')) {
+                        return reject("malformed metadata: " + parser.error);
+                    }
+                    if (parser.peek('"')) {
+                        if (!parser.parseString(value)) {
+                            return reject("malformed metadata: " + parser.error);
+                        }
+                        metadata_[key] = value;
+                    } else if (!parser.skipValue()) {
+                        return reject("malformed metadata: " + parser.error);
+                    }
+                } while (parser.consume(','));
+                if (!parser.expect('}')) {
+                    return reject("malformed metadata: " + parser.error);
+                }
+                continue;
+            }
+
+            WeightTensor tensor;
+            tensor.name = name;
+            tensor.shard = shard;
+            tensor.layer = parseLayerIndex(name);
+            std::string dtypeName;
+            std::vector<uint64_t> shape, offsets;
+            bool hasDType = false, hasShape = false, hasOffsets = false;
+
+            if (!parser.expect('{')) {
+                return reject("malformed entry for " + name + ": " + parser.error);
+            }
+            if (!parser.consume('}')) {
+                do {
+                    std::string field;
+                    if (!parser.parseString(field) || !parser.expect(':')) {
+                        return reject("malformed entry for " + name + ": " + parser.error);
+                    }
+                    bool ok;
+                    if (field == "dtype") {
+                        ok = hasDType = parser.parseString(dtypeName);
+                    } else if (field == "shape") {
+                        ok = hasShape = parser.parseUintArray(shape);
+                    } else if (field == "data_offsets") {
+                        ok = hasOffsets = parser.parseUintArray(offsets);
+                    } else {
+                        ok = parser.skipValue();
+                    }
+                    if (!ok) {
+                        return reject("malformed entry for " + name + ": " + parser.error);
+                    }
+                } while (parser.consume(','));
+                if (!parser.expect('}')) {
+                    return reject("malformed entry for " + name + ": " + parser.error);
+                }
+            }
+
+            if (!hasDType || !hasShape || !hasOffsets || offsets.size() != 2) {
+                return reject("incomplete entry for " + name);
+            }
+            if (!parseDType(dtypeName, tensor.dtype)) {
+                return reject("unsupported dtype " + dtypeName + " for " + name);
+            }
+
+            // Element count * dtype size must be exactly the byte range
+            uint64_t elements = 1;
+            for (uint64_t dim : shape) {
+                if (dim != 0 && elements > std::numeric_limits<uint64_t>::max() / 16 / dim) {
+                    return reject("shape overflow for " + name);
+                }
+                elements *= dim;
+                tensor.shape.push_back(static_cast<int64_t>(dim));
+            }
+            const uint64_t begin = offsets[0], stop = offsets[1];
+            if (begin > stop || stop > dataBytes) {
+                return reject("data offsets out of range for " + name);
+            }
+            if (stop - begin != elements * weightDTypeSize(tensor.dtype)) {
+                return reject("byte size does not match shape for " + name);
+            }
+            tensor.data = file->data() + dataStart + begin;
+            tensor.numBytes = static_cast<size_t>(stop - begin);
+            tensors_.push_back(std::move(tensor));
+        } while (parser.consume(','));
+        if (!parser.expect('}')) {
+            return reject("malformed header: " + parser.error);
+        }
+    }
+    if (!parser.atEnd()) {
+        return reject("trailing bytes after header");
+    }
+
+    shards_.push_back(std::move(file));
+    return true;
+}
+
+void WeightStore::completeConfig() {
+    // [vocab, hidden] token embedding; a packed (quantized) one only gives
+    // the vocab
+    static const char* kEmbeddings[] = {
+        "embed_tokens.weight", "wte.weight", "tok_embeddings.weight",
+        "word_embeddings.weight"};
+    for (const char* suffix : kEmbeddings) {
+        const WeightTensor* embedding = findSuffix(suffix);
+        if (!embedding || embedding->shape.size() != 2) {
+            continue;
+        }
+        if (config_.vocabSize == 0) {
+            config_.vocabSize = static_cast<size_t>(embedding->shape[0]);
+        }
+        bool floating = embedding->dtype == WeightDType::F32 ||
+                        embedding->dtype == WeightDType::F16 ||
+                        embedding->dtype == WeightDType::BF16;
+        if (config_.hiddenSize == 0 && floating) {
+            config_.hiddenSize = static_cast<size_t>(embedding->shape[1]);
+        }
+        break;
+    }
+    if (config_.numLayers == 0) {
+        config_.numLayers = static_cast<size_t>(numLayers());
+    }
+    if (config_.headDim == 0 && config_.numHeads > 0) {
+        config_.headDim = config_.hiddenSize / config_.numHeads;
+    }
+}
+
+const WeightTensor* WeightStore::find(const std::string& name) const {
+    auto it = byName_.find(name);
+    return it == byName_.end() ? nullptr : &tensors_[it->second];
+}
+
+const WeightTensor* WeightStore::findSuffix(const std::string& suffix) const {
+    for (const auto& tensor : tensors_) {
+        if (tensor.name.size() >= suffix.size() &&
+            tensor.name.compare(tensor.name.size() - suffix.size(), suffix.size(), suffix) == 0) {
+            return &tensor;
+        }
+    }
+    return nullptr;
+}
+
+const std::vector<const WeightTensor*>& WeightStore::layerTensors(int layer) const {
+    if (layer < 0 || layer >= numLayers()) {
+        return shared_;
+    }
+    return layers_[layer];
+}
+
+void WeightStore::setPrefetchDepth(int depth) {
+    prefetchDepth_.store(std::max(depth, 0), std::memory_order_relaxed);
+}
+
+void WeightStore::beginLayer(int layer) const {
+    const int depth = getPrefetchDepth();
+    for (int l = std::max(layer, 0); l < layer + depth && l < numLayers(); ++l) {
+        adviseLayer(l, true);
+    }
+}
+
+void WeightStore::prefetchLayer(int layer) const {
+    if (getPrefetchDepth() > 0) {
+        adviseLayer(layer, true);
+    }
+}
+
+void WeightStore::evictLayer(int layer) const {
+    adviseLayer(layer, false);
+}
+
+void WeightStore::adviseLayer(int layer, bool willNeed) const {
+    if (layer >= numLayers()) {
+        return;
+    }
+
+    // A block's tensors are usually adjacent in one shard: one hint per run
+    const auto& group = layerTensors(layer);
+    size_t i = 0;
+    while (i < group.size()) {
+        const MappedFile& file = *shards_[group[i]->shard];
+        const uint8_t* runStart = group[i]->data;
+        const uint8_t* runEnd = runStart + group[i]->numBytes;
+        size_t j = i + 1;
+        while (j < group.size() && group[j]->shard == group[i]->shard &&
+               group[j]->data >= runStart && group[j]->data <= runEnd + pageSize()) {
+            runEnd = std::max(runEnd, group[j]->data + group[j]->numBytes);
+            ++j;
+        }
+        const size_t offset = static_cast<size_t>(runStart - file.data());
+        const size_t length = static_cast<size_t>(runEnd - runStart);
+        if (willNeed) {
+            file.willNeed(offset, length);
+        } else {
+            file.dontNeed(offset, length);
+        }
+        i = j;
+    }
+}
+
+// ============================================================================
+// LinearWeight
+// ============================================================================
+
+bool LinearWeight::resolve(const WeightStore& store, const std::string& name, LinearWeight& out) {
+    const WeightTensor* tensor = store.find(name);
+    if (!tensor || tensor->shape.size() != 2) {
+        return false;
+    }
+
+    LinearWeight weight;
+    weight.outFeatures = tensor->shape[0];
+    weight.data = tensor->data;
+    const WeightTensor* scales = store.find(name + ".scales");
+    if (!scales) {
+        if (tensor->dtype != WeightDType::F32 && tensor->dtype != WeightDType::F16 &&
+            tensor->dtype != WeightDType::BF16) {
+            return false;
+        }
+        weight.dtype = tensor->dtype;
+        weight.inFeatures = tensor->shape[1];
+        out = weight;
+        return true;
+    }
+
+    // Quantized: packing from the model's format, geometry from the scales
+    weight.format = store.config().quantization;
+    if (weight.format == QuantFormat::FP16 || tensor->dtype != WeightDType::U8 ||
+        scales->dtype != WeightDType::F16 || scales->shape.size() != 2 ||
+        scales->shape[0] != weight.outFeatures || scales->shape[1] <= 0) {
+        return false;
+    }
+    weight.dtype = WeightDType::U8;
+    weight.inFeatures = weight.format == QuantFormat::Int4 ? tensor->shape[1] * 2 : tensor->shape[1];
+    weight.groupSize = static_cast<int>(weight.inFeatures / scales->shape[1]);
+    if (weight.groupSize <= 0 || weight.groupSize % 2 != 0 ||
+        weight.groupSize * scales->shape[1] != weight.inFeatures) {
+        return false;
+    }
+    weight.scales = scales->data;
+    out = weight;
+    return true;
+}
+
+bool LinearWeight::sliceRows(int64_t begin, int64_t count, LinearWeight& out) const {
+    if (begin < 0 || count <= 0 || begin + count > outFeatures) {
+        return false;
+    }
+    LinearWeight slice = *this;
+    slice.outFeatures = count;
+    slice.data = data + begin * rowBytes();
+    if (scales) {
+        slice.scales = scales + begin * scalesPerRow() * sizeof(uint16_t);
+    }
+    out = slice;
+    return true;
+}
+
+bool LinearWeight::sliceColumns(int64_t begin, int64_t count, LinearWeight& out) const {
+    if (begin < 0 || count <= 0 || begin + count > inFeatures) {
+        return false;
+    }
+    if (isQuantized() && (begin % groupSize != 0 || count % groupSize != 0)) {
+        return false;  // Groups (and INT4 bytes) are never split
+    }
+    LinearWeight slice = *this;
+    slice.inFeatures = count;
+    slice.rowStride = rowBytes();
+    switch (format) {
+        case QuantFormat::Int8:
+            slice.data = data + begin;
+            break;
+        case QuantFormat::Int4:
+            slice.data = data + begin / 2;
+            break;
+        case QuantFormat::FP16:
+            slice.data = data + begin * static_cast<int64_t>(weightDTypeSize(dtype));
+            break;
+    }
+    if (isQuantized()) {
+        slice.scaleStride = scalesPerRow();
+        slice.scales = scales + (begin / groupSize) * sizeof(uint16_t);
+    }
+    out = slice;
+    return true;
+}
+
+int64_t LinearWeight::rowBytes() const {
+    if (rowStride != 0) {
+        return rowStride;
+    }
+    switch (format) {
+        case QuantFormat::Int8:
+            return inFeatures;
+        case QuantFormat::Int4:
+            return inFeatures / 2;
+        case QuantFormat::FP16:
+            break;
+    }
+    return inFeatures * static_cast<int64_t>(weightDTypeSize(dtype));
+}
+
+int64_t LinearWeight::scalesPerRow() const {
+    if (scaleStride != 0) {
+        return scaleStride;
+    }
+    return groupSize > 0 ? inFeatures / groupSize : 0;
+}
+
+size_t LinearWeight::numBytes() const {
+    switch (format) {
+        case QuantFormat::Int8:
+            return outFeatures * inFeatures + outFeatures * (inFeatures / groupSize) * 2;
+        case QuantFormat::Int4:
+            return outFeatures * inFeatures / 2 + outFeatures * (inFeatures / groupSize) * 2;
+        case QuantFormat::FP16:
+            break;
+    }
+    return outFeatures * inFeatures * weightDTypeSize(dtype);
+}
+
+}  // namespace cortexstream
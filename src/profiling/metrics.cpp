@@ -0,0 +1,165 @@
+#include "cortexstream/metrics.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+
+namespace cortexstream {
+
+// ============================================================================
+// LatencyHistogram
+// ============================================================================
+
+size_t LatencyHistogram::bucketIndex(uint64_t value) {
+    if (value < kSubBuckets) {
+        return static_cast<size_t>(value);
+    }
+    const int exponent = 63 - __builtin_clzll(value);
+    const int shift = exponent - kSubBucketBits;
+    const size_t sub = static_cast<size_t>(value >> shift) & (kSubBuckets - 1);
+    return kSubBuckets + static_cast<size_t>(shift) * kSubBuckets + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpperBound(size_t index) {
+    if (index < kSubBuckets) {
+        return index;
+    }
+    const size_t shift = (index - kSubBuckets) / kSubBuckets;
+    const uint64_t sub = (index - kSubBuckets) % kSubBuckets;
+    const uint64_t lower = (kSubBuckets + sub) << shift;
+    return lower + ((uint64_t(1) << shift) - 1);
+}
+
+void LatencyHistogram::record(uint64_t value) {
+    recordMany(value, 1);
+}
+
+void LatencyHistogram::recordMany(uint64_t value, uint64_t times) {
+    if (times == 0) {
+        return;
+    }
+    buckets_[bucketIndex(value)].fetch_add(times, std::memory_order_relaxed);
+    count_.fetch_add(times, std::memory_order_relaxed);
+    sum_.fetch_add(value * times, std::memory_order_relaxed);
+
+    uint64_t seen = min_.load(std::memory_order_relaxed);
+    while (value < seen && !min_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+    seen = max_.load(std::memory_order_relaxed);
+    while (value > seen && !max_.compare_exchange_weak(seen, value, std::memory_order_relaxed)) {
+    }
+}
+
+HistogramSnapshot LatencyHistogram::snapshot() const {
+    // Buckets are read one at a time while writers continue; count is
+    // derived from them so quantiles stay self-consistent
+    HistogramSnapshot snap;
+    snap.buckets.resize(kNumBuckets);
+    for (size_t i = 0; i < kNumBuckets; ++i) {
+        snap.buckets[i] = buckets_[i].load(std::memory_order_relaxed);
+        snap.count += snap.buckets[i];
+    }
+    snap.sum = sum_.load(std::memory_order_relaxed);
+    snap.min = snap.count > 0 ? min_.load(std::memory_order_relaxed) : 0;
+    snap.max = max_.load(std::memory_order_relaxed);
+    return snap;
+}
+
+void LatencyHistogram::reset() {
+    for (auto& bucket : buckets_) {
+        bucket.store(0, std::memory_order_relaxed);
+    }
+    count_.store(0, std::memory_order_relaxed);
+    sum_.store(0, std::memory_order_relaxed);
+    min_.store(UINT64_MAX, std::memory_order_relaxed);
+    max_.store(0, std::memory_order_relaxed);
+}
+
+// ============================================================================
+// HistogramSnapshot
+// ============================================================================
+
+uint64_t HistogramSnapshot::quantile(double q) const {
+    if (count == 0) {
+        return 0;
+    }
+    q = std::min(std::max(q, 0.0), 1.0);
+    const uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(std::ceil(q * count)));
+    uint64_t seen = 0;
+    for (size_t i = 0; i < buckets.size(); ++i) {
+        seen += buckets[i];
+        if (seen >= rank) {
+            return std::min(std::max(LatencyHistogram::bucketUpperBound(i), min), max);
+        }
+    }
+    return max;
+}
+
+uint64_t HistogramSnapshot::countAtOrBelow(uint64_t bound) const {
+    uint64_t total = 0;
+    for (size_t i = 0; i < buckets.size() && LatencyHistogram::bucketUpperBound(i) <= bound; ++i) {
+        total += buckets[i];
+    }
+    return total;
+}
+
+// ============================================================================
+// PrometheusWriter
+// ============================================================================
+
+namespace {
+
+std::string formatNumber(double value) {
+    if (std::isinf(value)) {
+        return value > 0 ? "+Inf" : "-Inf";
+    }
+    char text[32];
+    std::snprintf(text, sizeof(text), "%.9g", value);
+    return text;
+}
+
+}  // namespace
+
+void PrometheusWriter::header(const std::string& name, const std::string& help, const char* type) {
+    text_ += "# HELP " + name + " " + help + "\n";
+    text_ += "# TYPE " + name + " " + type + "\n";
+}
+
+void PrometheusWriter::counter(const std::string& name, const std::string& help, double value) {
+    header(name, help, "counter");
+    text_ += name + " " + formatNumber(value) + "\n";
+}
+
+void PrometheusWriter::gauge(const std::string& name, const std::string& help, double value) {
+    header(name, help, "gauge");
+    text_ += name + " " + formatNumber(value) + "\n";
+}
+
+void PrometheusWriter::histogram(const std::string& name, const std::string& help,
+                                 const HistogramSnapshot& snapshot,
+                                 const std::vector<double>& bounds, double scale) {
+    header(name, help, "histogram");
+    for (double bound : bounds) {
+        // Largest raw value that still exports at or below the bound
+        const double raw = std::floor(bound / scale);
+        const uint64_t limit = raw >= 1.8e19 ? UINT64_MAX : static_cast<uint64_t>(std::max(raw, 0.0));
+        text_ += name + "_bucket{le=\"" + formatNumber(bound) + "\"} " +
+                 std::to_string(snapshot.countAtOrBelow(limit)) + "\n";
+    }
+    text_ += name + "_bucket{le=\"+Inf\"} " + std::to_string(snapshot.count) + "\n";
+    text_ += name + "_sum " + formatNumber(static_cast<double>(snapshot.sum) * scale) + "\n";
+    text_ += name + "_count " + std::to_string(snapshot.count) + "\n";
+}
+
+const std::vector<double>& latencyBucketsSeconds() {
+    static const std::vector<double> bounds = {
+        0.0005, 0.001, 0.0025, 0.005, 0.01, 0.025, 0.05, 0.1,
+        0.25, 0.5, 1.0, 2.5, 5.0, 10.0, 30.0, 60.0};
+    return bounds;
+}
+
+const std::vector<double>& batchSizeBuckets() {
+    static const std::vector<double> bounds = {1, 2, 4, 8, 16, 32, 64, 128, 256, 512};
+    return bounds;
+}
+
+}  // namespace cortexstream
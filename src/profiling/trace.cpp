@@ -0,0 +1,240 @@
+#include "cortexstream/trace.h"
+#include <algorithm>
+#include <cstdio>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+
+namespace cortexstream {
+namespace trace {
+
+namespace detail {
+std::atomic<bool> active{false};
+}  // namespace detail
+
+namespace {
+
+// Written by its owning thread only; a new session gets fresh buffers, so
+// a span ending after stop() never races with start()
+struct ThreadBuffer {
+    std::vector<Event> events;
+    size_t mask = 0;
+    std::atomic<uint64_t> written{0};
+    uint64_t session = 0;
+    int tid = 0;
+    std::string name;
+};
+
+struct Registry {
+    std::mutex mutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> buffers;
+    std::atomic<uint64_t> session{0};
+    size_t capacity = size_t(1) << 16;
+
+    // Tick <-> wall-clock calibration points
+    uint64_t startTicks = 0;
+    std::chrono::steady_clock::time_point startTime;
+    uint64_t stopTicks = 0;
+    std::chrono::steady_clock::time_point stopTime;
+};
+
+Registry& registry() {
+    static Registry instance;
+    return instance;
+}
+
+std::atomic<int> nextTid{1};
+thread_local int threadId = 0;
+thread_local std::string threadName;
+thread_local std::shared_ptr<ThreadBuffer> localBuffer;
+
+ThreadBuffer& bufferForThisThread() {
+    Registry& reg = registry();
+    const uint64_t session = reg.session.load(std::memory_order_acquire);
+    if (!localBuffer || localBuffer->session != session) {
+        if (threadId == 0) {
+            threadId = nextTid.fetch_add(1, std::memory_order_relaxed);
+        }
+        auto buffer = std::make_shared<ThreadBuffer>();
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        size_t capacity = 1;
+        while (capacity < reg.capacity) capacity <<= 1;
+        buffer->events.resize(capacity);
+        buffer->mask = capacity - 1;
+        buffer->session = session;
+        buffer->tid = threadId;
+        buffer->name = threadName;
+        reg.buffers.push_back(buffer);
+        localBuffer = std::move(buffer);
+    }
+    return *localBuffer;
+}
+
+// Events of one buffer, oldest first
+std::vector<Event> snapshot(const ThreadBuffer& buffer) {
+    const uint64_t written = buffer.written.load(std::memory_order_acquire);
+    const uint64_t count = std::min<uint64_t>(written, buffer.events.size());
+    std::vector<Event> events;
+    events.reserve(count);
+    for (uint64_t i = written - count; i < written; ++i) {
+        events.push_back(buffer.events[i & buffer.mask]);
+    }
+    return events;
+}
+
+// Microseconds per tick from the session's calibration points
+double microsPerTick(const Registry& reg) {
+    uint64_t ticks = reg.stopTicks;
+    auto time = reg.stopTime;
+    if (detail::active.load(std::memory_order_relaxed) || ticks <= reg.startTicks) {
+        ticks = detail::now();
+        time = std::chrono::steady_clock::now();
+    }
+    double micros = std::chrono::duration<double, std::micro>(time - reg.startTime).count();
+    return ticks > reg.startTicks ? micros / static_cast<double>(ticks - reg.startTicks) : 0.0;
+}
+
+std::string escapeJson(const std::string& text) {
+    std::string out;
+    for (char c : text) {
+        if (c == '"' || c == '\\') {
+            out += '\\';
+            out += c;
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+            char code[8];
+            std::snprintf(code, sizeof(code), "\\u%04x", c);
+            out += code;
+        } else {
+            out += c;
+        }
+    }
+    return out;
+}
+
+}  // namespace
+
+namespace detail {
+
+void record(const char* name, uint64_t begin, uint64_t end, int64_t arg) {
+    ThreadBuffer& buffer = bufferForThisThread();
+    const uint64_t index = buffer.written.load(std::memory_order_relaxed);
+    buffer.events[index & buffer.mask] = Event{name, begin, end, arg};
+    buffer.written.store(index + 1, std::memory_order_release);
+}
+
+}  // namespace detail
+
+void start(size_t eventsPerThread) {
+    Registry& reg = registry();
+    {
+        std::lock_guard<std::mutex> lock(reg.mutex);
+        reg.buffers.clear();
+        reg.capacity = std::max<size_t>(eventsPerThread, 1);
+        reg.startTicks = detail::now();
+        reg.startTime = std::chrono::steady_clock::now();
+        reg.stopTicks = 0;
+        reg.session.fetch_add(1, std::memory_order_acq_rel);
+    }
+    detail::active.store(true, std::memory_order_release);
+}
+
+void stop() {
+    detail::active.store(false, std::memory_order_release);
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.stopTicks = detail::now();
+    reg.stopTime = std::chrono::steady_clock::now();
+}
+
+void clear() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    reg.buffers.clear();
+    reg.session.fetch_add(1, std::memory_order_acq_rel);
+}
+
+void setThreadName(const std::string& name) {
+    threadName = name;
+    if (localBuffer) {
+        std::lock_guard<std::mutex> lock(registry().mutex);
+        localBuffer->name = name;
+    }
+}
+
+std::vector<SpanSummary> summarize() {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    const double scale = microsPerTick(reg);
+
+    std::unordered_map<std::string, SpanSummary> byName;
+    for (const auto& buffer : reg.buffers) {
+        for (const Event& event : snapshot(*buffer)) {
+            SpanSummary& summary = byName[event.name];
+            double micros = static_cast<double>(event.end - event.begin) * scale;
+            summary.count++;
+            summary.totalMs += micros / 1000.0;
+            summary.maxUs = std::max(summary.maxUs, micros);
+        }
+    }
+
+    std::vector<SpanSummary> summaries;
+    for (auto& entry : byName) {
+        entry.second.name = entry.first;
+        entry.second.meanUs = entry.second.totalMs * 1000.0 / entry.second.count;
+        summaries.push_back(std::move(entry.second));
+    }
+    std::sort(summaries.begin(), summaries.end(),
+              [](const SpanSummary& a, const SpanSummary& b) { return a.totalMs > b.totalMs; });
+    return summaries;
+}
+
+bool writeChromeTrace(const std::string& path) {
+    Registry& reg = registry();
+    std::lock_guard<std::mutex> lock(reg.mutex);
+    const double scale = microsPerTick(reg);
+
+    std::ofstream out(path);
+    if (!out) {
+        std::cerr << "[Trace] Cannot write " << path << std::endl;
+        return false;
+    }
+
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    bool first = true;
+    char line[512];
+    for (const auto& buffer : reg.buffers) {
+        if (!buffer->name.empty()) {
+            out << (first ? "" : ",\n")
+                << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << buffer->tid
+                << ",\"args\":{\"name\":\"" << escapeJson(buffer->name) << "\"}}";
+            first = false;
+        }
+        for (const Event& event : snapshot(*buffer)) {
+            // Spans sit on the session's time axis; earlier ones are clipped
+            double ts = event.begin > reg.startTicks
+                ? static_cast<double>(event.begin - reg.startTicks) * scale : 0.0;
+            double dur = static_cast<double>(event.end - event.begin) * scale;
+            std::snprintf(line, sizeof(line),
+                          "{\"name\":\"%s\",\"ph\":\"X\",\"pid\":1,\"tid\":%d,\"ts\":%.3f,\"dur\":%.3f",
+                          escapeJson(event.name).c_str(), buffer->tid, ts, dur);
+            out << (first ? "" : ",\n") << line;
+            if (event.arg >= 0) {
+                out << ",\"args\":{\"n\":" << event.arg << "}";
+            }
+            out << "}";
+            first = false;
+        }
+    }
+    out << "\n]}\n";
+    out.flush();
+    if (!out) {
+        std::cerr << "[Trace] Failed writing " << path << std::endl;
+        return false;
+    }
+    return true;
+}
+
+}  // namespace trace
+}  // namespace cortexstream
@@ -1,14 +1,57 @@
 #include "cortexstream/request.h"
+#include "cortexstream/constraint.h"
+#include "cortexstream/stop_matcher.h"
+#include "cortexstream/token_stream.h"
 #include <chrono>
+#include <functional>
+#include <mutex>
+#include <queue>
 #include <stdexcept>
 
 namespace cortexstream {
 
+namespace {
+
+// Released ids, smallest first, so tables indexed by SeqId stay compact
+struct SeqIdPool {
+    std::mutex lock;
+    SeqId next = 0;
+    std::priority_queue<SeqId, std::vector<SeqId>, std::greater<SeqId>> released;
+};
+
+SeqIdPool& seqIdPool() {
+    static SeqIdPool pool;
+    return pool;
+}
+
+}  // namespace
+
+SeqId acquireSeqId() {
+    SeqIdPool& pool = seqIdPool();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    if (pool.released.empty()) {
+        return pool.next++;
+    }
+    SeqId id = pool.released.top();
+    pool.released.pop();
+    return id;
+}
+
+void releaseSeqId(SeqId id) {
+    if (id == kInvalidSeqId) {
+        return;
+    }
+    SeqIdPool& pool = seqIdPool();
+    std::lock_guard<std::mutex> guard(pool.lock);
+    pool.released.push(id);
+}
+
 Request::Request(const std::string& id,
                  const std::vector<int>& promptTokens,
                  int maxTokens,
                  const std::string& promptText)
     : id_(id),
+      seqId_(acquireSeqId()),
       promptText_(promptText),
       promptTokens_(promptTokens),
       maxTokens_(maxTokens) {
@@ -28,7 +71,9 @@ Request::Request(const std::string& id,
               maxTokens,
               promptText) {}
 
-Request::~Request() = default;
+Request::~Request() {
+    releaseSeqId(seqId_);
+}
 
 // ---- Immutable Input ----
 
@@ -36,6 +81,10 @@ const std::string& Request::getId() const {
     return id_;
 }
 
+SeqId Request::getSeqId() const {
+    return seqId_;
+}
+
 const std::string& Request::getPrompt() const {
     return promptText_;
 }
@@ -83,6 +132,7 @@ const std::vector<int>& Request::getStopTokens() const {
 
 void Request::setStopTokens(const std::vector<int>& tokens) {
     stopTokens_ = tokens;
+    rebuildStopMatcher();
 }
 
 const std::string& Request::getStopString() const {
@@ -91,6 +141,86 @@ const std::string& Request::getStopString() const {
 
 void Request::setStopString(const std::string& stopStr) {
     stopString_ = stopStr;
+    rebuildStopMatcher();
+}
+
+const std::vector<std::string>& Request::getStopStrings() const {
+    return stopStrings_;
+}
+
+void Request::setStopStrings(const std::vector<std::string>& strings) {
+    stopStrings_ = strings;
+    rebuildStopMatcher();
+}
+
+const std::vector<std::vector<int>>& Request::getStopSequences() const {
+    return stopSequences_;
+}
+
+void Request::setStopSequences(const std::vector<std::vector<int>>& sequences) {
+    stopSequences_ = sequences;
+    rebuildStopMatcher();
+}
+
+const std::shared_ptr<const StopMatcher>& Request::getStopMatcher() const {
+    return stopMatcher_;
+}
+
+void Request::rebuildStopMatcher() {
+    std::vector<std::string> strings = stopStrings_;
+    if (!stopString_.empty()) {
+        strings.push_back(stopString_);
+    }
+    std::vector<std::vector<int>> sequences = stopSequences_;
+    for (int token : stopTokens_) {
+        sequences.push_back({token});
+    }
+    auto matcher = std::make_shared<const StopMatcher>(strings, sequences);
+    stopMatcher_ = matcher->empty() ? nullptr : std::move(matcher);
+}
+
+bool Request::isIgnoringEos() const {
+    return ignoreEos_;
+}
+
+void Request::setIgnoreEos(bool ignore) {
+    ignoreEos_ = ignore;
+}
+
+// ---- Constrained Decoding ----
+
+void Request::setConstraint(std::shared_ptr<const TokenAutomaton> automaton) {
+    constraint_ = std::move(automaton);
+    constraintState_ = constraint_ ? constraint_->startState() : 0;
+    for (int token : generatedTokens_) {
+        if (constraint_) {
+            constraintState_ = constraint_->advance(constraintState_, token);
+        }
+    }
+}
+
+bool Request::hasConstraint() const {
+    return constraint_ != nullptr;
+}
+
+const std::shared_ptr<const TokenAutomaton>& Request::getConstraint() const {
+    return constraint_;
+}
+
+int Request::getConstraintState() const {
+    return constraintState_;
+}
+
+const uint64_t* Request::getAllowedTokens() const {
+    return constraint_ ? constraint_->allowedTokens(constraintState_) : nullptr;
+}
+
+size_t Request::getConstraintVocabSize() const {
+    return constraint_ ? constraint_->vocabSize() : 0;
+}
+
+bool Request::isConstraintComplete() const {
+    return constraint_ && constraint_->isComplete(constraintState_);
 }
 
 // ---- Scheduling Controls ----
@@ -108,6 +238,47 @@ void Request::setState(RequestState state) {
     }
 }
 
+int Request::getPriority() const {
+    return priority_;
+}
+
+void Request::setPriority(int priority) {
+    priority_ = priority;
+}
+
+uint64_t Request::getDeadlineNs() const {
+    return deadlineNs_;
+}
+
+bool Request::hasDeadline() const {
+    return deadlineNs_ != 0;
+}
+
+void Request::setDeadline(std::chrono::milliseconds sinceArrival) {
+    if (sinceArrival.count() <= 0) {
+        deadlineNs_ = 0;
+        return;
+    }
+    deadlineNs_ = arrivalTimestampNs_ +
+        std::chrono::duration_cast<std::chrono::nanoseconds>(sinceArrival).count();
+}
+
+const std::string& Request::getTenant() const {
+    return tenant_;
+}
+
+void Request::setTenant(const std::string& tenant) {
+    tenant_ = tenant;
+}
+
+const std::string& Request::getAdapter() const {
+    return adapter_;
+}
+
+void Request::setAdapter(const std::string& adapterId) {
+    adapter_ = adapterId;
+}
+
 // ---- Streaming ----
 
 bool Request::isStreamingEnabled() const {
@@ -152,6 +323,9 @@ const std::vector<int>& Request::getGeneratedTokens() const {
 
 void Request::addGeneratedToken(int token) {
     generatedTokens_.push_back(token);
+    if (constraint_) {
+        constraintState_ = constraint_->advance(constraintState_, token);
+    }
 }
 
 int Request::getGeneratedLength() const {
@@ -162,6 +336,14 @@ int Request::getGeneratedTokenCount() const {
     return getGeneratedLength();
 }
 
+int Request::getNumComputedTokens() const {
+    return numComputedTokens_;
+}
+
+void Request::setNumComputedTokens(int count) {
+    numComputedTokens_ = count;
+}
+
 bool Request::isFinished() const {
     return finished_;
 }
@@ -170,6 +352,19 @@ bool Request::isFailed() const {
     return failed_;
 }
 
+StopReason Request::getStopReason() const {
+    return stopReason_;
+}
+
+const std::string& Request::getMatchedStop() const {
+    return matchedStop_;
+}
+
+void Request::setStopReason(StopReason reason, const std::string& matched) {
+    stopReason_ = reason;
+    matchedStop_ = matched;
+}
+
 // ---- Error Handling ----
 
 const std::string& Request::getErrorMessage() const {
@@ -194,5 +389,26 @@ void Request::notifyToken(int token, bool finished) {
     }
 }
 
-}  // namespace cortexstream
+// ---- Stream Delivery ----
 
+void Request::setTokenStream(std::shared_ptr<TokenStream> stream) {
+    tokenStream_ = std::move(stream);
+}
+
+const std::shared_ptr<TokenStream>& Request::getTokenStream() const {
+    return tokenStream_;
+}
+
+bool Request::isStreamBackpressured() const {
+    return tokenStream_ && tokenStream_->isBackpressured();
+}
+
+int Request::getStreamedLength() const {
+    return streamedLength_;
+}
+
+void Request::setStreamedLength(int count) {
+    streamedLength_ = count;
+}
+
+}  // namespace cortexstream
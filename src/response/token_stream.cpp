@@ -0,0 +1,119 @@
+#include "cortexstream/token_stream.h"
+#include <algorithm>
+
+namespace cortexstream {
+
+namespace {
+
+size_t roundUpPow2(size_t n) {
+    size_t p = 1;
+    while (p < n) p <<= 1;
+    return p;
+}
+
+}  // namespace
+
+TokenStream::TokenStream(const std::string& requestId, size_t capacity, size_t highWater)
+    : slots_(roundUpPow2(std::max<size_t>(capacity, 2)), ResponseChunk(requestId, 0, "")),
+      mask_(slots_.size() - 1),
+      highWater_(highWater > 0 ? std::min(highWater, slots_.size()) : slots_.size() * 3 / 4) {
+    for (ResponseChunk& slot : slots_) {
+        slot.textPiece.reserve(kTextReserve);
+    }
+}
+
+// ---- Producer ----
+
+bool TokenStream::push(int token, bool finished, const std::string& textPiece) {
+    const size_t tail = tail_.load(std::memory_order_relaxed);
+    if (tail - cachedHead_ >= slots_.size()) {
+        cachedHead_ = head_.load(std::memory_order_acquire);
+        if (tail - cachedHead_ >= slots_.size()) {
+            return false;
+        }
+    }
+    ResponseChunk& slot = slots_[tail & mask_];
+    slot.token = token;
+    slot.textPiece.assign(textPiece);
+    slot.finished = finished;
+    tail_.store(tail + 1, std::memory_order_release);
+    wakeConsumer();
+    return true;
+}
+
+void TokenStream::close() {
+    closed_.store(true, std::memory_order_release);
+    wakeConsumer();
+}
+
+void TokenStream::wakeConsumer() {
+    // Pairs with the seq_cst store in wait(): either the consumer sees the
+    // new tail before sleeping, or the producer sees it waiting
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (consumerWaiting_.load(std::memory_order_relaxed)) {
+        std::lock_guard<std::mutex> lock(waitMutex_);
+        waitCv_.notify_one();
+    }
+}
+
+// ---- Consumer ----
+
+bool TokenStream::pop(ResponseChunk& chunk) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    if (head == cachedTail_) {
+        cachedTail_ = tail_.load(std::memory_order_acquire);
+        if (head == cachedTail_) {
+            return false;
+        }
+    }
+    const ResponseChunk& slot = slots_[head & mask_];
+    chunk.requestId = slot.requestId;
+    chunk.token = slot.token;
+    chunk.textPiece.assign(slot.textPiece);
+    chunk.finished = slot.finished;
+    head_.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+size_t TokenStream::drain(std::vector<ResponseChunk>& out, size_t maxChunks) {
+    const size_t head = head_.load(std::memory_order_relaxed);
+    cachedTail_ = tail_.load(std::memory_order_acquire);
+    size_t count = cachedTail_ - head;
+    if (maxChunks > 0) {
+        count = std::min(count, maxChunks);
+    }
+    out.reserve(out.size() + count);
+    for (size_t i = 0; i < count; ++i) {
+        out.push_back(slots_[(head + i) & mask_]);
+    }
+    head_.store(head + count, std::memory_order_release);
+    return count;
+}
+
+bool TokenStream::wait(std::chrono::milliseconds timeout) {
+    auto ready = [this] {
+        return tail_.load(std::memory_order_acquire) != head_.load(std::memory_order_relaxed) ||
+               closed_.load(std::memory_order_acquire);
+    };
+    if (ready()) {
+        return true;
+    }
+    std::unique_lock<std::mutex> lock(waitMutex_);
+    consumerWaiting_.store(true, std::memory_order_seq_cst);
+    bool woke = true;
+    if (timeout.count() <= 0) {
+        waitCv_.wait(lock, ready);
+    } else {
+        woke = waitCv_.wait_for(lock, timeout, ready);
+    }
+    consumerWaiting_.store(false, std::memory_order_relaxed);
+    return woke;
+}
+
+// ---- State ----
+
+size_t TokenStream::size() const {
+    return tail_.load(std::memory_order_acquire) - head_.load(std::memory_order_acquire);
+}
+
+}  // namespace cortexstream
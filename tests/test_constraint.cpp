@@ -0,0 +1,224 @@
+// Constrained decoding unit tests
+#include "cortexstream/constraint.h"
+#include "cortexstream/sampler.h"
+#include <iostream>
+#include <memory>
+#include <set>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+// Token ids are the indices; 0 is EOS
+const std::vector<std::string> kTokens = {
+    "</s>", "{", "}", "\"", "a", "b", "ab", "1", "12", ":", ",", " ", "true",
+    "false", "ok", "x", ""};
+
+std::shared_ptr<const TokenVocabulary> makeVocabulary() {
+    return std::make_shared<TokenVocabulary>(kTokens, 0);
+}
+
+bool allowed(const TokenAutomaton& automaton, int state, int token) {
+    return (automaton.allowedTokens(state)[token >> 6] >> (token & 63)) & 1;
+}
+
+std::set<int> allowedSet(const TokenAutomaton& automaton, int state) {
+    std::set<int> tokens;
+    for (size_t t = 0; t < automaton.vocabSize(); ++t) {
+        if (allowed(automaton, state, static_cast<int>(t))) {
+            tokens.insert(static_cast<int>(t));
+        }
+    }
+    return tokens;
+}
+
+// Advance through token ids; the state after the last one
+int walk(const TokenAutomaton& automaton, const std::vector<int>& tokens) {
+    int state = automaton.startState();
+    for (int token : tokens) {
+        state = automaton.advance(state, token);
+    }
+    return state;
+}
+
+void testRegexMaskAllowsOnlyLiveTokens() {
+    std::cout << "testRegexMaskAllowsOnlyLiveTokens" << std::endl;
+    std::string error;
+    auto automaton = TokenAutomaton::fromRegex("a(b|x)*1", makeVocabulary(), &error);
+    CHECK(automaton != nullptr);
+    if (!automaton) return;
+
+    // "ab" is one token that spans two DFA steps
+    CHECK((allowedSet(*automaton, 0) == std::set<int>{4, 6}));
+
+    int state = walk(*automaton, {6});
+    // "12" would leave the language after "1"; EOS needs a full match
+    CHECK((allowedSet(*automaton, state) == std::set<int>{5, 7, 15}));
+    CHECK(automaton->advance(state, 8) == TokenAutomaton::kDeadState);
+    CHECK(!automaton->isAccepting(state));
+
+    state = automaton->advance(state, 7);
+    CHECK(automaton->isAccepting(state));
+    CHECK((allowedSet(*automaton, state) == std::set<int>{0}));
+    CHECK(automaton->isComplete(state));
+    CHECK(automaton->advance(state, 0) == TokenAutomaton::kDoneState);
+
+    // Empty-text tokens never advance the output
+    CHECK(!allowed(*automaton, 0, 16));
+}
+
+void testJsonSchemaLowersToObjectGrammar() {
+    std::cout << "testJsonSchemaLowersToObjectGrammar" << std::endl;
+    std::string error;
+    auto automaton = TokenAutomaton::fromJsonSchema(
+        R"({"type": "object", "properties": {"ok": {"type": "boolean"}}})",
+        makeVocabulary(), &error);
+    CHECK(automaton != nullptr);
+    if (!automaton) return;
+
+    // {"ok": true}
+    int state = walk(*automaton, {1, 3, 14, 3, 9, 11, 12});
+    CHECK(state >= 0);
+    CHECK(!automaton->isAccepting(state));
+    CHECK(allowed(*automaton, state, 2));
+    CHECK(!allowed(*automaton, state, 10));
+    state = automaton->advance(state, 2);
+    CHECK(automaton->isComplete(state));
+
+    // A value of the wrong type is masked
+    state = walk(*automaton, {1, 3, 14, 3, 9});
+    CHECK(allowed(*automaton, state, 13));
+    CHECK(!allowed(*automaton, state, 7));
+
+    CHECK(TokenAutomaton::fromJsonSchema(R"({"$ref": "#"})", makeVocabulary(), &error) == nullptr);
+    CHECK(error.find("$ref") != std::string::npos);
+    CHECK(TokenAutomaton::fromRegex("(ab", makeVocabulary(), &error) == nullptr);
+}
+
+void testCacheSharesCompiledAutomata() {
+    std::cout << "testCacheSharesCompiledAutomata" << std::endl;
+    auto vocabulary = makeVocabulary();
+    ConstraintCache& cache = ConstraintCache::global();
+    cache.clear();
+
+    ConstraintSpec spec{ConstraintKind::Regex, "ab*"};
+    auto first = cache.compile(spec, vocabulary);
+    CHECK(first != nullptr);
+    CHECK(cache.compile(spec, vocabulary) == first);
+    CHECK(cache.size() == 1);
+
+    // Same source, other kind or vocabulary: separate entries
+    CHECK(cache.compile(spec, makeVocabulary()) != first);
+    spec.kind = ConstraintKind::JsonSchema;
+    CHECK(cache.compile(spec, vocabulary) == nullptr);
+    CHECK(cache.size() == 2);
+    cache.clear();
+}
+
+void testCacheIsBoundedAndEvictsVocabularies() {
+    std::cout << "testCacheIsBoundedAndEvictsVocabularies" << std::endl;
+    ConstraintCache& cache = ConstraintCache::global();
+    cache.clear();
+    cache.setCapacity(2);
+    auto vocabulary = makeVocabulary();
+
+    auto ab = cache.compile({ConstraintKind::Regex, "ab*"}, vocabulary);
+    auto ax = cache.compile({ConstraintKind::Regex, "ax*"}, vocabulary);
+    CHECK(cache.compile({ConstraintKind::Regex, "ab*"}, vocabulary) == ab);    // ab most recent
+    auto a1 = cache.compile({ConstraintKind::Regex, "a1"}, vocabulary);
+    CHECK(cache.size() == 2);
+    CHECK(cache.compile({ConstraintKind::Regex, "ab*"}, vocabulary) == ab);
+    CHECK(cache.compile({ConstraintKind::Regex, "ax*"}, vocabulary) != ax);    // Evicted, recompiled
+    CHECK(ax->numStates() > 0);                                                // Holder unaffected
+
+    // A vocabulary nothing else references goes with its automata
+    cache.setCapacity(ConstraintCache::kDefaultCapacity);
+    auto other = makeVocabulary();
+    cache.compile({ConstraintKind::Regex, "ab*"}, other);
+    CHECK(cache.size() == 3);
+    CHECK(cache.evictUnusedVocabularies() == 0);    // Both still held here
+    other.reset();
+    CHECK(cache.evictUnusedVocabularies() == 1);
+    CHECK(cache.size() == 2);
+
+    // Held automata pin their vocabulary; an explicit eviction does not care
+    const TokenVocabulary* shared = vocabulary.get();
+    vocabulary.reset();
+    CHECK(cache.evictUnusedVocabularies() == 0);    // `ab` and `a1` are held
+    CHECK(cache.evictVocabulary(shared) == 2);
+    CHECK(cache.size() == 0);
+    cache.clear();
+}
+
+void testSamplerDrawsOnlyAllowedTokens() {
+    std::cout << "testSamplerDrawsOnlyAllowedTokens" << std::endl;
+    auto automaton = TokenAutomaton::fromRegex("a(b|x)*1", makeVocabulary());
+    CHECK(automaton != nullptr);
+    if (!automaton) return;
+    const int state = walk(*automaton, {6});
+
+    // The unconstrained favourite (token 8) is not allowed here
+    Tensor logits;
+    logits.shape = {1, 20};
+    logits.data.assign(20, 0.0f);
+    logits.data[8] = 9.0f;
+    logits.data[7] = 1.0f;
+    logits.data[19] = 5.0f;             // Past the automaton's vocabulary
+
+    Sampler sampler;
+    SamplingParams greedy;
+    SampleRow row;
+    row.params = &greedy;
+    row.allowed = automaton->allowedTokens(state);
+    row.allowedSize = automaton->vocabSize();
+    CHECK(sampler.sampleBatch(logits, {row})[0] == 7);
+
+    SamplingParams sampled;
+    sampled.doSample = true;
+    sampled.topK = 4;
+    sampled.seed = 5;
+    row.params = &sampled;
+    std::set<int> drawn;
+    for (uint64_t pos = 0; pos < 64; ++pos) {
+        row.stream = sampler.streamKey(sampled);
+        row.position = pos;
+        drawn.insert(sampler.sampleBatch(logits, {row})[0]);
+    }
+    CHECK((drawn == std::set<int>{5, 7, 15}));
+
+    // Nothing allowed: the row reports failure instead of a token
+    row.allowed = automaton->allowedTokens(TokenAutomaton::kDeadState);
+    CHECK(sampler.sampleBatch(logits, {row})[0] == -1);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Constraint Tests" << std::endl;
+
+    testRegexMaskAllowsOnlyLiveTokens();
+    testJsonSchemaLowersToObjectGrammar();
+    testCacheSharesCompiledAutomata();
+    testCacheIsBoundedAndEvictsVocabularies();
+    testSamplerDrawsOnlyAllowedTokens();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All constraint tests passed" << std::endl;
+    return 0;
+}
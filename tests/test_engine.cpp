@@ -1,7 +1,624 @@
 // Engine unit tests
+#include "cortexstream/engine.h"
+#include "cortexstream/constraint.h"
+#include "cortexstream/speculative.h"
+#include "cortexstream/token_stream.h"
+#include <chrono>
 #include <iostream>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+struct Harness {
+    std::shared_ptr<ModelBackend> backend;
+    std::shared_ptr<Scheduler> scheduler;
+    std::shared_ptr<KVCache> cache;
+    std::shared_ptr<InferenceEngine> engine;
+
+    explicit Harness(size_t kvBlocks, int maxBatchSize = 8) {
+        backend = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+        backend->loadModel("test-model");
+        scheduler = std::make_shared<Scheduler>(maxBatchSize);
+        cache = std::make_shared<KVCache>(1, 1, 4, kvBlocks * 16, 16);
+        engine = std::make_shared<InferenceEngine>(backend, scheduler, cache);
+    }
+
+    // Start the engine thread (if needed) and wait for submitted work
+    bool drain() {
+        engine->run();
+        return engine->waitUntilIdle(std::chrono::seconds(30));
+    }
+};
+
+std::shared_ptr<Request> makeRequest(const std::string& id, int promptLen, int maxTokens) {
+    return std::make_shared<Request>(id, std::vector<int>(promptLen, 7), maxTokens);
+}
+
+void testDecodeGrowsKVAndReleasesOnFinish() {
+    std::cout << "testDecodeGrowsKVAndReleasesOnFinish" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+
+    // Prompt fits in one block; decode has to grow into three more.
+    auto req = makeRequest("grow", 10, 50);
+    h.scheduler->submitRequest(req);
+    CHECK(h.drain());
+
+    CHECK(req->isFinished());
+    CHECK(req->getGeneratedLength() == 50);
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+    CHECK(h.cache->getTotalAllocated() == 0);
+}
+
+void testSharedPromptIsPrefilledOnce() {
+    std::cout << "testSharedPromptIsPrefilledOnce" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+
+    std::vector<int> prompt(100, 3);
+    auto first = std::make_shared<Request>("first", prompt, 4);
+    h.scheduler->submitRequest(first);
+    CHECK(h.drain());
+
+    auto second = std::make_shared<Request>("second", prompt, 4);
+    h.scheduler->submitRequest(second);
+    CHECK(h.drain());
+
+    CHECK(first->isFinished());
+    CHECK(second->isFinished());
+    // 6 full blocks of the shared prompt were reused by the second request
+    CHECK(h.cache->getPrefixCacheStats().hitTokens == 96);
+}
+
+void testLongPromptIsPrefilledInChunks() {
+    std::cout << "testLongPromptIsPrefilledInChunks" << std::endl;
+    Harness h(128);
+    h.scheduler->setPrefillChunkSize(64);
+    CHECK(h.engine->initialize());
+
+    std::vector<int> document(1000, 5);
+    auto first = std::make_shared<Request>("doc-1", document, 4);
+    auto chat = makeRequest("chat", 10, 20);
+    h.scheduler->submitRequest(chat);
+    h.scheduler->submitRequest(first);
+    CHECK(h.drain());
+
+    CHECK(first->isFinished());
+    CHECK(chat->isFinished());
+    CHECK(first->getNumComputedTokens() == 1000);
+
+    // Every chunk's full blocks were published
+    auto second = std::make_shared<Request>("doc-2", document, 4);
+    h.scheduler->submitRequest(second);
+    CHECK(h.drain());
+    CHECK(second->isFinished());
+    CHECK(h.cache->getPrefixCacheStats().hitTokens == 992);
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+}
+
+void testDecodePressurePreemptsInsteadOfFailing() {
+    std::cout << "testDecodePressurePreemptsInsteadOfFailing" << std::endl;
+
+    for (size_t swapBlocks : {size_t(8), size_t(0)}) {
+        // 4 requests start in one block each but need 3 to finish
+        Harness h(8);
+        CHECK(h.cache->configureSwapSpace(swapBlocks));
+        CHECK(h.engine->initialize());
+
+        std::vector<std::shared_ptr<Request>> reqs;
+        for (int i = 0; i < 4; ++i) {
+            reqs.push_back(makeRequest("r" + std::to_string(i), 10, 30));
+            h.scheduler->submitRequest(reqs.back());
+        }
+        CHECK(h.drain());
+
+        for (const auto& req : reqs) {
+            CHECK(req->isFinished());
+            CHECK(req->getGeneratedLength() == 30);
+        }
+        CHECK(h.engine->getStats().requestsFailed == 0);
+        CHECK(h.engine->getStats().requestsPreempted > 0);
+        CHECK(h.cache->getNumAllocatedSequences() == 0);
+        CHECK(h.cache->getNumFreeSwapBlocks() == swapBlocks);
+    }
+}
+
+void testFinishingRowFreesKVForBatchmates() {
+    std::cout << "testFinishingRowFreesKVForBatchmates" << std::endl;
+    Harness h(2);
+    CHECK(h.engine->initialize());
+
+    // One block each; in the step where "done" stops, "grow" crosses into a
+    // second block that only the stopped row's release can provide
+    auto done = std::make_shared<Request>("done", std::vector<int>(8, 3), 2);
+    auto grow = std::make_shared<Request>("grow", std::vector<int>(15, 5), 4);
+    h.scheduler->submitRequest(done);
+    h.scheduler->submitRequest(grow);
+    CHECK(h.drain());
+
+    CHECK(done->isFinished());
+    CHECK(grow->isFinished());
+    CHECK(grow->getGeneratedLength() == 4);
+    CHECK(h.engine->getStats().requestsFailed == 0);
+    CHECK(h.engine->getStats().requestsPreempted == 0);
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+}
+
+void testPipelinedDecodeStreamsEveryToken() {
+    std::cout << "testPipelinedDecodeStreamsEveryToken" << std::endl;
+
+    for (bool pipelined : {false, true}) {
+        Harness h(64);
+        CHECK(h.engine->initialize());
+        h.engine->setPipelining(pipelined);
+
+        // Staggered lengths: sequences finish and drop out of the early launch
+        std::vector<std::shared_ptr<Request>> reqs;
+        std::vector<std::vector<int>> streamed(4);
+        std::vector<int> finishedFlags(4, 0);
+        for (int i = 0; i < 4; ++i) {
+            reqs.push_back(makeRequest("p" + std::to_string(i), 10, 8 + 4 * i));
+            reqs.back()->setTokenCallback([&, i](int token, bool finished) {
+                streamed[i].push_back(token);
+                finishedFlags[i] += finished ? 1 : 0;
+            });
+            h.scheduler->submitRequest(reqs.back());
+        }
+        CHECK(h.drain());
+
+        for (int i = 0; i < 4; ++i) {
+            CHECK(reqs[i]->isFinished());
+            CHECK(streamed[i] == reqs[i]->getGeneratedTokens());
+            CHECK(finishedFlags[i] == 1);
+        }
+        CHECK(h.engine->getStats().tokensProcessed == 8 + 12 + 16 + 20);
+        CHECK((h.engine->getStats().pipelinedSteps > 0) == pipelined);
+        CHECK(h.cache->getNumAllocatedSequences() == 0);
+    }
+}
+
+void testPipelinedDecodeWithPrefillMatchesPlainDecode() {
+    std::cout << "testPipelinedDecodeWithPrefillMatchesPlainDecode" << std::endl;
+    std::vector<std::vector<int>> outputs[2];
+    for (bool pipelined : {false, true}) {
+        Harness h(128);
+        CHECK(h.engine->initialize());
+        h.engine->setPipelining(pipelined);
+        h.scheduler->setPrefillChunkSize(32);
+
+        // Chunked prompts of different lengths keep prefilling while the
+        // shorter ones decode, so early launches overlap prefill steps
+        std::vector<std::shared_ptr<Request>> reqs;
+        for (int i = 0; i < 4; ++i) {
+            reqs.push_back(makeRequest("mix" + std::to_string(i), 10 + 70 * i, 12));
+            SamplingParams params;
+            params.doSample = true;
+            params.topK = 50;
+            params.seed = 100 + i;
+            reqs.back()->setSamplingParams(params);
+            h.scheduler->submitRequest(reqs.back());
+        }
+        CHECK(h.drain());
+
+        for (const auto& req : reqs) {
+            CHECK(req->isFinished());
+            CHECK(req->getGeneratedLength() == 12);
+            outputs[pipelined].push_back(req->getGeneratedTokens());
+        }
+        CHECK((h.engine->getStats().pipelinedSteps > 0) == pipelined);
+        CHECK(h.cache->getNumAllocatedSequences() == 0);
+    }
+    CHECK(outputs[0] == outputs[1]);
+}
+
+void testIdleEngineWakesOnSubmitAndShutsDown() {
+    std::cout << "testIdleEngineWakesOnSubmitAndShutsDown" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+
+    // run() returns immediately; the loop parks until work arrives
+    h.engine->run();
+    CHECK(h.engine->isRunning());
+    CHECK(h.engine->waitUntilIdle(std::chrono::seconds(5)));
+
+    for (int round = 0; round < 3; ++round) {
+        auto req = makeRequest("wake-" + std::to_string(round), 10, 5);
+        h.scheduler->submitRequest(req);
+        CHECK(h.engine->waitUntilIdle(std::chrono::seconds(5)));
+        CHECK(req->isFinished());
+    }
+
+    // Shutdown must not wait for more work to show up
+    h.engine->shutdown();
+    CHECK(!h.engine->isRunning());
+    CHECK(h.engine->getStats().requestsCompleted == 3);
+}
+
+void testConstrainedRequestStopsAtMatch() {
+    std::cout << "testConstrainedRequestStopsAtMatch" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+
+    // Byte tokens for ASCII, the rest decode to nothing; token 0 is EOS
+    std::vector<std::string> tokens(h.backend->getVocabSize());
+    for (int c = 1; c < 128; ++c) {
+        tokens[c] = std::string(1, static_cast<char>(c));
+    }
+    auto vocabulary = std::make_shared<TokenVocabulary>(tokens, 0);
+    auto automaton = ConstraintCache::global().compile(
+        {ConstraintKind::Regex, "c[a-b]t"}, vocabulary);
+    CHECK(automaton != nullptr);
+
+    // Flat logits: greedy takes the lowest allowed id at every step
+    auto req = makeRequest("constrained", 10, 50);
+    req->setConstraint(automaton);
+    h.scheduler->submitRequest(req);
+    CHECK(h.drain());
+
+    CHECK(req->isFinished());
+    CHECK((req->getGeneratedTokens() == std::vector<int>{'c', 'a', 't'}));
+    CHECK(req->isConstraintComplete());
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+}
+
+void testPromptLookupProposesContinuation() {
+    std::cout << "testPromptLookupProposesContinuation" << std::endl;
+    PromptLookupDrafter drafter;
+
+    // Suffix [1, 2] last occurred at the start; what followed it is copied
+    Request req("lookup", std::vector<int>{1, 2, 3, 4, 1, 2}, 10);
+    CHECK((drafter.propose(req, 3) == std::vector<int>{3, 4, 1}));
+    CHECK((drafter.propose(req, 1) == std::vector<int>{3}));
+    CHECK(drafter.propose(req, 0).empty());
+
+    Request fresh("fresh", std::vector<int>{5, 6, 7}, 10);
+    CHECK(drafter.propose(fresh, 4).empty());
+}
+
+void testSpeculativeDecodeMatchesPlainDecode() {
+    std::cout << "testSpeculativeDecodeMatchesPlainDecode" << std::endl;
+    std::vector<std::vector<int>> outputs;
+    for (bool speculative : {false, true}) {
+        Harness h(64);
+        CHECK(h.engine->initialize());
+        if (speculative) {
+            h.engine->setSpeculative(std::make_shared<PromptLookupDrafter>(), 4);
+            CHECK(h.engine->isSpeculative());
+        }
+
+        std::vector<std::shared_ptr<Request>> reqs;
+        std::vector<std::vector<int>> streamed(3);
+        for (int i = 0; i < 3; ++i) {
+            reqs.push_back(makeRequest("spec-" + std::to_string(i), 10 + i, 17 + 5 * i));
+            reqs[i]->setTokenCallback([&streamed, i](int token, bool) {
+                streamed[i].push_back(token);
+            });
+            h.scheduler->submitRequest(reqs[i]);
+        }
+        CHECK(h.drain());
+
+        for (int i = 0; i < 3; ++i) {
+            CHECK(reqs[i]->isFinished());
+            CHECK(reqs[i]->getGeneratedLength() == 17 + 5 * i);
+            CHECK(streamed[i] == reqs[i]->getGeneratedTokens());
+            outputs.push_back(reqs[i]->getGeneratedTokens());
+        }
+
+        // Greedy over flat logits repeats one token: lookup drafts hit
+        auto stats = h.engine->getStats();
+        CHECK(stats.tokensProcessed == 17 + 22 + 27);
+        CHECK((stats.acceptedDraftTokens > 0) == speculative);
+        CHECK(stats.acceptedDraftTokens <= stats.draftedTokens);
+        CHECK(h.cache->getNumAllocatedSequences() == 0);
+    }
+    for (int i = 0; i < 3; ++i) {
+        CHECK(outputs[i] == outputs[i + 3]);
+    }
+}
+
+void testSpeculativeFinalTokenOnBlockBoundary() {
+    std::cout << "testSpeculativeFinalTokenOnBlockBoundary" << std::endl;
+    Harness h(2);
+    CHECK(h.engine->initialize());
+    h.engine->setSpeculative(std::make_shared<PromptLookupDrafter>(), 4);
+
+    // The last token fills both blocks; the stopped row must not grow
+    auto req = makeRequest("boundary", 17, 16);
+    h.scheduler->submitRequest(req);
+    CHECK(h.drain());
+
+    CHECK(req->isFinished());
+    CHECK(req->getGeneratedLength() == 16);
+    CHECK(h.engine->getStats().acceptedDraftTokens > 0);
+    CHECK(h.engine->getStats().requestsFailed == 0);
+    CHECK(h.engine->getStats().requestsPreempted == 0);
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+}
+
+void testModelDrafterKeepsDraftKVInSync() {
+    std::cout << "testModelDrafterKeepsDraftKVInSync" << std::endl;
+    auto draftModel = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+    draftModel->loadModel("draft-model");
+    auto draftCache = std::make_shared<KVCache>(1, 1, 4, 64 * 16, 16);
+    ModelDrafter drafter(draftModel, draftCache);
+
+    auto req = makeRequest("draft", 10, 20);
+    Batch batch;
+    batch.requests.push_back(req);
+    batch.sequenceLengths.push_back(1);
+    batch.batchSize = 1;
+    const SeqId seq = req->getSeqId();
+
+    // First use prefills the prompt; each draft step adds its input token
+    std::vector<int> draft = drafter.proposeBatch(batch, {3})[0];
+    CHECK(draft.size() == 3);
+    CHECK(drafter.cachedTokens(seq) == 12);
+    CHECK(draftCache->usedTokens(seq) == 12);
+
+    // Target keeps the first draft, then disagrees: the rest is cut back
+    req->addGeneratedToken(draft[0]);
+    req->addGeneratedToken(draft[1] + 1);
+    drafter.onVerified(batch);
+    CHECK(drafter.cachedTokens(seq) == 11);
+    CHECK(draftCache->usedTokens(seq) == 11);
+
+    // Only the new tokens run next time
+    draft = drafter.proposeBatch(batch, {2})[0];
+    CHECK(draft.size() == 2);
+    CHECK(draftCache->usedTokens(seq) == 13);
+    for (int token : draft) req->addGeneratedToken(token);
+    req->addGeneratedToken(7);
+    drafter.onVerified(batch);
+    CHECK(draftCache->usedTokens(seq) == 13);       // All accepted: nothing to cut
+    draft = drafter.proposeBatch(batch, {1})[0];
+    CHECK(draft.size() == 1);
+    CHECK(draftCache->usedTokens(seq) == 15);       // Caught up on the target's token
+
+    drafter.release(*req);
+    CHECK(!draftCache->hasSequence(seq));
+    CHECK(drafter.cachedTokens(seq) == 0);
+}
+
+void testModelDrafterInEngineReleasesDraftKV() {
+    std::cout << "testModelDrafterInEngineReleasesDraftKV" << std::endl;
+    std::vector<std::vector<int>> outputs;
+    for (bool speculative : {false, true}) {
+        Harness h(64);
+        CHECK(h.engine->initialize());
+        auto draftModel = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+        draftModel->loadModel("draft-model");
+        auto draftCache = std::make_shared<KVCache>(1, 1, 4, 64 * 16, 16);
+        if (speculative) {
+            h.engine->setSpeculative(std::make_shared<ModelDrafter>(draftModel, draftCache), 3);
+        }
+        std::vector<std::shared_ptr<Request>> reqs;
+        for (int i = 0; i < 2; ++i) {
+            reqs.push_back(makeRequest("model-draft-" + std::to_string(i), 12 + i, 9 + 4 * i));
+            h.scheduler->submitRequest(reqs[i]);
+        }
+        CHECK(h.drain());
+        for (const auto& req : reqs) {
+            CHECK(req->isFinished());
+            outputs.push_back(req->getGeneratedTokens());
+        }
+        CHECK((h.engine->getStats().acceptedDraftTokens > 0) == speculative);
+        CHECK(draftCache->getNumAllocatedSequences() == 0);
+    }
+    CHECK(outputs[0] == outputs[2]);
+    CHECK(outputs[1] == outputs[3]);
+}
+
+void testSlowStreamThrottlesOnlyItsRequest() {
+    std::cout << "testSlowStreamThrottlesOnlyItsRequest" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+
+    auto slow = makeRequest("slow", 10, 40);
+    auto stream = std::make_shared<TokenStream>(slow->getId(), 8, 4);
+    slow->setTokenStream(stream);
+    auto fast = makeRequest("fast", 10, 30);
+    h.scheduler->submitRequest(slow);
+    h.scheduler->submitRequest(fast);
+    h.engine->run();
+
+    // Nobody drains the slow stream: the other request still completes
+    auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(10);
+    while (!fast->isFinished() && std::chrono::steady_clock::now() < deadline) {
+        std::this_thread::sleep_for(std::chrono::milliseconds(5));
+    }
+    CHECK(fast->isFinished());
+    CHECK(!slow->isFinished());
+    CHECK(slow->getGeneratedLength() <= 4);
+    CHECK(stream->isBackpressured());
+
+    // Draining releases the throttle; every token arrives once, in order
+    std::vector<ResponseChunk> chunks;
+    while (!stream->isDone()) {
+        stream->wait(std::chrono::milliseconds(100));
+        stream->drain(chunks);
+    }
+    CHECK(h.engine->waitUntilIdle(std::chrono::seconds(10)));
+    CHECK(slow->isFinished());
+    CHECK(chunks.size() == 40);
+    std::vector<int> tokens;
+    for (const auto& chunk : chunks) tokens.push_back(chunk.token);
+    CHECK(tokens == slow->getGeneratedTokens());
+    CHECK(!chunks.empty() && chunks.back().finished);
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+}
+
+// Every token decodes to "ab"; EOS is configurable
+class FixedTokenizer : public Tokenizer {
+public:
+    explicit FixedTokenizer(int32_t eos) : eos_(eos) {}
+    std::vector<int32_t> encode(const std::string&) override { return {}; }
+    std::string decode(const std::vector<int32_t>& ids) override {
+        std::string text;
+        for (size_t i = 0; i < ids.size(); ++i) text += "ab";
+        return text;
+    }
+    int32_t getEosTokenId() const override { return eos_; }
+    int32_t getBosTokenId() const override { return -1; }
+    int32_t getPadTokenId() const override { return -1; }
+    size_t getVocabSize() const override { return 0; }
+    bool isLoaded() const override { return true; }
+
+private:
+    int32_t eos_;
+};
+
+void testStopCriteriaEndRequestsEarly() {
+    std::cout << "testStopCriteriaEndRequestsEarly" << std::endl;
+    // Greedy decoding of the stub model repeats a single token
+    int repeated = -1;
+    {
+        Harness h(64);
+        CHECK(h.engine->initialize());
+        auto probe = makeRequest("probe", 10, 3);
+        h.scheduler->submitRequest(probe);
+        CHECK(h.drain());
+        CHECK(probe->getStopReason() == StopReason::MaxTokens);
+        repeated = probe->getGeneratedTokens().front();
+    }
+
+    Harness h(64);
+    CHECK(h.engine->initialize());
+    h.engine->setTokenizer(std::make_shared<FixedTokenizer>(repeated));
+
+    auto eos = makeRequest("eos", 10, 20);
+    auto ignoring = makeRequest("ignore-eos", 10, 20);
+    ignoring->setIgnoreEos(true);
+    auto sequence = makeRequest("sequence", 10, 20);
+    sequence->setIgnoreEos(true);
+    sequence->setStopSequences({{repeated, repeated, repeated}});
+    auto string = makeRequest("string", 10, 20);
+    string->setIgnoreEos(true);
+    string->setStopStrings({"zzz", "babab"});
+    for (const auto& req : {eos, ignoring, sequence, string}) {
+        h.scheduler->submitRequest(req);
+    }
+    CHECK(h.drain());
+
+    CHECK(eos->isFinished() && eos->getGeneratedLength() == 1);
+    CHECK(eos->getStopReason() == StopReason::EndOfSequence);
+    CHECK(ignoring->getGeneratedLength() == 20);
+    CHECK(ignoring->getStopReason() == StopReason::MaxTokens);
+    CHECK(sequence->getGeneratedLength() == 3);
+    CHECK(sequence->getStopReason() == StopReason::StopToken);
+    // "ababab" is the first output containing "babab"
+    CHECK(string->getGeneratedLength() == 3);
+    CHECK(string->getStopReason() == StopReason::StopString);
+    CHECK(string->getMatchedStop() == "babab");
+    CHECK(h.cache->getNumAllocatedSequences() == 0);
+}
+
+void testStreamChunksCarryText() {
+    std::cout << "testStreamChunksCarryText" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+    h.engine->setTokenizer(std::make_shared<FixedTokenizer>(-1));
+
+    // A small ring refuses pushes: retried tokens must not repeat text
+    auto req = makeRequest("text", 10, 30);
+    auto stream = std::make_shared<TokenStream>(req->getId(), 8, 4);
+    req->setTokenStream(stream);
+    h.scheduler->submitRequest(req);
+    h.engine->run();
+
+    std::vector<ResponseChunk> chunks;
+    while (!stream->isDone()) {
+        stream->wait(std::chrono::milliseconds(100));
+        stream->drain(chunks);
+    }
+    CHECK(h.engine->waitUntilIdle(std::chrono::seconds(10)));
+    CHECK(chunks.size() == 30);
+    std::string text;
+    for (const auto& chunk : chunks) {
+        CHECK(chunk.textPiece == "ab");
+        text += chunk.textPiece;
+    }
+    CHECK(text.size() == 60);
+}
+
+void testMetricsTrackLatencyAndOccupancy() {
+    std::cout << "testMetricsTrackLatencyAndOccupancy" << std::endl;
+    Harness h(64);
+    CHECK(h.engine->initialize());
+
+    auto a = makeRequest("metrics-a", 10, 8);
+    auto b = makeRequest("metrics-b", 20, 5);
+    h.scheduler->submitRequest(a);
+    h.scheduler->submitRequest(b);
+    CHECK(h.drain());
+
+    EngineMetrics m = h.engine->getMetrics();
+    CHECK(m.timeToFirstToken.count == 2);
+    CHECK(m.queueWait.count == 2);
+    // Every token after the first of each request is one inter-token gap
+    CHECK(m.interTokenLatency.count == (8 - 1) + (5 - 1));
+    CHECK(m.timeToFirstToken.quantile(0.99) >= m.timeToFirstToken.min);
+    CHECK(m.prefillStep.count > 0);
+    CHECK(m.decodeStep.count == m.stats.decodeSteps);
+    CHECK(m.decodeBatchSize.count == m.stats.decodeSteps);
+    CHECK(m.decodeBatchSize.max <= 2);
+    CHECK(m.stats.avgBatchSize >= 1.0f && m.stats.avgBatchSize <= 2.0f);
+    CHECK(m.kvBlocksTotal == 64);
+    // Only prompt blocks kept by the prefix cache outlive the requests
+    CHECK(m.kvBlocksUsed == h.cache->getPrefixCacheStats().cachedBlocks);
+    CHECK(m.kvOccupancy < 1.0f);
+    CHECK(m.activeRequests == 0 && m.pendingRequests == 0);
+
+    std::string text = h.engine->getPrometheusMetrics();
+    CHECK(text.find("# TYPE cortexstream_time_to_first_token_seconds histogram") != std::string::npos);
+    CHECK(text.find("cortexstream_time_to_first_token_seconds_count 2\n") != std::string::npos);
+    CHECK(text.find("cortexstream_kv_blocks_total 64\n") != std::string::npos);
+    CHECK(text.find("cortexstream_tokens_processed_total 13\n") != std::string::npos);
+}
+
+}  // namespace
 
 int main() {
     std::cout << "Engine Tests" << std::endl;
+
+    testDecodeGrowsKVAndReleasesOnFinish();
+    testSharedPromptIsPrefilledOnce();
+    testLongPromptIsPrefilledInChunks();
+    testDecodePressurePreemptsInsteadOfFailing();
+    testFinishingRowFreesKVForBatchmates();
+    testPipelinedDecodeStreamsEveryToken();
+    testPipelinedDecodeWithPrefillMatchesPlainDecode();
+    testIdleEngineWakesOnSubmitAndShutsDown();
+    testConstrainedRequestStopsAtMatch();
+    testPromptLookupProposesContinuation();
+    testSpeculativeDecodeMatchesPlainDecode();
+    testSpeculativeFinalTokenOnBlockBoundary();
+    testModelDrafterKeepsDraftKVInSync();
+    testModelDrafterInEngineReleasesDraftKV();
+    testSlowStreamThrottlesOnlyItsRequest();
+    testStopCriteriaEndRequestsEarly();
+    testStreamChunksCarryText();
+    testMetricsTrackLatencyAndOccupancy();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All engine tests passed" << std::endl;
     return 0;
 }
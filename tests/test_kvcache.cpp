@@ -1,7 +1,499 @@
 // KV Cache unit tests
+#include "cortexstream/kv_cache.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
 #include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+// 2 layers, 2 heads, headDim 4, 128 blocks of 16 tokens
+KVCache makeCache(KVAllocationMode mode) {
+    return KVCache(2, 2, 4, 128 * 16, 16, mode);
+}
+
+void testAllocatorUsesWholeNonPowerOfTwoPool() {
+    std::cout << "testAllocatorUsesWholeNonPowerOfTwoPool" << std::endl;
+    KVBlockAllocator allocator(100);  // 64 + 32 + 4
+
+    std::vector<int> pages;
+    CHECK(allocator.allocatePages(100, pages));
+    CHECK(allocator.usedBlocks() == 100);
+    CHECK(!allocator.allocatePages(1, pages));
+    CHECK(pages.size() == 100);
+
+    std::vector<int> sorted = pages;
+    std::sort(sorted.begin(), sorted.end());
+    CHECK(std::unique(sorted.begin(), sorted.end()) == sorted.end());
+    CHECK(sorted.front() == 0 && sorted.back() == 99);
+
+    // Freed pages coalesce back into the original buddies
+    allocator.freePages(pages);
+    CHECK(allocator.freeBlocks() == 100);
+    KVHandle big = allocator.allocate(64);
+    KVHandle mid = allocator.allocate(32);
+    KVHandle small = allocator.allocate(4);
+    CHECK(big.isValid() && mid.isValid() && small.isValid());
+    CHECK(!allocator.allocate(1).isValid());
+    allocator.free(big);
+    allocator.free(mid);
+    allocator.free(small);
+    CHECK(allocator.fragmentation() < 0.5f);
+}
+
+void testAllocatorMergesBuddiesInAnyOrder() {
+    std::cout << "testAllocatorMergesBuddiesInAnyOrder" << std::endl;
+    KVBlockAllocator allocator(16);
+
+    std::vector<KVHandle> handles;
+    for (int i = 0; i < 8; ++i) {
+        handles.push_back(allocator.allocate(2));
+        CHECK(handles.back().isValid());
+    }
+    CHECK(allocator.freeBlocks() == 0);
+    CHECK(allocator.fragmentation() == 0.0f);
+
+    // Odd halves first: nothing merges until their buddies return
+    for (int i : {1, 3, 5, 7, 6, 0, 2, 4}) {
+        allocator.free(handles[i]);
+    }
+    CHECK(allocator.freeBlocks() == 16);
+    CHECK(allocator.fragmentation() == 0.0f);
+    KVHandle all = allocator.allocate(16);
+    CHECK(all.isValid() && all.startBlockIndex == 0);
+    allocator.free(all);
+
+    std::ostringstream dump;
+    allocator.dumpBlockMap(dump);  // Must not deadlock
+    CHECK(dump.str().find("Used: 0 Free: 16") != std::string::npos);
+}
+
+void testPagedAllocationHasNoRoundingWaste() {
+    std::cout << "testPagedAllocationHasNoRoundingWaste" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    // 33 blocks worth of prompt: contiguous mode would round up to 64
+    CHECK(cache.allocateFor("a", 33 * 16));
+    CHECK(cache.allocateFor("b", 33 * 16));
+    CHECK(cache.allocateFor("c", 33 * 16));
+    CHECK(cache.getNumAllocatedSequences() == 3);
+
+    KVView k = cache.getKView("a", 1);
+    CHECK(k.valid);
+    CHECK(k.numPages() == 33);
+    CHECK(k.shape[1] == 33 * 16);
+    CHECK(k.data == k.page(0));
+
+    cache.freeFor("a");
+    cache.freeFor("b");
+    cache.freeFor("c");
+    CHECK(cache.getNumAllocatedSequences() == 0);
+    CHECK(cache.getTotalAllocated() == 0);
+}
+
+void testContiguousAllocationRoundsUp() {
+    std::cout << "testContiguousAllocationRoundsUp" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Contiguous);
+
+    CHECK(cache.allocateFor("a", 33 * 16));
+    CHECK(cache.allocateFor("b", 33 * 16));
+    // Both 64-block buddies are taken
+    CHECK(!cache.allocateFor("c", 33 * 16));
+
+    KVView k = cache.getKView("a", 0);
+    CHECK(k.valid);
+    CHECK(k.numPages() == 33);
+    // Contiguous pages are adjacent in the arena
+    CHECK(k.pageAs<float>(1) == k.pageAs<float>(0) + 2 * 16 * 4);
+}
+
+void testPagedViewIndexing() {
+    std::cout << "testPagedViewIndexing" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    CHECK(cache.allocateFor("a", 20));
+    KVView v = cache.getVView("a", 0);
+    CHECK(v.numPages() == 2);
+    // Token 17 lives in page 1 at row 1
+    CHECK(v.at(1, 17) == v.pageAs<float>(1) + 1 * 16 * 4 + 1 * 4);
+    CHECK(!cache.getKView("missing", 0).valid);
+}
+
+void testAppendTokenGrowsOnDemand() {
+    std::cout << "testAppendTokenGrowsOnDemand" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    CHECK(cache.allocateFor("a", 16));
+    CHECK(cache.getKView("a", 0).numPages() == 1);
+
+    // Crossing the block boundary takes exactly one more page
+    CHECK(cache.appendToken("a"));
+    CHECK(cache.usedTokens("a") == 17);
+    CHECK(cache.getKView("a", 0).numPages() == 2);
+
+    for (int i = 0; i < 15; ++i) {
+        CHECK(cache.appendToken("a"));
+    }
+    CHECK(cache.getKView("a", 0).numPages() == 2);
+    CHECK(cache.appendToken("a"));
+    CHECK(cache.getKView("a", 0).numPages() == 3);
+    CHECK(!cache.appendToken("missing"));
+}
+
+void testAppendTokenFailsWhenArenaExhausted() {
+    std::cout << "testAppendTokenFailsWhenArenaExhausted" << std::endl;
+    KVCache cache(1, 1, 4, 4 * 16, 16, KVAllocationMode::Paged);
+
+    CHECK(cache.allocateFor("a", 4 * 16));
+    CHECK(cache.isFull());
+    CHECK(!cache.appendToken("a"));
+
+    cache.freeFor("a");
+    CHECK(cache.allocateFor("b", 0));
+    CHECK(cache.appendToken("b"));
+    CHECK(cache.getKView("b", 0).numPages() == 1);
+}
+
+void testContiguousGrowthUsesBuddySlack() {
+    std::cout << "testContiguousGrowthUsesBuddySlack" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Contiguous);
+
+    // 3 blocks round up to a 4-block buddy: one block of slack
+    CHECK(cache.allocateFor("a", 3 * 16));
+    CHECK(cache.appendToken("a"));
+    for (int i = 0; i < 15; ++i) {
+        CHECK(cache.appendToken("a"));
+    }
+    CHECK(!cache.appendToken("a"));
+}
+
+std::vector<int> makePrompt(int length, int salt) {
+    std::vector<int> tokens(length);
+    for (int i = 0; i < length; ++i) {
+        tokens[i] = i * 31 + salt;
+    }
+    return tokens;
+}
+
+void testPrefixBlocksAreShared() {
+    std::cout << "testPrefixBlocksAreShared" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    std::vector<int> system = makePrompt(64, 0);
+    std::vector<int> promptA = system;
+    promptA.push_back(1000);
+    std::vector<int> promptB = system;
+    promptB.push_back(2000);
+    promptB.push_back(2001);
+
+    CHECK(cache.allocateWithPrefix("a", promptA) == 0);
+    cache.publishPrefix("a", promptA);
+    size_t usedAfterA = cache.getTotalAllocated();
+
+    // The 4 full system-prompt blocks are reused; only 1 new block taken
+    CHECK(cache.allocateWithPrefix("b", promptB) == 64);
+    CHECK(cache.getKView("b", 0).page(0) == cache.getKView("a", 0).page(0));
+    CHECK(cache.getKView("b", 0).page(4) != cache.getKView("a", 0).page(4));
+    CHECK(cache.getTotalAllocated() - usedAfterA == usedAfterA / 5);
+
+    PrefixCacheStats stats = cache.getPrefixCacheStats();
+    CHECK(stats.lookups == 2);
+    CHECK(stats.hitTokens == 64);
+    CHECK(stats.cachedBlocks == 4);
+
+    // Shared blocks survive the original owner
+    cache.freeFor("a");
+    CHECK(cache.getKView("b", 0).numPages() == 5);
+    cache.freeFor("b");
+    CHECK(cache.getPrefixCacheStats().cachedBlocks == 4);
+
+    cache.clearPrefixCache();
+    CHECK(cache.getTotalAllocated() == 0);
+}
+
+void testPrefixCacheIsPerAdapter() {
+    std::cout << "testPrefixCacheIsPerAdapter" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    std::vector<int> prompt = makePrompt(65, 3);
+    CHECK(cache.allocateWithPrefix("base", prompt) == 0);
+    cache.publishPrefix("base", prompt);
+
+    // Same tokens, different adapter: different KV, nothing shared
+    CHECK(cache.matchPrefix(prompt, "math") == 0);
+    CHECK(cache.allocateWithPrefix("math", prompt, -1, "math") == 0);
+    CHECK(cache.getKView("math", 0).page(0) != cache.getKView("base", 0).page(0));
+    cache.publishPrefix("math", prompt, "math");
+    CHECK(cache.getPrefixCacheStats().cachedBlocks == 8);
+
+    // Each adapter shares with itself only
+    CHECK(cache.matchPrefix(prompt) == 64);
+    CHECK(cache.matchPrefix(prompt, "math") == 64);
+    CHECK(cache.allocateWithPrefix("math-2", prompt, -1, "math") == 64);
+    CHECK(cache.getKView("math-2", 0).page(0) == cache.getKView("math", 0).page(0));
+    CHECK(cache.allocateWithPrefix("code", prompt, -1, "code") == 0);
+
+    for (const char* id : {"base", "math", "math-2", "code"}) {
+        cache.freeFor(id);
+    }
+    cache.clearPrefixCache();
+    CHECK(cache.getTotalAllocated() == 0);
+}
+
+void testChunkedReservationGrowsInBulk() {
+    std::cout << "testChunkedReservationGrowsInBulk" << std::endl;
+    KVCache cache(2, 2, 4, 8 * 16, 16);
+
+    std::vector<int> prompt = makePrompt(100, 1);
+    CHECK(cache.allocateWithPrefix("a", prompt, 0) == 0);
+    CHECK(cache.hasSequence("a"));
+    CHECK(cache.usedTokens("a") == 0);
+    CHECK(cache.getNumFreeBlocks() == 8);
+
+    CHECK(cache.appendTokens("a", 40));
+    CHECK(cache.usedTokens("a") == 40);
+    CHECK(cache.getNumFreeBlocks() == 5);
+    CHECK(cache.appendTokens("a", 60));
+    CHECK(cache.getNumFreeBlocks() == 1);
+
+    // All-or-nothing when the arena is short
+    CHECK(!cache.appendTokens("a", 40));
+    CHECK(cache.usedTokens("a") == 100);
+    CHECK(cache.getNumFreeBlocks() == 1);
+    CHECK(!cache.appendTokens("missing", 1));
+}
+
+void testPrefixMatchKeepsLastTokenUncached() {
+    std::cout << "testPrefixMatchKeepsLastTokenUncached" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    std::vector<int> prompt = makePrompt(32, 5);
+    CHECK(cache.allocateWithPrefix("a", prompt) == 0);
+    cache.publishPrefix("a", prompt);
+
+    // Identical prompt: the last block is recomputed for its logits
+    CHECK(cache.allocateWithPrefix("b", prompt) == 16);
+
+    // Diverging inside the first block matches nothing
+    std::vector<int> other = prompt;
+    other[3] = -1;
+    CHECK(cache.allocateWithPrefix("c", other) == 0);
+}
+
+void testIdlePrefixBlocksAreEvicted() {
+    std::cout << "testIdlePrefixBlocksAreEvicted" << std::endl;
+    KVCache cache(1, 1, 4, 8 * 16, 16, KVAllocationMode::Paged);
+
+    std::vector<int> prompt = makePrompt(6 * 16 + 1, 9);
+    CHECK(cache.allocateWithPrefix("a", prompt) == 0);
+    cache.publishPrefix("a", prompt);
+    cache.freeFor("a");
+    CHECK(cache.getPrefixCacheStats().cachedBlocks == 6);
+
+    // Needs all 8 blocks: unreferenced cached blocks give way
+    CHECK(cache.allocateWithPrefix("b", makePrompt(8 * 16, 77)) == 0);
+    CHECK(cache.getPrefixCacheStats().evictedBlocks == 6);
+    CHECK(cache.isFull());
+}
+
+void testPrefixCacheDisabledInContiguousMode() {
+    std::cout << "testPrefixCacheDisabledInContiguousMode" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Contiguous);
+    CHECK(!cache.isPrefixCachingEnabled());
+
+    std::vector<int> prompt = makePrompt(40, 1);
+    CHECK(cache.allocateWithPrefix("a", prompt) == 0);
+    cache.publishPrefix("a", prompt);
+    CHECK(cache.allocateWithPrefix("b", prompt) == 0);
+}
+
+float maxAbsError(const std::vector<float>& a, const std::vector<float>& b) {
+    float err = 0.0f;
+    for (size_t i = 0; i < a.size(); ++i) {
+        err = std::max(err, std::fabs(a[i] - b[i]));
+    }
+    return err;
+}
+
+void testQuantizedStorageRoundTrips() {
+    std::cout << "testQuantizedStorageRoundTrips" << std::endl;
+
+    for (KVDType dtype : {KVDType::FP32, KVDType::FP16, KVDType::INT8}) {
+        KVCache cache(2, 2, 4, 128 * 16, 16, KVAllocationMode::Paged, dtype);
+        CHECK(cache.getDType() == dtype);
+        CHECK(cache.allocateFor("a", 20));
+
+        // Position 3 first, then a larger-magnitude row in the same block
+        std::vector<float> k1 = {0.5f, -0.25f, 0.125f, 1.0f, -1.5f, 0.75f, 0.0f, 0.3f};
+        std::vector<float> v1 = {1.0f, 2.0f, -3.0f, 4.0f, -0.5f, 0.5f, 0.25f, -0.25f};
+        std::vector<float> k2 = {8.0f, -6.0f, 2.0f, 1.0f, 0.1f, 0.2f, 0.3f, 0.4f};
+        CHECK(cache.writeToken("a", 1, 3, k1.data(), v1.data()));
+        CHECK(cache.writeToken("a", 1, 4, k2.data(), v1.data()));
+
+        std::vector<float> k(8), v(8);
+        CHECK(cache.readToken("a", 1, 3, k.data(), v.data()));
+        float tolerance = dtype == KVDType::FP32 ? 0.0f
+                        : dtype == KVDType::FP16 ? 1e-3f
+                        : 8.0f / 127.0f;  // Rescaled by the second row
+        CHECK(maxAbsError(k, k1) <= tolerance);
+        CHECK(maxAbsError(v, v1) <= (dtype == KVDType::INT8 ? 4.0f / 127.0f : tolerance));
+        CHECK(cache.readToken("a", 1, 4, k.data(), v.data()));
+        CHECK(maxAbsError(k, k2) <= tolerance);
+
+        KVView view = cache.getKView("a", 1);
+        CHECK(view.dtype == dtype);
+        CHECK(view.scales.size() == (dtype == KVDType::INT8 ? 2u : 0u));
+        CHECK(!cache.writeToken("a", 2, 0, k1.data(), v1.data()));
+        CHECK(!cache.writeToken("a", 0, 32, k1.data(), v1.data()));
+    }
+
+    // Same token capacity, smaller arena
+    KVCache fp32(2, 2, 4, 128 * 16);
+    KVCache fp16(2, 2, 4, 128 * 16, 16, KVAllocationMode::Paged, KVDType::FP16);
+    KVCache int8(2, 2, 4, 128 * 16, 16, KVAllocationMode::Paged, KVDType::INT8);
+    CHECK(fp16.getBytesPerBlock() * 2 == fp32.getBytesPerBlock());
+    CHECK(int8.getBytesPerBlock() < fp16.getBytesPerBlock());
+}
+
+void testSwapRoundTripPreservesKV() {
+    std::cout << "testSwapRoundTripPreservesKV" << std::endl;
+    const std::string swapFile = "/tmp/cortexstream_test_swap.bin";
+
+    for (const std::string& backing : {std::string(), swapFile}) {
+        KVCache cache(2, 2, 4, 4 * 16, 16, KVAllocationMode::Paged, KVDType::INT8);
+        std::vector<float> k1 = {0.5f, -0.25f, 0.125f, 1.0f, -1.5f, 0.75f, 0.0f, 0.3f};
+        std::vector<float> v1 = {1.0f, 2.0f, -3.0f, 4.0f, -0.5f, 0.5f, 0.25f, -0.25f};
+
+        // No swap pool yet
+        CHECK(cache.allocateFor("a", 40));
+        CHECK(!cache.swapOut("a"));
+
+        CHECK(cache.configureSwapSpace(3, backing));
+        CHECK(cache.writeToken("a", 1, 35, k1.data(), v1.data()));
+        std::vector<float> before(8), unused(8);
+        CHECK(cache.readToken("a", 1, 35, before.data(), unused.data()));
+
+        CHECK(cache.swapOut("a"));
+        CHECK(cache.isSwapped("a"));
+        CHECK(cache.getNumFreeSwapBlocks() == 0);
+        CHECK(cache.getNumFreeBlocks() == 4);
+        CHECK(!cache.configureSwapSpace(8));  // Pool in use
+
+        // Someone else takes the blocks; swap-in must wait
+        CHECK(cache.allocateFor("b", 4 * 16));
+        CHECK(!cache.swapIn("a"));
+        cache.freeFor("b");
+
+        CHECK(cache.swapIn("a"));
+        CHECK(!cache.isSwapped("a"));
+        CHECK(cache.usedTokens("a") == 40);
+        CHECK(cache.getNumFreeSwapBlocks() == 3);
+        std::vector<float> k(8), v(8);
+        CHECK(cache.readToken("a", 1, 35, k.data(), v.data()));
+        CHECK(maxAbsError(k, before) == 0.0f);
+
+        // Freeing a swapped sequence returns its swap slots
+        CHECK(cache.swapOut("a"));
+        cache.freeFor("a");
+        CHECK(cache.getNumFreeSwapBlocks() == 3);
+        CHECK(cache.getNumAllocatedSequences() == 0);
+    }
+    std::remove(swapFile.c_str());
+}
+
+void testSeqIdAndNamedSequencesCoexist() {
+    std::cout << "testSeqIdAndNamedSequencesCoexist" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    // Named sequences draw from the same pool, so ids never collide
+    SeqId seq = acquireSeqId();
+    CHECK(cache.allocateFor(seq, 20));
+    CHECK(cache.allocateFor("named", 5));
+    CHECK(!cache.allocateFor(seq, 1));
+    CHECK(cache.usedTokens(seq) == 20);
+    CHECK(cache.usedTokens("named") == 5);
+    CHECK(cache.appendToken(seq));
+    CHECK(cache.usedTokens(seq) == 21);
+    CHECK(cache.getNumAllocatedSequences() == 2);
+
+    cache.freeFor("named");
+    CHECK(!cache.hasSequence("named"));
+    CHECK(cache.hasSequence(seq));
+    cache.freeFor(seq);
+    CHECK(cache.getNumAllocatedSequences() == 0);
+    CHECK(cache.getNumFreeBlocks() == 128);
+    CHECK(!cache.appendToken(kInvalidSeqId));
+    releaseSeqId(seq);
+}
+
+void testTruncateReleasesTrailingBlocks() {
+    std::cout << "testTruncateReleasesTrailingBlocks" << std::endl;
+    KVCache cache = makeCache(KVAllocationMode::Paged);
+
+    // 20 tokens plus 20 speculative slots: three blocks
+    SeqId seq = acquireSeqId();
+    CHECK(cache.allocateFor(seq, 20));
+    CHECK(cache.appendTokens(seq, 20));
+    CHECK(cache.usedTokens(seq) == 40);
+    CHECK(cache.getNumFreeBlocks() == 125);
+
+    // Rejected drafts roll back; the partly used block stays
+    CHECK(cache.truncateTokens(seq, 15));
+    CHECK(cache.usedTokens(seq) == 25);
+    CHECK(cache.getNumFreeBlocks() == 126);
+    CHECK(!cache.truncateTokens(seq, 26));
+    CHECK(cache.appendToken(seq));
+    CHECK(cache.usedTokens(seq) == 26);
+
+    cache.freeFor(seq);
+    CHECK(cache.getNumFreeBlocks() == 128);
+    releaseSeqId(seq);
+}
+
+}  // namespace
 
 int main() {
     std::cout << "KV Cache Tests" << std::endl;
+
+    testAllocatorUsesWholeNonPowerOfTwoPool();
+    testAllocatorMergesBuddiesInAnyOrder();
+    testPagedAllocationHasNoRoundingWaste();
+    testContiguousAllocationRoundsUp();
+    testPagedViewIndexing();
+    testAppendTokenGrowsOnDemand();
+    testAppendTokenFailsWhenArenaExhausted();
+    testContiguousGrowthUsesBuddySlack();
+    testPrefixBlocksAreShared();
+    testPrefixMatchKeepsLastTokenUncached();
+    testPrefixCacheIsPerAdapter();
+    testChunkedReservationGrowsInBulk();
+    testIdlePrefixBlocksAreEvicted();
+    testPrefixCacheDisabledInContiguousMode();
+    testQuantizedStorageRoundTrips();
+    testSwapRoundTripPreservesKV();
+    testSeqIdAndNamedSequencesCoexist();
+    testTruncateReleasesTrailingBlocks();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All KV cache tests passed" << std::endl;
     return 0;
 }
@@ -0,0 +1,407 @@
+// Multi-LoRA adapter serving unit tests
+#include "cortexstream/engine.h"
+#include "cortexstream/lora.h"
+#include <chrono>
+#include <cmath>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+const int64_t kHidden = 64;
+const int64_t kIntermediate = 128;
+const std::string kQProj = "model.layers.0.self_attn.q_proj.weight";
+const std::string kDownProj = "model.layers.0.mlp.down_proj.weight";
+
+std::vector<float> randomFloats(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> values(n);
+    for (auto& v : values) v = dist(rng);
+    return values;
+}
+
+float maxError(const std::vector<float>& a, const std::vector<float>& b) {
+    float worst = a.size() == b.size() ? 0.0f : INFINITY;
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        worst = std::max(worst, std::fabs(a[i] - b[i]));
+    }
+    return worst;
+}
+
+struct Matrix {
+    std::string name;
+    int64_t rows, cols;
+    std::vector<float> values;
+};
+
+void writeSafetensors(const std::string& file, const std::vector<Matrix>& matrices) {
+    std::string json = "{";
+    std::vector<float> payload;
+    for (size_t i = 0; i < matrices.size(); ++i) {
+        const Matrix& m = matrices[i];
+        size_t begin = payload.size() * sizeof(float);
+        payload.insert(payload.end(), m.values.begin(), m.values.end());
+        json += (i ? "," : "") + std::string("\"") + m.name + "\":{\"dtype\":\"F32\",\"shape\":[" +
+                std::to_string(m.rows) + "," + std::to_string(m.cols) + "],\"data_offsets\":[" +
+                std::to_string(begin) + "," + std::to_string(payload.size() * sizeof(float)) + "]}";
+    }
+    json += "}";
+    std::ofstream out(file, std::ios::binary);
+    uint64_t length = json.size();
+    for (int i = 0; i < 8; ++i) out.put(static_cast<char>((length >> (8 * i)) & 0xFF));
+    out << json;
+    out.write(reinterpret_cast<const char*>(payload.data()), payload.size() * sizeof(float));
+}
+
+// Base model: one attention projection and one MLP projection
+void writeBase(const std::filesystem::path& dir) {
+    std::filesystem::create_directories(dir);
+    writeSafetensors((dir / "model.safetensors").string(), {
+        {kQProj, kHidden, kHidden, randomFloats(kHidden * kHidden, 1)},
+        {kDownProj, kHidden, kIntermediate, randomFloats(kHidden * kIntermediate, 2)},
+        {"lm_head.weight", 32, kHidden, randomFloats(32 * kHidden, 3)},
+    });
+    std::ofstream(dir / "config.json")
+        << "{\"hidden_size\": " << kHidden << ", \"num_hidden_layers\": 1, \"vocab_size\": 32,"
+           " \"num_attention_heads\": 4, \"num_key_value_heads\": 4}";
+}
+
+struct Factors {
+    int64_t rank, in, out;
+    std::vector<float> a, b;    // [rank, in], [out, rank]
+};
+
+// PEFT layout: base_model.model.<projection>.lora_{A,B}.weight
+std::unordered_map<std::string, Factors> writeAdapter(
+        const std::filesystem::path& dir, int64_t rank, float alpha,
+        const std::vector<std::pair<std::string, int64_t>>& targets, uint32_t seed) {
+    std::filesystem::create_directories(dir);
+    std::unordered_map<std::string, Factors> factors;
+    std::vector<Matrix> matrices;
+    for (const auto& [name, in] : targets) {
+        Factors f{rank, in, kHidden, randomFloats(rank * in, seed++), randomFloats(kHidden * rank, seed++)};
+        std::string stem = "base_model.model." + name.substr(0, name.size() - 7);  // Drop ".weight"
+        matrices.push_back({stem + ".lora_A.weight", rank, in, f.a});
+        matrices.push_back({stem + ".lora_B.weight", kHidden, rank, f.b});
+        factors.emplace(name, std::move(f));
+    }
+    writeSafetensors((dir / "adapter_model.safetensors").string(), matrices);
+    std::ofstream(dir / "adapter_config.json")
+        << "{\"r\": " << rank << ", \"lora_alpha\": " << alpha << "}";
+    return factors;
+}
+
+// y_b += scale * B (A x_b)
+void addReference(const Factors& f, float scale, const float* x, float* y) {
+    std::vector<float> t(f.rank, 0.0f);
+    for (int64_t j = 0; j < f.rank; ++j) {
+        for (int64_t i = 0; i < f.in; ++i) t[j] += f.a[j * f.in + i] * x[i];
+    }
+    for (int64_t o = 0; o < f.out; ++o) {
+        for (int64_t j = 0; j < f.rank; ++j) y[o] += scale * f.b[o * f.rank + j] * t[j];
+    }
+}
+
+std::shared_ptr<Request> makeRequest(const std::string& id, const std::string& adapter) {
+    auto req = std::make_shared<Request>(id, std::vector<int>(8, 7), 4);
+    req->setAdapter(adapter);
+    return req;
+}
+
+Batch makeBatch(const std::vector<std::string>& adapters) {
+    Batch batch;
+    for (size_t i = 0; i < adapters.size(); ++i) {
+        batch.requests.push_back(makeRequest("row" + std::to_string(i), adapters[i]));
+        batch.sequenceLengths.push_back(1);
+        batch.batchSize++;
+    }
+    return batch;
+}
+
+struct Fixture {
+    std::filesystem::path root;
+    std::shared_ptr<ModelBackend> backend;
+    std::unordered_map<std::string, Factors> a, b;
+
+    Fixture() : root(std::filesystem::temp_directory_path() / "cortexstream_lora") {
+        std::filesystem::remove_all(root);
+        writeBase(root / "base");
+        a = writeAdapter(root / "a", 4, 8.0f, {{kQProj, kHidden}, {kDownProj, kIntermediate}}, 10);
+        b = writeAdapter(root / "b", 8, 16.0f, {{kQProj, kHidden}}, 20);
+        writeAdapter(root / "c", 8, 8.0f, {{kQProj, kHidden}}, 30);
+        backend = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+        CHECK(backend->loadModel((root / "base").string()));
+        CHECK(backend->registerAdapter("a", (root / "a").string()));
+        CHECK(backend->registerAdapter("b", (root / "b").string()));
+    }
+    ~Fixture() { std::filesystem::remove_all(root); }
+};
+
+void testAdapterNaming() {
+    std::cout << "testAdapterNaming" << std::endl;
+    bool isA = false;
+    CHECK(LoRAAdapter::baseNameOf("base_model.model.model.layers.0.self_attn.q_proj.lora_A.weight", isA) ==
+          "model.layers.0.self_attn.q_proj.weight");
+    CHECK(isA);
+    CHECK(LoRAAdapter::baseNameOf("model.layers.0.mlp.down_proj.lora_B.weight", isA) ==
+          "model.layers.0.mlp.down_proj.weight");
+    CHECK(!isA);
+    CHECK(LoRAAdapter::baseNameOf("model.layers.0.mlp.down_proj.weight", isA).empty());
+}
+
+void testMixedBatchMatchesPerRowReference() {
+    std::cout << "testMixedBatchMatchesPerRowReference" << std::endl;
+    Fixture f;
+    CHECK(f.backend->hasAdapter("a"));
+    CHECK(!f.backend->hasAdapter("ghost"));
+
+    // Rows interleave adapters (gathered) and repeat them (segmented)
+    Batch batch = makeBatch({"a", "", "b", "b", "a"});
+    const int64_t rows = batch.batchSize;
+    std::vector<int> slots = f.backend->acquireAdapters(batch);
+    CHECK(slots.size() == static_cast<size_t>(rows));
+    CHECK(slots[1] == -1);
+    CHECK(slots[0] >= 0 && slots[0] == slots[4]);
+    CHECK(slots[2] >= 0 && slots[2] == slots[3] && slots[2] != slots[0]);
+
+    for (const auto& [name, in] : std::vector<std::pair<std::string, int64_t>>{
+             {kQProj, kHidden}, {kDownProj, kIntermediate}}) {
+        std::vector<float> x = randomFloats(rows * in, 40);
+        TensorView view(x.data(), in);
+        view.rows = rows;
+        Tensor base = f.backend->linear(name, view);
+        Tensor mixed = f.backend->linear(name, view, slots);
+        CHECK(mixed.shape == base.shape);
+
+        std::vector<float> expected = base.data;
+        const std::vector<std::pair<const std::unordered_map<std::string, Factors>*, float>> rowAdapters = {
+            {&f.a, 2.0f}, {nullptr, 0.0f}, {&f.b, 2.0f}, {&f.b, 2.0f}, {&f.a, 2.0f}};
+        for (int64_t r = 0; r < rows; ++r) {
+            const auto* factors = rowAdapters[r].first;
+            if (factors && factors->count(name)) {
+                addReference(factors->at(name), rowAdapters[r].second,
+                             x.data() + r * in, expected.data() + r * kHidden);
+            }
+        }
+        CHECK(maxError(mixed.data, expected) < 1e-3f);
+        CHECK(maxError(mixed.data, base.data) > 1e-2f);     // The adapters did something
+    }
+    f.backend->releaseAdapters(slots);
+    CHECK(f.backend->getAdapterCache()->getStats().pinnedAdapters == 0);
+
+    // A prefill pins its adapters for the pass only
+    f.backend->prefill(makeBatch({"b", "a"}), {});
+    AdapterCacheStats stats = f.backend->getAdapterCache()->getStats();
+    CHECK(stats.pinnedAdapters == 0);
+    CHECK(stats.hits == 2);
+    CHECK(stats.misses == 2);
+}
+
+void testPagedCacheEvictsLeastRecentlyUsed() {
+    std::cout << "testPagedCacheEvictsLeastRecentlyUsed" << std::endl;
+    Fixture f;
+    CHECK(f.backend->registerAdapter("c", (f.root / "c").string()));
+
+    // a needs 2 * (4 + 4) pages, b and c 2 * 8 each: room for two at once
+    CHECK(f.backend->configureAdapterCache(32));
+    auto cache = f.backend->getAdapterCache();
+    CHECK(cache->getPageFloats() == static_cast<size_t>(kIntermediate));
+    f.backend->releaseAdapters(f.backend->acquireAdapters(makeBatch({"a"})));
+    f.backend->releaseAdapters(f.backend->acquireAdapters(makeBatch({"b"})));
+    CHECK(cache->isResident("a") && cache->isResident("b"));
+    CHECK(cache->getStats().freePages == 0);
+
+    f.backend->releaseAdapters(f.backend->acquireAdapters(makeBatch({"c"})));
+    CHECK(!cache->isResident("a"));     // Least recently used
+    CHECK(cache->isResident("b") && cache->isResident("c"));
+    CHECK(cache->getStats().evictions == 1);
+
+    // Pinned adapters are never evicted; a batch that cannot fit fails whole
+    std::vector<int> pinned = f.backend->acquireAdapters(makeBatch({"b", "c"}));
+    bool threw = false;
+    try {
+        f.backend->acquireAdapters(makeBatch({"a"}));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(!f.backend->configureAdapterCache(64));
+    f.backend->releaseAdapters(pinned);
+    CHECK(cache->getStats().pinnedAdapters == 0);
+
+    threw = false;
+    try {
+        f.backend->acquireAdapters(makeBatch({"b", "a", "c"}));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(cache->getStats().pinnedAdapters == 0);   // Partial pins rolled back
+
+    // Unregistering drops the resident copy
+    f.backend->unregisterAdapter("c");
+    CHECK(!f.backend->hasAdapter("c"));
+    CHECK(!cache->isResident("c"));
+    CHECK(f.backend->configureAdapterCache(64));
+}
+
+void testRejectsMismatchedAndUnknownAdapters() {
+    std::cout << "testRejectsMismatchedAndUnknownAdapters" << std::endl;
+    Fixture f;
+    // Targets a projection the base model does not have
+    writeAdapter(f.root / "bad", 4, 4.0f, {{"model.layers.0.mlp.up_proj.weight", kHidden}}, 50);
+    CHECK(!f.backend->registerAdapter("bad", (f.root / "bad").string()));
+    CHECK(!f.backend->registerAdapter("missing", (f.root / "missing").string()));
+    CHECK(!f.backend->hasAdapter("bad"));
+
+    bool threw = false;
+    try {
+        f.backend->acquireAdapters(makeBatch({"a", "ghost"}));
+    } catch (const std::runtime_error&) {
+        threw = true;
+    }
+    CHECK(threw);
+    CHECK(f.backend->getAdapterCache()->getStats().pinnedAdapters == 0);
+}
+
+void testSchedulerCapsAndGroupsAdapters() {
+    std::cout << "testSchedulerCapsAndGroupsAdapters" << std::endl;
+    {
+        // Active adapters capped at one: b waits until a drains
+        Scheduler scheduler(8);
+        scheduler.setMaxActiveAdapters(1);
+        auto a1 = makeRequest("a1", "a");
+        auto b1 = makeRequest("b1", "b");
+        auto a2 = makeRequest("a2", "a");
+        auto base = makeRequest("base", "");
+        for (const auto& req : {a1, b1, a2, base}) scheduler.submitRequest(req);
+
+        ScheduledStep step = scheduler.scheduleStep(1 << 20);
+        CHECK(step.prefill.batchSize == 3);
+        CHECK(scheduler.getNumPendingRequests() == 1);
+        CHECK(b1->getState() == RequestState::Pending);
+
+        scheduler.markRequestFinished(a1->getSeqId());
+        scheduler.acceptNewRequests();
+        CHECK(scheduler.getNumPendingRequests() == 1);     // a2 still holds the slot
+        scheduler.markRequestFinished(a2->getSeqId());
+        scheduler.acceptNewRequests();
+        CHECK(scheduler.getNumPendingRequests() == 0);
+        CHECK(b1->getState() == RequestState::Prefilling);
+    }
+    {
+        // Uncapped: every batch keeps each adapter's rows together
+        Scheduler scheduler(8);
+        std::vector<std::shared_ptr<Request>> reqs = {
+            makeRequest("a1", "a"), makeRequest("b1", "b"), makeRequest("base", ""),
+            makeRequest("a2", "a"), makeRequest("b2", "b")};
+        for (const auto& req : reqs) scheduler.submitRequest(req);
+        ScheduledStep step = scheduler.scheduleStep(1 << 20);
+        CHECK(step.prefill.batchSize == 5);
+        std::vector<std::string> order;
+        for (const auto& req : step.prefill.requests) order.push_back(req->getId());
+        CHECK((order == std::vector<std::string>{"a1", "a2", "b1", "b2", "base"}));
+        for (int i = 0; i < step.prefill.batchSize; ++i) {
+            CHECK(step.prefill.startPositions[i] == 0);
+            CHECK(step.prefill.sequenceLengths[i] == step.prefill.requests[i]->getPromptLength());
+        }
+
+        for (const auto& req : reqs) scheduler.markRequestReady(req->getSeqId());
+        Batch decode = scheduler.buildDecodeBatch();
+        order.clear();
+        for (const auto& req : decode.requests) order.push_back(req->getId());
+        CHECK((order == std::vector<std::string>{"a1", "a2", "b1", "b2", "base"}));
+    }
+}
+
+void testPrefixKVIsNotSharedAcrossAdapters() {
+    std::cout << "testPrefixKVIsNotSharedAcrossAdapters" << std::endl;
+    Fixture f;
+    auto scheduler = std::make_shared<Scheduler>(8);
+    auto cache = std::make_shared<KVCache>(1, 1, 4, 64 * 16, 16);
+    auto engine = std::make_shared<InferenceEngine>(f.backend, scheduler, cache);
+    CHECK(engine->initialize());
+    engine->run();
+
+    // One at a time, so each sees the blocks its predecessors published
+    const std::vector<int> prompt(40, 5);
+    std::vector<std::shared_ptr<Request>> reqs;
+    for (const char* adapter : {"a", "b", "", "a"}) {
+        reqs.push_back(std::make_shared<Request>("p" + std::to_string(reqs.size()), prompt, 4));
+        reqs.back()->setAdapter(adapter);
+        scheduler->submitRequest(reqs.back());
+        CHECK(engine->waitUntilIdle(std::chrono::seconds(30)));
+    }
+    engine->shutdown();
+
+    for (const auto& req : reqs) CHECK(req->isFinished());
+    // Only the second "a" request reuses KV: 2 full blocks
+    CHECK(cache->getPrefixCacheStats().hitTokens == 32);
+    CHECK(cache->getPrefixCacheStats().cachedBlocks == 6);
+    CHECK(cache->getNumAllocatedSequences() == 0);
+}
+
+void testEngineServesAdaptersAndFailsUnknown() {
+    std::cout << "testEngineServesAdaptersAndFailsUnknown" << std::endl;
+    Fixture f;
+    auto scheduler = std::make_shared<Scheduler>(8);
+    auto cache = std::make_shared<KVCache>(1, 1, 4, 64 * 16, 16);
+    auto engine = std::make_shared<InferenceEngine>(f.backend, scheduler, cache);
+    CHECK(engine->initialize());
+
+    auto tuned = makeRequest("tuned", "a");
+    auto ghost = makeRequest("ghost", "ghost");
+    auto plain = makeRequest("plain", "");
+    for (const auto& req : {tuned, ghost, plain}) scheduler->submitRequest(req);
+    engine->run();
+    CHECK(engine->waitUntilIdle(std::chrono::seconds(30)));
+    engine->shutdown();
+
+    CHECK(tuned->isFinished());
+    CHECK(plain->isFinished());
+    CHECK(ghost->isFailed());
+    CHECK(cache->getNumAllocatedSequences() == 0);
+    AdapterCacheStats stats = f.backend->getAdapterCache()->getStats();
+    CHECK(stats.misses == 1);
+    CHECK(stats.pinnedAdapters == 0);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "LoRA Tests" << std::endl;
+
+    testAdapterNaming();
+    testMixedBatchMatchesPerRowReference();
+    testPagedCacheEvictsLeastRecentlyUsed();
+    testRejectsMismatchedAndUnknownAdapters();
+    testSchedulerCapsAndGroupsAdapters();
+    testEngineServesAdaptersAndFailsUnknown();
+    testPrefixKVIsNotSharedAcrossAdapters();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All LoRA tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,140 @@
+// Latency histogram and Prometheus exporter unit tests
+#include "cortexstream/metrics.h"
+#include <cstdint>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+bool contains(const std::string& text, const std::string& needle) {
+    return text.find(needle) != std::string::npos;
+}
+
+void testBucketGeometryCoversEveryValue() {
+    std::cout << "testBucketGeometryCoversEveryValue" << std::endl;
+    for (uint64_t v = 0; v < 16; ++v) {
+        CHECK(LatencyHistogram::bucketIndex(v) == v);
+        CHECK(LatencyHistogram::bucketUpperBound(v) == v);
+    }
+    // Each value lands in a bucket whose range contains it, within 1/16
+    const uint64_t samples[] = {16, 17, 31, 32, 1000, 123456789, uint64_t(1) << 40, UINT64_MAX};
+    for (uint64_t v : samples) {
+        size_t index = LatencyHistogram::bucketIndex(v);
+        CHECK(index < LatencyHistogram::kNumBuckets);
+        uint64_t upper = LatencyHistogram::bucketUpperBound(index);
+        uint64_t lower = LatencyHistogram::bucketUpperBound(index - 1) + 1;
+        CHECK(lower <= v && v <= upper);
+        CHECK(static_cast<double>(upper - lower) <= static_cast<double>(v) / 16.0);
+    }
+    CHECK(LatencyHistogram::bucketIndex(UINT64_MAX) == LatencyHistogram::kNumBuckets - 1);
+}
+
+void testQuantilesWithinRelativeError() {
+    std::cout << "testQuantilesWithinRelativeError" << std::endl;
+    LatencyHistogram hist;
+    for (uint64_t v = 1; v <= 10000; ++v) {
+        hist.record(v * 1000);      // 1us .. 10ms in ns
+    }
+    HistogramSnapshot snap = hist.snapshot();
+    CHECK(snap.count == 10000);
+    CHECK(snap.min == 1000);
+    CHECK(snap.max == 10000000);
+    CHECK(snap.sum == 1000ull * 10000 * 10001 / 2);
+
+    const double quantiles[] = {0.5, 0.9, 0.99, 0.999};
+    for (double q : quantiles) {
+        double exact = q * 10000 * 1000;
+        double got = static_cast<double>(snap.quantile(q));
+        CHECK(got >= exact && got <= exact * 1.07);
+    }
+    CHECK(snap.quantile(0.0) >= 1000 && snap.quantile(0.0) <= 1070);
+    CHECK(snap.quantile(1.0) == 10000000);
+
+    hist.reset();
+    snap = hist.snapshot();
+    CHECK(snap.count == 0 && snap.quantile(0.99) == 0 && snap.mean() == 0.0);
+}
+
+void testConcurrentRecordingLosesNothing() {
+    std::cout << "testConcurrentRecordingLosesNothing" << std::endl;
+    LatencyHistogram hist;
+    constexpr int kThreads = 4;
+    constexpr int kPerThread = 50000;
+    std::vector<std::thread> threads;
+    for (int t = 0; t < kThreads; ++t) {
+        threads.emplace_back([&hist, t] {
+            for (int i = 0; i < kPerThread; ++i) {
+                hist.record(static_cast<uint64_t>(t * kPerThread + i));
+            }
+        });
+    }
+    for (auto& thread : threads) {
+        thread.join();
+    }
+    HistogramSnapshot snap = hist.snapshot();
+    CHECK(snap.count == static_cast<uint64_t>(kThreads) * kPerThread);
+    CHECK(snap.min == 0);
+    CHECK(snap.max == static_cast<uint64_t>(kThreads) * kPerThread - 1);
+
+    hist.recordMany(7, 3);
+    CHECK(hist.snapshot().count == snap.count + 3);
+}
+
+void testPrometheusExposition() {
+    std::cout << "testPrometheusExposition" << std::endl;
+    LatencyHistogram hist;
+    hist.record(2000000);           // 2ms
+    hist.record(20000000);          // 20ms
+    hist.record(3000000000ull);     // 3s
+
+    PrometheusWriter out;
+    out.histogram("test_latency_seconds", "Test latency", hist.snapshot(),
+                  {0.005, 0.05, 1.0}, 1e-9);
+    out.counter("test_total", "Things done", 42);
+    out.gauge("test_ratio", "A ratio", 0.25);
+    const std::string text = out.str();
+
+    CHECK(contains(text, "# HELP test_latency_seconds Test latency\n"));
+    CHECK(contains(text, "# TYPE test_latency_seconds histogram\n"));
+    CHECK(contains(text, "test_latency_seconds_bucket{le=\"0.005\"} 1\n"));
+    CHECK(contains(text, "test_latency_seconds_bucket{le=\"0.05\"} 2\n"));
+    CHECK(contains(text, "test_latency_seconds_bucket{le=\"1\"} 2\n"));
+    CHECK(contains(text, "test_latency_seconds_bucket{le=\"+Inf\"} 3\n"));
+    CHECK(contains(text, "test_latency_seconds_sum 3.022\n"));
+    CHECK(contains(text, "test_latency_seconds_count 3\n"));
+    CHECK(contains(text, "# TYPE test_total counter\ntest_total 42\n"));
+    CHECK(contains(text, "# TYPE test_ratio gauge\ntest_ratio 0.25\n"));
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Metrics Tests" << std::endl;
+
+    testBucketGeometryCoversEveryValue();
+    testQuantilesWithinRelativeError();
+    testConcurrentRecordingLosesNothing();
+    testPrometheusExposition();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All metrics tests passed" << std::endl;
+    return 0;
+}
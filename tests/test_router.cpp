@@ -0,0 +1,254 @@
+// Engine router unit tests
+#include "cortexstream/router.h"
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+// Replica with scripted load and prefix residency
+class FakeReplica : public EngineReplica {
+public:
+    FakeReplica(std::string name, std::string model = "m") : name_(std::move(name)), model_(std::move(model)) {
+        state.totalKVBlocks = 100;
+        state.freeKVBlocks = 100;
+    }
+
+    const std::string& name() const override { return name_; }
+    const std::string& model() const override { return model_; }
+    ReplicaLoad load() const override { return state; }
+    int cachedPrefixTokens(const std::vector<int>&, const std::string&) const override { return resident; }
+    bool submit(std::shared_ptr<Request> request) override {
+        if (!accepting) return false;
+        submitted.push_back(std::move(request));
+        state.pendingRequests++;
+        return true;
+    }
+
+    ReplicaLoad state;
+    int resident = 0;
+    bool accepting = true;
+    std::vector<std::shared_ptr<Request>> submitted;
+
+private:
+    std::string name_;
+    std::string model_;
+};
+
+std::shared_ptr<Request> makeRequest(const std::string& id, const std::vector<int>& prompt) {
+    return std::make_shared<Request>(id, prompt, 4);
+}
+
+std::vector<int> promptWithPrefix(int prefixToken, int prefixLen, int suffixToken, int suffixLen) {
+    std::vector<int> prompt(prefixLen, prefixToken);
+    prompt.insert(prompt.end(), suffixLen, suffixToken);
+    return prompt;
+}
+
+void testLeastLoadedWithoutAffinity() {
+    std::cout << "testLeastLoadedWithoutAffinity" << std::endl;
+    EngineRouter router;
+    auto a = std::make_shared<FakeReplica>("a");
+    auto b = std::make_shared<FakeReplica>("b");
+    router.addReplica(a);
+    router.addReplica(b);
+    a->state.pendingRequests = 5;
+
+    // Short prompts carry no block-aligned prefix: pure load balancing
+    CHECK(router.submit(makeRequest("r0", {1, 2, 3})) == 1);
+    b->state.pendingRequests = 9;
+    CHECK(router.submit(makeRequest("r1", {4, 5, 6})) == 0);
+
+    // Same depth: the replica with more free KV wins
+    a->state.pendingRequests = 3;
+    b->state.pendingRequests = 3;
+    a->state.freeKVBlocks = 10;
+    CHECK(router.route(*makeRequest("r2", {7})) == 1);
+}
+
+void testResidentPrefixAttractsRequests() {
+    std::cout << "testResidentPrefixAttractsRequests" << std::endl;
+    EngineRouter router;
+    auto a = std::make_shared<FakeReplica>("a");
+    auto b = std::make_shared<FakeReplica>("b");
+    router.addReplica(a);
+    router.addReplica(b);
+    b->resident = 64;
+    b->state.pendingRequests = 2;     // Slightly busier, but holds the prompt
+
+    auto req = makeRequest("hit", promptWithPrefix(9, 64, 1, 8));
+    CHECK(router.submit(req) == 1);
+    auto status = router.getReplicaStatus();
+    CHECK(status[1].affinityRoutes == 1);
+    CHECK(status[1].expectedHitTokens == 64);
+
+    // Past the imbalance limit load wins over affinity
+    b->state.pendingRequests = 20;
+    CHECK(router.submit(makeRequest("overloaded", promptWithPrefix(9, 64, 2, 8))) == 0);
+    CHECK(router.getReplicaStatus()[0].affinityRoutes == 0);
+}
+
+void testBurstSharingNewPrefixSticksTogether() {
+    std::cout << "testBurstSharingNewPrefixSticksTogether" << std::endl;
+    RouterConfig config;
+    config.maxQueueImbalance = 4;
+    EngineRouter router(config);
+    std::vector<std::shared_ptr<FakeReplica>> fleet;
+    for (int i = 0; i < 3; ++i) {
+        fleet.push_back(std::make_shared<FakeReplica>("r" + std::to_string(i)));
+        router.addReplica(fleet.back());
+    }
+
+    // Nothing is resident yet; the router's memory keeps the system prompt
+    // on one replica until load forces a spill
+    int first = router.submit(makeRequest("s0", promptWithPrefix(42, 128, 0, 4)));
+    CHECK(first >= 0);
+    for (int i = 1; i <= 4; ++i) {
+        CHECK(router.submit(makeRequest("s" + std::to_string(i), promptWithPrefix(42, 128, i, 4))) == first);
+    }
+    int spilled = router.submit(makeRequest("s5", promptWithPrefix(42, 128, 5, 4)));
+    CHECK(spilled >= 0 && spilled != first);
+
+    // Unrelated prompts still spread out
+    int other = router.submit(makeRequest("o0", promptWithPrefix(7, 128, 0, 4)));
+    CHECK(other >= 0 && other != first);
+}
+
+void testAffinityIsPerAdapter() {
+    std::cout << "testAffinityIsPerAdapter" << std::endl;
+    EngineRouter router;
+    auto a = std::make_shared<FakeReplica>("a");
+    auto b = std::make_shared<FakeReplica>("b");
+    router.addReplica(a);
+    router.addReplica(b);
+
+    const std::vector<int> prompt = promptWithPrefix(42, 64, 1, 4);
+    CHECK(router.submit(makeRequest("base-0", prompt)) == 0);
+    CHECK(router.submit(makeRequest("base-1", prompt)) == 0);     // Remembered prefix
+
+    // The same tokens under an adapter have no KV anywhere: load decides
+    auto tuned = makeRequest("tuned", prompt);
+    tuned->setAdapter("math");
+    CHECK(router.submit(tuned) == 1);
+    CHECK(router.getReplicaStatus()[1].affinityRoutes == 0);
+}
+
+void testHealthModelAndFailover() {
+    std::cout << "testHealthModelAndFailover" << std::endl;
+    RouterConfig config;
+    config.maxSubmitFailures = 2;
+    EngineRouter router(config);
+    auto a = std::make_shared<FakeReplica>("a", "llama");
+    auto b = std::make_shared<FakeReplica>("b", "llama");
+    auto c = std::make_shared<FakeReplica>("c", "mistral");
+    router.addReplica(a);
+    router.addReplica(b);
+    router.addReplica(c);
+
+    CHECK(router.route(*makeRequest("m", {1}), "mistral") == 2);
+    CHECK(router.route(*makeRequest("none", {1}), "gpt") == -1);
+
+    // Unhealthy and disabled replicas get nothing
+    a->state.healthy = false;
+    CHECK(router.route(*makeRequest("h", {1}), "llama") == 1);
+    router.setReplicaEnabled(1, false);
+    CHECK(router.submit(makeRequest("h2", {1}), "llama") == -1);
+    router.setReplicaEnabled(1, true);
+    a->state.healthy = true;
+
+    // A refusing replica falls through to the next; after repeated
+    // failures it is ranked last even when idle
+    a->accepting = false;
+    b->state.pendingRequests = 1;
+    CHECK(router.submit(makeRequest("f0", {1}), "llama") == 1);
+    CHECK(router.submit(makeRequest("f1", {1}), "llama") == 1);
+    auto status = router.getReplicaStatus();
+    CHECK(status[0].failedSubmits == 2);
+    CHECK(!status[0].healthy);
+    CHECK(router.route(*makeRequest("f2", {1}), "llama") == 1);
+
+    // Last resort still tries it; success restores it
+    a->accepting = true;
+    router.setReplicaEnabled(1, false);
+    CHECK(router.submit(makeRequest("f3", {1}), "llama") == 0);
+    CHECK(router.getReplicaStatus()[0].healthy);
+}
+
+void testLocalReplicasRouteToResidentKV() {
+    std::cout << "testLocalReplicasRouteToResidentKV" << std::endl;
+    EngineRouter router;
+    std::vector<std::shared_ptr<LocalReplica>> replicas;
+    for (int i = 0; i < 2; ++i) {
+        auto backend = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+        backend->loadModel("test-model");
+        auto scheduler = std::make_shared<Scheduler>(8);
+        auto cache = std::make_shared<KVCache>(1, 1, 4, 64 * 16, 16);
+        auto engine = std::make_shared<InferenceEngine>(backend, scheduler, cache);
+        CHECK(engine->initialize());
+        engine->run();
+        replicas.push_back(std::make_shared<LocalReplica>("gpu" + std::to_string(i), "test-model",
+                                                          engine, scheduler, cache));
+        router.addReplica(replicas.back());
+    }
+
+    auto first = makeRequest("warm", promptWithPrefix(11, 64, 3, 5));
+    int home = router.submit(first, "test-model");
+    CHECK(home >= 0);
+    CHECK(replicas[home]->getEngine()->waitUntilIdle(std::chrono::seconds(30)));
+    CHECK(first->isFinished());
+
+    // Published prompt blocks are visible to the probe
+    CHECK(replicas[home]->cachedPrefixTokens(promptWithPrefix(11, 64, 4, 5), "") == 64);
+    CHECK(replicas[1 - home]->cachedPrefixTokens(promptWithPrefix(11, 64, 4, 5), "") == 0);
+
+    auto second = makeRequest("reuse", promptWithPrefix(11, 64, 4, 5));
+    CHECK(router.submit(second, "test-model") == home);
+    CHECK(replicas[home]->getEngine()->waitUntilIdle(std::chrono::seconds(30)));
+    CHECK(second->isFinished());
+
+    auto status = router.getReplicaStatus();
+    CHECK(status[home].routedRequests == 2);
+    CHECK(status[home].expectedHitTokens >= 64);
+    CHECK(status[home].load.healthy);
+    CHECK(status[home].load.totalKVBlocks == 64);
+
+    for (auto& replica : replicas) {
+        replica->getEngine()->shutdown();
+    }
+    CHECK(!router.getReplicaStatus()[0].healthy);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Router Tests" << std::endl;
+
+    testLeastLoadedWithoutAffinity();
+    testResidentPrefixAttractsRequests();
+    testBurstSharingNewPrefixSticksTogether();
+    testAffinityIsPerAdapter();
+    testHealthModelAndFailover();
+    testLocalReplicasRouteToResidentKV();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All router tests passed" << std::endl;
+    return 0;
+}
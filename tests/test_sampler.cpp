@@ -0,0 +1,223 @@
+// Sampler unit tests
+#include "cortexstream/sampler.h"
+#include <iostream>
+#include <set>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+// [rows, vocab] logits where row r peaks at token (r * 3) % vocab
+Tensor makeLogits(int rows, int vocab) {
+    Tensor logits;
+    logits.shape = {rows, vocab};
+    logits.data.assign(static_cast<size_t>(rows) * vocab, 0.0f);
+    for (int r = 0; r < rows; ++r) {
+        for (int v = 0; v < vocab; ++v) {
+            logits.data[r * vocab + v] = 0.01f * v;
+        }
+        logits.data[r * vocab + (r * 3) % vocab] = 5.0f;
+    }
+    return logits;
+}
+
+void testRowViewsSampleWithoutCopying() {
+    std::cout << "testRowViewsSampleWithoutCopying" << std::endl;
+    Tensor logits = makeLogits(4, 32);
+    TensorView batch(logits);
+    CHECK(batch.rows == 4);
+    CHECK(batch.cols == 32);
+    CHECK(batch.row(2).data == logits.data.data() + 64);
+
+    Sampler sampler;
+    for (int r = 0; r < 4; ++r) {
+        CHECK(sampler.sampleToken(batch.row(r)) == (r * 3) % 32);
+    }
+    CHECK((sampler.sampleBatch(logits) == std::vector<int>{0, 3, 6, 9}));
+}
+
+void testPenaltyAppliesOncePerTokenAndLeavesInputIntact() {
+    std::cout << "testPenaltyAppliesOncePerTokenAndLeavesInputIntact" << std::endl;
+    Tensor logits;
+    logits.shape = {1, 4};
+    logits.data = {2.0f, 1.9f, 0.5f, -1.0f};
+    const std::vector<float> original = logits.data;
+
+    SamplingParams params;
+    params.repetitionPenaltyEnabled = true;
+    params.repetitionPenalty = 1.5f;
+    Sampler sampler;
+    sampler.setParams(params);
+
+    // 2.0 / 1.5 < 1.9, no matter how often token 0 repeats
+    CHECK(sampler.sampleToken(logits, {0, 0, 0, 0}) == 1);
+    CHECK(logits.data == original);
+
+    // Scratch marks are cleared between calls
+    CHECK(sampler.sampleToken(logits, {3}) == 0);
+}
+
+void testTopKDrawsOnlyFromCandidates() {
+    std::cout << "testTopKDrawsOnlyFromCandidates" << std::endl;
+    Tensor logits;
+    logits.shape = {1, 64};
+    logits.data.assign(64, 0.0f);
+    logits.data[10] = 3.0f;
+    logits.data[20] = 3.0f;
+    logits.data[30] = 3.0f;
+
+    SamplingParams params;
+    params.doSample = true;
+    params.topK = 3;
+    params.seed = 7;
+    Sampler sampler;
+    sampler.setParams(params);
+
+    std::set<int> drawn;
+    for (int i = 0; i < 200; ++i) {
+        drawn.insert(sampler.sampleToken(logits));
+    }
+    CHECK((drawn == std::set<int>{10, 20, 30}));
+
+    // Nucleus over the same three: the long tail is excluded as well
+    params.topK = 0;
+    params.topP = 0.9f;
+    sampler.setParams(params);
+    logits.data[10] = logits.data[20] = logits.data[30] = 10.0f;
+    drawn.clear();
+    for (int i = 0; i < 200; ++i) {
+        drawn.insert(sampler.sampleToken(logits));
+    }
+    CHECK((drawn == std::set<int>{10, 20, 30}));
+}
+
+void testBatchRowsUseTheirOwnParams() {
+    std::cout << "testBatchRowsUseTheirOwnParams" << std::endl;
+    Tensor logits = makeLogits(3, 32);
+    logits.data[1 * 32 + 20] = 5.0f;   // Row 1: tie between 3 and 20
+
+    SamplingParams greedy;
+    SamplingParams topTwo;
+    topTwo.doSample = true;
+    topTwo.topK = 2;
+    topTwo.seed = 11;
+    SamplingParams invalid;
+    invalid.topP = 2.0f;
+
+    Sampler sampler;
+    std::set<int> drawn;
+    for (uint64_t pos = 0; pos < 64; ++pos) {
+        std::vector<SampleRow> rows(3);
+        rows[0].params = &greedy;
+        rows[1].params = &topTwo;
+        rows[1].stream = sampler.streamKey(topTwo);
+        rows[1].position = pos;
+        rows[2].params = &invalid;
+        std::vector<int> tokens = sampler.sampleBatch(logits, rows);
+        CHECK(tokens[0] == 0);
+        CHECK(tokens[2] == -1);
+        drawn.insert(tokens[1]);
+    }
+    CHECK((drawn == std::set<int>{3, 20}));
+}
+
+void testSeededRowReplaysInAnyBatch() {
+    std::cout << "testSeededRowReplaysInAnyBatch" << std::endl;
+    Tensor logits;
+    logits.shape = {4, 16};
+    logits.data.assign(64, 1.0f);      // Uniform rows: every draw counts
+
+    SamplingParams seeded;
+    seeded.doSample = true;
+    seeded.topK = 0;
+    seeded.seed = 42;
+    SamplingParams unseeded = seeded;
+    unseeded.seed = -1;
+
+    const Sampler sampler;
+    std::vector<int> alone, crowded;
+    for (uint64_t pos = 0; pos < 32; ++pos) {
+        std::vector<SampleRow> one(1);
+        one[0] = {&seeded, nullptr, sampler.streamKey(seeded), pos};
+        alone.push_back(sampler.sampleBatch(logits, one)[0]);
+
+        // Same request at another row, next to unseeded neighbours
+        std::vector<SampleRow> four(4);
+        for (auto& row : four) {
+            row = {&unseeded, nullptr, sampler.streamKey(unseeded), pos};
+        }
+        four[2] = one[0];
+        crowded.push_back(sampler.sampleBatch(logits, four)[2]);
+    }
+    CHECK(alone == crowded);
+    CHECK(std::set<int>(alone.begin(), alone.end()).size() > 1);
+    CHECK(sampler.streamKey(seeded) == Sampler().streamKey(seeded));
+    CHECK(sampler.streamKey(unseeded) != sampler.streamKey(unseeded));
+}
+
+void testMemoReusesRepeatedRowsOnly() {
+    std::cout << "testMemoReusesRepeatedRowsOnly" << std::endl;
+    Tensor logits;
+    logits.shape = {4, 16};
+    logits.data.assign(64, 1.0f);
+    logits.data[3 * 16 + 5] = 2.0f;    // Row 3 differs from the rest
+
+    SamplingParams seeded;
+    seeded.doSample = true;
+    seeded.topK = 0;
+    seeded.seed = 3;
+
+    Sampler sampler;
+    CHECK(!sampler.isMemoizing());
+    sampler.setMemoization(true);
+
+    // Rows 0-2 share logits, params, stream and position; row 3 does not
+    std::vector<SampleRow> rows(4, SampleRow{&seeded, nullptr, sampler.streamKey(seeded), 9});
+    std::vector<int> memo = sampler.sampleBatch(logits, rows);
+    CHECK(memo[1] == memo[0] && memo[2] == memo[0]);
+
+    // The memo changes no result, only how often rows are sampled
+    sampler.setMemoization(false);
+    CHECK(sampler.sampleBatch(logits, rows) == memo);
+
+    // A different position is a different draw, not a repeat
+    sampler.setMemoization(true);
+    std::set<int> drawn;
+    for (uint64_t pos = 0; pos < 32; ++pos) {
+        rows[1].position = pos;
+        drawn.insert(sampler.sampleBatch(logits, rows)[1]);
+    }
+    CHECK(drawn.size() > 1);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Sampler Tests" << std::endl;
+
+    testRowViewsSampleWithoutCopying();
+    testPenaltyAppliesOncePerTokenAndLeavesInputIntact();
+    testTopKDrawsOnlyFromCandidates();
+    testBatchRowsUseTheirOwnParams();
+    testSeededRowReplaysInAnyBatch();
+    testMemoReusesRepeatedRowsOnly();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All sampler tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,97 @@
+// StopMatcher unit tests
+#include "cortexstream/stop_matcher.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+void testStringsMatchAcrossPieces() {
+    std::cout << "testStringsMatchAcrossPieces" << std::endl;
+    StopMatcher matcher({"</answer>", "\n\nUser:"}, {});
+    CHECK(matcher.hasStrings() && !matcher.hasTokenSequences());
+
+    StopMatcher::Cursor cursor;
+    size_t end = 0;
+    CHECK(matcher.advanceText(cursor, "The answer is 42<", &end) == -1);
+    CHECK(matcher.advanceText(cursor, "/ans", &end) == -1);
+    CHECK(matcher.advanceText(cursor, "wer> trailing", &end) == 0);
+    CHECK(end == 4);    // "wer>"
+
+    // A false start falls back instead of restarting from scratch
+    StopMatcher::Cursor other;
+    CHECK(matcher.advanceText(other, "\n\n\n\nUse", &end) == -1);
+    CHECK(matcher.advanceText(other, "r:", &end) == 1);
+    CHECK(end == 2);
+}
+
+void testOverlappingPatterns() {
+    std::cout << "testOverlappingPatterns" << std::endl;
+    StopMatcher matcher({"hers", "she", "he", ""}, {});
+
+    // "she" and "he" end on the same byte: the longer one is reported
+    StopMatcher::Cursor cursor;
+    size_t end = 0;
+    CHECK(matcher.advanceText(cursor, "ushers", &end) == 1);
+    CHECK(matcher.string(1) == "she");
+    CHECK(end == 4);
+
+    // Reached through a failure link only
+    StopMatcher::Cursor second;
+    CHECK(matcher.advanceText(second, "ahe", &end) == 2);
+    CHECK(end == 3);
+
+    StopMatcher::Cursor none;
+    CHECK(matcher.advanceText(none, "hrs sh", &end) == -1);
+}
+
+void testTokenSequences() {
+    std::cout << "testTokenSequences" << std::endl;
+    StopMatcher matcher({}, {{1, 2, 3}, {2, 1, 2, 4}, {9}, {}});
+    CHECK(!matcher.hasStrings() && matcher.hasTokenSequences());
+
+    StopMatcher::Cursor cursor;
+    std::vector<int> stream = {1, 2, 1, 2, 3};
+    std::vector<int> results;
+    for (int token : stream) results.push_back(matcher.advanceToken(cursor, token));
+    CHECK((results == std::vector<int>{-1, -1, -1, -1, 0}));
+
+    StopMatcher::Cursor other;
+    for (int token : {2, 1, 2, 1, 2}) CHECK(matcher.advanceToken(other, token) == -1);
+    CHECK(matcher.advanceToken(other, 4) == 1);
+
+    StopMatcher::Cursor single;
+    CHECK(matcher.advanceToken(single, 5) == -1);
+    CHECK(matcher.advanceToken(single, 9) == 2);
+    CHECK(StopMatcher({""}, {{}}).empty());
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "StopMatcher Tests" << std::endl;
+
+    testStringsMatchAcrossPieces();
+    testOverlappingPatterns();
+    testTokenSequences();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All stop matcher tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,375 @@
+// Tensor-parallel sharding unit tests
+#include "cortexstream/half.h"
+#include "cortexstream/model_converter.h"
+#include "cortexstream/quant_matmul.h"
+#include "cortexstream/tensor_parallel.h"
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+std::vector<float> randomFloats(size_t n, uint32_t seed) {
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<float> dist(-1.0f, 1.0f);
+    std::vector<float> values(n);
+    for (auto& v : values) v = dist(rng);
+    return values;
+}
+
+float maxError(const std::vector<float>& a, const std::vector<float>& b) {
+    float worst = a.size() == b.size() ? 0.0f : INFINITY;
+    for (size_t i = 0; i < a.size() && i < b.size(); ++i) {
+        worst = std::max(worst, std::fabs(a[i] - b[i]));
+    }
+    return worst;
+}
+
+// Random codes and scales in the engine's group-quantized layout
+struct Packed {
+    std::vector<uint8_t> data;
+    std::vector<uint8_t> scales;
+    LinearWeight weight;
+};
+
+Packed pack(QuantFormat format, int64_t rows, int64_t cols, int groupSize, uint32_t seed) {
+    Packed p;
+    std::mt19937 rng(seed);
+    p.data.resize(format == QuantFormat::Int8 ? rows * cols : rows * cols / 2);
+    for (auto& byte : p.data) byte = static_cast<uint8_t>(rng());
+    p.scales.resize(rows * (cols / groupSize) * sizeof(uint16_t));
+    std::uniform_real_distribution<float> scale(0.001f, 0.05f);
+    for (size_t i = 0; i < p.scales.size() / 2; ++i) {
+        uint16_t h = floatToHalf(scale(rng));
+        std::memcpy(p.scales.data() + i * 2, &h, 2);
+    }
+    p.weight.format = format;
+    p.weight.dtype = WeightDType::U8;
+    p.weight.outFeatures = rows;
+    p.weight.inFeatures = cols;
+    p.weight.groupSize = groupSize;
+    p.weight.data = p.data.data();
+    p.weight.scales = p.scales.data();
+    return p;
+}
+
+void testShardRangesAndKinds() {
+    std::cout << "testShardRangesAndKinds" << std::endl;
+    CHECK(shardKindFor("model.layers.3.self_attn.q_proj.weight") == ShardKind::Column);
+    CHECK(shardKindFor("model.layers.3.self_attn.v_proj.weight") == ShardKind::Column);
+    CHECK(shardKindFor("model.layers.3.mlp.up_proj.weight") == ShardKind::Column);
+    CHECK(shardKindFor("model.layers.3.self_attn.o_proj.weight") == ShardKind::Row);
+    CHECK(shardKindFor("model.layers.3.mlp.down_proj.weight") == ShardKind::Row);
+    CHECK(shardKindFor("lm_head.weight") == ShardKind::Replicated);
+    CHECK(shardKindFor("model.layers.3.mlp.down_proj.weight.scales") == ShardKind::Replicated);
+
+    // Ranges tile the dimension in aligned units, spread evenly
+    for (int world : {1, 2, 3, 4}) {
+        int64_t next = 0;
+        for (int rank = 0; rank < world; ++rank) {
+            ShardRange range = shardRange(640, world, rank, 64);
+            CHECK(range.begin == next);
+            CHECK(range.begin % 64 == 0);
+            CHECK(range.count >= 128);
+            next += range.count;
+        }
+        CHECK(next == 640);
+    }
+    CHECK(shardRange(10, 4, 3, 1).count == 2);
+    CHECK(shardRange(10, 4, 4, 1).count == 0);
+
+    ModelConfig config;
+    config.hiddenSize = 4096;
+    config.numLayers = 32;
+    config.numHeads = 32;
+    config.numKVHeads = 8;
+    config.intermediateSize = 11008;
+    ModelConfig rank = shardModelConfig(config, 4);
+    CHECK(rank.numHeads == 8);
+    CHECK(rank.numKVHeads == 2);
+    CHECK(rank.headDim == 128);
+    CHECK(rank.intermediateSize == 2752);
+    CHECK(rank.kvBytesPerToken(2) == 2 * 32 * 2 * 128 * 2);    // A quarter of the KV heads
+}
+
+void testSlicesComposeToFullProduct() {
+    std::cout << "testSlicesComposeToFullProduct" << std::endl;
+    const int64_t rows = 64, cols = 256, batch = 3;
+    std::vector<float> dense = randomFloats(rows * cols, 5);
+    Packed int8 = pack(QuantFormat::Int8, rows, cols, 32, 7);
+    Packed int4 = pack(QuantFormat::Int4, rows, cols, 32, 9);
+    LinearWeight fp32;
+    fp32.dtype = WeightDType::F32;
+    fp32.outFeatures = rows;
+    fp32.inFeatures = cols;
+    fp32.data = reinterpret_cast<const uint8_t*>(dense.data());
+
+    std::vector<float> x = randomFloats(batch * cols, 11);
+    TensorView input(x.data(), cols);
+    input.rows = batch;
+
+    for (const LinearWeight* weight : {&fp32, &int8.weight, &int4.weight}) {
+        std::vector<float> full(batch * rows);
+        CHECK(linearForward(*weight, input, full.data()));
+
+        for (int world : {2, 4}) {
+            // Column: output rows concatenate
+            std::vector<float> gathered(batch * rows, 0.0f);
+            for (int rank = 0; rank < world; ++rank) {
+                ShardRange range = shardRange(rows, world, rank);
+                LinearWeight slice;
+                CHECK(weight->sliceRows(range.begin, range.count, slice));
+                std::vector<float> part(batch * range.count);
+                CHECK(linearForward(slice, input, part.data()));
+                for (int64_t b = 0; b < batch; ++b) {
+                    std::copy_n(part.data() + b * range.count, range.count,
+                                gathered.data() + b * rows + range.begin);
+                }
+            }
+            CHECK(maxError(gathered, full) == 0.0f);
+
+            // Row: partial sums over input columns add up
+            std::vector<float> reduced(batch * rows, 0.0f);
+            for (int rank = 0; rank < world; ++rank) {
+                ShardRange range = shardRange(cols, world, rank, 32);
+                LinearWeight slice;
+                CHECK(weight->sliceColumns(range.begin, range.count, slice));
+                CHECK(!slice.isPacked());
+                TensorView columns = input;
+                columns.data = x.data() + range.begin;
+                columns.cols = range.count;
+                std::vector<float> part(batch * rows);
+                CHECK(linearForward(slice, columns, part.data()));
+                for (size_t i = 0; i < part.size(); ++i) reduced[i] += part[i];
+            }
+            CHECK(maxError(reduced, full) < 1e-3f);
+        }
+    }
+
+    // Quantized groups are never split; out-of-range slices are refused
+    LinearWeight slice;
+    CHECK(!int4.weight.sliceColumns(16, 32, slice));
+    CHECK(!int8.weight.sliceColumns(0, 48, slice));
+    CHECK(fp32.sliceColumns(3, 5, slice));
+    CHECK(!fp32.sliceRows(60, 8, slice));
+}
+
+// One attention block and one MLP in HuggingFace naming
+void writeCheckpoint(const std::string& dir, int64_t hidden, int64_t intermediate) {
+    struct Entry {
+        std::string name;
+        int64_t rows, cols;
+    };
+    std::vector<Entry> entries = {
+        {"model.layers.0.self_attn.q_proj.weight", hidden, hidden},
+        {"model.layers.0.self_attn.o_proj.weight", hidden, hidden},
+        {"model.layers.0.mlp.gate_proj.weight", intermediate, hidden},
+        {"model.layers.0.mlp.down_proj.weight", hidden, intermediate},
+        {"lm_head.weight", 32, hidden},
+    };
+    std::string json = "{";
+    std::vector<float> payload;
+    for (size_t i = 0; i < entries.size(); ++i) {
+        const Entry& e = entries[i];
+        size_t begin = payload.size() * sizeof(float);
+        std::vector<float> w = randomFloats(e.rows * e.cols, 100 + static_cast<uint32_t>(i));
+        payload.insert(payload.end(), w.begin(), w.end());
+        json += (i ? "," : "") + std::string("\"") + e.name + "\":{\"dtype\":\"F32\",\"shape\":[" +
+                std::to_string(e.rows) + "," + std::to_string(e.cols) + "],\"data_offsets\":[" +
+                std::to_string(begin) + "," + std::to_string(payload.size() * sizeof(float)) + "]}";
+    }
+    json += "}";
+    std::ofstream out(dir + "/model.safetensors", std::ios::binary);
+    uint64_t length = json.size();
+    for (int i = 0; i < 8; ++i) out.put(static_cast<char>((length >> (8 * i)) & 0xFF));
+    out << json;
+    out.write(reinterpret_cast<const char*>(payload.data()), payload.size() * sizeof(float));
+    std::ofstream(dir + "/config.json")
+        << "{\"hidden_size\": " << hidden << ", \"num_hidden_layers\": 1, \"vocab_size\": 32,"
+           " \"num_attention_heads\": 4, \"num_key_value_heads\": 4}";
+}
+
+void testBackendShardsMatchUnsharded() {
+    std::cout << "testBackendShardsMatchUnsharded" << std::endl;
+    auto dir = std::filesystem::temp_directory_path() / "cortexstream_tensor_parallel";
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    const int64_t hidden = 64, intermediate = 128, batch = 2;
+    writeCheckpoint(dir.string(), hidden, intermediate);
+    std::vector<float> x = randomFloats(batch * intermediate, 21);
+    TensorView hiddenIn(x.data(), hidden);
+    hiddenIn.rows = batch;
+    TensorView mlpIn(x.data(), intermediate);
+    mlpIn.rows = batch;
+    const std::vector<std::pair<std::string, TensorView>> calls = {
+        {"model.layers.0.self_attn.q_proj.weight", hiddenIn},
+        {"model.layers.0.self_attn.o_proj.weight", hiddenIn},
+        {"model.layers.0.mlp.gate_proj.weight", hiddenIn},
+        {"model.layers.0.mlp.down_proj.weight", mlpIn},
+        {"lm_head.weight", hiddenIn},
+    };
+
+    for (QuantFormat format : {QuantFormat::FP16, QuantFormat::Int8, QuantFormat::Int4}) {
+        ConvertOptions options;
+        options.inputPath = dir.string();
+        options.outputPath = (dir / "model.cstream").string();
+        options.format = format;
+        options.groupSize = 16;
+        CHECK(convertModel(options));
+
+        ModelBackend backend(Device::CPU, DType::FP32);
+        CHECK(backend.loadModel(options.outputPath));
+        std::vector<Tensor> expected;
+        for (const auto& [name, input] : calls) {
+            expected.push_back(backend.linear(name, input));
+        }
+
+        CHECK(!backend.setTensorParallel(3));          // 4 heads do not split
+        CHECK(backend.getTensorParallelSize() == 1);
+        for (int world : {2, 4}) {
+            CHECK(backend.setTensorParallel(world));
+            CHECK(backend.getTensorParallelSize() == world);
+            auto group = backend.getTensorParallel();
+            CHECK(group->isSharded("model.layers.0.self_attn.q_proj.weight"));
+            CHECK(!group->isSharded("lm_head.weight"));
+            // Attention shards hold whole heads (head dim 16)
+            CHECK(group->getRange(1, "model.layers.0.self_attn.q_proj.weight").begin % 16 == 0);
+            for (size_t i = 0; i < calls.size(); ++i) {
+                Tensor y = backend.linear(calls[i].first, calls[i].second);
+                CHECK(y.shape == expected[i].shape);
+                CHECK(maxError(y.data, expected[i].data) < 1e-4f);
+            }
+
+            // A column shard's output feeds the row shard of the same ranks
+            // directly; only the final partial sums are reduced
+            const std::string gate = "model.layers.0.mlp.gate_proj.weight";
+            const std::string down = "model.layers.0.mlp.down_proj.weight";
+            std::vector<float> h(batch * intermediate);
+            std::copy_n(expected[2].data.data(), h.size(), h.data());
+            TensorView hView(h.data(), intermediate);
+            hView.rows = batch;
+            std::vector<float> fullDown(batch * hidden);
+            CHECK(group->linear(down, hView, fullDown.data()));
+
+            std::vector<float> reduced(batch * hidden, 0.0f);
+            for (int rank = 0; rank < world; ++rank) {
+                ShardRange range = group->getRange(rank, gate);
+                CHECK(range.begin == group->getRange(rank, down).begin);
+                std::vector<float> local(batch * range.count), partial(batch * hidden);
+                CHECK(group->linearShard(rank, gate, hiddenIn, local.data()));
+                TensorView localView(local.data(), range.count);
+                localView.rows = batch;
+                CHECK(group->linearShard(rank, down, localView, partial.data()));
+                for (size_t i = 0; i < partial.size(); ++i) reduced[i] += partial[i];
+            }
+            CHECK(maxError(reduced, fullDown) < 1e-4f);
+        }
+        CHECK(backend.setTensorParallel(1));
+        CHECK(backend.getTensorParallel() == nullptr);
+    }
+    std::filesystem::remove_all(dir);
+}
+
+void testKVHeadShardsShareBlockTables() {
+    std::cout << "testKVHeadShardsShareBlockTables" << std::endl;
+    const size_t headsPerRank = 2, headDim = 4, row = headsPerRank * headDim;
+    auto rank0 = std::make_shared<KVCache>(1, headsPerRank, headDim, 64, 4);
+    TensorParallelGroup group(std::make_shared<LocalCommunicator>(2));
+    CHECK(group.attachKVCache(rank0));
+    auto rank1 = group.getKVShard(1);
+    CHECK(group.getKVShard(0) == rank0);
+    CHECK(rank1 != nullptr && rank1 != rank0);
+    CHECK(rank1->getShardRank() == 1);
+    CHECK(rank0->getNumHeadShards() == 2);
+    CHECK(rank1->getNumHeads() == headsPerRank);
+    CHECK(rank0->configureSwapSpace(8));
+
+    // Rank r stores (r + 1) * 100 + position in its heads
+    auto fill = [&](int rank, int position) {
+        return std::vector<float>(row, static_cast<float>((rank + 1) * 100 + position));
+    };
+    auto writeAll = [&](const std::string& seq, int begin, int end) {
+        for (int p = begin; p < end; ++p) {
+            auto k0 = fill(0, p), k1 = fill(1, p);
+            CHECK(rank0->writeToken(seq, 0, p, k0.data(), k0.data()));
+            CHECK(rank1->writeToken(seq, 0, p, k1.data(), k1.data()));
+        }
+    };
+    auto holds = [&](const std::shared_ptr<KVCache>& cache, const std::string& seq, int p, float value) {
+        std::vector<float> k(row), v(row);
+        return cache->readToken(seq, 0, p, k.data(), v.data()) && k[0] == value && v[row - 1] == value;
+    };
+
+    // Sequence management only on rank 0; rank 1 sees the same sequences
+    std::vector<int> prompt(9, 5);
+    CHECK(rank0->allocateWithPrefix("a", prompt) == 0);
+    writeAll("a", 0, 9);
+    KVView view = rank1->getKView("a", 0);
+    CHECK(view.valid);
+    CHECK((view.shape == std::vector<size_t>{headsPerRank, 9, headDim}));
+    CHECK(holds(rank1, "a", 8, 208.0f));
+
+    // Shared prefix: a write through rank 1 copies the block on every rank
+    rank0->publishPrefix("a", prompt);
+    CHECK(rank0->allocateWithPrefix("b", prompt) == 8);
+    CHECK(holds(rank1, "b", 3, 203.0f));
+    auto k1 = std::vector<float>(row, -1.0f);
+    CHECK(rank1->writeToken("b", 0, 3, k1.data(), k1.data()));
+    CHECK(holds(rank1, "b", 3, -1.0f));
+    CHECK(holds(rank1, "a", 3, 203.0f));
+    CHECK(holds(rank0, "b", 3, 103.0f));                // Copied, not lost
+
+    // Swap round trip moves every rank's heads
+    rank0->freeFor("b");
+    rank0->clearPrefixCache();
+    CHECK(rank0->swapOut("a"));
+    CHECK(!rank1->readToken("a", 0, 0, k1.data(), k1.data()));
+    std::vector<int> filler(40, 9);
+    CHECK(rank0->allocateWithPrefix("filler", filler) == 0);   // Blocks get reused
+    CHECK(rank0->swapIn("a"));
+    CHECK(holds(rank0, "a", 7, 107.0f));
+    CHECK(holds(rank1, "a", 7, 207.0f));
+    CHECK(holds(rank1, "a", 0, 200.0f));
+
+    // No new shard once sequences hold KV
+    CHECK(KVCache::createHeadShard(rank0) == nullptr);
+    CHECK(KVCache::createHeadShard(rank1) == nullptr);
+    rank0->freeFor("a");
+    rank0->freeFor("filler");
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Tensor Parallel Tests" << std::endl;
+
+    testShardRangesAndKinds();
+    testSlicesComposeToFullProduct();
+    testBackendShardsMatchUnsharded();
+    testKVHeadShardsShareBlockTables();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All tensor parallel tests passed" << std::endl;
+    return 0;
+}
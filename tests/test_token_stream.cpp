@@ -0,0 +1,144 @@
+// TokenStream unit tests
+#include "cortexstream/token_stream.h"
+#include <chrono>
+#include <iostream>
+#include <thread>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+void testRingBoundsAndOrder() {
+    std::cout << "testRingBoundsAndOrder" << std::endl;
+    TokenStream stream("req", 6);       // Rounds up to 8; high water 6
+    CHECK(stream.capacity() == 8);
+    CHECK(stream.empty());
+
+    for (int i = 0; i < 8; ++i) {
+        CHECK(stream.push(i, false));
+        CHECK(stream.isBackpressured() == (i + 1 >= 6));
+    }
+    CHECK(!stream.push(8, false));      // Full: refused, nothing lost
+    CHECK(stream.size() == 8);
+
+    ResponseChunk chunk;
+    CHECK(stream.pop(chunk));
+    CHECK(chunk.token == 0 && chunk.requestId == "req" && !chunk.finished);
+
+    // Wrap around the end of the slot array
+    CHECK(stream.push(8, false));
+    CHECK(stream.push(9, true) == false);
+    std::vector<ResponseChunk> out;
+    CHECK(stream.drain(out, 3) == 3);
+    CHECK(stream.push(9, true));
+    CHECK(stream.drain(out) == 6);
+    CHECK(out.size() == 9);
+    for (size_t i = 0; i < out.size(); ++i) {
+        CHECK(out[i].token == static_cast<int>(i) + 1);
+    }
+    CHECK(out.back().finished);
+    CHECK(!stream.pop(chunk));
+
+    CHECK(!stream.isDone());
+    stream.close();
+    CHECK(stream.isDone());
+    CHECK(stream.wait(std::chrono::milliseconds(0)));   // Closed: never blocks
+}
+
+void testChunksCarryTextPieces() {
+    std::cout << "testChunksCarryTextPieces" << std::endl;
+    TokenStream stream("req", 4);
+    const std::string longPiece(TokenStream::kTextReserve * 2, 'x');
+    CHECK(stream.push(1, false, "He"));
+    CHECK(stream.push(2, false));
+    CHECK(stream.push(3, false, longPiece));
+    CHECK(stream.push(4, true, "llo"));
+    CHECK(stream.isFull());
+    CHECK(!stream.push(5, true, "dropped"));
+
+    ResponseChunk chunk;
+    chunk.textPiece = "stale";
+    CHECK(stream.pop(chunk));
+    CHECK(chunk.token == 1 && chunk.textPiece == "He");
+    CHECK(stream.pop(chunk));
+    CHECK(chunk.token == 2 && chunk.textPiece.empty());
+
+    // Slots are reused after wrapping: no piece leaks into the next chunk
+    CHECK(stream.push(6, false));
+    std::vector<ResponseChunk> out;
+    CHECK(stream.drain(out) == 3);
+    CHECK(out[0].textPiece == longPiece);
+    CHECK(out[1].textPiece == "llo" && out[1].finished);
+    CHECK(out[2].token == 6 && out[2].textPiece.empty());
+}
+
+void testWaitTimesOutWhenEmpty() {
+    std::cout << "testWaitTimesOutWhenEmpty" << std::endl;
+    TokenStream stream("idle");
+    auto start = std::chrono::steady_clock::now();
+    CHECK(!stream.wait(std::chrono::milliseconds(20)));
+    CHECK(std::chrono::steady_clock::now() - start >= std::chrono::milliseconds(15));
+}
+
+void testProducerConsumerThreads() {
+    std::cout << "testProducerConsumerThreads" << std::endl;
+    TokenStream stream("spsc", 64);
+    const int total = 200000;
+
+    std::thread producer([&] {
+        for (int i = 0; i < total; ++i) {
+            while (!stream.push(i, i + 1 == total)) {
+                std::this_thread::yield();
+            }
+        }
+        stream.close();
+    });
+
+    int expected = 0;
+    bool ordered = true;
+    bool sawFinished = false;
+    std::vector<ResponseChunk> batch;
+    while (!stream.isDone()) {
+        stream.wait(std::chrono::milliseconds(100));
+        batch.clear();
+        stream.drain(batch);
+        for (const auto& chunk : batch) {
+            ordered = ordered && chunk.token == expected++;
+            sawFinished = chunk.finished;
+        }
+    }
+    producer.join();
+    CHECK(ordered);
+    CHECK(expected == total);
+    CHECK(sawFinished);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "TokenStream Tests" << std::endl;
+
+    testRingBoundsAndOrder();
+    testChunksCarryTextPieces();
+    testWaitTimesOutWhenEmpty();
+    testProducerConsumerThreads();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All token stream tests passed" << std::endl;
+    return 0;
+}
@@ -0,0 +1,178 @@
+// Tokenizer unit tests
+#include "cortexstream/tokenizer.h"
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+// SentencePiece-style vocabulary: "_" marks a word boundary, a leading
+// space is dropped, and byte tokens carry raw UTF-8 bytes that decode to
+// U+FFFD while incomplete
+class PieceTokenizer : public Tokenizer {
+public:
+    PieceTokenizer() : pieces_{"_Hello", "_wor", "ld", "_", "!", "\xE2", "\x82", "\xAC"} {}
+
+    std::vector<int32_t> encode(const std::string& text) override {
+        std::vector<int32_t> ids;
+        for (size_t pos = 0; pos < text.size();) {
+            int32_t best = -1;
+            size_t bestLength = 0;
+            for (size_t id = 0; id < pieces_.size(); ++id) {
+                std::string piece = surface(pieces_[id]);
+                if (piece.size() > bestLength && text.compare(pos, piece.size(), piece) == 0) {
+                    best = static_cast<int32_t>(id);
+                    bestLength = piece.size();
+                }
+            }
+            if (best < 0) { ++pos; continue; }
+            ids.push_back(best);
+            pos += bestLength;
+        }
+        return ids;
+    }
+
+    std::string decode(const std::vector<int32_t>& ids) override {
+        ++decodeCalls;
+        decodedTokens += ids.size();
+        std::string text;
+        for (int32_t id : ids) text += surface(pieces_[id]);
+        if (!text.empty() && text[0] == ' ') text.erase(0, 1);
+        size_t complete = completeUtf8Length(text);
+        if (complete < text.size()) text = text.substr(0, complete) + "\xEF\xBF\xBD";
+        return text;
+    }
+
+    int32_t getEosTokenId() const override { return -1; }
+    int32_t getBosTokenId() const override { return -1; }
+    int32_t getPadTokenId() const override { return -1; }
+    size_t getVocabSize() const override { return pieces_.size(); }
+    bool isLoaded() const override { return true; }
+
+    size_t decodeCalls = 0;
+    size_t decodedTokens = 0;
+
+private:
+    static std::string surface(const std::string& piece) {
+        std::string out;
+        for (char c : piece) out += c == '_' ? ' ' : c;
+        return out;
+    }
+
+    std::vector<std::string> pieces_;
+};
+
+bool validUtf8(const std::string& text) {
+    return completeUtf8Length(text) == text.size() && text.find("\xEF\xBF\xBD") == std::string::npos;
+}
+
+void testCompleteUtf8Length() {
+    std::cout << "testCompleteUtf8Length" << std::endl;
+    CHECK(completeUtf8Length("") == 0);
+    CHECK(completeUtf8Length("abc") == 3);
+    CHECK(completeUtf8Length("a\xE2\x82") == 1);
+    CHECK(completeUtf8Length("a\xE2\x82\xAC") == 4);
+    CHECK(completeUtf8Length("\xF0\x9F\x98") == 0);
+    CHECK(completeUtf8Length("\xF0\x9F\x98\x80") == 4);
+    CHECK(completeUtf8Length("\xC3") == 0);
+}
+
+void testPiecesReassembleFullDecode() {
+    std::cout << "testPiecesReassembleFullDecode" << std::endl;
+    PieceTokenizer tokenizer;
+    // "Hello world €!" with the euro sign split over three byte tokens
+    std::vector<int32_t> ids = {0, 1, 2, 3, 5, 6, 7, 4};
+    IncrementalDetokenizer detok(tokenizer);
+    std::string streamed;
+    std::vector<std::string> pieces;
+    for (int32_t id : ids) {
+        pieces.push_back(detok.push(id));
+        CHECK(validUtf8(pieces.back()));
+        streamed += pieces.back();
+    }
+    streamed += detok.flush();
+    CHECK(streamed == tokenizer.decode(ids));
+    CHECK(streamed == "Hello world \xE2\x82\xAC!");
+
+    // Spacing comes from left context, the split character waits
+    CHECK(pieces[0] == "Hello");
+    CHECK(pieces[1] == " wor");
+    CHECK(pieces[2] == "ld");
+    CHECK(pieces[4].empty() && pieces[5].empty());
+    CHECK(pieces[6] == "\xE2\x82\xAC");
+}
+
+void testWindowStaysBounded() {
+    std::cout << "testWindowStaysBounded" << std::endl;
+    PieceTokenizer tokenizer;
+    IncrementalDetokenizer detok(tokenizer);
+    const size_t steps = 3000;
+    std::string streamed;
+    std::vector<int32_t> ids;
+    size_t widest = 0;
+    for (size_t i = 0; i < steps; ++i) {
+        int32_t id = static_cast<int32_t>(i % 3);   // _Hello _wor ld ...
+        ids.push_back(id);
+        streamed += detok.push(id);
+        widest = std::max(widest, detok.windowSize());
+    }
+    CHECK(widest <= 2);
+    CHECK(streamed == tokenizer.decode(ids));
+    // Two short decodes per token, not O(n^2) re-decoding
+    CHECK(tokenizer.decodedTokens < 6 * steps);
+}
+
+void testFlushEmitsHeldBytesAndResets() {
+    std::cout << "testFlushEmitsHeldBytesAndResets" << std::endl;
+    PieceTokenizer tokenizer;
+    IncrementalDetokenizer detok(tokenizer);
+    CHECK(detok.push(0) == "Hello");
+    CHECK(detok.push(5).empty());
+    CHECK(detok.flush() == "\xEF\xBF\xBD");
+    CHECK(detok.windowSize() == 0);
+    CHECK(detok.push(0) == "Hello");     // Fresh sequence: no leading space
+}
+
+void testEncodeBatchKeepsOrder() {
+    std::cout << "testEncodeBatchKeepsOrder" << std::endl;
+    PieceTokenizer tokenizer;
+    std::vector<std::string> texts = {" Hello world", " world!", "", " Hello"};
+    auto batch = tokenizer.encodeBatch(texts);
+    CHECK(batch.size() == texts.size());
+    for (size_t i = 0; i < texts.size(); ++i) {
+        CHECK(batch[i] == tokenizer.encode(texts[i]));
+    }
+    CHECK((batch[0] == std::vector<int32_t>{0, 1, 2}));
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Tokenizer Tests" << std::endl;
+
+    testCompleteUtf8Length();
+    testPiecesReassembleFullDecode();
+    testWindowStaysBounded();
+    testFlushEmitsHeldBytesAndResets();
+    testEncodeBatchKeepsOrder();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All tokenizer tests passed" << std::endl;
+    return 0;
+}
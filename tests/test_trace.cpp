@@ -0,0 +1,127 @@
+// Trace profiler unit tests
+#include "cortexstream/trace.h"
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+const trace::SpanSummary* find(const std::vector<trace::SpanSummary>& spans, const std::string& name) {
+    for (const auto& span : spans) {
+        if (span.name == name) return &span;
+    }
+    return nullptr;
+}
+
+void macroSite() {
+    CORTEX_TRACE_SCOPE("test.macro");
+}
+
+void testSpansRecordOnlyWhileActive() {
+    std::cout << "testSpansRecordOnlyWhileActive" << std::endl;
+    { trace::Span before("test.inactive"); }
+
+    trace::start();
+    for (int i = 0; i < 3; ++i) {
+        trace::Span span("test.outer", i);
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+        trace::Span inner("test.inner");
+    }
+    macroSite();
+    std::thread worker([] {
+        trace::setThreadName("worker");
+        for (int i = 0; i < 5; ++i) {
+            trace::Span span("test.worker");
+        }
+    });
+    worker.join();
+    trace::stop();
+    { trace::Span after("test.inactive"); }
+
+    auto spans = trace::summarize();
+    CHECK(find(spans, "test.inactive") == nullptr);
+    const auto* outer = find(spans, "test.outer");
+    CHECK(outer && outer->count == 3);
+    // Timings come out in wall-clock units: each outer span slept 2 ms
+    CHECK(outer && outer->meanUs >= 1500.0 && outer->meanUs < 1e6);
+    CHECK(outer && outer->maxUs >= outer->meanUs);
+    const auto* worker_ = find(spans, "test.worker");
+    CHECK(worker_ && worker_->count == 5);
+    CHECK((find(spans, "test.macro") != nullptr) == trace::compiledIn());
+    CHECK(!spans.empty() && spans.front().name == "test.outer");   // Largest total first
+}
+
+void testRingKeepsNewestEvents() {
+    std::cout << "testRingKeepsNewestEvents" << std::endl;
+    trace::start(4);
+    for (int i = 0; i < 10; ++i) {
+        trace::Span span(i < 6 ? "test.old" : "test.new");
+    }
+    trace::stop();
+    auto spans = trace::summarize();
+    CHECK(find(spans, "test.old") == nullptr);
+    const auto* fresh = find(spans, "test.new");
+    CHECK(fresh && fresh->count == 4);
+
+    trace::clear();
+    CHECK(trace::summarize().empty());
+}
+
+void testChromeTraceExport() {
+    std::cout << "testChromeTraceExport" << std::endl;
+    trace::start();
+    trace::setThreadName("main \"test\"");
+    {
+        trace::Span span("test.export", 7);
+    }
+    trace::stop();
+
+    auto path = (std::filesystem::temp_directory_path() / "cortexstream_trace.json").string();
+    CHECK(trace::writeChromeTrace(path));
+    std::ifstream in(path);
+    std::stringstream text;
+    text << in.rdbuf();
+    const std::string json = text.str();
+    CHECK(json.find("\"traceEvents\":[") != std::string::npos);
+    CHECK(json.find("\"name\":\"test.export\",\"ph\":\"X\"") != std::string::npos);
+    CHECK(json.find("\"args\":{\"n\":7}") != std::string::npos);
+    CHECK(json.find("\"args\":{\"name\":\"main \\\"test\\\"\"}") != std::string::npos);
+    CHECK(json.rfind("]}") != std::string::npos);
+    std::filesystem::remove(path);
+
+    CHECK(!trace::writeChromeTrace("/nonexistent-dir/trace.json"));
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Trace Tests" << std::endl;
+
+    testSpansRecordOnlyWhileActive();
+    testRingKeepsNewestEvents();
+    testChromeTraceExport();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All trace tests passed" << std::endl;
+    return 0;
+}
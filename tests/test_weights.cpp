@@ -0,0 +1,362 @@
+// Memory-mapped weight loader unit tests
+#include "cortexstream/half.h"
+#include "cortexstream/kv_cache.h"
+#include "cortexstream/model.h"
+#include "cortexstream/model_converter.h"
+#include "cortexstream/weights.h"
+#include <cmath>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+int failures = 0;
+
+#define CHECK(cond)                                                        \
+    do {                                                                   \
+        if (!(cond)) {                                                     \
+            std::cerr << "  FAILED: " #cond " (" << __FILE__ << ":"         \
+                      << __LINE__ << ")" << std::endl;                     \
+            ++failures;                                                    \
+        }                                                                  \
+    } while (0)
+
+struct FakeTensor {
+    std::string name;
+    std::string dtype;
+    std::vector<int64_t> shape;
+    std::vector<uint8_t> bytes;
+};
+
+FakeTensor floats(const std::string& name, std::vector<int64_t> shape, float base) {
+    FakeTensor t{name, "F32", std::move(shape), {}};
+    int64_t n = 1;
+    for (auto s : t.shape) n *= s;
+    t.bytes.resize(n * sizeof(float));
+    for (int64_t i = 0; i < n; ++i) {
+        float value = base + static_cast<float>(i);
+        std::memcpy(t.bytes.data() + i * sizeof(float), &value, sizeof(float));
+    }
+    return t;
+}
+
+// Writes a safetensors file; `header` overrides the generated JSON
+void writeShard(const std::string& path, const std::vector<FakeTensor>& tensors,
+                const std::string& header = "") {
+    std::string json = "{\"__metadata__\":{\"format\":\"pt\"}";
+    std::vector<uint8_t> data;
+    for (const auto& t : tensors) {
+        json += ",\"" + t.name + "\":{\"dtype\":\"" + t.dtype + "\",\"shape\":[";
+        for (size_t i = 0; i < t.shape.size(); ++i) {
+            json += (i ? "," : "") + std::to_string(t.shape[i]);
+        }
+        json += "],\"data_offsets\":[" + std::to_string(data.size()) + "," +
+                std::to_string(data.size() + t.bytes.size()) + "]}";
+        data.insert(data.end(), t.bytes.begin(), t.bytes.end());
+    }
+    json += "}";
+    if (!header.empty()) {
+        json = header;
+    }
+
+    std::ofstream out(path, std::ios::binary | std::ios::trunc);
+    uint64_t length = json.size();
+    for (int i = 0; i < 8; ++i) {
+        out.put(static_cast<char>((length >> (8 * i)) & 0xFF));
+    }
+    out.write(json.data(), json.size());
+    out.write(reinterpret_cast<const char*>(data.data()), data.size());
+}
+
+std::string scratchDir(const std::string& name) {
+    auto dir = std::filesystem::temp_directory_path() / ("cortexstream_" + name);
+    std::filesystem::remove_all(dir);
+    std::filesystem::create_directories(dir);
+    return dir.string();
+}
+
+void testSingleShardMapsTensorsInPlace() {
+    std::cout << "testSingleShardMapsTensorsInPlace" << std::endl;
+    const std::string dir = scratchDir("weights_single");
+    const std::string path = dir + "/model.safetensors";
+    FakeTensor embed = floats("model.embed_tokens.weight", {8, 4}, 0.0f);
+    FakeTensor q0 = floats("model.layers.0.self_attn.q_proj.weight", {4, 4}, 100.0f);
+    FakeTensor q1 = floats("model.layers.1.self_attn.q_proj.weight", {4, 4}, 200.0f);
+    FakeTensor norm = floats("model.norm.weight", {4}, 300.0f);
+    writeShard(path, {embed, q0, q1, norm});
+
+    auto store = WeightStore::open(path);
+    CHECK(store != nullptr);
+    if (!store) return;
+    CHECK(store->numShards() == 1);
+    CHECK(store->numTensors() == 4);
+    CHECK(store->numLayers() == 2);
+    CHECK(store->metadata().at("format") == "pt");
+    CHECK(store->totalBytes() == (32 + 16 + 16 + 4) * sizeof(float));
+
+    const WeightTensor* found = store->find("model.layers.1.self_attn.q_proj.weight");
+    CHECK(found != nullptr);
+    if (!found) return;
+    CHECK(found->layer == 1);
+    CHECK(found->dtype == WeightDType::F32);
+    CHECK((found->shape == std::vector<int64_t>{4, 4}));
+    CHECK(std::memcmp(found->data, q1.bytes.data(), q1.bytes.size()) == 0);
+
+    CHECK(store->find("missing") == nullptr);
+    CHECK(store->findSuffix("embed_tokens.weight")->layer == -1);
+    CHECK(store->layerTensors(0).size() == 1);
+    CHECK(store->layerTensors(-1).size() == 2);
+
+    // Hints over every group, including eviction, leave the data readable
+    store->setPrefetchDepth(4);
+    for (int l = -1; l < store->numLayers(); ++l) {
+        store->beginLayer(l);
+        store->evictLayer(l);
+    }
+    CHECK(std::memcmp(found->data, q1.bytes.data(), q1.bytes.size()) == 0);
+    std::filesystem::remove_all(dir);
+}
+
+void testDirectoryOfShards() {
+    std::cout << "testDirectoryOfShards" << std::endl;
+    const std::string dir = scratchDir("weights_shards");
+    writeShard(dir + "/model-00001-of-00002.safetensors",
+               {floats("transformer.wte.weight", {16, 8}, 0.0f),
+                floats("transformer.h.0.attn.c_attn.weight", {8, 24}, 1.0f)});
+    writeShard(dir + "/model-00002-of-00002.safetensors",
+               {floats("transformer.h.1.attn.c_attn.weight", {8, 24}, 2.0f),
+                floats("transformer.h.2.attn.c_attn.weight", {8, 24}, 3.0f)});
+    std::ofstream(dir + "/config.json") << "{}";
+
+    auto store = WeightStore::open(dir);
+    CHECK(store != nullptr);
+    if (!store) return;
+    CHECK(store->numShards() == 2);
+    CHECK(store->numTensors() == 4);
+    CHECK(store->numLayers() == 3);
+    CHECK(store->find("transformer.h.2.attn.c_attn.weight")->shard == 1);
+
+    // The same tensor in two shards is ambiguous
+    writeShard(dir + "/model-extra.safetensors",
+               {floats("transformer.h.0.attn.c_attn.weight", {8, 24}, 1.0f)});
+    CHECK(WeightStore::open(dir) == nullptr);
+    std::filesystem::remove_all(dir);
+}
+
+void testMalformedShardsAreRejected() {
+    std::cout << "testMalformedShardsAreRejected" << std::endl;
+    const std::string dir = scratchDir("weights_bad");
+    const std::string path = dir + "/bad.safetensors";
+    FakeTensor t = floats("w", {2, 2}, 0.0f);
+
+    const std::vector<std::string> headers = {
+        "{\"w\":{\"dtype\":\"F32\",\"shape\":[2,2],\"data_offsets\":[0,32]}}",   // Past the end
+        "{\"w\":{\"dtype\":\"F32\",\"shape\":[2,3],\"data_offsets\":[0,16]}}",   // Size mismatch
+        "{\"w\":{\"dtype\":\"Q4\",\"shape\":[2,2],\"data_offsets\":[0,16]}}",    // Unknown dtype
+        "{\"w\":{\"dtype\":\"F32\",\"shape\":[2,2]}}",                            // No offsets
+        "{\"w\":{\"dtype\":\"F32\",\"shape\":[2,2],\"data_offsets\":[0,16]}",    // Unterminated
+        "[1, 2]",
+    };
+    for (const auto& header : headers) {
+        writeShard(path, {t}, header);
+        CHECK(WeightStore::open(path) == nullptr);
+    }
+
+    // Header length beyond the file
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        const char length[8] = {char(0xFF), char(0xFF), 0, 0, 0, 0, 0, 0};
+        out.write(length, 8);
+        out << "{}";
+    }
+    CHECK(WeightStore::open(path) == nullptr);
+    CHECK(WeightStore::open(dir + "/missing.safetensors") == nullptr);
+
+    // Valid, with unknown fields skipped and whitespace between tokens
+    writeShard(path, {t},
+               " { \"w\" : { \"dtype\" : \"F32\", \"extra\": [true, null, {\"k\": 1.5}],"
+               " \"shape\" : [ 2, 2 ], \"data_offsets\" : [ 0, 16 ] } } ");
+    auto store = WeightStore::open(path);
+    CHECK(store != nullptr && store->numTensors() == 1);
+    std::filesystem::remove_all(dir);
+}
+
+void testBackendTakesArchitectureFromWeights() {
+    std::cout << "testBackendTakesArchitectureFromWeights" << std::endl;
+    const std::string dir = scratchDir("weights_backend");
+    writeShard(dir + "/model.safetensors",
+               {floats("model.embed_tokens.weight", {64, 16}, 0.0f),
+                floats("model.layers.0.mlp.up_proj.weight", {16, 16}, 0.0f),
+                floats("model.layers.1.mlp.up_proj.weight", {16, 16}, 0.0f),
+                floats("model.layers.2.mlp.up_proj.weight", {16, 16}, 0.0f)});
+
+    ModelBackend backend(Device::CPU, DType::FP32);
+    CHECK(backend.loadModel(dir));
+    CHECK(backend.getVocabSize() == 64);
+    CHECK(backend.getHiddenSize() == 16);
+    CHECK(backend.getNumLayers() == 3);
+    CHECK(backend.getWeights() != nullptr);
+
+    // A corrupt checkpoint fails the load instead of using placeholders
+    writeShard(dir + "/model.safetensors", {}, "{");
+    ModelBackend broken(Device::CPU, DType::FP32);
+    CHECK(!broken.loadModel(dir));
+    CHECK(!broken.isLoaded());
+
+    // Demo builds: no such path, placeholder metadata
+    ModelBackend demo(Device::CPU, DType::FP32);
+    CHECK(demo.loadModel("test-model"));
+    CHECK(demo.getWeights() == nullptr);
+    CHECK(demo.getVocabSize() == 32000);
+    std::filesystem::remove_all(dir);
+}
+
+float halfAt(const WeightTensor& t, size_t i) {
+    uint16_t h;
+    std::memcpy(&h, t.data + i * sizeof(h), sizeof(h));
+    return halfToFloat(h);
+}
+
+// A 2-block HF checkpoint: [rows, 64] projections quantize with groups of 32
+std::string writeCheckpoint(const std::string& name) {
+    const std::string dir = scratchDir(name);
+    FakeTensor positions{"model.rotary.positions", "I32", {4}, std::vector<uint8_t>(16, 3)};
+    writeShard(dir + "/model.safetensors",
+               {floats("model.embed_tokens.weight", {32, 16}, -5.0f),
+                floats("model.layers.0.self_attn.q_proj.weight", {16, 64}, -300.0f),
+                floats("model.layers.0.input_layernorm.weight", {16}, 1.0f),
+                floats("model.layers.1.self_attn.q_proj.weight", {16, 64}, 0.25f),
+                positions});
+    std::ofstream(dir + "/config.json")
+        << "{\"model_type\": \"llama\", \"hidden_size\": 16, \"num_hidden_layers\": 2,"
+           " \"vocab_size\": 32, \"num_attention_heads\": 4, \"num_key_value_heads\": 2,"
+           " \"rope_theta\": 500000.0, \"eos_token_id\": [2, 3],"
+           " \"rope_scaling\": {\"type\": \"linear\"}, \"bos_token_id\": 1}";
+    std::ofstream(dir + "/tokenizer.json") << "{\"version\": \"1.0\"}";
+    return dir;
+}
+
+void testConverterWritesAlignedEngineFormat() {
+    std::cout << "testConverterWritesAlignedEngineFormat" << std::endl;
+    const std::string dir = writeCheckpoint("convert");
+    auto source = WeightStore::open(dir);
+    CHECK(source != nullptr);
+    if (!source) return;
+    CHECK(source->config().architecture == "llama");
+    CHECK(source->config().numKVHeads == 2);
+    CHECK(source->config().headDim == 4);
+    CHECK(source->config().bosTokenId == 1);
+    CHECK(source->config().eosTokenId == -1);   // A list: not a scalar
+
+    for (QuantFormat format : {QuantFormat::FP16, QuantFormat::Int8, QuantFormat::Int4}) {
+        ConvertOptions options;
+        options.inputPath = dir;
+        options.outputPath = dir + "/model.cstream";
+        options.format = format;
+        options.groupSize = 32;
+        ConvertReport report;
+        CHECK(convertModel(options, &report));
+        CHECK(report.hasTokenizer);
+        CHECK(report.quantized == (format == QuantFormat::FP16 ? 0u : 2u));
+
+        auto store = WeightStore::open(options.outputPath);
+        CHECK(store != nullptr);
+        if (!store) continue;
+        CHECK(store->isEngineFormat());
+        CHECK(store->config().quantization == format);
+        CHECK(store->config().numHeads == 4);
+        CHECK(store->config().numKVHeads == 2);
+        CHECK(store->config().ropeTheta == 500000.0f);
+        CHECK(store->numLayers() == 2);
+        for (const auto& tensor : store->tensors()) {
+            CHECK(reinterpret_cast<uintptr_t>(tensor.data) % WeightStore::kTensorAlignment == 0);
+        }
+
+        // Norms stay FP16, integers are copied, the tokenizer is embedded
+        const WeightTensor* norm = store->find("model.layers.0.input_layernorm.weight");
+        CHECK(norm && norm->dtype == WeightDType::F16 && halfAt(*norm, 3) == 4.0f);
+        const WeightTensor* positions = store->find("model.rotary.positions");
+        CHECK(positions && positions->dtype == WeightDType::I32 && positions->data[5] == 3);
+        const WeightTensor* blob = store->tokenizerBlob();
+        CHECK(blob && std::string(reinterpret_cast<const char*>(blob->data), blob->numBytes) ==
+                          "{\"version\": \"1.0\"}");
+
+        // Dequantized weights land within half a step of the source
+        const WeightTensor* original = source->find("model.layers.0.self_attn.q_proj.weight");
+        const WeightTensor* q = store->find("model.layers.0.self_attn.q_proj.weight");
+        const WeightTensor* scales = store->find("model.layers.0.self_attn.q_proj.weight.scales");
+        CHECK(q != nullptr && (scales != nullptr) == (format != QuantFormat::FP16));
+        if (!q || !original) continue;
+        float worst = 0.0f;
+        for (int r = 0; r < 16; ++r) {
+            for (int c = 0; c < 64; ++c) {
+                float expected;
+                std::memcpy(&expected, original->data + (r * 64 + c) * sizeof(float), sizeof(float));
+                float value, step;
+                if (format == QuantFormat::FP16) {
+                    value = halfAt(*q, r * 64 + c);
+                    step = std::fabs(expected) / 1024.0f;
+                } else {
+                    float scale = halfAt(*scales, r * 2 + c / 32);
+                    int code = format == QuantFormat::Int8
+                                   ? q->data[r * 64 + c] - 128
+                                   : ((q->data[r * 32 + c / 2] >> (4 * (c % 2))) & 0xF) - 8;
+                    value = code * scale;
+                    step = scale;
+                }
+                worst = std::max(worst, std::fabs(value - expected) - 0.5f * step);
+            }
+        }
+        CHECK(worst <= 1e-3f);
+    }
+
+    // The backend runs the converted file as-is; KV is sized from its heads
+    ModelBackend backend(Device::CPU, DType::FP16);
+    CHECK(backend.loadModel(dir + "/model.cstream"));
+    CHECK(backend.getVocabSize() == 32);
+    CHECK(backend.getConfig().numKVHeads == 2);
+    const size_t perToken = backend.getConfig().kvBytesPerToken(sizeof(float));
+    CHECK(perToken == 2 * 2 * 2 * 4 * sizeof(float));
+    KVCache cache(backend.getConfig(), 160 * 16 * perToken);
+    CHECK(cache.getNumFreeBlocks() == 160);
+
+    // Already converted, or missing head geometry: rejected
+    ConvertOptions again;
+    again.inputPath = dir + "/model.cstream";
+    again.outputPath = dir + "/again.cstream";
+    CHECK(!convertModel(again));
+    std::filesystem::remove(dir + "/config.json");
+    std::filesystem::remove(dir + "/model.cstream");
+    ConvertOptions headless;
+    headless.inputPath = dir;
+    headless.outputPath = dir + "/model.cstream";
+    CHECK(!convertModel(headless));
+    CHECK(!std::filesystem::exists(dir + "/model.cstream"));
+    std::filesystem::remove_all(dir);
+}
+
+}  // namespace
+
+int main() {
+    std::cout << "Weight Loader Tests" << std::endl;
+
+    testSingleShardMapsTensorsInPlace();
+    testDirectoryOfShards();
+    testMalformedShardsAreRejected();
+    testBackendTakesArchitectureFromWeights();
+    testConverterWritesAlignedEngineFormat();
+
+    if (failures > 0) {
+        std::cerr << failures << " check(s) failed" << std::endl;
+        return 1;
+    }
+    std::cout << "All weight loader tests passed" << std::endl;
+    return 0;
+}
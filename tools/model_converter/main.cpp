@@ -0,0 +1,68 @@
+// cortexstream-convert: HF checkpoint -> single-file engine format
+#include "cortexstream/model_converter.h"
+#include <cstdlib>
+#include <iostream>
+#include <string>
+
+using namespace cortexstream;
+
+namespace {
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " <checkpoint> <output.cstream> [options]\n"
+              << "\n"
+              << "  <checkpoint>              HF model directory (safetensors + config.json)\n"
+              << "                            or a single .safetensors file\n"
+              << "  --format fp16|int8|int4   Weight format (default: fp16)\n"
+              << "  --group-size N            Columns per quantization scale (default: 64)\n"
+              << "  --tokenizer PATH          tokenizer.json to embed (default: beside\n"
+              << "                            the checkpoint, if present)\n";
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ConvertOptions options;
+    int positional = 0;
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--format" && hasValue) {
+            if (!parseQuantFormat(argv[++i], options.format)) {
+                std::cerr << "Unknown format: " << argv[i] << std::endl;
+                return 1;
+            }
+        } else if (arg == "--group-size" && hasValue) {
+            options.groupSize = std::atoi(argv[++i]);
+        } else if (arg == "--tokenizer" && hasValue) {
+            options.tokenizerPath = argv[++i];
+        } else if (arg == "-h" || arg == "--help") {
+            printUsage(argv[0]);
+            return 0;
+        } else if (!arg.empty() && arg[0] != '-' && positional < 2) {
+            (positional++ == 0 ? options.inputPath : options.outputPath) = arg;
+        } else {
+            printUsage(argv[0]);
+            return 1;
+        }
+    }
+    if (positional != 2) {
+        printUsage(argv[0]);
+        return 1;
+    }
+
+    std::cout << "Converting " << options.inputPath << " -> " << options.outputPath
+              << " (" << quantFormatName(options.format) << ")" << std::endl;
+    ConvertReport report;
+    if (!convertModel(options, &report)) {
+        return 1;
+    }
+
+    const double mb = 1024.0 * 1024.0;
+    std::cout << "  Tensors:    " << report.tensors << " (" << report.quantized
+              << " quantized)" << std::endl;
+    std::cout << "  Size:       " << report.inputBytes / mb << " MB -> "
+              << report.outputBytes / mb << " MB" << std::endl;
+    std::cout << "  Tokenizer:  " << (report.hasTokenizer ? "embedded" : "not found") << std::endl;
+    return 0;
+}
@@ -0,0 +1,154 @@
+// cortexstream-profile: run a synthetic batch mix and export a trace
+#include "cortexstream/engine.h"
+#include "cortexstream/trace.h"
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace cortexstream;
+
+namespace {
+
+struct ProfileOptions {
+    std::string modelPath = "profile-model";    // Missing path: stub backend
+    std::string outputPath = "cortexstream-trace.json";
+    int requests = 64;
+    int maxPromptLen = 512;     // Prompts drawn from [maxPromptLen / 8, maxPromptLen]
+    int maxTokens = 64;
+    int maxBatchSize = 32;
+    int tokensPerStep = 2048;
+    int prefillChunk = 256;
+    size_t kvTokens = 1 << 16;
+    bool pipelined = false;
+    int draftTokens = 0;        // > 0: speculative decoding with prompt lookup
+};
+
+void printUsage(const char* program) {
+    std::cerr << "Usage: " << program << " [options]\n"
+              << "\n"
+              << "  --model PATH          Model to load (default: stub backend)\n"
+              << "  --out PATH            Trace file (default: cortexstream-trace.json)\n"
+              << "  --requests N          Requests submitted at once (default: 64)\n"
+              << "  --prompt-len N        Longest prompt; lengths vary down to N/8 (default: 512)\n"
+              << "  --max-tokens N        Tokens generated per request (default: 64)\n"
+              << "  --batch N             Max decode batch (default: 32)\n"
+              << "  --step-tokens N       Token budget per step (default: 2048)\n"
+              << "  --chunk N             Prefill chunk size, 0 = off (default: 256)\n"
+              << "  --kv-tokens N         KV cache capacity in tokens (default: 65536)\n"
+              << "  --pipelined           Overlap host work with the next decode\n"
+              << "  --speculative K       Prompt-lookup speculative decoding, K drafts\n"
+              << "\n"
+              << "Open the trace in chrome://tracing or https://ui.perfetto.dev\n";
+}
+
+bool parseArgs(int argc, char** argv, ProfileOptions& options) {
+    for (int i = 1; i < argc; ++i) {
+        std::string arg = argv[i];
+        bool hasValue = i + 1 < argc;
+        if (arg == "--model" && hasValue) {
+            options.modelPath = argv[++i];
+        } else if (arg == "--out" && hasValue) {
+            options.outputPath = argv[++i];
+        } else if (arg == "--requests" && hasValue) {
+            options.requests = std::atoi(argv[++i]);
+        } else if (arg == "--prompt-len" && hasValue) {
+            options.maxPromptLen = std::atoi(argv[++i]);
+        } else if (arg == "--max-tokens" && hasValue) {
+            options.maxTokens = std::atoi(argv[++i]);
+        } else if (arg == "--batch" && hasValue) {
+            options.maxBatchSize = std::atoi(argv[++i]);
+        } else if (arg == "--step-tokens" && hasValue) {
+            options.tokensPerStep = std::atoi(argv[++i]);
+        } else if (arg == "--chunk" && hasValue) {
+            options.prefillChunk = std::atoi(argv[++i]);
+        } else if (arg == "--kv-tokens" && hasValue) {
+            options.kvTokens = std::strtoull(argv[++i], nullptr, 10);
+        } else if (arg == "--pipelined") {
+            options.pipelined = true;
+        } else if (arg == "--speculative" && hasValue) {
+            options.draftTokens = std::atoi(argv[++i]);
+        } else {
+            return false;
+        }
+    }
+    return options.requests > 0 && options.maxPromptLen > 0 && options.maxTokens > 0;
+}
+
+}  // namespace
+
+int main(int argc, char** argv) {
+    ProfileOptions options;
+    if (!parseArgs(argc, argv, options)) {
+        printUsage(argv[0]);
+        return 1;
+    }
+    if (!trace::compiledIn()) {
+        std::cerr << "Warning: library built without trace spans; reconfigure with "
+                     "-DCORTEXSTREAM_ENABLE_TRACING=ON for per-stage timings" << std::endl;
+    }
+
+    auto backend = std::make_shared<ModelBackend>(Device::CPU, DType::FP32);
+    if (!backend->loadModel(options.modelPath)) {
+        return 1;
+    }
+    auto scheduler = std::make_shared<Scheduler>(options.maxBatchSize, options.tokensPerStep);
+    scheduler->setPrefillChunkSize(options.prefillChunk);
+    auto cache = std::make_shared<KVCache>(1, 1, 4, options.kvTokens, 16);
+    InferenceEngine engine(backend, scheduler, cache);
+    if (!engine.initialize()) {
+        return 1;
+    }
+    engine.setPipelining(options.pipelined);
+    if (options.draftTokens > 0) {
+        engine.setSpeculative(std::make_shared<PromptLookupDrafter>(), options.draftTokens);
+    }
+
+    // A production-like mix: prompt lengths spread over an order of magnitude
+    std::mt19937 rng(42);
+    std::uniform_int_distribution<int> promptLen(std::max(1, options.maxPromptLen / 8),
+                                                 options.maxPromptLen);
+    std::uniform_int_distribution<int> token(3, 1000);
+    std::vector<std::shared_ptr<Request>> requests;
+    for (int i = 0; i < options.requests; ++i) {
+        std::vector<int> prompt(promptLen(rng));
+        for (int& t : prompt) t = token(rng);
+        requests.push_back(std::make_shared<Request>("profile-" + std::to_string(i), prompt,
+                                                     options.maxTokens));
+    }
+
+    trace::start();
+    auto begin = std::chrono::steady_clock::now();
+    for (const auto& req : requests) {
+        scheduler->submitRequest(req);
+    }
+    engine.run();
+    bool idle = engine.waitUntilIdle(std::chrono::minutes(10));
+    double wallMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - begin).count();
+    trace::stop();
+    engine.shutdown();
+    if (!idle) {
+        std::cerr << "Timed out waiting for the workload" << std::endl;
+    }
+
+    auto stats = engine.getStats();
+    std::cout << "\nWall time: " << wallMs << " ms, " << stats.tokensProcessed << " tokens ("
+              << (wallMs > 0 ? stats.tokensProcessed * 1000.0 / wallMs : 0.0) << " tok/s)\n\n";
+    std::printf("%-30s %10s %12s %10s %10s %7s\n", "span", "count", "total ms", "mean us", "max us", "wall%");
+    for (const auto& span : trace::summarize()) {
+        std::printf("%-30s %10zu %12.3f %10.2f %10.2f %6.1f%%\n", span.name.c_str(), span.count,
+                    span.totalMs, span.meanUs, span.maxUs,
+                    wallMs > 0 ? 100.0 * span.totalMs / wallMs : 0.0);
+    }
+
+    if (!trace::writeChromeTrace(options.outputPath)) {
+        return 1;
+    }
+    std::cout << "\nTrace written to " << options.outputPath << std::endl;
+    return idle ? 0 : 1;
+}